@@ -0,0 +1,140 @@
+﻿#include "app_registry.h"
+#include "conditional_get.h"
+#include "debounced_refresh.h"
+#include "file_sender.h"
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "nlohmann/json.hpp"
+
+namespace {
+
+/**
+ * @brief One version of the registry, immutable once built.
+ */
+struct AppSnapshot {
+    std::string body;               // The JSON array of manifests, as sent.
+    std::string etag;
+    std::int64_t mtime_ns = 0;      // The newest manifest's mtime, for Last-Modified.
+    uint64_t apps = 0;
+    uint64_t errors = 0;
+};
+
+native_string g_apps_dir;
+// Published with std::atomic_load/atomic_store; a request keeps the snapshot it loaded alive until it is done.
+std::shared_ptr<const AppSnapshot> g_snapshot = std::make_shared<AppSnapshot>();
+
+std::atomic<uint64_t> g_hits{ 0 };
+std::atomic<uint64_t> g_reloads{ 0 };
+
+/**
+ * @brief Reads every app's manifest and serializes the /api/apps response.
+ */
+std::shared_ptr<const AppSnapshot> build_snapshot()
+{
+    auto snapshot = std::make_shared<AppSnapshot>();
+    nlohmann::json apps_list = nlohmann::json::array();
+
+    // Sorted, so that the body (and its ETag) only changes when a manifest does.
+    std::vector<native_string> dir_names = platform_list_subdirectories(g_apps_dir);
+    std::sort(dir_names.begin(), dir_names.end());
+
+    for (const native_string& dir_name : dir_names) {
+        // --- 1. Read and parse the manifest.json for each app ---
+        std::filesystem::path manifest_path = std::filesystem::path(g_apps_dir) / dir_name / "manifest.json";
+        std::ifstream manifest_file(manifest_path);
+        if (!manifest_file.is_open()) continue;
+
+        try {
+            nlohmann::json manifest_json;
+            manifest_file >> manifest_json;
+
+            // --- 2. Convert relative paths to web-accessible paths ---
+            // "viewer.js" becomes "apps/text_viewer/viewer.js".
+            std::string app_path = "apps/" + native_to_utf8(dir_name) + "/";
+            manifest_json["entry_point"] = app_path + manifest_json["entry_point"].get<std::string>();
+            if (manifest_json.contains("readme")) {
+                manifest_json["readme"] = app_path + manifest_json["readme"].get<std::string>();
+            }
+            apps_list.push_back(manifest_json);
+            snapshot->apps++;
+
+            platform_file_info info;
+            if (platform_stat_path(manifest_path.native(), info)) {
+                snapshot->mtime_ns = std::max(snapshot->mtime_ns, info.mtime_ns);
+            }
+        }
+        catch (const std::exception& e) {
+            // If parsing fails for one manifest, report it and continue with the next.
+            std::cerr << "JSON parse error in " << native_to_utf8(manifest_path.native()) << ": " << e.what() << std::endl;
+            snapshot->errors++;
+        }
+    }
+
+    // --- 3. Serialize once; every request sends these bytes ---
+    snapshot->body = apps_list.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+    snapshot->etag = make_content_etag(snapshot->body.data(), snapshot->body.size(), "");
+    return snapshot;
+}
+
+/**
+ * @brief Rebuilds and publishes the snapshot after the manifests change.
+ */
+DebouncedRefresh& refresher()
+{
+    static DebouncedRefresh* refresh = new DebouncedRefresh([] {
+        std::atomic_store(&g_snapshot, build_snapshot());
+        g_reloads.fetch_add(1, std::memory_order_relaxed);
+    });
+    return *refresh;
+}
+
+/**
+ * @brief File watch callback: schedules a rebuild.
+ */
+void on_apps_change(const native_string& path, void* ctx)
+{
+    refresher().notify();
+}
+
+} // namespace
+
+void app_registry_start(const native_string& apps_dir)
+{
+    g_apps_dir = apps_dir;
+    std::atomic_store(&g_snapshot, build_snapshot());
+
+    if (platform_watch_tree(g_apps_dir, on_apps_change, nullptr)) {
+        refresher().start(nullptr, true);
+    }
+}
+
+void serve_app_registry(const httplib::Request& req, httplib::Response& res)
+{
+    std::shared_ptr<const AppSnapshot> snapshot = std::atomic_load(&g_snapshot);
+    g_hits.fetch_add(1, std::memory_order_relaxed);
+
+    // The browser usually has the current list already.
+    if (check_conditional_get(req, res, snapshot->etag, snapshot->mtime_ns)) {
+        return;
+    }
+    set_shared_content(res, snapshot, snapshot->body.data(), snapshot->body.size(), "application/json; charset=utf-8");
+}
+
+AppRegistryStats get_app_registry_stats()
+{
+    std::shared_ptr<const AppSnapshot> snapshot = std::atomic_load(&g_snapshot);
+    AppRegistryStats stats;
+    stats.apps = snapshot->apps;
+    stats.bytes = snapshot->body.size();
+    stats.errors = snapshot->errors;
+    stats.hits = g_hits.load(std::memory_order_relaxed);
+    stats.reloads = g_reloads.load(std::memory_order_relaxed);
+    return stats;
+}
@@ -0,0 +1,38 @@
+﻿#pragma once
+
+#include "httplib.h"
+#include "platform.h"
+#include <cstdint>
+
+/**
+ * @brief Loads the app manifests (apps/<app>/manifest.json) and keeps them up to date.
+ *
+ * The manifests are read once into an immutable snapshot: the /api/apps response body,
+ * already serialized, and its ETag. A file watch on 'apps_dir' rebuilds the snapshot in
+ * the background when a manifest changes and swaps it in atomically, so a request never
+ * touches the disk or waits for a rebuild.
+ *
+ * If 'apps_dir' does not exist at startup there is nothing to watch, and the registry
+ * stays empty until the server restarts.
+ *
+ * @param apps_dir The directory holding one subdirectory per app.
+ */
+void app_registry_start(const native_string& apps_dir);
+
+/**
+ * @brief Answers GET /api/apps from the current snapshot, including 304s for If-None-Match.
+ */
+void serve_app_registry(const httplib::Request& req, httplib::Response& res);
+
+/**
+ * @brief Counters describing the app registry, for diagnostics and metrics.
+ */
+struct AppRegistryStats {
+    uint64_t apps;
+    uint64_t bytes;                 // Size of the serialized response.
+    uint64_t errors;                // Manifests skipped in the current snapshot because they could not be parsed.
+    uint64_t hits;                  // Requests answered (including 304s).
+    uint64_t reloads;               // Snapshot rebuilds triggered by the file watch.
+};
+
+AppRegistryStats get_app_registry_stats();
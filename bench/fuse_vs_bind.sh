@@ -0,0 +1,68 @@
+#!/bin/sh
+#
+# Compares the FUSE3 pass through filesystem (passthrough_fuse.c) against a plain
+# bind mount of the same backing directory. Must run as root (for mount --bind).
+#
+# usage: bench/fuse_vs_bind.sh PERSONA_WEB_BINARY [WORKDIR] [FILE_MB] [SMALL_FILES]
+#
+# Each workload runs once on the bind mount and once on the FUSE mount and prints
+# the wall clock time in seconds, so the two columns can be compared directly.
+
+set -eu
+
+BIN=${1:?usage: $0 PERSONA_WEB_BINARY [WORKDIR] [FILE_MB] [SMALL_FILES]}
+WORK=${2:-/tmp/persona_fuse_bench}
+FILE_MB=${3:-1024}
+SMALL_FILES=${4:-20000}
+
+BACKING=$WORK/backing
+BIND=$WORK/bind
+FUSE=$WORK/fuse
+
+now() { date +%s.%N; }
+elapsed() { awk "BEGIN { print $2 - $1 }"; }
+
+drop_caches() { sync; echo 3 > /proc/sys/vm/drop_caches 2>/dev/null || true; }
+
+cleanup() {
+    umount "$BIND" 2>/dev/null || true
+    fusermount3 -u "$FUSE" 2>/dev/null || umount "$FUSE" 2>/dev/null || true
+    [ -n "${FUSE_PID:-}" ] && kill "$FUSE_PID" 2>/dev/null || true
+}
+trap cleanup EXIT
+
+rm -rf "$WORK"
+mkdir -p "$BACKING" "$BIND" "$FUSE"
+
+mount --bind "$BACKING" "$BIND"
+"$BIN" -r "$BACKING" -p "$BACKING" -m "$FUSE" &
+FUSE_PID=$!
+# wait for the mount to show up
+for _ in $(seq 50); do mountpoint -q "$FUSE" && break; sleep 0.1; done
+mountpoint -q "$FUSE"
+
+# Each side works in its own subtree of the backing directory so the runs never
+# see each other's files.
+mkdir -p "$BACKING/b" "$BACKING/f"
+
+run() {
+    # $1 = workload function, called with the base directory of the side under test
+    b0=$(now); $1 "$BIND/b"; b1=$(now)
+    f0=$(now); $1 "$FUSE/f"; f1=$(now)
+    printf '%-16s %10.3f %10.3f\n' "$1" "$(elapsed "$b0" "$b1")" "$(elapsed "$f0" "$f1")"
+}
+
+seq_write()   { dd if=/dev/zero of="$1/big" bs=1M count="$FILE_MB" conv=fsync status=none; }
+seq_read()    { drop_caches; dd if="$1/big" of=/dev/null bs=1M status=none; }
+small_write() { mkdir -p "$1/small"; i=0; while [ $i -lt "$SMALL_FILES" ]; do echo x > "$1/small/f$i"; i=$((i + 1)); done; }
+list_dir()    { drop_caches; ls -f "$1/small" > /dev/null; }
+stat_all()    { drop_caches; find "$1/small" -printf '%s %T@\n' > /dev/null; }
+delete_all()  { rm -rf "$1/small" "$1/big"; }
+
+printf '%-16s %10s %10s\n' workload bind fuse
+run seq_write
+run seq_read
+run small_write
+run list_dir
+run stat_all
+run delete_all
@@ -0,0 +1,365 @@
+﻿/**
+ * @file load_bench.cpp
+ *
+ * Drives the server's endpoints with httplib::Client and reports the throughput and the
+ * latency percentiles of each workload, so builds can be compared.
+ *
+ * By default the server runs in-process on its usual port, on a temporary root filled
+ * with synthetic fixtures. With --host the requests go to a server that is already
+ * running; --root must then name that server's root directory, so the fixtures can be
+ * created in it (under "load_bench.<pid>/", removed afterwards).
+ *
+ * usage: load_bench [--host HOST] [--port PORT] [--root DIR] [--clients N] [--seconds S]
+ *                   [--dirs N] [--files N] [--scenarios NAME,NAME,...]
+ *
+ * Scenarios (all of them by default):
+ *   resources_cold  each of the --dirs synthetic directories (--files entries each) listed once
+ *   resources_warm  the same directories listed again and again
+ *   readfile_1k, readfile_64k, readfile_1m, readfile_16m
+ *                   /api/readfile of one file of that size
+ *   streamfile_range
+ *                   256 KiB Range requests at random offsets of a 64 MiB file
+ *   write_storm     writefile, updatefile and deletefile of a 1 KiB file per client, in turn
+ *   page_load       opening the workspace: index.html, its stylesheets and scripts,
+ *                   /api/apps, the root listing and a file (one sample per sequence)
+ *
+ * The static files are served from the working directory, so run it from the directory
+ * persona_web runs from (build/Release) or page_load reports their 404s as errors.
+ *
+ * Output is one JSON document, e.g.
+ *   {"target":"in-process","clients":8,"seconds":5,"scenarios":[{"name":"readfile_64k",
+ *    "requests":...,"errors":...,"bytes":...,"seconds":...,"requests_per_s":...,"mb_per_s":...,
+ *    "latency_us":{"min":...,"mean":...,"p50":...,"p90":...,"p99":...,"p999":...,"max":...}}]}
+ */
+
+#include "httplib.h"
+#include "nlohmann/json.hpp"
+#include "platform.h"
+#include "search_index.h"
+#include "filename_index.h"
+#include "server.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+namespace {
+
+const size_t kStreamFileSize = 64 * 1024 * 1024;
+const size_t kStreamRange = 256 * 1024;
+const size_t kWriteSize = 1024;
+
+struct Options {
+    std::string host = "localhost";
+    int port = 1234;
+    bool external = false;
+    std::string root;
+    int clients = 8;
+    double seconds = 5;
+    int dirs = 64;
+    int files = 1000;
+    std::vector<std::string> scenarios;
+};
+
+/**
+ * @brief What one client thread measured: a latency per request (or per sequence).
+ */
+struct ClientResult {
+    std::vector<double> latencies_us;
+    size_t errors = 0;
+    size_t bytes = 0;
+};
+
+/**
+ * @brief One step of a workload: one request, or one page-load sequence.
+ *
+ * Made with the calling client's own connection; adds the bytes it received and returns
+ * whether it succeeded. 'iteration' counts the steps of all clients together.
+ */
+using Step = std::function<bool(httplib::Client& client, int id, size_t iteration, size_t& bytes)>;
+
+bool ok(const httplib::Result& result, size_t& bytes)
+{
+    if (!result) return false;
+    bytes += result->body.size();
+    return result->status == 200 || result->status == 206 || result->status == 304;
+}
+
+void write_file(const std::string& path, size_t size, std::uint64_t seed)
+{
+    std::ofstream out(path, std::ios::binary);
+    std::mt19937_64 rng(seed);
+    std::vector<std::uint64_t> block(64 * 1024 / sizeof(std::uint64_t));
+    for (size_t written = 0; written < size; written += block.size() * sizeof(std::uint64_t)) {
+        for (auto& v : block) v = rng();
+        out.write((const char*)block.data(), std::min(size - written, block.size() * sizeof(std::uint64_t)));
+    }
+}
+
+/**
+ * @brief Creates the synthetic directories and files under 'dir' (the server's root + 'prefix').
+ */
+void create_fixtures(const std::string& dir, const Options& options)
+{
+    namespace fs = std::filesystem;
+    fs::create_directories(dir + "/dirs");
+    fs::create_directories(dir + "/files");
+    fs::create_directories(dir + "/write");
+    char name[64];
+    std::string line(100, 'x');
+    for (int d = 0; d < options.dirs; d++) {
+        snprintf(name, sizeof(name), "/dirs/d%04d", d);
+        std::string subdir = dir + name;
+        fs::create_directories(subdir);
+        for (int f = 0; f < options.files; f++) {
+            snprintf(name, sizeof(name), "/f%06d.dat", f);
+            std::ofstream(subdir + name, std::ios::binary) << line;
+        }
+    }
+    write_file(dir + "/files/read_1k.bin", 1024, 1);
+    write_file(dir + "/files/read_64k.bin", 64 * 1024, 2);
+    write_file(dir + "/files/read_1m.bin", 1024 * 1024, 3);
+    write_file(dir + "/files/read_16m.bin", 16 * 1024 * 1024, 4);
+    write_file(dir + "/files/stream.bin", kStreamFileSize, 5);
+}
+
+/**
+ * @brief Nearest-rank percentile of sorted samples.
+ */
+double percentile(const std::vector<double>& sorted, double p)
+{
+    if (sorted.empty()) return 0;
+    size_t rank = (size_t)std::ceil(p * sorted.size());
+    return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+/**
+ * @brief Runs one scenario on 'clients' threads until 'limit' steps have been made (0:
+ * no limit) or the time is up, and summarizes it as JSON.
+ */
+nlohmann::json run_scenario(const Options& options, const std::string& name, const Step& step, size_t limit)
+{
+    std::vector<ClientResult> results(options.clients);
+    std::vector<std::thread> threads;
+    std::atomic<size_t> next{ 0 };
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(options.seconds);
+
+    auto wall_start = std::chrono::steady_clock::now();
+    for (int c = 0; c < options.clients; c++) {
+        threads.emplace_back([&, c] {
+            httplib::Client client(options.host, options.port);
+            client.set_keep_alive(true);
+            // Like a browser: requests are not held back by Nagle's algorithm.
+            client.set_tcp_nodelay(true);
+            ClientResult& result = results[c];
+            while (std::chrono::steady_clock::now() < deadline) {
+                size_t iteration = next.fetch_add(1, std::memory_order_relaxed);
+                if (limit && iteration >= limit) break;
+                auto start = std::chrono::steady_clock::now();
+                bool success = step(client, c, iteration, result.bytes);
+                result.latencies_us.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+                if (!success) result.errors++;
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+
+    // --- Merge the clients' samples ---
+    std::vector<double> latencies;
+    size_t errors = 0, bytes = 0;
+    for (const ClientResult& result : results) {
+        latencies.insert(latencies.end(), result.latencies_us.begin(), result.latencies_us.end());
+        errors += result.errors;
+        bytes += result.bytes;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    double sum = 0;
+    for (double latency : latencies) sum += latency;
+
+    nlohmann::json summary;
+    summary["name"] = name;
+    summary["requests"] = latencies.size();
+    summary["errors"] = errors;
+    summary["bytes"] = bytes;
+    summary["seconds"] = seconds;
+    summary["requests_per_s"] = latencies.size() / seconds;
+    summary["mb_per_s"] = bytes / 1e6 / seconds;
+    nlohmann::json& latency = summary["latency_us"];
+    latency["min"] = latencies.empty() ? 0 : latencies.front();
+    latency["mean"] = latencies.empty() ? 0 : sum / latencies.size();
+    latency["p50"] = percentile(latencies, 0.50);
+    latency["p90"] = percentile(latencies, 0.90);
+    latency["p99"] = percentile(latencies, 0.99);
+    latency["p999"] = percentile(latencies, 0.999);
+    latency["max"] = latencies.empty() ? 0 : latencies.back();
+    return summary;
+}
+
+bool parse_options(int argc, char** argv, Options& options)
+{
+    for (int i = 1; i < argc; i++) {
+        auto value = [&]() -> const char* { return i + 1 < argc ? argv[++i] : nullptr; };
+        const char* arg = argv[i];
+        const char* v = nullptr;
+        if (strcmp(arg, "--host") == 0 && (v = value())) { options.host = v; options.external = true; }
+        else if (strcmp(arg, "--port") == 0 && (v = value())) options.port = atoi(v);
+        else if (strcmp(arg, "--root") == 0 && (v = value())) options.root = v;
+        else if (strcmp(arg, "--clients") == 0 && (v = value())) options.clients = std::max(1, atoi(v));
+        else if (strcmp(arg, "--seconds") == 0 && (v = value())) options.seconds = atof(v);
+        else if (strcmp(arg, "--dirs") == 0 && (v = value())) options.dirs = std::max(1, atoi(v));
+        else if (strcmp(arg, "--files") == 0 && (v = value())) options.files = std::max(0, atoi(v));
+        else if (strcmp(arg, "--scenarios") == 0 && (v = value())) {
+            std::string list = v;
+            for (size_t start = 0; start <= list.size();) {
+                size_t comma = std::min(list.find(',', start), list.size());
+                if (comma > start) options.scenarios.push_back(list.substr(start, comma - start));
+                start = comma + 1;
+            }
+        }
+        else return false;
+    }
+    return !(options.external && options.root.empty());
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        fprintf(stderr, "usage: %s [--host HOST --root SERVER_ROOT] [--port PORT] [--clients N] [--seconds S]\n"
+            "       [--dirs N] [--files N] [--scenarios NAME,NAME,...]\n", argv[0]);
+        return 2;
+    }
+
+    // --- 1. Create the fixtures in a temporary root, or in the external server's root ---
+    std::string root = options.root;
+    char root_template[] = "/tmp/persona_load_bench.XXXXXX";
+    if (!options.external) {
+        const char* temp = mkdtemp(root_template);
+        if (temp == nullptr || !platform_set_root_path(temp)) {
+            fprintf(stderr, "cannot create a temporary root directory\n");
+            return 1;
+        }
+        root = temp;
+    }
+    const std::string prefix = "load_bench." + std::to_string(getpid());
+    const std::string fixture_dir = root + "/" + prefix;
+    create_fixtures(fixture_dir, options);
+
+    // --- 2. Start the server (in-process) and wait until it accepts connections ---
+    if (!options.external) {
+        start_web_server();
+    }
+    httplib::Client probe(options.host, options.port);
+    bool up = false;
+    for (int i = 0; i < 100 && !(up = (bool)probe.Get("/api/apps")); i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    if (!up) {
+        fprintf(stderr, "no server at %s:%d\n", options.host.c_str(), options.port);
+        return 1;
+    }
+    // The indexes' startup scans would compete with the first scenarios.
+    while (!options.external) {
+        SearchIndexStats search = get_search_index_stats();
+        if (search.ready && search.pending == 0 && get_filename_index_stats().ready) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+
+    // --- 3. The workloads ---
+    const std::string p = "/" + prefix;
+    auto dir_path = [&](size_t index) {
+        char name[32];
+        snprintf(name, sizeof(name), "/dirs/d%04d", (int)(index % options.dirs));
+        return "/api/resources" + p + name;
+    };
+    auto readfile = [&](const char* file) {
+        std::string path = "/api/readfile?filename=" + prefix + "/files/" + file;
+        return Step([path](httplib::Client& client, int, size_t, size_t& bytes) { return ok(client.Get(path), bytes); });
+    };
+    auto post_json = [](httplib::Client& client, const char* path, const nlohmann::json& body, size_t& bytes) {
+        return ok(client.Post(path, body.dump(), "application/json"), bytes);
+    };
+
+    // Each write_storm client writes, updates and deletes its own file, in turn.
+    std::vector<size_t> write_rounds(options.clients);
+
+    struct Scenario {
+        const char* name;
+        Step step;
+        size_t limit;
+    };
+    std::vector<Scenario> scenarios = {
+        { "resources_cold", [&](httplib::Client& client, int, size_t i, size_t& bytes) {
+            return ok(client.Get(dir_path(i)), bytes);
+        }, (size_t)options.dirs },
+        { "resources_warm", [&](httplib::Client& client, int, size_t i, size_t& bytes) {
+            return ok(client.Get(dir_path(i)), bytes);
+        }, 0 },
+        { "readfile_1k", readfile("read_1k.bin"), 0 },
+        { "readfile_64k", readfile("read_64k.bin"), 0 },
+        { "readfile_1m", readfile("read_1m.bin"), 0 },
+        { "readfile_16m", readfile("read_16m.bin"), 0 },
+        { "streamfile_range", [&](httplib::Client& client, int id, size_t i, size_t& bytes) {
+            std::uint64_t offset = (std::mt19937_64(i * 7919 + id)() % (kStreamFileSize / kStreamRange)) * kStreamRange;
+            std::string range = "bytes=" + std::to_string(offset) + "-" + std::to_string(offset + kStreamRange - 1);
+            return ok(client.Get("/api/streamfile?filename=" + prefix + "/files/stream.bin", { { "Range", range } }), bytes);
+        }, 0 },
+        { "write_storm", [&](httplib::Client& client, int id, size_t, size_t& bytes) {
+            nlohmann::json body;
+            body["filename"] = prefix + "/write/client" + std::to_string(id) + ".txt";
+            switch (write_rounds[id]++ % 3) {
+            case 0:
+                body["content"] = std::string(kWriteSize, 'w');
+                return post_json(client, "/api/writefile", body, bytes);
+            case 1:
+                body["content"] = std::string(kWriteSize, 'u');
+                return post_json(client, "/api/updatefile", body, bytes);
+            default:
+                return post_json(client, "/api/deletefile", body, bytes);
+            }
+        }, 0 },
+        { "page_load", [&](httplib::Client& client, int, size_t, size_t& bytes) {
+            bool success = true;
+            for (const char* path : { "/", "/lib/golden-layout/goldenlayout-base.css", "/lib/golden-layout/goldenlayout-dark-theme.css",
+                                      "/lib/golden-layout/goldenlayout.min.js", "/explorer.js", "/api/apps", "/api/resources/" }) {
+                success = ok(client.Get(path), bytes) && success;
+            }
+            return ok(client.Get("/api/readfile?filename=" + prefix + "/files/read_64k.bin"), bytes) && success;
+        }, 0 },
+    };
+
+    nlohmann::json report;
+    report["target"] = options.external ? options.host + ":" + std::to_string(options.port) : std::string("in-process");
+    report["clients"] = options.clients;
+    report["seconds"] = options.seconds;
+    report["scenarios"] = nlohmann::json::array();
+    for (const Scenario& scenario : scenarios) {
+        if (!options.scenarios.empty() &&
+            std::find(options.scenarios.begin(), options.scenarios.end(), scenario.name) == options.scenarios.end()) {
+            continue;
+        }
+        report["scenarios"].push_back(run_scenario(options, scenario.name, scenario.step, scenario.limit));
+    }
+    printf("%s\n", report.dump(1).c_str());
+    fflush(stdout);
+
+    std::error_code ignored;
+    std::filesystem::remove_all(fixture_dir, ignored);
+    if (!options.external) rmdir(root.c_str());
+    // The server thread is detached and has no stop hook; just leave.
+    _exit(0);
+}
@@ -0,0 +1,334 @@
+﻿/**
+ * @file micro_bench.cpp
+ *
+ * Google Benchmark microbenchmarks for the helpers every request goes through:
+ * is_safe_path(), platform_open_read(), wstring_to_utf8(), utf8_to_wstring() and
+ * content_type_for_name().
+ *
+ * Each benchmark cycles through a corpus of realistic inputs, one input per iteration,
+ * so "Time" is the cost of one call. Besides ns/op each reports allocs_per_op, counted
+ * by the global operator new below.
+ *
+ * Corpora:
+ *   ascii    short English names, one or two directories deep
+ *   korean   Hangul file and directory names (multi-byte UTF-8)
+ *   deep     16 directories deep
+ *   hostile  "..", backslash and symlink escapes, which must be refused (by is_safe_path,
+ *            or for symlinks on Linux by the confined open itself)
+ *   missing  files that do not exist yet, as /api/writefile sees them
+ *   names    file names with assorted extensions (content_type_for_name() only)
+ *
+ * The checked paths are opened for real, so main() builds these trees in a temporary root.
+ *
+ * usage: micro_bench [Google Benchmark options, e.g. --benchmark_format=json]
+ */
+
+#include "content_type.h"
+#include "platform.h"
+#include "utf_transcode.h"
+#include <benchmark/benchmark.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <new>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+// --- Allocation counting ---
+// Every replaceable operator new/delete is replaced, so whatever form the code under test
+// uses is counted and freed by the matching function. The counting allocator and its
+// release are kept out of line: inlined, GCC would see std::free() on memory from operator
+// new and warn (-Wmismatched-new-delete), although here both sides are ours.
+static std::atomic<std::uint64_t> g_allocations{ 0 };
+
+#if defined(__GNUC__)
+#define BENCH_NOINLINE __attribute__((noinline))
+#else
+#define BENCH_NOINLINE
+#endif
+
+BENCH_NOINLINE static void* counted_alloc(size_t size, size_t alignment) noexcept
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (size == 0) size = 1;
+    if (alignment <= alignof(std::max_align_t)) return std::malloc(size);
+    // std::aligned_alloc() wants a multiple of the alignment.
+    return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
+
+BENCH_NOINLINE static void counted_free(void* p) noexcept
+{
+    std::free(p);
+}
+
+static void* counted_alloc_or_throw(size_t size, size_t alignment)
+{
+    if (void* p = counted_alloc(size, alignment)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new(size_t size) { return counted_alloc_or_throw(size, 0); }
+void* operator new[](size_t size) { return counted_alloc_or_throw(size, 0); }
+void* operator new(size_t size, std::align_val_t alignment) { return counted_alloc_or_throw(size, (size_t)alignment); }
+void* operator new[](size_t size, std::align_val_t alignment) { return counted_alloc_or_throw(size, (size_t)alignment); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return counted_alloc(size, 0); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return counted_alloc(size, 0); }
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return counted_alloc(size, (size_t)alignment); }
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return counted_alloc(size, (size_t)alignment); }
+
+void operator delete(void* p) noexcept { counted_free(p); }
+void operator delete[](void* p) noexcept { counted_free(p); }
+void operator delete(void* p, size_t) noexcept { counted_free(p); }
+void operator delete[](void* p, size_t) noexcept { counted_free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { counted_free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { counted_free(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { counted_free(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { counted_free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { counted_free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { counted_free(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { counted_free(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { counted_free(p); }
+
+namespace {
+
+struct Corpus {
+    std::vector<std::string> paths;
+    std::vector<std::wstring> wide;
+};
+
+std::string deep_path(const char* leaf)
+{
+    std::string path;
+    for (int i = 0; i < 16; i++) path += "level" + std::to_string(i) + "/";
+    return path + leaf;
+}
+
+Corpus make_corpus(std::vector<std::string> paths)
+{
+    Corpus corpus;
+    for (const std::string& path : paths) corpus.wide.push_back(utf8_to_wstring(path));
+    corpus.paths = std::move(paths);
+    return corpus;
+}
+
+const Corpus kAscii = make_corpus({
+    "readme.txt", "docs/guide.md", "docs/notes.txt", "src/main.cpp", "src/server.cpp",
+    "videos/intro.mp4", "index.html", "apps/viewer.js", "styles/site.css", "docs",
+});
+
+const Corpus kKorean = make_corpus({
+    u8"문서/보고서.txt", u8"문서/회의록 2024-03.md", u8"사진/여름 휴가/바다.jpg", u8"사진/여름 휴가",
+    u8"음악/플레이리스트.txt", u8"영상/강의 01.mp4", u8"문서", u8"메모.txt",
+});
+
+const Corpus kDeep = make_corpus({
+    deep_path("file.txt"), deep_path("notes.md"), deep_path("index.html"), deep_path(""),
+});
+
+const Corpus kHostile = make_corpus({
+    "../../etc/passwd", "docs/../../../etc/shadow", "..\\..\\windows\\win.ini", "docs/./../docs/../../x",
+    "escape/etc/passwd", "escape", "/etc/passwd", "docs/..", "..",
+});
+
+// File names as the static route and the listings see them, for content_type_for_name().
+const Corpus kNames = make_corpus({
+    "index.html", "explorer.js", "goldenlayout-base.css", "intro.mp4", "photo.JPG", "archive.tar.gz",
+    "foo.js.txt", "README", "data.json", u8"사진.png", u8"문서/보고서.html",
+});
+
+const Corpus kMissing = make_corpus({
+    "docs/new.txt", u8"문서/새 문서.txt", deep_path("new.txt"), "new.txt",
+});
+
+/**
+ * @brief Builds the directories and files the corpora name in a fresh root.
+ */
+bool create_root(std::string& root)
+{
+    namespace fs = std::filesystem;
+    char root_template[] = "/tmp/persona_micro_bench.XXXXXX";
+    if (mkdtemp(root_template) == nullptr) return false;
+    root = root_template;
+    std::error_code error;
+    for (const Corpus* corpus : { &kAscii, &kKorean, &kDeep }) {
+        for (const std::string& path : corpus->paths) {
+            fs::path full = fs::u8path(root + "/" + path);
+            bool is_dir = path.empty() || path.back() == '/' || path.find('.') == std::string::npos;
+            fs::create_directories(is_dir ? full : full.parent_path(), error);
+            if (!is_dir) std::ofstream(full) << "x";
+        }
+    }
+    // A symlink out of the root, which neither is_safe_path nor the open may follow.
+    fs::create_directory_symlink("/", root + "/escape", error);
+    return platform_set_root_path(root);
+}
+
+void report_allocations(benchmark::State& state, std::uint64_t allocations)
+{
+    state.counters["allocs_per_op"] = benchmark::Counter((double)allocations, benchmark::Counter::kAvgIterations);
+}
+
+void BM_is_safe_path(benchmark::State& state, const Corpus* corpus)
+{
+    const std::vector<std::string>& paths = corpus->paths;
+    native_string full_path;
+    size_t i = 0, accepted = 0;
+    std::uint64_t allocations = g_allocations.load();
+    for (auto _ : state) {
+        accepted += is_safe_path(utf8_to_native(paths[i++ % paths.size()]), full_path);
+        benchmark::DoNotOptimize(full_path);
+    }
+    report_allocations(state, g_allocations.load() - allocations);
+    state.counters["accepted"] = benchmark::Counter((double)accepted, benchmark::Counter::kAvgIterations);
+}
+
+/**
+ * @brief The check plus the open every file request does, as the handlers call them.
+ */
+void BM_safe_open(benchmark::State& state, const Corpus* corpus)
+{
+    const std::vector<std::string>& paths = corpus->paths;
+    native_string full_path;
+    size_t i = 0, opened = 0;
+    std::uint64_t allocations = g_allocations.load();
+    for (auto _ : state) {
+        if (!is_safe_path(utf8_to_native(paths[i++ % paths.size()]), full_path)) continue;
+        platform_file file = platform_open_read(full_path);
+        if (file == PLATFORM_INVALID_FILE) continue;
+        platform_close_file(file);
+        opened++;
+    }
+    report_allocations(state, g_allocations.load() - allocations);
+    state.counters["opened"] = benchmark::Counter((double)opened, benchmark::Counter::kAvgIterations);
+}
+
+void BM_utf8_to_wstring(benchmark::State& state, const Corpus* corpus)
+{
+    const std::vector<std::string>& paths = corpus->paths;
+    size_t i = 0, bytes = 0;
+    std::uint64_t allocations = g_allocations.load();
+    for (auto _ : state) {
+        const std::string& path = paths[i++ % paths.size()];
+        std::wstring wide = utf8_to_wstring(path);
+        benchmark::DoNotOptimize(wide.data());
+        bytes += path.size();
+    }
+    report_allocations(state, g_allocations.load() - allocations);
+    state.SetBytesProcessed((int64_t)bytes);
+}
+
+void BM_wstring_to_utf8(benchmark::State& state, const Corpus* corpus)
+{
+    const std::vector<std::wstring>& wide = corpus->wide;
+    size_t i = 0, bytes = 0;
+    std::uint64_t allocations = g_allocations.load();
+    for (auto _ : state) {
+        std::string utf8 = wstring_to_utf8(wide[i++ % wide.size()]);
+        benchmark::DoNotOptimize(utf8.data());
+        bytes += utf8.size();
+    }
+    report_allocations(state, g_allocations.load() - allocations);
+    state.SetBytesProcessed((int64_t)bytes);
+}
+
+/**
+ * @brief The same conversions into a string the caller keeps (utf_transcode.h), as a hot loop would.
+ */
+void BM_utf8_to_wide_reused(benchmark::State& state, const Corpus* corpus)
+{
+    const std::vector<std::string>& paths = corpus->paths;
+    std::wstring wide;
+    size_t i = 0, bytes = 0;
+    std::uint64_t allocations = g_allocations.load();
+    for (auto _ : state) {
+        const std::string& path = paths[i++ % paths.size()];
+        utf8_to_wide(path, wide);
+        benchmark::DoNotOptimize(wide.data());
+        bytes += path.size();
+    }
+    report_allocations(state, g_allocations.load() - allocations);
+    state.SetBytesProcessed((int64_t)bytes);
+    state.SetLabel(utf_transcode_isa());
+}
+
+void BM_wide_to_utf8_reused(benchmark::State& state, const Corpus* corpus)
+{
+    const std::vector<std::wstring>& wide = corpus->wide;
+    std::string utf8;
+    size_t i = 0, bytes = 0;
+    std::uint64_t allocations = g_allocations.load();
+    for (auto _ : state) {
+        wide_to_utf8(wide[i++ % wide.size()], utf8);
+        benchmark::DoNotOptimize(utf8.data());
+        bytes += utf8.size();
+    }
+    report_allocations(state, g_allocations.load() - allocations);
+    state.SetBytesProcessed((int64_t)bytes);
+    state.SetLabel(utf_transcode_isa());
+}
+
+void BM_content_type_for_name(benchmark::State& state, const Corpus* corpus)
+{
+    const std::vector<std::string>& paths = corpus->paths;
+    size_t i = 0;
+    std::uint64_t allocations = g_allocations.load();
+    for (auto _ : state) {
+        std::string_view type = content_type_for_name(paths[i++ % paths.size()]);
+        benchmark::DoNotOptimize(type.data());
+    }
+    report_allocations(state, g_allocations.load() - allocations);
+}
+
+BENCHMARK_CAPTURE(BM_is_safe_path, ascii, &kAscii);
+BENCHMARK_CAPTURE(BM_is_safe_path, korean, &kKorean);
+BENCHMARK_CAPTURE(BM_is_safe_path, deep, &kDeep);
+BENCHMARK_CAPTURE(BM_is_safe_path, hostile, &kHostile);
+BENCHMARK_CAPTURE(BM_is_safe_path, missing, &kMissing);
+
+BENCHMARK_CAPTURE(BM_safe_open, ascii, &kAscii);
+BENCHMARK_CAPTURE(BM_safe_open, korean, &kKorean);
+BENCHMARK_CAPTURE(BM_safe_open, deep, &kDeep);
+BENCHMARK_CAPTURE(BM_safe_open, hostile, &kHostile);
+
+BENCHMARK_CAPTURE(BM_utf8_to_wstring, ascii, &kAscii);
+BENCHMARK_CAPTURE(BM_utf8_to_wstring, korean, &kKorean);
+BENCHMARK_CAPTURE(BM_utf8_to_wstring, deep, &kDeep);
+
+BENCHMARK_CAPTURE(BM_wstring_to_utf8, ascii, &kAscii);
+BENCHMARK_CAPTURE(BM_wstring_to_utf8, korean, &kKorean);
+BENCHMARK_CAPTURE(BM_wstring_to_utf8, deep, &kDeep);
+
+BENCHMARK_CAPTURE(BM_utf8_to_wide_reused, ascii, &kAscii);
+BENCHMARK_CAPTURE(BM_utf8_to_wide_reused, korean, &kKorean);
+BENCHMARK_CAPTURE(BM_utf8_to_wide_reused, deep, &kDeep);
+
+BENCHMARK_CAPTURE(BM_wide_to_utf8_reused, ascii, &kAscii);
+BENCHMARK_CAPTURE(BM_wide_to_utf8_reused, korean, &kKorean);
+BENCHMARK_CAPTURE(BM_wide_to_utf8_reused, deep, &kDeep);
+
+BENCHMARK_CAPTURE(BM_content_type_for_name, names, &kNames);
+BENCHMARK_CAPTURE(BM_content_type_for_name, deep, &kDeep);
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    std::string root;
+    if (!create_root(root)) {
+        fprintf(stderr, "cannot create a temporary root directory\n");
+        return 1;
+    }
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+
+    std::error_code ignored;
+    std::filesystem::remove_all(root, ignored);
+    return 0;
+}
@@ -0,0 +1,143 @@
+﻿/**
+ * @file stream_bench.cpp
+ *
+ * Measures the CPU the server spends per GB served by /api/streamfile, with the
+ * zero-copy (sendfile) path enabled and disabled.
+ *
+ * The server runs in-process on its usual port. The client threads record their own
+ * CPU time, so "server CPU" is the process CPU time minus the client threads' share.
+ *
+ * usage: stream_bench [FileMB] [Passes] [Clients]
+ *
+ * Output is one JSON object per mode, e.g.
+ *   {"mode":"zero_copy","bytes":...,"seconds":...,"gb_per_s":...,"server_cpu_s_per_gb":...,"pool_heap_allocations":...}
+ *
+ * "pool_heap_allocations" counts buffers the buffer pool had to allocate during the run;
+ * after warm-up it should stay at zero no matter how many chunks were copied.
+ */
+
+#include "httplib.h"
+#include "platform.h"
+#include "file_sender.h"
+#include "buffer_pool.h"
+#include "server.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+static double process_cpu_seconds()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+        + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static double thread_cpu_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief One client: downloads the file 'passes' times, alternating whole-file GETs and
+ * 1 MiB Range requests the way a video element seeks. Returns its own CPU time.
+ */
+static double run_client(size_t file_size, int passes, std::atomic<size_t>& bytes)
+{
+    double cpu_start = thread_cpu_seconds();
+    httplib::Client client("localhost", 1234);
+    client.set_keep_alive(true);
+
+    auto count = [&](const char*, size_t n) { bytes += n; return true; };
+
+    for (int pass = 0; pass < passes; pass++) {
+        if (pass % 2 == 0) {
+            client.Get("/api/streamfile?filename=stream_bench.bin", count);
+        }
+        else {
+            const size_t range = 1024 * 1024;
+            for (size_t offset = 0; offset < file_size; offset += range) {
+                std::string header = "bytes=" + std::to_string(offset) + "-" +
+                    std::to_string(std::min(offset + range, file_size) - 1);
+                client.Get("/api/streamfile?filename=stream_bench.bin", { { "Range", header } }, count);
+            }
+        }
+    }
+    return thread_cpu_seconds() - cpu_start;
+}
+
+int main(int argc, char** argv)
+{
+    size_t file_mb = argc > 1 ? strtoul(argv[1], nullptr, 0) : 256;
+    int passes = argc > 2 ? atoi(argv[2]) : 8;
+    int clients = argc > 3 ? atoi(argv[3]) : 4;
+    size_t file_size = file_mb * 1024 * 1024;
+
+    // --- 1. Create a root with one incompressible file in it ---
+    char root_template[] = "/tmp/persona_stream_bench.XXXXXX";
+    const char* root = mkdtemp(root_template);
+    if (root == nullptr || !platform_set_root_path(root)) {
+        fprintf(stderr, "cannot create a temporary root directory\n");
+        return 1;
+    }
+    std::string file_path = std::string(root) + "/stream_bench.bin";
+    {
+        std::ofstream out(file_path, std::ios::binary);
+        std::mt19937_64 rng(42);
+        std::vector<uint64_t> block(1024 * 1024 / sizeof(uint64_t));
+        for (size_t written = 0; written < file_size; written += block.size() * sizeof(uint64_t)) {
+            for (auto& v : block) v = rng();
+            out.write((const char*)block.data(), block.size() * sizeof(uint64_t));
+        }
+    }
+
+    // --- 2. Start the server and wait until it accepts connections ---
+    start_web_server();
+    httplib::Client probe("localhost", 1234);
+    for (int i = 0; i < 100 && !probe.Get("/api/apps"); i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+
+    // --- 3. Measure both paths ---
+    for (bool zero_copy : { false, true }) {
+        set_zero_copy_enabled(zero_copy);
+
+        std::atomic<size_t> bytes{ 0 };
+        std::vector<double> client_cpu(clients);
+        std::vector<std::thread> threads;
+
+        uint64_t allocations_start = get_buffer_pool_stats().heap_allocations;
+        double cpu_start = process_cpu_seconds();
+        auto wall_start = std::chrono::steady_clock::now();
+        for (int c = 0; c < clients; c++) {
+            threads.emplace_back([&, c] { client_cpu[c] = run_client(file_size, passes, bytes); });
+        }
+        for (auto& t : threads) t.join();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+        double cpu = process_cpu_seconds() - cpu_start;
+        for (double c : client_cpu) cpu -= c;
+
+        uint64_t allocations = get_buffer_pool_stats().heap_allocations - allocations_start;
+
+        double gb = bytes / 1e9;
+        printf("{\"mode\":\"%s\",\"bytes\":%zu,\"seconds\":%.3f,\"gb_per_s\":%.3f,\"server_cpu_s\":%.3f,\"server_cpu_s_per_gb\":%.4f,\"pool_heap_allocations\":%llu}\n",
+            zero_copy ? "zero_copy" : "copy", (size_t)bytes, seconds, gb / seconds, cpu, cpu / gb, (unsigned long long)allocations);
+        fflush(stdout);
+    }
+
+    std::remove(file_path.c_str());
+    rmdir(root);
+    // The server thread is detached and has no stop hook; just leave.
+    _exit(0);
+}
@@ -0,0 +1,183 @@
+﻿#include "buffer_pool.h"
+#include <atomic>
+#include <cstdlib>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+const size_t kClassSizes[] = { 64 * 1024, 128 * 1024, 256 * 1024, 512 * 1024, 1024 * 1024 };
+const int kClassCount = sizeof(kClassSizes) / sizeof(kClassSizes[0]);
+
+// How many free buffers of each class a single thread keeps for itself.
+const size_t kThreadCacheDepth = 4;
+// How many free buffers of each class are kept globally for threads that run dry.
+const size_t kGlobalCacheDepth = 64;
+
+std::atomic<uint64_t> g_acquires{ 0 };
+std::atomic<uint64_t> g_heap_allocations{ 0 };
+std::atomic<uint64_t> g_bytes_in_use{ 0 };
+std::atomic<uint64_t> g_bytes_in_use_high_water{ 0 };
+std::atomic<uint64_t> g_bytes_owned{ 0 };
+std::atomic<uint64_t> g_bytes_owned_high_water{ 0 };
+
+void raise_high_water(std::atomic<uint64_t>& high_water, uint64_t value)
+{
+    uint64_t current = high_water.load(std::memory_order_relaxed);
+    while (value > current && !high_water.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+/**
+ * @brief The shared overflow list, used when a thread's own cache is empty or full.
+ */
+struct GlobalCache {
+    std::mutex lock;
+    std::vector<char*> free[kClassCount];
+
+    GlobalCache() {
+        for (auto& list : free) list.reserve(kGlobalCacheDepth);
+    }
+
+    char* pop(int size_class) {
+        std::lock_guard<std::mutex> guard(lock);
+        auto& list = free[size_class];
+        if (list.empty()) return nullptr;
+        char* buffer = list.back();
+        list.pop_back();
+        return buffer;
+    }
+
+    bool push(int size_class, char* buffer) {
+        std::lock_guard<std::mutex> guard(lock);
+        auto& list = free[size_class];
+        if (list.size() >= kGlobalCacheDepth) return false;
+        list.push_back(buffer);
+        return true;
+    }
+};
+
+GlobalCache& global_cache()
+{
+    // Never destroyed, so worker threads that exit after main() can still return their buffers.
+    static GlobalCache* cache = new GlobalCache();
+    return *cache;
+}
+
+void free_buffer(int size_class, char* buffer)
+{
+    std::free(buffer);
+    g_bytes_owned.fetch_sub(kClassSizes[size_class], std::memory_order_relaxed);
+}
+
+/**
+ * @brief The per-thread cache. Lock-free because only its own thread ever touches it.
+ */
+struct ThreadCache {
+    char* free[kClassCount][kThreadCacheDepth];
+    size_t count[kClassCount] = {};
+    bool alive = true;
+
+    ~ThreadCache() {
+        // Hand everything to the global cache so the memory is not lost with the thread.
+        alive = false;
+        for (int c = 0; c < kClassCount; c++) {
+            for (size_t i = 0; i < count[c]; i++) {
+                if (!global_cache().push(c, free[c][i])) free_buffer(c, free[c][i]);
+            }
+            count[c] = 0;
+        }
+    }
+};
+
+thread_local ThreadCache t_cache;
+
+void release_buffer(int size_class, char* buffer)
+{
+    g_bytes_in_use.fetch_sub(kClassSizes[size_class], std::memory_order_relaxed);
+
+    if (t_cache.alive && t_cache.count[size_class] < kThreadCacheDepth) {
+        t_cache.free[size_class][t_cache.count[size_class]++] = buffer;
+        return;
+    }
+    if (!global_cache().push(size_class, buffer)) {
+        free_buffer(size_class, buffer);
+    }
+}
+
+} // namespace
+
+PooledBuffer acquire_buffer(size_t min_size)
+{
+    // --- 1. Pick the smallest size class that fits (requests above 1 MiB get 1 MiB) ---
+    int size_class = kClassCount - 1;
+    for (int c = 0; c < kClassCount; c++) {
+        if (kClassSizes[c] >= min_size) {
+            size_class = c;
+            break;
+        }
+    }
+    size_t size = kClassSizes[size_class];
+
+    g_acquires.fetch_add(1, std::memory_order_relaxed);
+    raise_high_water(g_bytes_in_use_high_water, g_bytes_in_use.fetch_add(size, std::memory_order_relaxed) + size);
+
+    // --- 2. Try this thread's cache, then the global cache, then the allocator ---
+    char* buffer = nullptr;
+    if (t_cache.alive && t_cache.count[size_class] > 0) {
+        buffer = t_cache.free[size_class][--t_cache.count[size_class]];
+    }
+    if (buffer == nullptr) {
+        buffer = global_cache().pop(size_class);
+    }
+    if (buffer == nullptr) {
+        buffer = (char*)std::malloc(size);
+        if (buffer == nullptr) {
+            g_bytes_in_use.fetch_sub(size, std::memory_order_relaxed);
+            return PooledBuffer();
+        }
+        g_heap_allocations.fetch_add(1, std::memory_order_relaxed);
+        raise_high_water(g_bytes_owned_high_water, g_bytes_owned.fetch_add(size, std::memory_order_relaxed) + size);
+    }
+
+    return PooledBuffer(buffer, size, size_class);
+}
+
+PooledBuffer::PooledBuffer(PooledBuffer&& other) noexcept
+    : data_(other.data_), size_(other.size_), size_class_(other.size_class_)
+{
+    other.data_ = nullptr;
+    other.size_ = 0;
+    other.size_class_ = -1;
+}
+
+PooledBuffer& PooledBuffer::operator=(PooledBuffer&& other) noexcept
+{
+    if (this != &other) {
+        if (data_ != nullptr) release_buffer(size_class_, data_);
+        data_ = other.data_;
+        size_ = other.size_;
+        size_class_ = other.size_class_;
+        other.data_ = nullptr;
+        other.size_ = 0;
+        other.size_class_ = -1;
+    }
+    return *this;
+}
+
+PooledBuffer::~PooledBuffer()
+{
+    if (data_ != nullptr) release_buffer(size_class_, data_);
+}
+
+BufferPoolStats get_buffer_pool_stats()
+{
+    BufferPoolStats stats;
+    stats.acquires = g_acquires.load(std::memory_order_relaxed);
+    stats.heap_allocations = g_heap_allocations.load(std::memory_order_relaxed);
+    stats.bytes_in_use = g_bytes_in_use.load(std::memory_order_relaxed);
+    stats.bytes_in_use_high_water = g_bytes_in_use_high_water.load(std::memory_order_relaxed);
+    stats.bytes_owned = g_bytes_owned.load(std::memory_order_relaxed);
+    stats.bytes_owned_high_water = g_bytes_owned_high_water.load(std::memory_order_relaxed);
+    return stats;
+}
@@ -0,0 +1,63 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief A reusable I/O buffer borrowed from the buffer pool.
+ *
+ * The buffer goes back to the pool automatically when this object is destroyed,
+ * so a content provider can simply keep one in a local variable (or capture it in
+ * a lambda) without ever calling new/delete for file data.
+ */
+class PooledBuffer {
+public:
+    PooledBuffer() = default;
+    PooledBuffer(PooledBuffer&& other) noexcept;
+    PooledBuffer& operator=(PooledBuffer&& other) noexcept;
+    PooledBuffer(const PooledBuffer&) = delete;
+    PooledBuffer& operator=(const PooledBuffer&) = delete;
+    ~PooledBuffer();
+
+    char* data() const { return data_; }
+    size_t size() const { return size_; }
+    explicit operator bool() const { return data_ != nullptr; }
+
+private:
+    friend PooledBuffer acquire_buffer(size_t min_size);
+    PooledBuffer(char* data, size_t size, int size_class) : data_(data), size_(size), size_class_(size_class) {}
+
+    char* data_ = nullptr;
+    size_t size_ = 0;
+    int size_class_ = -1;
+};
+
+/**
+ * @brief The largest buffer the pool hands out. Callers that need more must work in chunks.
+ */
+const size_t kMaxPooledBufferSize = 1024 * 1024;
+
+/**
+ * @brief Borrows a buffer of at least 'min_size' bytes (capped at kMaxPooledBufferSize).
+ *
+ * Buffers come in fixed size classes (64 KiB, 128 KiB, 256 KiB, 512 KiB, 1 MiB).
+ * Each thread keeps a small cache of free buffers per class, so in steady state a
+ * request served on a worker thread reuses the same memory and never touches the
+ * allocator. When a thread's cache is empty or full, buffers move to and from a
+ * shared global list; only when both are empty is new memory allocated.
+ */
+PooledBuffer acquire_buffer(size_t min_size);
+
+/**
+ * @brief Counters describing the pool, for diagnostics and metrics.
+ */
+struct BufferPoolStats {
+    uint64_t acquires;              // Total number of acquire_buffer() calls.
+    uint64_t heap_allocations;      // How many of those had to allocate new memory.
+    uint64_t bytes_in_use;          // Bytes currently borrowed by callers.
+    uint64_t bytes_in_use_high_water;
+    uint64_t bytes_owned;           // Bytes allocated by the pool (borrowed + cached).
+    uint64_t bytes_owned_high_water;
+};
+
+BufferPoolStats get_buffer_pool_stats();
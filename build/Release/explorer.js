@@ -79,13 +79,19 @@ $(function () {
             }
         });
 
-        fetch('/api/resources/').then(res => res.json()).then(data => {
-            fileListElement.empty();
-            data.items.forEach(file => {
-                const listItem = $(`<li>${file.isDir ? '📁' : '📄'} ${file.name}<span class="hamburger-menu">☰</span></li>`).data('file', file);
-                fileListElement.append(listItem);
+        // Load the listing a page at a time, so the first entries of a huge folder show up right away.
+        const loadPage = (cursor) => {
+            const query = cursor === undefined ? '?limit=500' : `?limit=500&cursor=${encodeURIComponent(cursor)}`;
+            fetch('/api/resources/' + query).then(res => res.json()).then(data => {
+                if (cursor === undefined) fileListElement.empty();
+                data.items.forEach(file => {
+                    const listItem = $(`<li>${file.isDir ? '📁' : '📄'} ${file.name}<span class="hamburger-menu">☰</span></li>`).data('file', file);
+                    fileListElement.append(listItem);
+                });
+                if (data.nextCursor !== undefined) loadPage(data.nextCursor);
             });
-        });
+        };
+        loadPage();
     });
 
     myLayout.registerComponent('appBrowser', function (container, componentState) {
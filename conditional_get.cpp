@@ -0,0 +1,169 @@
+﻿#include "conditional_get.h"
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+const char* const kWeekdays[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+const char* const kMonths[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+// Days since 1970-01-01 for a proleptic Gregorian date (month 1-12).
+// Plain arithmetic, so it needs neither timegm() nor _mkgmtime().
+std::int64_t days_from_civil(std::int64_t year, unsigned month, unsigned day)
+{
+    year -= month <= 2;
+    const std::int64_t era = (year >= 0 ? year : year - 399) / 400;
+    const unsigned year_of_era = (unsigned)(year - era * 400);
+    const unsigned day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    const unsigned day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + (std::int64_t)day_of_era - 719468;
+}
+
+// The inverse of days_from_civil.
+void civil_from_days(std::int64_t days, std::int64_t& year, unsigned& month, unsigned& day)
+{
+    days += 719468;
+    const std::int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    const unsigned day_of_era = (unsigned)(days - era * 146097);
+    const unsigned year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    const unsigned day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    const unsigned mp = (5 * day_of_year + 2) / 153;
+    day = day_of_year - (153 * mp + 2) / 5 + 1;
+    month = mp < 10 ? mp + 3 : mp - 9;
+    year = (std::int64_t)year_of_era + era * 400 + (month <= 2);
+}
+
+std::int64_t floor_seconds(std::int64_t ns)
+{
+    return ns >= 0 ? ns / 1000000000LL : -((-ns + 999999999LL) / 1000000000LL);
+}
+
+/**
+ * @brief Parses an IMF-fixdate ("Sun, 06 Nov 1994 08:49:37 GMT"), the only format browsers send.
+ */
+bool parse_http_date(const std::string& text, std::int64_t& out_seconds)
+{
+    int day, year, hour, minute, second;
+    char month_name[4] = {};
+    if (sscanf(text.c_str(), "%*3s, %2d %3s %4d %2d:%2d:%2d GMT", &day, month_name, &year, &hour, &minute, &second) != 6) {
+        return false;
+    }
+    for (unsigned month = 0; month < 12; month++) {
+        if (strcmp(month_name, kMonths[month]) == 0) {
+            out_seconds = days_from_civil(year, month + 1, (unsigned)day) * 86400 + hour * 3600 + minute * 60 + second;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Returns true if a comma-separated list of entity tags contains 'etag'.
+ *
+ * @param weak Use the weak comparison (W/ prefixes ignored), as If-None-Match requires.
+ */
+bool etag_list_matches(const std::string& header, const std::string& etag, bool weak)
+{
+    size_t pos = 0;
+    while (pos < header.size()) {
+        size_t end = header.find(',', pos);
+        if (end == std::string::npos) end = header.size();
+        std::string tag = header.substr(pos, end - pos);
+        pos = end + 1;
+
+        tag.erase(0, tag.find_first_not_of(" \t"));
+        tag.erase(tag.find_last_not_of(" \t") + 1);
+        if (tag == "*") return true;
+        if (tag.compare(0, 2, "W/") == 0) {
+            if (!weak) continue;
+            tag.erase(0, 2);
+        }
+        if (tag == etag) return true;
+    }
+    return false;
+}
+
+} // namespace
+
+std::string make_file_etag(const platform_file_info& info)
+{
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "\"%llx-%llx-%llx\"", (unsigned long long)info.file_id,
+        (unsigned long long)info.size, (unsigned long long)info.mtime_ns);
+    return buffer;
+}
+
+std::string make_content_etag(const char* data, size_t size, const char* suffix)
+{
+    // FNV-1a over the content: the tag changes whenever the bytes do, whatever the mtime says.
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ (unsigned char)data[i]) * 1099511628211ULL;
+    }
+    char buffer[48];
+    snprintf(buffer, sizeof(buffer), "\"%016llx%s\"", (unsigned long long)hash, suffix);
+    return buffer;
+}
+
+std::string format_http_date(std::int64_t unix_seconds)
+{
+    std::int64_t days = unix_seconds >= 0 ? unix_seconds / 86400 : -((-unix_seconds + 86399) / 86400);
+    std::int64_t seconds_of_day = unix_seconds - days * 86400;
+    std::int64_t year;
+    unsigned month, day;
+    civil_from_days(days, year, month, day);
+    // 1970-01-01 was a Thursday.
+    int weekday = (int)(((days % 7) + 11) % 7);
+
+    char buffer[40];
+    snprintf(buffer, sizeof(buffer), "%s, %02u %s %04lld %02d:%02d:%02d GMT", kWeekdays[weekday], day,
+        kMonths[month - 1], (long long)year, (int)(seconds_of_day / 3600), (int)(seconds_of_day / 60 % 60), (int)(seconds_of_day % 60));
+    return buffer;
+}
+
+bool check_conditional_get(const httplib::Request& req, httplib::Response& res, const std::string& etag, std::int64_t mtime_ns)
+{
+    // --- 1. Validators ---
+    std::int64_t mtime_seconds = floor_seconds(mtime_ns);
+    std::string last_modified = format_http_date(mtime_seconds);
+    res.set_header("ETag", etag);
+    res.set_header("Last-Modified", last_modified);
+    res.set_header("Cache-Control", "no-cache");
+
+    // --- 2. If-None-Match, or If-Modified-Since when there is no If-None-Match (RFC 9110, 13.2.2) ---
+    bool not_modified = false;
+    if (req.has_header("If-None-Match")) {
+        not_modified = etag_list_matches(req.get_header_value("If-None-Match"), etag, true);
+    }
+    else if (req.has_header("If-Modified-Since")) {
+        std::int64_t since;
+        not_modified = parse_http_date(req.get_header_value("If-Modified-Since"), since) && mtime_seconds <= since;
+    }
+    if (not_modified) {
+        res.status = 304;
+        return true;
+    }
+
+    // --- 3. If-Range: only send the requested part if the client's copy is still current ---
+    if (!req.ranges.empty() && req.has_header("If-Range")) {
+        const std::string& if_range = req.get_header_value("If-Range");
+        bool current;
+        if (!if_range.empty() && (if_range[0] == '"' || if_range.compare(0, 2, "W/") == 0)) {
+            // An entity tag must match strongly; a weak tag never does.
+            current = if_range == etag;
+        }
+        else {
+            // A date only counts if it is exactly our Last-Modified.
+            std::int64_t date;
+            current = parse_http_date(if_range, date) && date == mtime_seconds;
+        }
+        if (!current) {
+            // httplib parses Range before routing and applies req.ranges when writing the body,
+            // whatever the status. The Request is a mutable local of httplib's process_request()
+            // that handlers only see as const, so dropping the ranges here is safe, and it is the
+            // only way to get the whole body sent as a plain 200.
+            const_cast<httplib::Request&>(req).ranges.clear();
+        }
+    }
+    return false;
+}
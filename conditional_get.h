@@ -0,0 +1,44 @@
+﻿#pragma once
+
+#include "httplib.h"
+#include "platform.h"
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief Builds a strong ETag from a file's identity: its file id, size and mtime.
+ *
+ * Any write changes the mtime (and usually the size), and replacing the file (e.g. an
+ * editor's save-by-rename) changes the file id, so equal tags mean equal bytes.
+ */
+std::string make_file_etag(const platform_file_info& info);
+
+/**
+ * @brief Builds a strong ETag from the content itself (a 64-bit FNV-1a hash), for bodies held in memory.
+ *
+ * @param suffix Appended inside the quotes, to tell apart encodings of the same content (e.g. "-br").
+ */
+std::string make_content_etag(const char* data, size_t size, const char* suffix);
+
+/**
+ * @brief Formats a time as an HTTP date (IMF-fixdate), e.g. "Sun, 06 Nov 1994 08:49:37 GMT".
+ */
+std::string format_http_date(std::int64_t unix_seconds);
+
+/**
+ * @brief Adds validators to a file response and evaluates the request's conditional headers.
+ *
+ * Call this once the file's metadata is known and before any body is set. It sets the
+ * ETag, Last-Modified and Cache-Control: no-cache headers (the URLs are not versioned,
+ * so the browser should keep the body but revalidate it every time), then:
+ *
+ *   - If-None-Match (or, without it, If-Modified-Since) matching the current validators
+ *     turns the response into 304 Not Modified.
+ *   - If-Range that does not match clears the request's parsed ranges, so httplib sends
+ *     the whole, current file (status 200) instead of a part of a different version.
+ *
+ * @param etag The representation's ETag, including quotes.
+ * @param mtime_ns The file's last write time (see platform_file_info::mtime_ns).
+ * @return true if the response is a 304; the handler must return without setting a body.
+ */
+bool check_conditional_get(const httplib::Request& req, httplib::Response& res, const std::string& etag, std::int64_t mtime_ns);
@@ -0,0 +1,249 @@
+﻿#include "content_type.h"
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+
+namespace {
+
+const std::string_view kUnknownType = "application/octet-stream";
+
+struct ExtensionType {
+    const char* extension;      // Lowercase, at most 8 characters.
+    const char* type;
+};
+
+constexpr ExtensionType kExtensions[] = {
+    { "html", "text/html" }, { "htm", "text/html" },
+    { "js", "application/javascript" }, { "mjs", "application/javascript" },
+    { "css", "text/css" }, { "json", "application/json" }, { "map", "application/json" },
+    { "md", "text/markdown; charset=utf-8" }, { "markdown", "text/markdown; charset=utf-8" },
+    { "txt", "text/plain; charset=utf-8" }, { "log", "text/plain; charset=utf-8" },
+    { "csv", "text/csv; charset=utf-8" }, { "xml", "application/xml" },
+    { "svg", "image/svg+xml" }, { "png", "image/png" }, { "jpg", "image/jpeg" }, { "jpeg", "image/jpeg" },
+    { "gif", "image/gif" }, { "webp", "image/webp" }, { "avif", "image/avif" }, { "bmp", "image/bmp" },
+    { "ico", "image/x-icon" },
+    { "mp4", "video/mp4" }, { "m4v", "video/mp4" }, { "webm", "video/webm" }, { "ogv", "video/ogg" },
+    { "mov", "video/quicktime" }, { "mkv", "video/x-matroska" },
+    { "mp3", "audio/mpeg" }, { "m4a", "audio/mp4" }, { "ogg", "audio/ogg" }, { "oga", "audio/ogg" },
+    { "opus", "audio/ogg" }, { "wav", "audio/wav" }, { "flac", "audio/flac" },
+    { "pdf", "application/pdf" }, { "wasm", "application/wasm" }, { "zip", "application/zip" },
+    { "woff", "font/woff" }, { "woff2", "font/woff2" }, { "ttf", "font/ttf" }, { "otf", "font/otf" },
+};
+
+constexpr size_t kExtensionCount = sizeof(kExtensions) / sizeof(kExtensions[0]);
+constexpr size_t kMaxExtension = 8;
+
+// --- The perfect hash ---
+// An extension is packed little-endian into a 64-bit key, and the slot is the top kSlotBits
+// of key * multiplier. The multiplier is searched for at compile time, so adding an
+// extension above is all it takes; the static_assert fires if no multiplier is found.
+constexpr int kSlotBits = 8;
+constexpr size_t kSlots = size_t(1) << kSlotBits;
+
+constexpr uint64_t pack_extension(const char* extension)
+{
+    uint64_t key = 0;
+    for (size_t i = 0; extension[i]; i++) key |= uint64_t((unsigned char)extension[i]) << (8 * i);
+    return key;
+}
+
+constexpr size_t slot_of(uint64_t key, uint64_t multiplier)
+{
+    return size_t((key * multiplier) >> (64 - kSlotBits));
+}
+
+struct HashTable {
+    uint64_t multiplier = 0;
+    uint8_t slots[kSlots] = {};     // Index into kExtensions plus one; 0 is empty.
+};
+
+constexpr HashTable build_table()
+{
+    uint64_t candidate = 0x9E3779B97F4A7C15ull;
+    for (int attempt = 0; attempt < 1000; attempt++) {
+        HashTable table;
+        table.multiplier = candidate | 1;
+        bool collision = false;
+        for (size_t i = 0; i < kExtensionCount && !collision; i++) {
+            uint8_t& slot = table.slots[slot_of(pack_extension(kExtensions[i].extension), table.multiplier)];
+            collision = slot != 0;
+            slot = uint8_t(i + 1);
+        }
+        if (!collision) return table;
+        // Next candidate from a 64-bit LCG.
+        candidate = candidate * 6364136223846793005ull + 1442695040888963407ull;
+    }
+    return HashTable{};
+}
+
+constexpr HashTable kTable = build_table();
+static_assert(kTable.multiplier != 0, "no perfect hash multiplier found for kExtensions");
+static_assert(kExtensionCount < 255, "slots hold uint8_t indexes");
+
+// --- Sniffing ---
+const size_t kSniffBytes = 512;
+const size_t kMaxSniffCacheEntries = 4096;
+
+struct FileIdentity {
+    uint64_t device;
+    uint64_t file_id;
+    uint64_t size;
+    int64_t mtime_ns;
+
+    bool operator==(const FileIdentity& other) const
+    {
+        return device == other.device && file_id == other.file_id && size == other.size && mtime_ns == other.mtime_ns;
+    }
+};
+
+struct FileIdentityHash {
+    size_t operator()(const FileIdentity& id) const
+    {
+        uint64_t h = id.file_id * 0x9E3779B97F4A7C15ull ^ id.device ^ (uint64_t)id.mtime_ns * 31 ^ id.size;
+        return (size_t)(h ^ (h >> 29));
+    }
+};
+
+std::mutex g_sniff_lock;
+std::unordered_map<FileIdentity, std::string_view, FileIdentityHash> g_sniffed;
+
+std::atomic<uint64_t> g_sniffs{ 0 };
+std::atomic<uint64_t> g_sniff_cache_hits{ 0 };
+
+bool sniffing_enabled()
+{
+    static const bool enabled = [] {
+        const char* sniff = getenv("PERSONA_SNIFF");
+        return !(sniff && strcmp(sniff, "0") == 0);
+    }();
+    return enabled;
+}
+
+bool starts_with(const unsigned char* data, size_t length, size_t offset, const char* magic, size_t magic_length)
+{
+    return length >= offset + magic_length && memcmp(data + offset, magic, magic_length) == 0;
+}
+
+bool contains(const unsigned char* data, size_t length, const char* needle, size_t needle_length)
+{
+    for (size_t i = 0; i + needle_length <= length; i++) {
+        if (memcmp(data + i, needle, needle_length) == 0) return true;
+    }
+    return false;
+}
+
+} // namespace
+
+std::string_view content_type_for_name(std::string_view name)
+{
+    // --- 1. The extension of the last segment ---
+    size_t slash = name.find_last_of("/\\");
+    if (slash != std::string_view::npos) name.remove_prefix(slash + 1);
+    size_t dot = name.rfind('.');
+    // No dot, a trailing dot, or only a leading one (".bashrc") means no extension.
+    if (dot == std::string_view::npos || dot == 0 || dot + 1 == name.size() || name.size() - dot - 1 > kMaxExtension) {
+        return kUnknownType;
+    }
+
+    // --- 2. Pack it lowercased and look it up ---
+    uint64_t key = 0;
+    for (size_t i = dot + 1, shift = 0; i < name.size(); i++, shift += 8) {
+        unsigned char c = (unsigned char)name[i];
+        if (c >= 'A' && c <= 'Z') c = (unsigned char)(c - 'A' + 'a');
+        key |= uint64_t(c) << shift;
+    }
+    uint8_t index = kTable.slots[slot_of(key, kTable.multiplier)];
+    if (index == 0 || pack_extension(kExtensions[index - 1].extension) != key) {
+        return kUnknownType;
+    }
+    return kExtensions[index - 1].type;
+}
+
+std::string_view sniff_content_type(const void* bytes, size_t length)
+{
+    const unsigned char* data = (const unsigned char*)bytes;
+
+    // --- 1. Images and documents ---
+    if (starts_with(data, length, 0, "\x89PNG\r\n\x1a\n", 8)) return "image/png";
+    if (starts_with(data, length, 0, "\xff\xd8\xff", 3)) return "image/jpeg";
+    if (starts_with(data, length, 0, "GIF87a", 6) || starts_with(data, length, 0, "GIF89a", 6)) return "image/gif";
+    if (starts_with(data, length, 0, "RIFF", 4) && starts_with(data, length, 8, "WEBP", 4)) return "image/webp";
+    if (starts_with(data, length, 0, "BM", 2) && length >= 14 && data[6] == 0 && data[7] == 0) return "image/bmp";
+    if (starts_with(data, length, 0, "%PDF-", 5)) return "application/pdf";
+    if (starts_with(data, length, 0, "\0asm", 4)) return "application/wasm";
+    if (starts_with(data, length, 0, "PK\x03\x04", 4)) return "application/zip";
+
+    // --- 2. Media containers ---
+    // ISO base media (MP4, MOV, M4A, AVIF): a box size, then "ftyp" and the major brand.
+    if (starts_with(data, length, 4, "ftyp", 4) && length >= 12) {
+        if (starts_with(data, length, 8, "qt  ", 4)) return "video/quicktime";
+        if (starts_with(data, length, 8, "M4A ", 4)) return "audio/mp4";
+        if (starts_with(data, length, 8, "avif", 4) || starts_with(data, length, 8, "avis", 4)) return "image/avif";
+        return "video/mp4";
+    }
+    // EBML: WebM is the Matroska profile with the "webm" DocType.
+    if (starts_with(data, length, 0, "\x1a\x45\xdf\xa3", 4)) {
+        return contains(data, length, "webm", 4) ? "video/webm" : "video/x-matroska";
+    }
+    if (starts_with(data, length, 0, "OggS", 4)) {
+        return contains(data, length, "\x80theora", 7) ? "video/ogg" : "audio/ogg";
+    }
+    if (starts_with(data, length, 0, "RIFF", 4) && starts_with(data, length, 8, "WAVE", 4)) return "audio/wav";
+    if (starts_with(data, length, 0, "fLaC", 4)) return "audio/flac";
+    // MP3: an ID3v2 tag, or a bare MPEG audio frame sync.
+    if (starts_with(data, length, 0, "ID3", 3) || (length >= 2 && data[0] == 0xff && (data[1] & 0xe6) == 0xe2)) return "audio/mpeg";
+
+    // --- 3. Text: no control bytes other than whitespace and ESC ---
+    if (length == 0) return std::string_view();
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = data[i];
+        if (c < 0x20 && c != '\t' && c != '\n' && c != '\r' && c != '\f' && c != 0x1b) return std::string_view();
+        if (c == 0x7f) return std::string_view();
+    }
+    return "text/plain; charset=utf-8";
+}
+
+std::string_view content_type_for_file(platform_file file, const platform_file_info& info, std::string_view name)
+{
+    std::string_view type = content_type_for_name(name);
+    if (type != kUnknownType || !sniffing_enabled()) {
+        return type;
+    }
+
+    // --- 1. Already sniffed this version of the file? ---
+    FileIdentity id{ info.device, info.file_id, info.size, info.mtime_ns };
+    {
+        std::lock_guard<std::mutex> lock(g_sniff_lock);
+        auto found = g_sniffed.find(id);
+        if (found != g_sniffed.end()) {
+            g_sniff_cache_hits.fetch_add(1, std::memory_order_relaxed);
+            return found->second;
+        }
+    }
+
+    // --- 2. Read the first block and look at it ---
+    unsigned char block[kSniffBytes];
+    long long read = platform_read_at(file, block, sizeof(block), 0);
+    if (read < 0) {
+        return kUnknownType;
+    }
+    g_sniffs.fetch_add(1, std::memory_order_relaxed);
+    std::string_view sniffed = sniff_content_type(block, (size_t)read);
+    if (sniffed.empty()) sniffed = kUnknownType;
+
+    std::lock_guard<std::mutex> lock(g_sniff_lock);
+    // Identities of old file versions never come back, so the map is simply started over when full.
+    if (g_sniffed.size() >= kMaxSniffCacheEntries) g_sniffed.clear();
+    g_sniffed.emplace(id, sniffed);
+    return sniffed;
+}
+
+ContentTypeStats get_content_type_stats()
+{
+    ContentTypeStats stats;
+    stats.sniffs = g_sniffs.load(std::memory_order_relaxed);
+    stats.sniff_cache_hits = g_sniff_cache_hits.load(std::memory_order_relaxed);
+    return stats;
+}
@@ -0,0 +1,45 @@
+﻿#pragma once
+
+#include "platform.h"
+#include <cstdint>
+#include <string_view>
+
+/**
+ * @brief The Content-Type for a file name, from its extension.
+ *
+ * Only the extension of the last path segment counts ("foo.js.txt" is text, "docs.v2/README"
+ * has none), in any case. The lookup is a compile-time perfect hash over the types the
+ * frontend and its viewers handle, so it never allocates.
+ *
+ * @return A string with static storage, "application/octet-stream" for unknown extensions.
+ */
+std::string_view content_type_for_name(std::string_view name);
+
+/**
+ * @brief Recognizes a file type from its first bytes (PNG, JPEG, MP4, WebM, Ogg, PDF, ...).
+ *
+ * Data without any binary control bytes is taken as UTF-8 text.
+ *
+ * @return A string with static storage, or an empty view if the bytes are not recognized.
+ */
+std::string_view sniff_content_type(const void* data, size_t length);
+
+/**
+ * @brief The Content-Type for an open file: by name, or by its content when the name has
+ * no known extension.
+ *
+ * The sniffed type is remembered per file identity (device, file id, size, mtime), so a
+ * file is read for sniffing at most once until it changes. Set PERSONA_SNIFF=0 to go by
+ * the name only.
+ */
+std::string_view content_type_for_file(platform_file file, const platform_file_info& info, std::string_view name);
+
+/**
+ * @brief Counters describing content sniffing, for diagnostics and metrics.
+ */
+struct ContentTypeStats {
+    uint64_t sniffs;                // Files read to sniff their type.
+    uint64_t sniff_cache_hits;      // Files whose sniffed type was already known.
+};
+
+ContentTypeStats get_content_type_stats();
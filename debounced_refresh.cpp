@@ -0,0 +1,48 @@
+﻿#include "debounced_refresh.h"
+#include "platform.h"
+#include <utility>
+
+namespace {
+
+// How long the watch must be quiet before a rebuild; see DebouncedRefresh.
+const std::chrono::milliseconds kRefreshQuietPeriod(200);
+
+} // namespace
+
+DebouncedRefresh::DebouncedRefresh(std::function<void()> rebuild) : rebuild_(std::move(rebuild))
+{
+}
+
+void DebouncedRefresh::start(std::function<void()> first, bool follow_changes)
+{
+    first_ = std::move(first);
+    follow_changes_ = follow_changes;
+    platform_start_thread(thread_main, this);
+}
+
+void DebouncedRefresh::notify()
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    pending_ = true;
+    last_change_ = std::chrono::steady_clock::now();
+    signal_.notify_one();
+}
+
+void DebouncedRefresh::thread_main(void* arg)
+{
+    DebouncedRefresh& refresh = *(DebouncedRefresh*)arg;
+    if (refresh.first_) refresh.first_();
+    if (!refresh.follow_changes_) return;
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> guard(refresh.lock_);
+            refresh.signal_.wait(guard, [&] { return refresh.pending_; });
+            while (std::chrono::steady_clock::now() - refresh.last_change_ < kRefreshQuietPeriod) {
+                refresh.signal_.wait_until(guard, refresh.last_change_ + kRefreshQuietPeriod);
+            }
+            refresh.pending_ = false;
+        }
+        refresh.rebuild_();
+    }
+}
@@ -0,0 +1,50 @@
+﻿#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <chrono>
+
+/**
+ * @brief Rebuilds something on its own thread after the files it is built from change.
+ *
+ * File watch callbacks call notify(). The thread waits until the watch has been quiet for
+ * kRefreshQuietPeriod, so that an editor's burst of events for a single save causes a
+ * single rebuild, and then calls 'rebuild' once.
+ *
+ * Instances are never destroyed: the thread waits on them for the life of the process,
+ * and destroying a condition variable with a waiter blocks exit().
+ */
+class DebouncedRefresh {
+public:
+    explicit DebouncedRefresh(std::function<void()> rebuild);
+    DebouncedRefresh(const DebouncedRefresh&) = delete;
+    DebouncedRefresh& operator=(const DebouncedRefresh&) = delete;
+
+    /**
+     * @brief Starts the thread.
+     *
+     * @param first Run on the thread before anything else (may be empty), e.g. a first
+     * build that should not hold up the caller.
+     * @param follow_changes Whether to keep running and rebuild after notify(); false when
+     * the watch could not be set up, which makes the thread end after 'first'.
+     */
+    void start(std::function<void()> first, bool follow_changes);
+
+    /**
+     * @brief Schedules a rebuild. Safe to call from any thread.
+     */
+    void notify();
+
+private:
+    static void thread_main(void* arg);
+
+    std::function<void()> rebuild_;
+    std::function<void()> first_;
+    bool follow_changes_ = false;
+
+    std::mutex lock_;
+    std::condition_variable signal_;
+    bool pending_ = false;
+    std::chrono::steady_clock::time_point last_change_;
+};
@@ -0,0 +1,506 @@
+﻿#include "directory_listing.h"
+#include "conditional_get.h"
+#include "content_type.h"
+#include "file_receiver.h"
+#include "root_watch.h"
+#include "trace.h"
+#include "nlohmann/json.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+// Upper bound for the serialized listings kept in memory; the least recently used go first.
+const size_t kMaxCachedBytes = 64 * 1024 * 1024;
+
+// How often the background sweep re-checks the cached directories.
+const std::chrono::seconds kSweepInterval(10);
+
+// Entries nobody asked for in this long are dropped by the sweep.
+const std::chrono::seconds kIdleTimeout(300);
+
+// If the change notifications could not be set up, an entry is only trusted for this long,
+// since changes to the files inside a directory do not show up in the directory's own mtime.
+const std::chrono::seconds kUnwatchedMaxAge(5);
+
+// Changed directories remembered for the scans in progress. Beyond this many, a change
+// simply counts as a change to everything (the scans then are not cached).
+const size_t kMaxTrackedChanges = 4096;
+
+// Streamed listings are sent in chunks of about this size.
+const size_t kStreamChunkSize = 64 * 1024;
+
+// Streamed listings read the directory this many entries at a time.
+const size_t kStreamBatchSize = 256;
+
+struct Entry {
+    std::shared_ptr<const DirectoryListing> listing;
+    std::chrono::steady_clock::time_point created;
+    std::chrono::steady_clock::time_point last_used;
+    size_t bytes;               // Memory held by the listing (body and entries).
+};
+
+struct ListingCache {
+    std::mutex lock;
+    std::unordered_map<native_string, Entry> entries;
+    size_t bytes = 0;
+
+    // A listing built while its directory changed must not be cached. Every invalidation
+    // gets the next generation; while scans are in progress, 'changed' records the last
+    // one of each directory, so a scan is only thrown away for a change to its own
+    // directory (or to everything: 'cleared').
+    uint64_t generation = 0;
+    uint64_t cleared = 0;
+    std::unordered_map<native_string, uint64_t> changed;
+    size_t scanning = 0;
+};
+
+ListingCache& listing_cache()
+{
+    // Never destroyed: the watch and sweep threads use it for the life of the process.
+    static ListingCache* cache = new ListingCache();
+    return *cache;
+}
+
+std::once_flag g_start_once;
+std::atomic<bool> g_watching{ false };
+
+std::atomic<uint64_t> g_hits{ 0 };
+std::atomic<uint64_t> g_misses{ 0 };
+std::atomic<uint64_t> g_invalidations{ 0 };
+
+bool is_separator(native_string::value_type c)
+{
+    return c == '/' || c == '\\';
+}
+
+// Cache keys never end with a separator, so the root (spelled "…/PersonaRoot/") and the
+// paths reported by the file watch ("…/PersonaRoot/sub") line up.
+native_string to_key(native_string path)
+{
+    while (path.size() > 1 && is_separator(path.back())) path.pop_back();
+    return path;
+}
+
+bool same_directory(const platform_file_info& a, const platform_file_info& b)
+{
+    return a.mtime_ns == b.mtime_ns && a.file_id == b.file_id && a.device == b.device && a.size == b.size;
+}
+
+// Removes one entry. The caller holds the cache lock.
+void drop_entry(ListingCache& cache, std::unordered_map<native_string, Entry>::iterator it)
+{
+    cache.bytes -= it->second.bytes;
+    cache.entries.erase(it);
+}
+
+// Records a change to one directory for the scans in progress. The caller holds the cache lock.
+void note_change(ListingCache& cache, const native_string& key)
+{
+    cache.generation++;
+    if (cache.scanning == 0) return;
+    if (cache.changed.size() >= kMaxTrackedChanges) {
+        cache.cleared = cache.generation;
+        cache.changed.clear();
+        return;
+    }
+    cache.changed[key] = cache.generation;
+}
+
+// Whether nothing invalidated 'key' since a scan started at 'generation'. The caller holds the cache lock.
+bool unchanged_since(const ListingCache& cache, const native_string& key, uint64_t generation)
+{
+    if (cache.cleared > generation) return false;
+    auto found = cache.changed.find(key);
+    return found == cache.changed.end() || found->second <= generation;
+}
+
+/**
+ * @brief File watch callback: a file or directory below the root changed.
+ */
+void on_tree_change(const native_string& path, void* ctx)
+{
+    native_string key = to_key(path);
+    ListingCache& cache = listing_cache();
+    std::lock_guard<std::mutex> guard(cache.lock);
+
+    // The root itself means "events were lost": nothing can be trusted any more.
+    if (key == to_key(platform_root_path())) {
+        cache.cleared = ++cache.generation;
+        cache.changed.clear();
+        g_invalidations.fetch_add(cache.entries.size(), std::memory_order_relaxed);
+        cache.entries.clear();
+        cache.bytes = 0;
+        return;
+    }
+
+    // The changed path's own listing (if it is a directory) and its parent's listing,
+    // which shows the entry being added, removed, renamed or resized.
+    size_t separator = key.find_last_of(NATIVE_TEXT("/\\"));
+    native_string parent = separator == native_string::npos ? native_string() : to_key(key.substr(0, separator + 1));
+    for (const native_string* affected : { &key, &parent }) {
+        note_change(cache, *affected);
+        auto found = cache.entries.find(*affected);
+        if (found != cache.entries.end()) {
+            drop_entry(cache, found);
+            g_invalidations.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
+
+/**
+ * @brief Background thread: the periodic consistency sweep.
+ *
+ * Drops entries whose directory's identity (mtime, file id) no longer matches, entries
+ * that have been idle for kIdleTimeout, and, when there are no change notifications,
+ * entries older than kUnwatchedMaxAge.
+ */
+void sweep_thread(void* arg)
+{
+    ListingCache& cache = listing_cache();
+    for (;;) {
+        std::this_thread::sleep_for(kSweepInterval);
+        auto now = std::chrono::steady_clock::now();
+
+        // --- 1. Snapshot the entries, then stat the directories without holding the lock ---
+        std::vector<std::pair<native_string, std::shared_ptr<const DirectoryListing>>> snapshot;
+        {
+            std::lock_guard<std::mutex> guard(cache.lock);
+            for (const auto& entry : cache.entries) {
+                snapshot.emplace_back(entry.first, entry.second.listing);
+            }
+        }
+
+        std::vector<std::pair<native_string, std::shared_ptr<const DirectoryListing>>> stale;
+        for (const auto& entry : snapshot) {
+            platform_file_info info;
+            if (!platform_stat_path(entry.first, info) || !same_directory(info, entry.second->directory)) {
+                stale.push_back(entry);
+            }
+        }
+
+        // --- 2. Drop what is stale, idle or too old ---
+        std::lock_guard<std::mutex> guard(cache.lock);
+        for (const auto& entry : stale) {
+            auto found = cache.entries.find(entry.first);
+            // Only if nobody replaced the entry with a fresh listing in the meantime.
+            if (found != cache.entries.end() && found->second.listing == entry.second) {
+                drop_entry(cache, found);
+                note_change(cache, entry.first);
+                g_invalidations.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        bool watching = g_watching.load(std::memory_order_relaxed);
+        for (auto it = cache.entries.begin(); it != cache.entries.end();) {
+            auto next = std::next(it);
+            if (now - it->second.last_used > kIdleTimeout || (!watching && now - it->second.created > kUnwatchedMaxAge)) {
+                drop_entry(cache, it);
+                g_invalidations.fetch_add(1, std::memory_order_relaxed);
+            }
+            it = next;
+        }
+    }
+}
+
+void start_listing_cache()
+{
+    g_watching = root_watch_subscribe(on_tree_change, nullptr);
+    platform_start_thread(sweep_thread, nullptr);
+}
+
+// Serializes a listing response around entries [first, last).
+std::string serialize_listing(const DirectoryListing& listing, std::vector<DirectoryEntry>::const_iterator first,
+    std::vector<DirectoryEntry>::const_iterator last, const std::string* next_cursor)
+{
+    // The members are written directly rather than through a nlohmann::json tree, so a huge
+    // directory costs one growing string instead of a node per entry on top of it.
+    std::string out = "{\"isDir\":true,\"items\":[";
+    for (auto it = first; it != last; ++it) {
+        if (it != first) out += ',';
+        append_directory_entry(out, *it);
+    }
+    out += "],\"name\":";
+    append_json_string(out, listing.name);
+    if (next_cursor) {
+        out += ",\"nextCursor\":";
+        append_json_string(out, *next_cursor);
+    }
+    out += ",\"path\":";
+    append_json_string(out, listing.request_path);
+    out += '}';
+    return out;
+}
+
+/**
+ * @brief Scans a directory and serializes the /api/resources response for it.
+ */
+std::shared_ptr<const DirectoryListing> build_listing(const native_string& full_path, const std::string& request_path, const platform_file_info& directory)
+{
+    auto listing = std::make_shared<DirectoryListing>();
+    listing->request_path = request_path;
+    listing->name = native_to_utf8(std::filesystem::path(full_path).filename().native());
+
+    // Names and metadata in bulk: no stat per entry on Windows, batched (and for large
+    // directories parallel) statx on Linux.
+    std::vector<platform_dir_entry> entries;
+    {
+        TraceScope span("fs");
+        if (!platform_list_directory(full_path, entries)) {
+            throw std::runtime_error("Cannot read directory.");
+        }
+    }
+    listing->entries.reserve(entries.size());
+    for (const platform_dir_entry& entry : entries) {
+        if (is_upload_temp_name(entry.name)) continue;
+        listing->entries.push_back(make_directory_entry(entry));
+    }
+    std::sort(listing->entries.begin(), listing->entries.end(),
+        [](const DirectoryEntry& a, const DirectoryEntry& b) { return a.name < b.name; });
+
+    {
+        TraceScope span("json_dump");
+        listing->body = serialize_listing(*listing, listing->entries.begin(), listing->entries.end(), nullptr);
+    }
+    listing->etag = make_content_etag(listing->body.data(), listing->body.size(), "");
+    listing->built_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    listing->directory = directory;
+    return listing;
+}
+
+size_t listing_bytes(const DirectoryListing& listing)
+{
+    size_t bytes = sizeof(DirectoryListing) + listing.body.size() + listing.entries.size() * sizeof(DirectoryEntry);
+    for (const auto& entry : listing.entries) {
+        bytes += entry.name.size();
+    }
+    return bytes;
+}
+
+/**
+ * @brief The state of one streamed listing, owned by its content provider.
+ */
+struct ListingStream {
+    platform_directory directory = nullptr;
+    std::vector<platform_dir_entry> batch;
+    std::string head;           // Everything before the first item.
+    bool started = false;
+    bool first_item = true;
+
+    ~ListingStream()
+    {
+        if (directory) platform_close_directory(directory);
+    }
+};
+
+} // namespace
+
+void append_json_string(std::string& out, const std::string& text)
+{
+    // Most names are printable ASCII with nothing to escape: copy them as they are.
+    bool plain = true;
+    for (unsigned char c : text) {
+        if (c < 0x20 || c >= 0x7F || c == '"' || c == '\\') {
+            plain = false;
+            break;
+        }
+    }
+    if (plain) {
+        out += '"';
+        out += text;
+        out += '"';
+        return;
+    }
+    out += nlohmann::json(text).dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+}
+
+void append_directory_entry(std::string& out, const DirectoryEntry& entry)
+{
+    const platform_file_info& info = entry.info;
+    out += "{\"fileId\":\"";
+    out += std::to_string(info.file_id);
+    out += info.is_directory ? "\",\"isDir\":true,\"mime\":\"inode/directory\"" : "\",\"isDir\":false,\"mime\":";
+    if (!info.is_directory) {
+        // Content types are plain ASCII, with nothing to escape.
+        out += '"';
+        out += content_type_for_name(entry.name);
+        out += '"';
+    }
+    out += ",\"mtime\":";
+    out += std::to_string(info.mtime_ns / 1000000);
+    out += ",\"name\":";
+    append_json_string(out, entry.name);
+    out += ",\"size\":";
+    out += std::to_string(info.is_directory ? 0 : info.size);
+    out += '}';
+}
+
+DirectoryEntry make_directory_entry(const platform_dir_entry& entry)
+{
+    return DirectoryEntry{ native_to_utf8(entry.name), entry.info };
+}
+
+std::shared_ptr<const DirectoryListing> get_directory_listing(const native_string& full_path, const std::string& request_path)
+{
+    std::call_once(g_start_once, start_listing_cache);
+
+    // --- 1. One stat: is it a directory, and has its entry list changed? ---
+    platform_file_info info;
+    if (!platform_stat_path(full_path, info) || !info.is_directory) {
+        return nullptr;
+    }
+
+    // --- 2. Hit: an entry built for the same "path" spelling, for this exact directory state ---
+    native_string key = to_key(full_path);
+    ListingCache& cache = listing_cache();
+    auto now = std::chrono::steady_clock::now();
+    uint64_t generation;
+    {
+        std::lock_guard<std::mutex> guard(cache.lock);
+        auto found = cache.entries.find(key);
+        if (found != cache.entries.end()) {
+            const Entry& entry = found->second;
+            bool fresh = g_watching.load(std::memory_order_relaxed) || now - entry.created < kUnwatchedMaxAge;
+            if (fresh && entry.listing->request_path == request_path && same_directory(entry.listing->directory, info)) {
+                found->second.last_used = now;
+                g_hits.fetch_add(1, std::memory_order_relaxed);
+                return entry.listing;
+            }
+        }
+        generation = cache.generation;
+        cache.scanning++;
+    }
+    // With no scan left in progress, nobody needs the recorded changes.
+    auto end_scan = [&cache] {
+        if (--cache.scanning == 0) cache.changed.clear();
+    };
+
+    // --- 3. Miss: scan without holding the lock ---
+    g_misses.fetch_add(1, std::memory_order_relaxed);
+    std::shared_ptr<const DirectoryListing> listing;
+    try {
+        listing = build_listing(full_path, request_path, info);
+    }
+    catch (...) {
+        std::lock_guard<std::mutex> guard(cache.lock);
+        end_scan();
+        throw;
+    }
+
+    // --- 4. Publish it, unless this directory changed while we were scanning ---
+    size_t bytes = listing_bytes(*listing);
+    std::lock_guard<std::mutex> guard(cache.lock);
+    bool unchanged = unchanged_since(cache, key, generation);
+    end_scan();
+    if (unchanged && bytes <= kMaxCachedBytes) {
+        auto found = cache.entries.find(key);
+        if (found != cache.entries.end()) drop_entry(cache, found);
+
+        while (!cache.entries.empty() && cache.bytes + bytes > kMaxCachedBytes) {
+            auto oldest = cache.entries.begin();
+            for (auto it = cache.entries.begin(); it != cache.entries.end(); ++it) {
+                if (it->second.last_used < oldest->second.last_used) oldest = it;
+            }
+            drop_entry(cache, oldest);
+        }
+
+        cache.entries[key] = Entry{ listing, now, now, bytes };
+        cache.bytes += bytes;
+    }
+    return listing;
+}
+
+std::string build_listing_page(const DirectoryListing& listing, const std::string& cursor, size_t limit)
+{
+    auto first = listing.entries.begin();
+    if (!cursor.empty()) {
+        first = std::upper_bound(listing.entries.begin(), listing.entries.end(), cursor,
+            [](const std::string& name, const DirectoryEntry& entry) { return name < entry.name; });
+    }
+    size_t count = std::min(limit, (size_t)(listing.entries.end() - first));
+    auto last = first + count;
+
+    if (last != listing.entries.end() && count > 0) {
+        return serialize_listing(listing, first, last, &(last - 1)->name);
+    }
+    return serialize_listing(listing, first, last, nullptr);
+}
+
+bool stream_directory_listing(httplib::Response& res, const native_string& full_path, const std::string& request_path)
+{
+    platform_file_info info;
+    if (!platform_stat_path(full_path, info) || !info.is_directory) {
+        return false;
+    }
+
+    // Opened here, so a directory that cannot be read still fails the request with a status code.
+    auto stream = std::make_shared<ListingStream>();
+    stream->directory = platform_open_directory(full_path);
+    if (stream->directory == nullptr) {
+        throw std::runtime_error("Cannot read directory.");
+    }
+    stream->head = "{\"isDir\":true,\"name\":";
+    append_json_string(stream->head, native_to_utf8(std::filesystem::path(full_path).filename().native()));
+    stream->head += ",\"path\":";
+    append_json_string(stream->head, request_path);
+    stream->head += ",\"items\":[";
+
+    res.set_chunked_content_provider("application/json; charset=utf-8",
+        [stream](size_t offset, httplib::DataSink& sink) {
+            std::string chunk;
+            chunk.reserve(kStreamChunkSize + 1024);
+            if (!stream->started) {
+                chunk = std::move(stream->head);
+                stream->started = true;
+            }
+
+            // --- 1. Read entries until the chunk is full or the directory ends ---
+            long long added = 0;
+            while (chunk.size() < kStreamChunkSize) {
+                stream->batch.clear();
+                added = platform_read_directory(stream->directory, stream->batch, kStreamBatchSize);
+                if (added <= 0) break;
+                for (const platform_dir_entry& entry : stream->batch) {
+                    if (is_upload_temp_name(entry.name)) continue;
+                    if (!stream->first_item) chunk += ',';
+                    append_directory_entry(chunk, make_directory_entry(entry));
+                    stream->first_item = false;
+                }
+            }
+
+            // --- 2. Close the document after the last entry (or a read error) ---
+            if (added <= 0) {
+                chunk += ']';
+                if (added < 0) {
+                    chunk += ",\"error\":\"Cannot read directory.\"";
+                }
+                chunk += '}';
+                if (!sink.write(chunk.data(), chunk.size())) return false;
+                sink.done();
+                return true;
+            }
+            return sink.write(chunk.data(), chunk.size());
+        });
+    return true;
+}
+
+DirectoryListingStats get_directory_listing_stats()
+{
+    DirectoryListingStats stats;
+    stats.hits = g_hits.load(std::memory_order_relaxed);
+    stats.misses = g_misses.load(std::memory_order_relaxed);
+    stats.invalidations = g_invalidations.load(std::memory_order_relaxed);
+
+    ListingCache& cache = listing_cache();
+    std::lock_guard<std::mutex> guard(cache.lock);
+    stats.entries = cache.entries.size();
+    stats.bytes = cache.bytes;
+    return stats;
+}
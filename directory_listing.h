@@ -0,0 +1,115 @@
+﻿#pragma once
+
+#include "httplib.h"
+#include "platform.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// The largest page /api/resources returns for one request with a 'limit' or 'cursor'.
+const size_t kMaxListingPageSize = 10000;
+
+/**
+ * @brief One item of a directory listing.
+ */
+struct DirectoryEntry {
+    std::string name;               // UTF-8.
+    platform_file_info info;        // Size, mtime, file id and type, read in bulk with the names.
+};
+
+/**
+ * @brief Converts a platform directory entry (native name) into a listing item (UTF-8 name).
+ */
+DirectoryEntry make_directory_entry(const platform_dir_entry& entry);
+
+/**
+ * @brief Appends one listing item as JSON, exactly as it appears in "items".
+ *
+ * The members are in sorted order, as nlohmann::json used to write them:
+ *   fileId - the inode number / NTFS file id, as a string since it may not fit a JavaScript number
+ *   isDir  - true for directories
+ *   mime   - the Content-Type the file would be served with, "inode/directory" for directories
+ *   mtime  - the last write time, in milliseconds since 1970 (ready for new Date())
+ *   name   - the file name
+ *   size   - the size in bytes, 0 for directories
+ */
+void append_directory_entry(std::string& out, const DirectoryEntry& entry);
+
+/**
+ * @brief Appends a string as a JSON string literal.
+ *
+ * Invalid UTF-8 (possible in Linux file names) is replaced with U+FFFD rather than
+ * failing the whole response.
+ */
+void append_json_string(std::string& out, const std::string& text);
+
+/**
+ * @brief A prebuilt /api/resources response for one directory, immutable once built.
+ */
+struct DirectoryListing {
+    std::string request_path;       // The "path" the body was built for, e.g. "/Videos".
+    std::string name;               // The directory's own name (UTF-8), "" for the root.
+    std::vector<DirectoryEntry> entries;    // Sorted by name (UTF-8 byte order), so pages are stable.
+    std::string body;               // The serialized JSON response with all entries.
+    std::string etag;
+    std::int64_t built_ns;          // When the listing was built (used as its Last-Modified).
+    platform_file_info directory;   // The directory's identity when it was scanned.
+};
+
+/**
+ * @brief Returns the /api/resources response for a directory, from the listing cache when possible.
+ *
+ * The cache is keyed by the directory's canonical path and watches the whole virtual
+ * drive (inotify on Linux, ReadDirectoryChangesW on Windows): any change inside a
+ * directory drops its entry, so an unchanged directory is answered from memory
+ * without being scanned again. On top of that, each lookup compares the directory's
+ * own identity (one stat), and a background sweep drops entries that went stale or
+ * have not been used for a while.
+ *
+ * @param full_path The canonical path of the directory (see is_safe_path()).
+ * @param request_path The "path" value to put in the response, e.g. "/Videos".
+ * @return The listing, or nullptr if 'full_path' is not a directory.
+ */
+std::shared_ptr<const DirectoryListing> get_directory_listing(const native_string& full_path, const std::string& request_path);
+
+/**
+ * @brief Serializes one page of a listing: the entries after 'cursor', at most 'limit' of them.
+ *
+ * The page has the same shape as the full response, plus a "nextCursor" member when
+ * more entries follow. Passing that value back as 'cursor' continues right after the
+ * last entry of this page. Since the cursor is the last name returned rather than a
+ * position, entries created or deleted between two requests never make the listing
+ * skip or repeat the others.
+ *
+ * @param cursor The "nextCursor" of the previous page, or "" for the first page.
+ * @param limit The page size, at most kMaxListingPageSize.
+ */
+std::string build_listing_page(const DirectoryListing& listing, const std::string& cursor, size_t limit);
+
+/**
+ * @brief Streams a directory listing as a chunked response while the directory is being read.
+ *
+ * For directories too large to wait for: the first bytes go out as soon as the first
+ * entries are read, and memory stays bounded by one chunk whatever the directory's size.
+ * Entries come in the order the file system returns them, and "name" / "path" come
+ * before "items". If reading fails halfway, the array is closed and an "error" member
+ * is added, so a client can tell a truncated listing from a complete one.
+ * The listing cache is not used.
+ *
+ * @return false if 'full_path' is not a directory (the response is left untouched).
+ */
+bool stream_directory_listing(httplib::Response& res, const native_string& full_path, const std::string& request_path);
+
+/**
+ * @brief Counters describing the listing cache, for diagnostics and metrics.
+ */
+struct DirectoryListingStats {
+    uint64_t hits;
+    uint64_t misses;            // Lookups that scanned the directory.
+    uint64_t invalidations;     // Entries dropped because of change notifications or the sweep.
+    uint64_t entries;
+    uint64_t bytes;             // Serialized bytes currently cached.
+};
+
+DirectoryListingStats get_directory_listing_stats();
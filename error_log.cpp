@@ -0,0 +1,422 @@
+﻿#include "error_log.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <system_error>
+#include <unordered_map>
+
+namespace {
+
+// Slots in the ring; a power of two. Messages beyond this many waiting are dropped.
+const size_t kRingSize = 1024;
+
+// Longer messages are cut, so a full ring holds at most kRingSize * kMaxMessageSize bytes.
+const size_t kMaxMessageSize = 16 * 1024;
+
+// The file is rotated once it reaches this size, keeping kRotatedFiles older files.
+const std::uint64_t kMaxFileSize = 8 * 1024 * 1024;
+const int kRotatedFiles = 3;
+
+// Even without a wakeup the writer looks at the ring this often.
+const std::chrono::milliseconds kWriterInterval(100);
+
+// Repeats of a report within this window become one "repeated N more times" line.
+const std::chrono::seconds kDedupWindow(10);
+
+// Fingerprints tracked at once; reports beyond that are logged without deduplication.
+const size_t kMaxFingerprints = 4096;
+
+// Per-client token bucket: a burst of kBucketCapacity reports, then kBucketRate per second.
+const double kBucketCapacity = 50;
+const double kBucketRate = 5;
+const size_t kMaxBuckets = 4096;
+
+/**
+ * @brief A bounded multi-producer, single-consumer ring.
+ *
+ * Each slot carries a sequence number: a producer claims the next position with one
+ * compare-and-swap on 'head' and publishes the slot by advancing its sequence; the
+ * writer consumes slots in order as their sequence shows them published. A full ring
+ * fails the push instead of waiting.
+ */
+class LogRing {
+public:
+    LogRing()
+    {
+        for (size_t i = 0; i < kRingSize; i++) slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    bool push(std::time_t time, std::string&& message)
+    {
+        size_t pos = head_.load(std::memory_order_relaxed);
+        Slot* slot;
+        for (;;) {
+            slot = &slots_[pos & (kRingSize - 1)];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t diff = (std::ptrdiff_t)sequence - (std::ptrdiff_t)pos;
+            if (diff == 0) {
+                if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            }
+            else if (diff < 0) {
+                return false;   // The writer has not consumed this slot yet: full.
+            }
+            else {
+                pos = head_.load(std::memory_order_relaxed);
+            }
+        }
+        slot->time = time;
+        slot->message = std::move(message);
+        slot->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Writer only.
+    bool pop(std::time_t& time, std::string& message)
+    {
+        Slot& slot = slots_[tail_ & (kRingSize - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) != tail_ + 1) return false;
+        time = slot.time;
+        message.swap(slot.message);
+        slot.message.clear();
+        slot.sequence.store(tail_ + kRingSize, std::memory_order_release);
+        tail_++;
+        return true;
+    }
+
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        std::time_t time;
+        std::string message;
+    };
+
+    Slot slots_[kRingSize];
+    alignas(64) std::atomic<size_t> head_{ 0 };
+    alignas(64) size_t tail_ = 0;
+};
+
+/**
+ * @brief Hand-off between producers and the writer thread, used only to wake it up.
+ */
+struct WriterState {
+    LogRing ring;
+    std::mutex lock;
+    std::condition_variable signal;
+    std::atomic<bool> sleeping{ false };
+};
+
+WriterState& writer_state()
+{
+    // Never destroyed: the writer thread uses it for the life of the process.
+    static WriterState* state = new WriterState();
+    return *state;
+}
+
+/**
+ * @brief One fingerprint's open dedup window.
+ */
+struct DedupEntry {
+    std::chrono::steady_clock::time_point opened;
+    std::string message;            // The report as first logged, for the summary line.
+    uint64_t repeats = 0;
+};
+
+/**
+ * @brief The open dedup windows; request threads add to it, the writer closes expired windows.
+ */
+struct DedupTable {
+    std::mutex lock;
+    std::unordered_map<std::uint64_t, DedupEntry> entries;
+};
+
+DedupTable& dedup_table()
+{
+    static DedupTable* table = new DedupTable();
+    return *table;
+}
+
+struct TokenBucket {
+    double tokens;
+    std::chrono::steady_clock::time_point updated;
+};
+
+struct BucketTable {
+    std::mutex lock;
+    std::unordered_map<std::string, TokenBucket> buckets;
+};
+
+BucketTable& bucket_table()
+{
+    static BucketTable* table = new BucketTable();
+    return *table;
+}
+
+native_string g_path;
+std::once_flag g_start_once;
+
+std::atomic<uint64_t> g_written{ 0 };
+std::atomic<uint64_t> g_dropped{ 0 };
+std::atomic<uint64_t> g_duplicates{ 0 };
+std::atomic<uint64_t> g_limited{ 0 };
+std::atomic<uint64_t> g_batches{ 0 };
+std::atomic<uint64_t> g_bytes{ 0 };
+std::atomic<uint64_t> g_rotations{ 0 };
+
+/**
+ * @brief "[YYYY-MM-DD HH:MM:SS] ", reformatted only when the second changes.
+ */
+class TimestampCache {
+public:
+    const std::string& format(std::time_t time)
+    {
+        if (time != time_ || text_.empty()) {
+            std::tm buf;
+            platform_local_time(time, buf);
+            char text[64];
+            size_t length = strftime(text, sizeof(text), "[%Y-%m-%d %X] ", &buf);
+            text_.assign(text, length);
+            time_ = time;
+        }
+        return text_;
+    }
+
+private:
+    std::time_t time_ = 0;
+    std::string text_;
+};
+
+/**
+ * @brief The open log file, with size-based rotation.
+ */
+class LogFile {
+public:
+    void write(const std::string& batch)
+    {
+        if (!out_.is_open()) open();
+        if (size_ >= kMaxFileSize) {
+            rotate();
+            open();
+        }
+        if (!out_.is_open()) return;
+
+        out_.write(batch.data(), (std::streamsize)batch.size());
+        out_.flush();
+        if (!out_) {
+            // A failed write (disk full, file removed) is retried with a fresh handle next time.
+            out_.close();
+            out_.clear();
+            return;
+        }
+        size_ += batch.size();
+        g_batches.fetch_add(1, std::memory_order_relaxed);
+        g_bytes.fetch_add(batch.size(), std::memory_order_relaxed);
+    }
+
+private:
+    void open()
+    {
+        out_.open(std::filesystem::path(g_path), std::ios::binary | std::ios::app);
+        std::error_code error;
+        std::uintmax_t size = std::filesystem::file_size(std::filesystem::path(g_path), error);
+        size_ = error ? 0 : size;
+    }
+
+    // persona_error.log -> .1 -> .2 -> ... ; the oldest is replaced.
+    void rotate()
+    {
+        out_.close();
+        std::error_code error;
+        for (int i = kRotatedFiles - 1; i >= 0; i--) {
+            native_string from = i == 0 ? g_path : g_path + NATIVE_TEXT(".") + utf8_to_native(std::to_string(i));
+            native_string to = g_path + NATIVE_TEXT(".") + utf8_to_native(std::to_string(i + 1));
+            std::filesystem::rename(std::filesystem::path(from), std::filesystem::path(to), error);
+        }
+        size_ = 0;
+        g_rotations.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    std::ofstream out_;
+    std::uint64_t size_ = 0;
+};
+
+/**
+ * @brief Background thread: drains the ring in batches and appends them to the file.
+ */
+void writer_thread(void* arg)
+{
+    WriterState& state = writer_state();
+    LogFile file;
+    TimestampCache timestamps;
+    std::string batch;
+    std::string message;
+    std::time_t time;
+    uint64_t dropped_reported = 0;
+
+    for (;;) {
+        // --- 1. Sleep until there is something to write ---
+        {
+            std::unique_lock<std::mutex> guard(state.lock);
+            state.sleeping.store(true);
+            state.signal.wait_for(guard, kWriterInterval);
+            state.sleeping.store(false);
+        }
+
+        // --- 2. Format everything waiting into one batch ---
+        batch.clear();
+        uint64_t written = 0;
+        while (state.ring.pop(time, message)) {
+            batch += timestamps.format(time);
+            batch += "ERROR: ";
+            batch += message;
+            batch += '\n';
+            written++;
+        }
+        // Dedup windows that have closed: one line for all the repeats they absorbed.
+        {
+            DedupTable& table = dedup_table();
+            std::lock_guard<std::mutex> guard(table.lock);
+            auto now = std::chrono::steady_clock::now();
+            for (auto it = table.entries.begin(); it != table.entries.end();) {
+                if (now - it->second.opened < kDedupWindow) {
+                    ++it;
+                    continue;
+                }
+                if (it->second.repeats > 0) {
+                    batch += timestamps.format(std::time(nullptr));
+                    batch += "ERROR (repeated " + std::to_string(it->second.repeats) + " more times): ";
+                    batch += it->second.message;
+                    batch += '\n';
+                }
+                it = table.entries.erase(it);
+            }
+        }
+        uint64_t dropped = g_dropped.load(std::memory_order_relaxed);
+        if (dropped != dropped_reported) {
+            batch += timestamps.format(std::time(nullptr));
+            batch += "WARNING: " + std::to_string(dropped - dropped_reported) + " messages dropped (log ring full)\n";
+            dropped_reported = dropped;
+        }
+
+        // --- 3. One write and one flush for the whole batch ---
+        if (!batch.empty()) {
+            file.write(batch);
+            g_written.fetch_add(written, std::memory_order_relaxed);
+        }
+    }
+}
+
+} // namespace
+
+void error_log_start(const native_string& path)
+{
+    std::call_once(g_start_once, [&path] {
+        g_path = path;
+        writer_state();
+        platform_start_thread(writer_thread, nullptr);
+    });
+}
+
+std::uint64_t error_log_fingerprint(const std::string& message, const std::string& stack)
+{
+    // 64-bit FNV-1a over message, a separator, and stack.
+    std::uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : message) hash = (hash ^ c) * 1099511628211ULL;
+    hash = (hash ^ 0xFF) * 1099511628211ULL;
+    for (unsigned char c : stack) hash = (hash ^ c) * 1099511628211ULL;
+    return hash;
+}
+
+LogSubmitResult error_log_submit(std::string message, std::uint64_t fingerprint)
+{
+    if (message.size() > kMaxMessageSize) {
+        message.resize(kMaxMessageSize);
+        message += "...(truncated)";
+    }
+    // One message per line: embedded line breaks would split it.
+    for (char& c : message) {
+        if (c == '\n' || c == '\r') c = ' ';
+    }
+
+    // --- 1. A repeat within its window is only counted ---
+    bool window_opened = false;
+    {
+        DedupTable& table = dedup_table();
+        std::lock_guard<std::mutex> guard(table.lock);
+        auto found = table.entries.find(fingerprint);
+        if (found != table.entries.end()) {
+            found->second.repeats++;
+            g_duplicates.fetch_add(1, std::memory_order_relaxed);
+            return LogSubmitResult::duplicate;
+        }
+        if (table.entries.size() < kMaxFingerprints) {
+            DedupEntry& entry = table.entries[fingerprint];
+            entry.opened = std::chrono::steady_clock::now();
+            entry.message = message;
+            window_opened = true;
+        }
+    }
+
+    // --- 2. Hand the first one to the writer ---
+    WriterState& state = writer_state();
+    if (!state.ring.push(std::time(nullptr), std::move(message))) {
+        // Nothing reached the file, so there is nothing for repeats to be counted against.
+        if (window_opened) {
+            DedupTable& table = dedup_table();
+            std::lock_guard<std::mutex> guard(table.lock);
+            table.entries.erase(fingerprint);
+        }
+        g_dropped.fetch_add(1, std::memory_order_relaxed);
+        return LogSubmitResult::dropped;
+    }
+    // Only a sleeping writer needs waking; otherwise it will find the message on its next pass.
+    if (state.sleeping.load()) {
+        std::lock_guard<std::mutex> guard(state.lock);
+        state.signal.notify_one();
+    }
+    return LogSubmitResult::queued;
+}
+
+size_t error_log_admit(const std::string& client, size_t count)
+{
+    BucketTable& table = bucket_table();
+    std::lock_guard<std::mutex> guard(table.lock);
+    auto now = std::chrono::steady_clock::now();
+
+    // Forget clients whose buckets have refilled; they are indistinguishable from new ones.
+    if (table.buckets.size() >= kMaxBuckets) {
+        for (auto it = table.buckets.begin(); it != table.buckets.end();) {
+            double elapsed = std::chrono::duration<double>(now - it->second.updated).count();
+            if (it->second.tokens + elapsed * kBucketRate >= kBucketCapacity) it = table.buckets.erase(it);
+            else ++it;
+        }
+    }
+
+    auto inserted = table.buckets.emplace(client, TokenBucket{ kBucketCapacity, now });
+    TokenBucket& bucket = inserted.first->second;
+    double elapsed = std::chrono::duration<double>(now - bucket.updated).count();
+    bucket.tokens = std::min(kBucketCapacity, bucket.tokens + elapsed * kBucketRate);
+    bucket.updated = now;
+
+    size_t admitted = std::min(count, (size_t)bucket.tokens);
+    bucket.tokens -= (double)admitted;
+    g_limited.fetch_add(count - admitted, std::memory_order_relaxed);
+    return admitted;
+}
+
+ErrorLogStats get_error_log_stats()
+{
+    ErrorLogStats stats;
+    stats.written = g_written.load(std::memory_order_relaxed);
+    stats.dropped = g_dropped.load(std::memory_order_relaxed);
+    stats.duplicates = g_duplicates.load(std::memory_order_relaxed);
+    stats.limited = g_limited.load(std::memory_order_relaxed);
+    stats.batches = g_batches.load(std::memory_order_relaxed);
+    stats.bytes = g_bytes.load(std::memory_order_relaxed);
+    stats.rotations = g_rotations.load(std::memory_order_relaxed);
+    return stats;
+}
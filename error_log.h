@@ -0,0 +1,71 @@
+﻿#pragma once
+
+#include "platform.h"
+#include <cstdint>
+#include <string>
+
+// The most reports /api/log takes from one request body (a JSON array); the rest are ignored.
+const size_t kMaxLogBatchReports = 100;
+
+/**
+ * @brief Starts the background writer for the frontend error log (/api/log).
+ *
+ * Request threads hand their messages to a fixed-size lock-free ring and return at once;
+ * one writer thread drains the ring, formats each line as
+ * "[YYYY-MM-DD HH:MM:SS] ERROR: <message>", and appends the whole batch to the file with
+ * one write and one flush. The file is kept open, and it is rotated (persona_error.log.1,
+ * .2, ...) once it grows past its size limit.
+ *
+ * @param path The log file, e.g. "persona_error.log".
+ */
+void error_log_start(const native_string& path);
+
+/**
+ * @brief Identifies an error report for deduplication: a 64-bit hash of its message and stack.
+ */
+std::uint64_t error_log_fingerprint(const std::string& message, const std::string& stack);
+
+enum class LogSubmitResult {
+    queued,                         // Handed to the writer.
+    duplicate,                      // Same fingerprint as a report in the current window: only counted.
+    dropped,                        // The ring was full.
+};
+
+/**
+ * @brief Queues one report for the log.
+ *
+ * Never blocks and never touches the disk. The first report with a given fingerprint is
+ * queued and opens a dedup window (kDedupWindow); repeats within the window are only
+ * counted, and when it closes the writer adds one "repeated N more times" line for them.
+ *
+ * When the ring is full (the writer cannot keep up with an error storm), the report is
+ * dropped and counted instead; the writer records how many were lost once it catches up.
+ *
+ * @return LogSubmitResult::dropped means the caller should tell the client to back off.
+ */
+LogSubmitResult error_log_submit(std::string message, std::uint64_t fingerprint);
+
+/**
+ * @brief Takes up to 'count' reports from a client's token bucket.
+ *
+ * Each client (by address) may burst a few dozen reports and then sustain a handful per
+ * second; whatever exceeds that is not logged at all.
+ *
+ * @return How many of the 'count' reports may be submitted.
+ */
+size_t error_log_admit(const std::string& client, size_t count);
+
+/**
+ * @brief Counters describing the error log, for diagnostics and metrics.
+ */
+struct ErrorLogStats {
+    uint64_t written;               // Messages written to the file.
+    uint64_t dropped;               // Messages refused because the ring was full.
+    uint64_t duplicates;            // Repeats folded into "repeated N more times" lines.
+    uint64_t limited;               // Reports refused by a client's token bucket.
+    uint64_t batches;               // Writes to the file (each one flushed once).
+    uint64_t bytes;                 // Bytes written.
+    uint64_t rotations;
+};
+
+ErrorLogStats get_error_log_stats();
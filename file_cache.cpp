@@ -0,0 +1,210 @@
+﻿#include "file_cache.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <list>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+namespace {
+
+const size_t kDefaultBudget = 64 * 1024 * 1024;
+
+// Files up to this size are kept on the heap; larger ones get their own pages from the OS.
+const size_t kPageAllocationThreshold = 256 * 1024;
+
+// Never cache a single file larger than this, whatever the budget (big files are streamed with sendfile anyway).
+const size_t kMaxEntrySize = 8 * 1024 * 1024;
+
+struct Entry {
+    native_string path;
+    std::shared_ptr<const CachedFile> file;
+    // The CLOCK "second chance" bit: set on every hit, cleared as the eviction hand passes by.
+    std::atomic<bool> referenced{ true };
+};
+
+// Lookups (the common case) take the lock shared; inserts, evictions and invalidations take it exclusively.
+std::shared_mutex g_lock;
+std::list<Entry> g_entries;
+std::list<Entry>::iterator g_hand = g_entries.end();
+std::unordered_map<native_string, std::list<Entry>::iterator> g_index;
+size_t g_bytes = 0;
+
+std::atomic<uint64_t> g_hits{ 0 };
+std::atomic<uint64_t> g_misses{ 0 };
+std::atomic<uint64_t> g_bypasses{ 0 };
+std::atomic<uint64_t> g_evictions{ 0 };
+
+size_t initial_budget()
+{
+    const char* megabytes = getenv("PERSONA_FILE_CACHE_MB");
+    return megabytes != nullptr ? (size_t)strtoull(megabytes, nullptr, 10) * 1024 * 1024 : kDefaultBudget;
+}
+
+std::atomic<size_t> g_budget{ initial_budget() };
+
+bool same_identity(const platform_file_info& a, const platform_file_info& b)
+{
+    return a.size == b.size && a.mtime_ns == b.mtime_ns && a.file_id == b.file_id && a.device == b.device;
+}
+
+// Removes one entry. The caller holds g_lock exclusively.
+void erase_entry(std::list<Entry>::iterator it)
+{
+    g_bytes -= it->file->size();
+    g_index.erase(it->path);
+    if (g_hand == it) ++g_hand;
+    g_entries.erase(it);
+}
+
+// Runs the CLOCK hand until 'incoming' more bytes fit in the budget. The caller holds g_lock exclusively.
+void evict_until_fits(size_t incoming, size_t budget)
+{
+    while (!g_entries.empty() && g_bytes + incoming > budget) {
+        if (g_hand == g_entries.end()) g_hand = g_entries.begin();
+        if (g_hand->referenced.exchange(false, std::memory_order_relaxed)) {
+            // Recently used: give it a second chance and move on.
+            ++g_hand;
+            continue;
+        }
+        erase_entry(g_hand);
+        g_evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+} // namespace
+
+std::shared_ptr<const CachedFile> CachedFile::load(const native_string& path)
+{
+    platform_file file = platform_open_read(path);
+    if (file == PLATFORM_INVALID_FILE) {
+        return nullptr;
+    }
+
+    std::shared_ptr<CachedFile> cached(new CachedFile());
+    bool ok = platform_get_file_info(file, cached->info_) && !cached->info_.is_directory;
+
+    // --- 1. Allocate storage for the whole file ---
+    if (ok && cached->info_.size > 0) {
+        cached->size_ = (size_t)cached->info_.size;
+        if (cached->size_ >= kPageAllocationThreshold) {
+            cached->data_ = (char*)platform_alloc_pages(cached->size_);
+            cached->page_allocated_ = true;
+        }
+        else {
+            cached->data_ = (char*)malloc(cached->size_);
+        }
+        ok = cached->data_ != nullptr;
+    }
+
+    // --- 2. Read it ---
+    for (size_t offset = 0; ok && offset < cached->size_;) {
+        long long bytes_read = platform_read_at(file, cached->data_ + offset, cached->size_ - offset, offset);
+        if (bytes_read <= 0) {
+            ok = false;
+            break;
+        }
+        offset += (size_t)bytes_read;
+    }
+
+    // --- 3. Make sure nobody modified the file while we were reading it ---
+    platform_file_info after;
+    ok = ok && platform_get_file_info(file, after) && same_identity(cached->info_, after);
+
+    platform_close_file(file);
+    return ok ? cached : nullptr;
+}
+
+CachedFile::~CachedFile()
+{
+    if (data_ == nullptr) return;
+    if (page_allocated_) {
+        platform_free_pages(data_, size_);
+    }
+    else {
+        free(data_);
+    }
+}
+
+std::shared_ptr<const CachedFile> file_cache_get(const native_string& path)
+{
+    // --- 1. One stat call gives us the file's current identity ---
+    platform_file_info info;
+    if (!platform_stat_path(path, info) || info.is_directory) {
+        return nullptr;
+    }
+
+    size_t budget = g_budget.load(std::memory_order_relaxed);
+    if (budget == 0 || info.size > (std::min)(kMaxEntrySize, budget / 8)) {
+        g_bypasses.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    // --- 2. Hit: the cached content is still what is on disk ---
+    {
+        std::shared_lock<std::shared_mutex> guard(g_lock);
+        auto found = g_index.find(path);
+        if (found != g_index.end() && same_identity(found->second->file->info(), info)) {
+            found->second->referenced.store(true, std::memory_order_relaxed);
+            g_hits.fetch_add(1, std::memory_order_relaxed);
+            return found->second->file;
+        }
+    }
+
+    // --- 3. Miss: read the file outside the lock, then publish it ---
+    g_misses.fetch_add(1, std::memory_order_relaxed);
+    std::shared_ptr<const CachedFile> file = CachedFile::load(path);
+    if (!file) {
+        return nullptr;
+    }
+
+    std::unique_lock<std::shared_mutex> guard(g_lock);
+    auto found = g_index.find(path);
+    if (found != g_index.end()) {
+        // Stale (or loaded concurrently by another request); the newest read wins.
+        erase_entry(found->second);
+    }
+    evict_until_fits(file->size(), budget);
+    if (g_bytes + file->size() <= budget) {
+        g_entries.emplace_back();
+        auto it = std::prev(g_entries.end());
+        it->path = path;
+        it->file = file;
+        g_index.emplace(path, it);
+        g_bytes += file->size();
+    }
+    return file;
+}
+
+void file_cache_invalidate(const native_string& path)
+{
+    std::unique_lock<std::shared_mutex> guard(g_lock);
+    auto found = g_index.find(path);
+    if (found != g_index.end()) {
+        erase_entry(found->second);
+    }
+}
+
+void file_cache_set_budget(size_t bytes)
+{
+    g_budget.store(bytes, std::memory_order_relaxed);
+
+    std::unique_lock<std::shared_mutex> guard(g_lock);
+    evict_until_fits(0, bytes);
+}
+
+FileCacheStats get_file_cache_stats()
+{
+    FileCacheStats stats;
+    stats.hits = g_hits.load(std::memory_order_relaxed);
+    stats.misses = g_misses.load(std::memory_order_relaxed);
+    stats.bypasses = g_bypasses.load(std::memory_order_relaxed);
+    stats.evictions = g_evictions.load(std::memory_order_relaxed);
+    stats.budget = g_budget.load(std::memory_order_relaxed);
+
+    std::shared_lock<std::shared_mutex> guard(g_lock);
+    stats.entries = g_entries.size();
+    stats.bytes = g_bytes;
+    return stats;
+}
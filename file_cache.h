@@ -0,0 +1,86 @@
+﻿#pragma once
+
+#include "platform.h"
+#include <cstdint>
+#include <memory>
+
+/**
+ * @brief The immutable, in-memory content of a file, shared by the cache and every response serving it.
+ *
+ * Small files live on the heap; larger ones get their own pages straight from the OS
+ * (platform_alloc_pages) so that evicting them hands the memory back immediately.
+ * The content never changes after loading: when the file on disk changes, a new
+ * CachedFile is loaded and the old one is freed once the last response using it is done.
+ */
+class CachedFile {
+public:
+    /**
+     * @brief Reads a whole file into a new CachedFile.
+     *
+     * @return The content, or nullptr if the file cannot be read or changed while being read.
+     */
+    static std::shared_ptr<const CachedFile> load(const native_string& path);
+
+    CachedFile(const CachedFile&) = delete;
+    CachedFile& operator=(const CachedFile&) = delete;
+    ~CachedFile();
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+    // The identity (size, mtime, file id) the content was read at.
+    const platform_file_info& info() const { return info_; }
+
+private:
+    CachedFile() = default;
+
+    char* data_ = nullptr;
+    size_t size_ = 0;
+    bool page_allocated_ = false;
+    platform_file_info info_ = {};
+};
+
+/**
+ * @brief Returns the content of a small/medium file from the in-process file cache.
+ *
+ * The cache is keyed by the canonical path (as produced by is_safe_path()). Every
+ * lookup costs one stat call, and an entry is only used when the file's current
+ * size, mtime and file id still match the ones it was loaded with, so edits made
+ * through any route (the API, the mounted drive, another program) are picked up
+ * on the next request. On a miss the file is read once and inserted, evicting
+ * cold entries (CLOCK) until the cache fits its memory budget.
+ *
+ * @param path The canonical full path of the file.
+ * @return The shared content, or nullptr if the file does not exist, is a directory,
+ * is too large to cache, or changed while it was being read. The caller should then
+ * fall back to serving it from disk.
+ */
+std::shared_ptr<const CachedFile> file_cache_get(const native_string& path);
+
+/**
+ * @brief Drops the entry for 'path', if any. Called after the server itself writes or deletes a file.
+ */
+void file_cache_invalidate(const native_string& path);
+
+/**
+ * @brief Sets the cache's memory budget in bytes, evicting entries right away if needed.
+ *
+ * The default is 64 MiB, or the PERSONA_FILE_CACHE_MB environment variable if set.
+ * A budget of 0 disables the cache. Files larger than an eighth of the budget
+ * (and never above 8 MiB) are not cached.
+ */
+void file_cache_set_budget(size_t bytes);
+
+/**
+ * @brief Counters describing the file cache, for diagnostics and metrics.
+ */
+struct FileCacheStats {
+    uint64_t hits;
+    uint64_t misses;        // Lookups that had to read the file from disk.
+    uint64_t bypasses;      // Lookups for files too large to cache.
+    uint64_t evictions;
+    uint64_t entries;
+    uint64_t bytes;         // Bytes of file content currently held by the cache.
+    uint64_t budget;
+};
+
+FileCacheStats get_file_cache_stats();
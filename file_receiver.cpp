@@ -0,0 +1,145 @@
+﻿#include "file_receiver.h"
+#include <cstring>
+
+namespace {
+
+// Uploads smaller than this are not worth a preallocation call.
+const std::uint64_t kMinPreallocation = 1024 * 1024;
+
+const char kUploadSuffix[] = ".persona-upload";
+
+size_t name_offset(const native_string& path)
+{
+#ifdef _WIN32
+    size_t separator = path.find_last_of(L"\\/");
+#else
+    size_t separator = path.rfind('/');
+#endif
+    return separator == native_string::npos ? 0 : separator + 1;
+}
+
+} // namespace
+
+native_string upload_temp_path(const native_string& target, std::uint64_t attempt)
+{
+    size_t name = name_offset(target);
+    return target.substr(0, name) + utf8_to_native(".") + target.substr(name) +
+        utf8_to_native("." + std::to_string(attempt) + kUploadSuffix);
+}
+
+bool is_upload_temp_name(const native_string& path)
+{
+    const size_t suffix_length = sizeof(kUploadSuffix) - 1;
+    size_t name = name_offset(path);
+    if (path.size() < name + 1 + suffix_length || path[name] != '.') return false;
+    for (size_t i = 0; i < suffix_length; i++) {
+        if (path[path.size() - suffix_length + i] != (native_string::value_type)kUploadSuffix[i]) return false;
+    }
+    return true;
+}
+
+FileReceiver::FileReceiver(platform_file file, std::uint64_t expected_size) : file_(file)
+{
+    buffers_[0] = acquire_buffer(kMaxPooledBufferSize);
+    // Out of memory: every write() and finish() fails (the writer thread is not started yet).
+    failed_ = buffers_[0].size() == 0;
+    if (expected_size >= kMinPreallocation) {
+        // Only a hint: a file system without preallocation simply grows the file as it is written.
+        platform_preallocate(file_, expected_size);
+    }
+}
+
+FileReceiver::~FileReceiver()
+{
+    if (writer_.joinable()) {
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            stop_ = true;
+        }
+        changed_.notify_all();
+        writer_.join();
+    }
+}
+
+bool FileReceiver::write(const char* data, size_t length)
+{
+    // Without a buffer to copy into, the loop below could never advance.
+    if (buffers_[filling_].size() == 0) return false;
+    while (length > 0) {
+        size_t room = buffers_[filling_].size() - filled_;
+        size_t chunk = length < room ? length : room;
+        memcpy(buffers_[filling_].data() + filled_, data, chunk);
+        filled_ += chunk;
+        bytes_ += chunk;
+        data += chunk;
+        length -= chunk;
+        if (filled_ == buffers_[filling_].size()) {
+            hand_off();
+            std::lock_guard<std::mutex> guard(lock_);
+            if (failed_) return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Queues the full buffer for the writer thread and switches write() to the other one.
+ */
+void FileReceiver::hand_off()
+{
+    if (!writer_.joinable()) {
+        buffers_[1] = acquire_buffer(kMaxPooledBufferSize);
+        if (buffers_[1].size() == 0) {
+            std::lock_guard<std::mutex> guard(lock_);
+            failed_ = true;
+            return;
+        }
+        writer_ = std::thread(&FileReceiver::writer_loop, this);
+    }
+
+    // --- 1. Wait until the other buffer has been written ---
+    std::unique_lock<std::mutex> guard(lock_);
+    changed_.wait(guard, [this] { return pending_ == -1; });
+
+    // --- 2. Queue this one and fill the other ---
+    pending_ = filling_;
+    pending_length_ = filled_;
+    guard.unlock();
+    changed_.notify_all();
+    filling_ ^= 1;
+    filled_ = 0;
+}
+
+void FileReceiver::writer_loop()
+{
+    std::unique_lock<std::mutex> guard(lock_);
+    for (;;) {
+        changed_.wait(guard, [this] { return pending_ != -1 || stop_; });
+        if (pending_ == -1) break;
+
+        // The buffer is not touched by write() until pending_ is cleared, so write it unlocked.
+        int index = pending_;
+        size_t length = pending_length_;
+        guard.unlock();
+        bool written = failed_ || platform_write_all(file_, buffers_[index].data(), length);
+        guard.lock();
+        if (!written) failed_ = true;
+        pending_ = -1;
+        changed_.notify_all();
+    }
+}
+
+bool FileReceiver::finish()
+{
+    // Wait for the last full buffer, then write the partial one from this thread.
+    {
+        std::unique_lock<std::mutex> guard(lock_);
+        changed_.wait(guard, [this] { return pending_ == -1; });
+        if (failed_) return false;
+    }
+    if (filled_ > 0 && !platform_write_all(file_, buffers_[filling_].data(), filled_)) {
+        return false;
+    }
+    filled_ = 0;
+    return true;
+}
@@ -0,0 +1,83 @@
+﻿#pragma once
+
+#include "platform.h"
+#include "buffer_pool.h"
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+/**
+ * @brief Where an upload to 'target' is received before it replaces it: a hidden name
+ * beside it, ".<name>.<attempt>.persona-upload".
+ *
+ * Listings, the tree walk and the indexes skip such names (is_upload_temp_name()), so a
+ * half-received file never shows up.
+ */
+native_string upload_temp_path(const native_string& target, std::uint64_t attempt);
+
+/**
+ * @brief Whether the last segment of a path is an upload still being received.
+ */
+bool is_upload_temp_name(const native_string& path);
+
+/**
+ * @brief Writes a request body to a file as it arrives, with constant memory.
+ *
+ * httplib hands a ContentReader's receiver one socket read at a time (16 KiB or less).
+ * Those chunks are gathered into one of two pooled buffers; when it is full, a background
+ * thread writes it to the file while the next chunk fills the other buffer, so the
+ * network and the disk work at the same time. At most two buffers (2 MiB) are held,
+ * whatever the size of the upload.
+ *
+ * Bodies smaller than one buffer never start the thread: finish() writes them directly.
+ */
+class FileReceiver {
+public:
+    /**
+     * @param file The open file to write to (see platform_open_write()). It stays owned by the caller.
+     * @param expected_size The announced body size, or 0 if unknown; larger bodies are
+     * preallocated up front (platform_preallocate()) so the file system can lay them out
+     * in one piece.
+     */
+    FileReceiver(platform_file file, std::uint64_t expected_size);
+    FileReceiver(const FileReceiver&) = delete;
+    FileReceiver& operator=(const FileReceiver&) = delete;
+    ~FileReceiver();
+
+    /**
+     * @brief Appends the next piece of the body. Usable directly as an httplib::ContentReceiver.
+     *
+     * @return false once a write has failed or a buffer could not be allocated, which
+     * makes httplib stop reading the body.
+     */
+    bool write(const char* data, size_t length);
+
+    /**
+     * @brief Writes what is left and waits for the background writes.
+     *
+     * @return true if every byte passed to write() is in the file.
+     */
+    bool finish();
+
+    std::uint64_t bytes() const { return bytes_; }
+
+private:
+    void hand_off();
+    void writer_loop();
+
+    platform_file file_;
+    PooledBuffer buffers_[2];
+    int filling_ = 0;               // The buffer write() copies into.
+    size_t filled_ = 0;             // Bytes in buffers_[filling_].
+    std::uint64_t bytes_ = 0;
+
+    // The handoff to the writer thread: one buffer at most is being written at a time.
+    std::mutex lock_;
+    std::condition_variable changed_;
+    int pending_ = -1;              // The buffer waiting for or being written, or -1.
+    size_t pending_length_ = 0;
+    bool stop_ = false;
+    bool failed_ = false;
+    std::thread writer_;
+};
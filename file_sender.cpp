@@ -0,0 +1,177 @@
+﻿#include "file_sender.h"
+#include "buffer_pool.h"
+#include <algorithm>
+#include <atomic>
+
+namespace {
+
+// Upper bound for a single sendfile/TransmitFile call. Keeping calls bounded lets httplib
+// check for server shutdown between chunks instead of blocking on a multi-GB transfer.
+const size_t kSendFileChunk = 4 * 1024 * 1024;
+
+std::atomic<bool> g_zero_copy_enabled{ true };
+
+/**
+ * @brief A pass-through Stream that can account for bytes the kernel already sent on its behalf.
+ *
+ * After send_file_range() has pushed 'n' bytes with sendfile(), it calls DataSink::write()
+ * with a special marker pointer and length 'n'. httplib forwards that to this stream's
+ * write(), which recognizes the marker and reports the bytes as written without sending
+ * anything. That keeps httplib's own offset bookkeeping (and range handling) correct.
+ */
+class ZeroCopyStream final : public httplib::Stream {
+public:
+    explicit ZeroCopyStream(httplib::Stream& inner) : inner_(inner) {}
+
+    bool is_readable() const override { return inner_.is_readable(); }
+    bool wait_readable() const override { return inner_.wait_readable(); }
+    bool wait_writable() const override { return inner_.wait_writable(); }
+
+    ssize_t read(char* ptr, size_t size) override { return inner_.read(ptr, size); }
+
+    using httplib::Stream::write;
+    ssize_t write(const char* ptr, size_t size) override {
+        if (ptr == sent_marker() && size <= already_sent_) {
+            already_sent_ -= size;
+            return (ssize_t)size;
+        }
+        return inner_.write(ptr, size);
+    }
+
+    void get_remote_ip_and_port(std::string& ip, int& port) const override { inner_.get_remote_ip_and_port(ip, port); }
+    void get_local_ip_and_port(std::string& ip, int& port) const override { inner_.get_local_ip_and_port(ip, port); }
+    socket_t socket() const override { return inner_.socket(); }
+    time_t duration() const override { return inner_.duration(); }
+
+    // Records that 'size' bytes were written to the socket behind httplib's back.
+    void add_already_sent(size_t size) { already_sent_ += size; }
+
+    static const char* sent_marker() {
+        static const char marker = 0;
+        return &marker;
+    }
+
+private:
+    httplib::Stream& inner_;
+    size_t already_sent_ = 0;
+};
+
+// The stream of the connection currently being served by this thread, if any.
+// httplib runs a connection's handler and its content provider on the same worker thread.
+thread_local ZeroCopyStream* t_current_stream = nullptr;
+
+} // namespace
+
+bool PersonaServer::process_and_close_socket(socket_t sock)
+{
+    // This mirrors httplib::Server::process_and_close_socket, except that every request
+    // is processed through a ZeroCopyStream so send_file_range() can reach the socket.
+    std::string remote_addr;
+    int remote_port = 0;
+    httplib::detail::get_remote_ip_and_port(sock, remote_addr, remote_port);
+
+    std::string local_addr;
+    int local_port = 0;
+    httplib::detail::get_local_ip_and_port(sock, local_addr, local_port);
+
+    auto ret = httplib::detail::process_server_socket(
+        svr_sock_, sock, keep_alive_max_count_, keep_alive_timeout_sec_,
+        read_timeout_sec_, read_timeout_usec_, write_timeout_sec_,
+        write_timeout_usec_,
+        [&](httplib::Stream& strm, bool close_connection, bool& connection_closed) {
+            ZeroCopyStream zero_copy_stream(strm);
+            t_current_stream = &zero_copy_stream;
+            bool result = process_request(zero_copy_stream, remote_addr, remote_port, local_addr,
+                local_port, close_connection, connection_closed, nullptr);
+            t_current_stream = nullptr;
+            return result;
+        });
+
+    httplib::detail::shutdown_socket(sock);
+    httplib::detail::close_socket(sock);
+    return ret;
+}
+
+bool send_file_range(platform_file file, size_t offset, size_t length, httplib::DataSink& sink)
+{
+    // --- 1. Zero-copy path: let the kernel move the bytes from the page cache to the socket ---
+    ZeroCopyStream* stream = t_current_stream;
+    if (stream != nullptr && g_zero_copy_enabled.load(std::memory_order_relaxed)) {
+        long long sent = platform_send_file((std::uintptr_t)stream->socket(), file, offset,
+            (std::min)(length, kSendFileChunk));
+        if (sent > 0) {
+            stream->add_already_sent((size_t)sent);
+            return sink.write(ZeroCopyStream::sent_marker(), (size_t)sent);
+        }
+        if (sent == 0) {
+            // The file is shorter than when the response started; we cannot deliver the promised length.
+            return false;
+        }
+        // sent < 0: this file/socket pair cannot be sent by the kernel; copy it ourselves below.
+    }
+
+    // --- 2. Fallback: positioned read into a pooled buffer ---
+    // The buffer's size class follows the remaining length (64 KiB for small files, up to 1 MiB
+    // for large ranges) and goes straight back to this thread's pool cache after the write.
+    PooledBuffer buffer = acquire_buffer(length);
+    if (!buffer) {
+        return false;
+    }
+    long long bytes_read = platform_read_at(file, buffer.data(), (std::min)(length, buffer.size()), offset);
+    if (bytes_read <= 0) {
+        return false;
+    }
+    return sink.write(buffer.data(), (size_t)bytes_read);
+}
+
+void set_file_content(httplib::Response& res, platform_file file, std::uint64_t file_size, const std::string& content_type)
+{
+    // An empty file has no body to stream (httplib treats a zero length provider as "length unknown").
+    if (file_size == 0) {
+        platform_close_file(file);
+        res.set_content("", content_type);
+        return;
+    }
+
+    // httplib applies any Range header itself and asks the provider for exactly those bytes.
+    res.set_content_provider(
+        (size_t)file_size,
+        content_type,
+        [file](size_t offset, size_t length, httplib::DataSink& sink) {
+            return send_file_range(file, offset, length, sink);
+        },
+        // Called after the entire file has been sent (or the client went away).
+        [file](bool success) {
+            platform_close_file(file);
+        }
+    );
+}
+
+void set_shared_content(httplib::Response& res, std::shared_ptr<const void> owner, const char* data, size_t size, const std::string& content_type)
+{
+    // An empty body has nothing to provide (httplib treats a zero length provider as "length unknown").
+    if (size == 0) {
+        res.set_content("", content_type);
+        return;
+    }
+
+    res.set_content_provider(
+        size,
+        content_type,
+        [owner, data](size_t offset, size_t length, httplib::DataSink& sink) {
+            return sink.write(data + offset, length);
+        }
+    );
+}
+
+void set_cached_file_content(httplib::Response& res, std::shared_ptr<const CachedFile> file, const std::string& content_type)
+{
+    const char* data = file->data();
+    size_t size = file->size();
+    set_shared_content(res, std::move(file), data, size, content_type);
+}
+
+void set_zero_copy_enabled(bool enabled)
+{
+    g_zero_copy_enabled.store(enabled, std::memory_order_relaxed);
+}
@@ -0,0 +1,77 @@
+﻿#pragma once
+
+#include "httplib.h"
+#include "platform.h"
+#include "file_cache.h"
+
+/**
+ * @brief The HTTP server used by start_web_server(): an httplib::Server that can send file bodies with zero copies.
+ *
+ * httplib only lets a content provider hand it bytes through DataSink::write(), which
+ * means every chunk of a video has to be read into a user-space buffer first. This
+ * subclass wraps each connection's stream so that a content provider running on that
+ * connection can instead ask the kernel to move the file data straight to the socket
+ * (sendfile() on Linux, TransmitFile() on Windows), and then tell httplib afterwards
+ * how many bytes went out. Everything else behaves exactly like httplib::Server.
+ */
+class PersonaServer : public httplib::Server {
+private:
+    bool process_and_close_socket(socket_t sock) override;
+};
+
+/**
+ * @brief Sends the next part of a file range from inside a content provider.
+ *
+ * Call this from an httplib content provider with the (offset, length) it was given.
+ * When the connection belongs to a PersonaServer, the data is sent with sendfile /
+ * TransmitFile. Otherwise (or if the kernel refuses, e.g. for some special files)
+ * it falls back to a positioned read into a buffer borrowed from the buffer pool.
+ * httplib keeps calling the provider until the whole range has been sent.
+ *
+ * @param file The open file to read from (see platform_open_read()).
+ * @param offset The file offset httplib wants next.
+ * @param length The number of bytes left in the requested range.
+ * @param sink The DataSink passed to the content provider.
+ * @return true to continue, false to abort the response.
+ */
+bool send_file_range(platform_file file, size_t offset, size_t length, httplib::DataSink& sink);
+
+/**
+ * @brief Makes an open file the body of a response, served through send_file_range().
+ *
+ * Nothing is read up front: the file is sent in chunks as httplib writes the response,
+ * so serving a file never allocates a buffer the size of the file. Takes ownership of
+ * 'file' and closes it once the response is done.
+ *
+ * @param res The response to fill in.
+ * @param file The open file (see platform_open_read()).
+ * @param file_size The file's size, which becomes the Content-Length.
+ * @param content_type The Content-Type header value.
+ */
+void set_file_content(httplib::Response& res, platform_file file, std::uint64_t file_size, const std::string& content_type);
+
+/**
+ * @brief Makes bytes owned by a shared object the body of a response, without copying them.
+ *
+ * The response holds a reference to 'owner' until it has been sent, so 'data' stays valid
+ * even if whoever published it (a cache, a table) drops or replaces it in the meantime.
+ *
+ * @param owner The object that owns 'data'.
+ * @param data The body bytes, inside 'owner'.
+ * @param size The body size, which becomes the Content-Length.
+ */
+void set_shared_content(httplib::Response& res, std::shared_ptr<const void> owner, const char* data, size_t size, const std::string& content_type);
+
+/**
+ * @brief Makes a cached file the body of a response.
+ *
+ * The response keeps a reference to the shared content and writes straight from it,
+ * so the bytes are neither copied into the response nor freed while still being sent,
+ * even if the cache evicts or replaces the entry in the meantime.
+ */
+void set_cached_file_content(httplib::Response& res, std::shared_ptr<const CachedFile> file, const std::string& content_type);
+
+/**
+ * @brief Turns the zero-copy path on or off (on by default). Used by benchmarks to compare both paths.
+ */
+void set_zero_copy_enabled(bool enabled);
@@ -0,0 +1,424 @@
+﻿#include "filename_index.h"
+#include "root_watch.h"
+#include "search_index.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <unordered_map>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FILENAME_INDEX_SSE2 1
+#endif
+
+namespace {
+
+// Removed paths stay in the posting arrays until they are this large a share of the index.
+const double kCompactRatio = 0.25;
+const size_t kCompactMinimum = 4096;
+
+// Below this ratio of list sizes, intersecting by binary search beats a linear merge.
+const size_t kGallopRatio = 32;
+
+struct PathEntry {
+    std::string path;               // UTF-8, relative to the root, '/'-separated.
+    std::string folded;             // search_fold_case(path), what queries are matched against.
+    std::uint32_t name_offset;      // Where the last component starts in 'folded'.
+    bool is_dir;
+    bool alive;
+};
+
+/**
+ * @brief The whole index. Guarded by g_index_lock; only the indexer thread writes.
+ *
+ * Ids are positions in 'entries' and only ever grow, so appending an id keeps every
+ * posting array sorted. A removed path is marked dead and left in its arrays until
+ * compact() rebuilds them.
+ */
+struct FilenameIndex {
+    std::vector<PathEntry> entries;
+    std::unordered_map<std::uint32_t, std::vector<std::uint32_t>> postings;     // Trigram -> ids.
+    std::map<std::string, std::uint32_t> ids;                                   // Live path -> id.
+    size_t dead = 0;
+    std::uint64_t posting_count = 0;
+};
+
+std::shared_mutex g_index_lock;
+
+FilenameIndex& filename_index()
+{
+    // Never destroyed: the indexer thread uses it for the life of the process.
+    static FilenameIndex* index = new FilenameIndex();
+    return *index;
+}
+
+RootChangeQueue& indexer_queue()
+{
+    static RootChangeQueue* queue = new RootChangeQueue();
+    return *queue;
+}
+
+std::once_flag g_start_once;
+std::atomic<bool> g_ready{ false };
+std::atomic<std::uint64_t> g_queries{ 0 };
+std::atomic<std::uint64_t> g_updates{ 0 };
+std::atomic<std::uint64_t> g_compactions{ 0 };
+
+// ============================================================================
+// --- Trigrams ---
+// ============================================================================
+
+std::uint32_t trigram_at(const std::string& text, size_t pos)
+{
+    return ((std::uint32_t)(unsigned char)text[pos] << 16) | ((std::uint32_t)(unsigned char)text[pos + 1] << 8) |
+        (std::uint32_t)(unsigned char)text[pos + 2];
+}
+
+// The distinct trigrams of a string, sorted.
+void collect_trigrams(const std::string& text, std::vector<std::uint32_t>& out)
+{
+    out.clear();
+    for (size_t pos = 0; pos + 3 <= text.size(); pos++) out.push_back(trigram_at(text, pos));
+    std::sort(out.begin(), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+}
+
+/**
+ * @brief Intersects two sorted id arrays into 'out' (room for the smaller size, not aliasing
+ * either input); returns the number of ids written.
+ *
+ * Very unequal sizes use a galloping search of the longer array. Otherwise the arrays are
+ * merged four ids at a time with SSE2: each block of 'a' is compared against all four
+ * rotations of a block of 'b', and the block with the smaller maximum advances.
+ */
+size_t intersect(const std::uint32_t* a, size_t a_size, const std::uint32_t* b, size_t b_size, std::uint32_t* out)
+{
+    if (a_size > b_size) {
+        std::swap(a, b);
+        std::swap(a_size, b_size);
+    }
+    size_t count = 0;
+    size_t i = 0;
+    size_t j = 0;
+
+    if (a_size * kGallopRatio < b_size) {
+        for (; i < a_size && j < b_size; i++) {
+            // Gallop from the last position, then binary search the bracketed range.
+            size_t step = 1;
+            size_t high = j;
+            while (high < b_size && b[high] < a[i]) {
+                j = high + 1;
+                high += step;
+                step *= 2;
+            }
+            j = std::lower_bound(b + j, b + std::min(high + 1, b_size), a[i]) - b;
+            if (j < b_size && b[j] == a[i]) out[count++] = a[i];
+        }
+        return count;
+    }
+
+#ifdef FILENAME_INDEX_SSE2
+    while (i + 4 <= a_size && j + 4 <= b_size) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + j));
+        __m128i match = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi32(va, vb), _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1)))),
+            _mm_or_si128(_mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2))),
+                _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(2, 1, 0, 3)))));
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(match));
+        for (int lane = 0; lane < 4; lane++) {
+            if (mask & (1 << lane)) out[count++] = a[i + lane];
+        }
+        std::uint32_t a_max = a[i + 3];
+        std::uint32_t b_max = b[j + 3];
+        if (a_max <= b_max) i += 4;
+        if (b_max <= a_max) j += 4;
+    }
+#endif
+    while (i < a_size && j < b_size) {
+        if (a[i] < b[j]) i++;
+        else if (b[j] < a[i]) j++;
+        else {
+            out[count++] = a[i];
+            i++;
+            j++;
+        }
+    }
+    return count;
+}
+
+// ============================================================================
+// --- Updates (indexer thread) ---
+// ============================================================================
+
+struct NewEntry {
+    std::string path;
+    bool is_dir;
+};
+
+void add_entries(FilenameIndex& index, const std::vector<NewEntry>& added)
+{
+    std::vector<std::uint32_t> trigrams;
+    for (const NewEntry& entry : added) {
+        if (index.ids.count(entry.path)) continue;
+        std::uint32_t id = (std::uint32_t)index.entries.size();
+        PathEntry path_entry{ entry.path, search_fold_case(entry.path), 0, entry.is_dir, true };
+        // An offset into 'folded', which score_match() searches: folding can shorten a name.
+        size_t slash = path_entry.folded.rfind('/');
+        path_entry.name_offset = (std::uint32_t)(slash == std::string::npos ? 0 : slash + 1);
+        collect_trigrams(path_entry.folded, trigrams);
+        for (std::uint32_t trigram : trigrams) index.postings[trigram].push_back(id);
+        index.posting_count += trigrams.size();
+        index.ids.emplace(entry.path, id);
+        index.entries.push_back(std::move(path_entry));
+    }
+}
+
+void remove_entry(FilenameIndex& index, std::map<std::string, std::uint32_t>::iterator found)
+{
+    index.entries[found->second].alive = false;
+    index.dead++;
+    index.ids.erase(found);
+}
+
+/**
+ * @brief Rebuilds the entries and posting arrays without the removed paths.
+ */
+void compact(FilenameIndex& index)
+{
+    std::vector<std::uint32_t> new_ids(index.entries.size(), UINT32_MAX);
+    std::vector<PathEntry> entries;
+    entries.reserve(index.entries.size() - index.dead);
+    for (std::uint32_t id = 0; id < index.entries.size(); id++) {
+        if (!index.entries[id].alive) continue;
+        new_ids[id] = (std::uint32_t)entries.size();
+        entries.push_back(std::move(index.entries[id]));
+    }
+    index.posting_count = 0;
+    for (auto it = index.postings.begin(); it != index.postings.end();) {
+        std::vector<std::uint32_t>& ids = it->second;
+        size_t kept = 0;
+        for (std::uint32_t id : ids) {
+            if (new_ids[id] != UINT32_MAX) ids[kept++] = new_ids[id];
+        }
+        ids.resize(kept);
+        if (kept == 0) {
+            it = index.postings.erase(it);
+            continue;
+        }
+        ids.shrink_to_fit();
+        index.posting_count += kept;
+        ++it;
+    }
+    for (auto& id : index.ids) id.second = new_ids[id.second];
+    index.entries.swap(entries);
+    index.dead = 0;
+    g_compactions.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Collects everything below a directory (not following links).
+void walk(const native_string& full_path, const std::string& relative_path, std::vector<NewEntry>& out)
+{
+    walk_root_tree(full_path, relative_path, [&out](const native_string&, const std::string& child_relative, const platform_dir_entry& entry) {
+        out.push_back(NewEntry{ child_relative, entry.info.is_directory });
+    });
+}
+
+/**
+ * @brief Walks the whole root into a new index and switches to it.
+ */
+void rebuild()
+{
+    std::vector<NewEntry> added;
+    walk(platform_root_path(), std::string(), added);
+    FilenameIndex fresh;
+    add_entries(fresh, added);
+
+    FilenameIndex& index = filename_index();
+    std::unique_lock<std::shared_mutex> guard(g_index_lock);
+    std::swap(index, fresh);
+}
+
+/**
+ * @brief Handles one changed path: a path that is gone is removed with everything below
+ * it, a new one is added (with its contents, for a directory moved in).
+ */
+void apply_change(const native_string& full_path)
+{
+    std::string relative_path;
+    if (!root_relative_path(full_path, relative_path) || relative_path.empty()) return;
+
+    FilenameIndex& index = filename_index();
+    platform_file_info info;
+    bool exists = platform_stat_path(full_path, info);
+    auto found = index.ids.find(relative_path);     // Only this thread writes: no lock needed to read.
+    bool indexed = found != index.ids.end();
+    if (exists && indexed && index.entries[found->second].is_dir == info.is_directory) return;
+
+    std::vector<NewEntry> added;
+    if (exists) {
+        added.push_back(NewEntry{ relative_path, info.is_directory });
+        if (info.is_directory) walk(full_path, relative_path, added);
+    }
+
+    std::unique_lock<std::shared_mutex> guard(g_index_lock);
+    if (indexed) {
+        std::string prefix = relative_path + "/";
+        for (auto it = index.ids.lower_bound(prefix); it != index.ids.end() && it->first.compare(0, prefix.size(), prefix) == 0;) {
+            remove_entry(index, it++);
+        }
+        remove_entry(index, index.ids.find(relative_path));
+    }
+    add_entries(index, added);
+    if (index.dead > kCompactMinimum && index.dead > index.entries.size() * kCompactRatio) compact(index);
+    g_updates.fetch_add(1, std::memory_order_relaxed);
+}
+
+void on_root_change(const native_string& path, void* ctx)
+{
+    indexer_queue().push(path);
+}
+
+void indexer_thread(void* arg)
+{
+    // --- 1. The initial walk; changes during it are queued and applied after ---
+    root_watch_subscribe(on_root_change, nullptr);
+    rebuild();
+    g_ready = true;
+
+    // --- 2. Follow the changes ---
+    RootChangeQueue& queue = indexer_queue();
+    std::set<native_string> pending;
+    bool rescan;
+    for (;;) {
+        queue.take(pending, rescan);
+        if (rescan) {
+            rebuild();
+            continue;
+        }
+        for (const native_string& path : pending) {
+            apply_change(path);
+        }
+    }
+}
+
+// ============================================================================
+// --- Queries ---
+// ============================================================================
+
+// Ranks a path that contains the query. Whole-name and name-prefix matches first, then
+// matches at a word start in the name, anywhere in the name, and in the directories.
+int score_match(const PathEntry& entry, const std::string& query)
+{
+    const std::string& folded = entry.folded;
+    size_t name = entry.name_offset;
+    size_t pos = folded.find(query, name);
+    int tier;
+    if (pos == std::string::npos) {
+        tier = 1;
+    }
+    else if (pos == name) {
+        tier = folded.size() - name == query.size() ? 5 : 4;
+    }
+    else {
+        unsigned char before = (unsigned char)folded[pos - 1];
+        tier = (before < 0x80 && !isalnum(before)) ? 3 : 2;
+    }
+    return tier * 1024 - (int)std::min<size_t>(entry.path.size(), 1023);
+}
+
+} // namespace
+
+void filename_index_start()
+{
+    std::call_once(g_start_once, [] {
+        platform_start_thread(indexer_thread, nullptr);
+    });
+}
+
+void filename_index_update(const native_string& full_path)
+{
+    on_root_change(full_path, nullptr);
+}
+
+std::vector<FindHit> filename_index_find(const std::string& query, size_t limit, std::uint64_t& out_total)
+{
+    g_queries.fetch_add(1, std::memory_order_relaxed);
+    out_total = 0;
+    std::vector<FindHit> hits;
+    std::string folded = search_fold_case(query);
+    while (!folded.empty() && folded[0] == '/') folded.erase(0, 1);
+    if (folded.empty() || limit == 0) return hits;
+
+    FilenameIndex& index = filename_index();
+    std::shared_lock<std::shared_mutex> guard(g_index_lock);
+
+    // --- 1. Candidates: the intersection of the query's trigram postings, rarest first ---
+    std::vector<std::uint32_t> candidates;
+    bool scan_all = folded.size() < 3;
+    if (!scan_all) {
+        std::vector<std::uint32_t> trigrams;
+        collect_trigrams(folded, trigrams);
+        std::vector<const std::vector<std::uint32_t>*> lists;
+        for (std::uint32_t trigram : trigrams) {
+            auto found = index.postings.find(trigram);
+            if (found == index.postings.end()) return hits;
+            lists.push_back(&found->second);
+        }
+        std::sort(lists.begin(), lists.end(), [](const std::vector<std::uint32_t>* a, const std::vector<std::uint32_t>* b) { return a->size() < b->size(); });
+        candidates = *lists[0];
+        std::vector<std::uint32_t> scratch(candidates.size());
+        for (size_t i = 1; i < lists.size() && !candidates.empty(); i++) {
+            scratch.resize(intersect(candidates.data(), candidates.size(), lists[i]->data(), lists[i]->size(), scratch.data()));
+            candidates.swap(scratch);
+            scratch.resize(candidates.size());
+        }
+    }
+
+    // --- 2. Check the candidates (trigrams can match out of order) and rank them ---
+    std::vector<std::pair<int, std::uint32_t>> matches;
+    auto consider = [&](std::uint32_t id) {
+        const PathEntry& entry = index.entries[id];
+        if (entry.alive && entry.folded.find(folded) != std::string::npos) matches.emplace_back(score_match(entry, folded), id);
+    };
+    if (scan_all) {
+        for (std::uint32_t id = 0; id < index.entries.size(); id++) consider(id);
+    }
+    else {
+        for (std::uint32_t id : candidates) consider(id);
+    }
+    out_total = matches.size();
+
+    auto better = [&index](const std::pair<int, std::uint32_t>& a, const std::pair<int, std::uint32_t>& b) {
+        if (a.first != b.first) return a.first > b.first;
+        return index.entries[a.second].path < index.entries[b.second].path;
+    };
+    size_t count = std::min(limit, matches.size());
+    std::partial_sort(matches.begin(), matches.begin() + count, matches.end(), better);
+    for (size_t i = 0; i < count; i++) {
+        const PathEntry& entry = index.entries[matches[i].second];
+        hits.push_back(FindHit{ "/" + entry.path, entry.is_dir, matches[i].first });
+    }
+    return hits;
+}
+
+FilenameIndexStats get_filename_index_stats()
+{
+    FilenameIndexStats stats;
+    {
+        FilenameIndex& index = filename_index();
+        std::shared_lock<std::shared_mutex> guard(g_index_lock);
+        stats.paths = index.ids.size();
+        stats.trigrams = index.postings.size();
+        stats.postings = index.posting_count;
+    }
+    stats.queries = g_queries.load(std::memory_order_relaxed);
+    stats.updates = g_updates.load(std::memory_order_relaxed);
+    stats.compactions = g_compactions.load(std::memory_order_relaxed);
+    stats.ready = g_ready.load();
+    return stats;
+}
@@ -0,0 +1,60 @@
+﻿#pragma once
+
+#include "platform.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Starts the in-memory filename index: every file and directory path under the
+ * root, indexed by the trigrams (three-byte substrings) of its case-folded form.
+ *
+ * A background thread walks the root once, then follows the drive's change notifications
+ * (see root_watch_subscribe()) and filename_index_update() calls, so created, renamed and
+ * deleted entries show up without another walk. Matching is case-insensitive, like the
+ * virtual volume itself.
+ */
+void filename_index_start();
+
+/**
+ * @brief Tells the index that a path was created, renamed or deleted.
+ *
+ * @param full_path The canonical path (see is_safe_path()).
+ */
+void filename_index_update(const native_string& full_path);
+
+/**
+ * @brief One find result.
+ */
+struct FindHit {
+    std::string path;               // As the client sees it, e.g. "/photos/2024/beach.jpg".
+    bool is_dir;
+    int score;                      // Higher is better: name matches beat directory matches, shorter paths win ties.
+};
+
+/**
+ * @brief Finds the paths containing a substring, for find-as-you-type.
+ *
+ * A query of three bytes or more is answered from the trigram postings (intersected rarest
+ * first) and checked against the candidates; shorter queries scan the names.
+ *
+ * @param limit The number of best hits to return.
+ * @param out_total Set to the number of matching paths.
+ * @return The best hits, best first.
+ */
+std::vector<FindHit> filename_index_find(const std::string& query, size_t limit, std::uint64_t& out_total);
+
+/**
+ * @brief Counters describing the filename index, for diagnostics and metrics.
+ */
+struct FilenameIndexStats {
+    uint64_t paths;                 // Indexed files and directories.
+    uint64_t trigrams;              // Distinct trigrams.
+    uint64_t postings;              // Entries in all posting arrays, including removed paths not yet compacted.
+    uint64_t queries;
+    uint64_t updates;               // Paths added or removed after the initial walk.
+    uint64_t compactions;
+    bool ready;                     // The initial walk has finished.
+};
+
+FilenameIndexStats get_filename_index_stats();
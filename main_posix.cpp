@@ -0,0 +1,122 @@
+﻿#ifndef _WIN32
+
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "platform.h"
+#include "server.h"
+
+#ifdef PERSONA_HAVE_FUSE3
+/**
+ * @brief Mounts the FUSE3 pass through filesystem and runs its session loop (passthrough_fuse.c).
+ *
+ * Accepts the same -d/-p/-m options as the WinFsp service in passthrough.c and
+ * blocks until the filesystem is unmounted or the process is signaled. 'mounted' is
+ * called once the mount is in place, before the filesystem answers any request.
+ */
+extern "C" int start_fuse_filesystem(int argc, char* argv[], void (*mounted)(void));
+
+// The root the web server uses once the filesystem is mounted (see start_after_mount()).
+static const char* g_fuse_root = nullptr;
+
+/**
+ * @brief Sets the root and starts the web server, on its own thread once the mount is up.
+ *
+ * The root usually is the mount point. Opening it (and everything the web server does
+ * at startup: static assets, indexes, watches) needs the FUSE session loop to answer,
+ * and the loop only starts after the 'mounted' callback returns, so this must not run
+ * on the callback's thread. Pinning the root before mounting would hold the directory
+ * underneath the mount instead.
+ */
+static void start_after_mount(void*)
+{
+    if (g_fuse_root != nullptr && !platform_set_root_path(g_fuse_root)) {
+        fprintf(stderr, "cannot use '%s' as the root directory\n", g_fuse_root);
+        return;
+    }
+    start_web_server();
+}
+
+static void on_mounted()
+{
+    platform_start_thread(start_after_mount, nullptr);
+}
+#endif
+
+/**
+ * @brief Entry point of the Linux build.
+ *
+ * On Windows, passthrough.c's wmain() starts the web server and then hands control
+ * to WinFsp's FspServiceRun. On Linux there is no service manager to hand off to,
+ * so this file takes that role: it parses the root directory, starts the web server
+ * thread, and then either mounts the FUSE3 pass through filesystem (when -p/-m are
+ * given) or simply blocks until the process is asked to stop (SIGINT/SIGTERM).
+ *
+ * usage: persona_web [-r RootDirectory] [-p Directory -m MountPoint [FUSE options]]
+ *        (the root may also be given with the PERSONA_ROOT environment variable;
+ *        when a filesystem is mounted the root defaults to its mount point)
+ */
+int main(int argc, char** argv)
+{
+    const char* root = getenv("PERSONA_ROOT");
+#ifdef PERSONA_HAVE_FUSE3
+    const char* mount_point = nullptr;
+#endif
+
+    // Everything except -r belongs to the filesystem backend.
+    std::vector<char*> fs_argv = { argv[0] };
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            root = argv[++i];
+            continue;
+        }
+#ifdef PERSONA_HAVE_FUSE3
+        if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            mount_point = argv[i + 1];
+        }
+#endif
+        fs_argv.push_back(argv[i]);
+    }
+
+#ifdef PERSONA_HAVE_FUSE3
+    // Like on Windows, the web server serves files through the mounted drive.
+    if (root == nullptr) root = mount_point;
+#else
+    if (fs_argv.size() > 1) {
+        fprintf(stderr, "usage: %s [-r RootDirectory]\n"
+            "(this build has no FUSE3 support; -p/-m are not available)\n", argv[0]);
+        return 2;
+    }
+#endif
+
+#ifdef PERSONA_HAVE_FUSE3
+    if (fs_argv.size() > 1) {
+        // The FUSE session installs its own SIGINT/SIGTERM handlers and unmounts on exit.
+        // The root and the web server are set up only once the mount exists.
+        g_fuse_root = root;
+        return start_fuse_filesystem((int)fs_argv.size(), fs_argv.data(), on_mounted);
+    }
+#endif
+
+    if (root != nullptr && !platform_set_root_path(root)) {
+        fprintf(stderr, "cannot use '%s' as the root directory\n", root);
+        return 1;
+    }
+
+    // Block the termination signals before any thread is created, so that every
+    // thread inherits the mask and only the sigwait() below receives them.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    start_web_server();
+
+    int received = 0;
+    sigwait(&signals, &received);
+    return 0;
+}
+
+#endif // !_WIN32
@@ -0,0 +1,416 @@
+﻿#include "metrics.h"
+#include "app_registry.h"
+#include "buffer_pool.h"
+#include "content_type.h"
+#include "directory_listing.h"
+#include "error_log.h"
+#include "file_cache.h"
+#include "filename_index.h"
+#include "search_index.h"
+#include "static_assets.h"
+#include "trace.h"
+#include "tree_walk.h"
+#include "work_pool.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+// The routes requests are counted under.
+enum Route {
+    kRouteResources,
+    kRouteTree,
+    kRouteSearch,
+    kRouteFind,
+    kRouteReadfile,
+    kRouteStreamfile,
+    kRouteApps,
+    kRouteWritefile,
+    kRouteUpdatefile,
+    kRouteDeletefile,
+    kRouteLog,
+    kRouteMetrics,
+    kRouteTrace,
+    kRouteStatic,       // Everything served by the catch-all GET route.
+    kRouteOther,        // Anything else (OPTIONS, unknown POSTs, ...).
+    kRouteCount
+};
+
+const char* const kRouteNames[kRouteCount] = {
+    "resources", "tree", "search", "find", "readfile", "streamfile", "apps",
+    "writefile", "updatefile", "deletefile", "log", "metrics", "trace", "static", "other",
+};
+
+const char* const kStatusClasses[5] = { "1xx", "2xx", "3xx", "4xx", "5xx" };
+
+// Histogram layout: values below kSubBuckets microseconds get a bucket each; above that,
+// every power of two is split into kSubBuckets equal parts, up to 2^kMaxExponent us.
+const int kSubBucketBits = 3;
+const std::uint64_t kSubBuckets = 1 << kSubBucketBits;
+const int kMaxExponent = 40;
+const size_t kHistogramBuckets = (kMaxExponent - kSubBucketBits + 2) * kSubBuckets;
+
+// The exported (cumulative) buckets: powers of two from 16 us to about 33.5 s. These are
+// edges of the internal buckets, so the export is exact.
+const int kFirstExportExponent = 4;
+const int kLastExportExponent = 25;
+
+const double kQuantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+/**
+ * @brief A counter written by one thread and read by scrapes.
+ *
+ * The owner adds with a plain load and store (no locked instruction, no cache line
+ * shared with other writers); the atomic only makes the concurrent read well-defined.
+ */
+struct Counter {
+    std::atomic<std::uint64_t> value{ 0 };
+
+    void add(std::uint64_t n) { value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+    std::uint64_t get() const { return value.load(std::memory_order_relaxed); }
+};
+
+struct RouteCounters {
+    Counter started;
+    Counter finished;
+    Counter status[5];
+    Counter bytes_in;
+    Counter bytes_out;
+    Counter duration_us;
+    Counter histogram[kHistogramBuckets];
+};
+
+/**
+ * @brief One request thread's counters, and the request it is handling.
+ */
+struct ThreadMetrics {
+    RouteCounters routes[kRouteCount];
+    std::chrono::steady_clock::time_point start;
+    int route = -1;                 // -1: no request started by the pre-routing handler.
+};
+
+/**
+ * @brief Every thread's counters. Only grows; the blocks outlive their threads so that
+ * totals never go backwards.
+ */
+struct MetricsRegistry {
+    std::mutex lock;
+    std::vector<ThreadMetrics*> threads;
+};
+
+MetricsRegistry& metrics_registry()
+{
+    static MetricsRegistry* registry = new MetricsRegistry();
+    return *registry;
+}
+
+thread_local ThreadMetrics* t_metrics = nullptr;
+
+ThreadMetrics& thread_metrics()
+{
+    if (!t_metrics) {
+        t_metrics = new ThreadMetrics();
+        MetricsRegistry& registry = metrics_registry();
+        std::lock_guard<std::mutex> guard(registry.lock);
+        registry.threads.push_back(t_metrics);
+    }
+    return *t_metrics;
+}
+
+int classify_route(const httplib::Request& req)
+{
+    const std::string& path = req.path;
+    if (path.compare(0, 5, "/api/") != 0) return req.method == "GET" || req.method == "HEAD" ? kRouteStatic : kRouteOther;
+
+    struct Prefix { const char* text; int route; };
+    static const Prefix kPrefixes[] = {
+        { "/api/resources", kRouteResources }, { "/api/tree", kRouteTree }, { "/api/search", kRouteSearch },
+        { "/api/find", kRouteFind }, { "/api/readfile", kRouteReadfile }, { "/api/streamfile", kRouteStreamfile },
+        { "/api/apps", kRouteApps }, { "/api/writefile", kRouteWritefile }, { "/api/updatefile", kRouteUpdatefile },
+        { "/api/deletefile", kRouteDeletefile }, { "/api/log", kRouteLog }, { "/api/metrics", kRouteMetrics },
+        { "/api/debug/trace", kRouteTrace },
+    };
+    for (const Prefix& prefix : kPrefixes) {
+        size_t length = strlen(prefix.text);
+        if (path.compare(0, length, prefix.text) == 0 && (path.size() == length || path[length] == '/')) return prefix.route;
+    }
+    return kRouteOther;
+}
+
+size_t histogram_bucket(std::uint64_t us)
+{
+    if (us < kSubBuckets) return (size_t)us;
+    int exponent = 0;
+    while ((us >> exponent) > 1) exponent++;
+    if (exponent > kMaxExponent) return kHistogramBuckets - 1;
+    size_t sub = (size_t)(us >> (exponent - kSubBucketBits)) & (kSubBuckets - 1);
+    return (size_t)(exponent - kSubBucketBits + 1) * kSubBuckets + sub;
+}
+
+// The exclusive upper edge of a bucket, in microseconds.
+std::uint64_t histogram_bucket_limit(size_t bucket)
+{
+    if (bucket < kSubBuckets) return bucket + 1;
+    int exponent = (int)(bucket / kSubBuckets) + kSubBucketBits - 1;
+    std::uint64_t sub = bucket % kSubBuckets;
+    return (kSubBuckets + sub + 1) << (exponent - kSubBucketBits);
+}
+
+void on_request_start(const httplib::Request& req)
+{
+    ThreadMetrics& metrics = thread_metrics();
+    metrics.route = classify_route(req);
+    metrics.start = std::chrono::steady_clock::now();
+    metrics.routes[metrics.route].started.add(1);
+    trace_begin_request(req);
+}
+
+void on_request_done(const httplib::Request& req, const httplib::Response& res)
+{
+    ThreadMetrics& metrics = thread_metrics();
+    if (metrics.route < 0) return;     // Rejected by httplib before routing (e.g. a malformed request).
+
+    std::uint64_t us = (std::uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - metrics.start).count();
+    RouteCounters& route = metrics.routes[metrics.route];
+    int status_class = res.status / 100 - 1;
+    route.status[status_class < 0 ? 0 : status_class > 4 ? 4 : status_class].add(1);
+    // Streamed uploads (ContentReader handlers) leave req.body empty; count what was announced instead.
+    route.bytes_in.add(!req.body.empty() ? req.body.size() : req.get_header_value_u64("Content-Length"));
+    if (req.method != "HEAD") route.bytes_out.add(!res.body.empty() ? res.body.size() : res.content_length_);
+    route.duration_us.add(us);
+    route.histogram[histogram_bucket(us)].add(1);
+    route.finished.add(1);
+    metrics.route = -1;
+    trace_end_request(req, res);
+}
+
+// --- Prometheus text format ---
+
+void append_metric_header(std::string& out, const char* name, const char* type, const char* help)
+{
+    out += "# HELP ";
+    out += name;
+    out += ' ';
+    out += help;
+    out += "\n# TYPE ";
+    out += name;
+    out += ' ';
+    out += type;
+    out += '\n';
+}
+
+void append_sample(std::string& out, const char* name, const std::string& labels, double value)
+{
+    char text[64];
+    snprintf(text, sizeof(text), "%.15g", value);
+    out += name;
+    if (!labels.empty()) {
+        out += '{';
+        out += labels;
+        out += '}';
+    }
+    out += ' ';
+    out += text;
+    out += '\n';
+}
+
+void append_metric(std::string& out, const char* name, const char* type, const char* help, double value)
+{
+    append_metric_header(out, name, type, help);
+    append_sample(out, name, std::string(), value);
+}
+
+/**
+ * @brief One labelled counter family, e.g. the hits of every cache.
+ */
+void append_family(std::string& out, const char* name, const char* type, const char* help, const char* label,
+    std::initializer_list<std::pair<const char*, double>> samples)
+{
+    append_metric_header(out, name, type, help);
+    for (const auto& sample : samples) {
+        append_sample(out, name, std::string(label) + "=\"" + sample.first + "\"", sample.second);
+    }
+}
+
+/**
+ * @brief The request counters, summed over all threads.
+ */
+void append_request_metrics(std::string& out)
+{
+    struct RouteTotals {
+        std::uint64_t started = 0;
+        std::uint64_t finished = 0;
+        std::uint64_t status[5] = {};
+        std::uint64_t bytes_in = 0;
+        std::uint64_t bytes_out = 0;
+        std::uint64_t duration_us = 0;
+        std::vector<std::uint64_t> histogram = std::vector<std::uint64_t>(kHistogramBuckets);
+    };
+    std::vector<RouteTotals> totals(kRouteCount);
+    {
+        MetricsRegistry& registry = metrics_registry();
+        std::lock_guard<std::mutex> guard(registry.lock);
+        for (const ThreadMetrics* thread : registry.threads) {
+            for (int r = 0; r < kRouteCount; r++) {
+                const RouteCounters& route = thread->routes[r];
+                RouteTotals& total = totals[r];
+                total.started += route.started.get();
+                total.finished += route.finished.get();
+                for (int s = 0; s < 5; s++) total.status[s] += route.status[s].get();
+                total.bytes_in += route.bytes_in.get();
+                total.bytes_out += route.bytes_out.get();
+                total.duration_us += route.duration_us.get();
+                for (size_t b = 0; b < kHistogramBuckets; b++) total.histogram[b] += route.histogram[b].get();
+            }
+        }
+    }
+
+    auto route_label = [](int r) { return std::string("route=\"") + kRouteNames[r] + "\""; };
+
+    append_metric_header(out, "persona_http_requests_total", "counter", "Requests completed, by route and status class.");
+    for (int r = 0; r < kRouteCount; r++) {
+        for (int s = 0; s < 5; s++) {
+            if (totals[r].status[s] == 0 && s != 1) continue;
+            append_sample(out, "persona_http_requests_total", route_label(r) + ",status=\"" + kStatusClasses[s] + "\"", (double)totals[r].status[s]);
+        }
+    }
+    append_metric_header(out, "persona_http_requests_in_flight", "gauge", "Requests being handled right now, by route.");
+    for (int r = 0; r < kRouteCount; r++) {
+        // The two counters are read at slightly different times; never report a negative gauge.
+        std::uint64_t in_flight = totals[r].started > totals[r].finished ? totals[r].started - totals[r].finished : 0;
+        append_sample(out, "persona_http_requests_in_flight", route_label(r), (double)in_flight);
+    }
+    append_metric_header(out, "persona_http_request_bytes_total", "counter", "Request body bytes received, by route.");
+    for (int r = 0; r < kRouteCount; r++) append_sample(out, "persona_http_request_bytes_total", route_label(r), (double)totals[r].bytes_in);
+    append_metric_header(out, "persona_http_response_bytes_total", "counter", "Response body bytes sent (known lengths only; chunked streams count as 0), by route.");
+    for (int r = 0; r < kRouteCount; r++) append_sample(out, "persona_http_response_bytes_total", route_label(r), (double)totals[r].bytes_out);
+
+    append_metric_header(out, "persona_http_request_duration_seconds", "histogram", "Time from routing to the end of the response, by route.");
+    for (int r = 0; r < kRouteCount; r++) {
+        const RouteTotals& total = totals[r];
+        std::uint64_t count = 0;
+        size_t bucket = 0;
+        for (int exponent = kFirstExportExponent; exponent <= kLastExportExponent; exponent++) {
+            std::uint64_t limit = (std::uint64_t)1 << exponent;
+            while (bucket < kHistogramBuckets && histogram_bucket_limit(bucket) <= limit) count += total.histogram[bucket++];
+            char le[32];
+            snprintf(le, sizeof(le), "%.15g", limit / 1e6);
+            append_sample(out, "persona_http_request_duration_seconds_bucket", route_label(r) + ",le=\"" + le + "\"", (double)count);
+        }
+        append_sample(out, "persona_http_request_duration_seconds_bucket", route_label(r) + ",le=\"+Inf\"", (double)total.finished);
+        append_sample(out, "persona_http_request_duration_seconds_sum", route_label(r), total.duration_us / 1e6);
+        append_sample(out, "persona_http_request_duration_seconds_count", route_label(r), (double)total.finished);
+    }
+
+    append_metric_header(out, "persona_http_request_duration_quantile_seconds", "gauge", "Latency quantiles since startup (upper bucket edge, within 12.5%), by route.");
+    for (int r = 0; r < kRouteCount; r++) {
+        const RouteTotals& total = totals[r];
+        if (total.finished == 0) continue;
+        for (double quantile : kQuantiles) {
+            std::uint64_t rank = (std::uint64_t)(quantile * (double)total.finished);
+            if (rank == 0) rank = 1;
+            std::uint64_t seen = 0;
+            size_t bucket = 0;
+            while (bucket + 1 < kHistogramBuckets && (seen += total.histogram[bucket]) < rank) bucket++;
+            char label[32];
+            snprintf(label, sizeof(label), ",quantile=\"%g\"", quantile);
+            append_sample(out, "persona_http_request_duration_quantile_seconds", route_label(r) + label, histogram_bucket_limit(bucket) / 1e6);
+        }
+    }
+}
+
+double hit_ratio(std::uint64_t hits, std::uint64_t misses)
+{
+    return hits + misses == 0 ? 0.0 : (double)hits / (double)(hits + misses);
+}
+
+} // namespace
+
+void metrics_install(httplib::Server& server)
+{
+    server.set_pre_routing_handler([](const httplib::Request& req, httplib::Response& res) {
+        on_request_start(req);
+        return httplib::Server::HandlerResponse::Unhandled;
+    });
+    server.set_post_routing_handler(trace_finish_handler);
+    server.set_logger(on_request_done);
+}
+
+std::string render_metrics()
+{
+    std::string out;
+    out.reserve(64 * 1024);
+
+    // --- 1. Requests ---
+    append_request_metrics(out);
+
+    // --- 2. Caches ---
+    FileCacheStats file_cache = get_file_cache_stats();
+    DirectoryListingStats listings = get_directory_listing_stats();
+    StaticAssetStats assets = get_static_asset_stats();
+    append_family(out, "persona_cache_hits_total", "counter", "Lookups answered from memory, by cache.", "cache", {
+        { "file", (double)file_cache.hits }, { "listing", (double)listings.hits }, { "static", (double)assets.hits } });
+    append_family(out, "persona_cache_misses_total", "counter", "Lookups that went to the disk, by cache.", "cache", {
+        { "file", (double)file_cache.misses }, { "listing", (double)listings.misses }, { "static", (double)assets.misses } });
+    append_family(out, "persona_cache_hit_ratio", "gauge", "hits / (hits + misses) since startup, by cache.", "cache", {
+        { "file", hit_ratio(file_cache.hits, file_cache.misses) }, { "listing", hit_ratio(listings.hits, listings.misses) },
+        { "static", hit_ratio(assets.hits, assets.misses) } });
+    append_family(out, "persona_cache_bytes", "gauge", "Bytes held in memory, by cache.", "cache", {
+        { "file", (double)file_cache.bytes }, { "listing", (double)listings.bytes },
+        { "static", (double)(assets.identity_bytes + assets.compressed_bytes) } });
+    append_family(out, "persona_cache_entries", "gauge", "Entries held, by cache.", "cache", {
+        { "file", (double)file_cache.entries }, { "listing", (double)listings.entries }, { "static", (double)assets.assets } });
+    append_metric(out, "persona_file_cache_bypasses_total", "counter", "File cache lookups for files too large to cache.", (double)file_cache.bypasses);
+    append_metric(out, "persona_file_cache_evictions_total", "counter", "Files evicted from the file cache.", (double)file_cache.evictions);
+    append_metric(out, "persona_listing_cache_invalidations_total", "counter", "Directory listings dropped by change notifications or the sweep.", (double)listings.invalidations);
+    append_metric(out, "persona_static_reloads_total", "counter", "Static asset table rebuilds.", (double)assets.reloads);
+    ContentTypeStats types = get_content_type_stats();
+    append_metric(out, "persona_content_sniffs_total", "counter", "Files read to sniff their content type.", (double)types.sniffs);
+    append_metric(out, "persona_content_sniff_cache_hits_total", "counter", "Content types answered from the sniffing cache.", (double)types.sniff_cache_hits);
+
+    // --- 3. Memory and threads ---
+    BufferPoolStats buffers = get_buffer_pool_stats();
+    append_metric(out, "persona_buffer_pool_acquires_total", "counter", "I/O buffers borrowed.", (double)buffers.acquires);
+    append_metric(out, "persona_buffer_pool_allocations_total", "counter", "Borrows that had to allocate.", (double)buffers.heap_allocations);
+    append_metric(out, "persona_buffer_pool_bytes_in_use", "gauge", "Bytes of I/O buffers currently borrowed.", (double)buffers.bytes_in_use);
+    append_metric(out, "persona_buffer_pool_bytes_owned", "gauge", "Bytes of I/O buffers allocated by the pool.", (double)buffers.bytes_owned);
+    WorkPoolStats work = get_work_pool_stats();
+    append_metric(out, "persona_work_pool_workers", "gauge", "Work pool threads.", (double)work.workers);
+    append_metric(out, "persona_work_pool_tasks_total", "counter", "Work pool tasks run.", (double)work.tasks);
+    append_metric(out, "persona_work_pool_steals_total", "counter", "Work pool tasks stolen from another worker.", (double)work.steals);
+    TreeWalkStats walks = get_tree_walk_stats();
+    append_metric(out, "persona_tree_walks_total", "counter", "Tree walks started (/api/tree).", (double)walks.walks);
+    append_metric(out, "persona_tree_walks_cancelled_total", "counter", "Tree walks whose client went away.", (double)walks.cancelled);
+    append_metric(out, "persona_tree_walk_entries_total", "counter", "Items sent by tree walks.", (double)walks.entries);
+
+    // --- 4. Indexes ---
+    SearchIndexStats search = get_search_index_stats();
+    append_metric(out, "persona_search_documents", "gauge", "Documents in the full-text index.", (double)search.documents);
+    append_metric(out, "persona_search_segment_bytes", "gauge", "Size of the mapped full-text segment.", (double)search.segment_bytes);
+    append_metric(out, "persona_search_live_postings", "gauge", "Full-text postings not yet merged to disk.", (double)search.live_postings);
+    append_metric(out, "persona_search_pending", "gauge", "Paths waiting for the full-text indexer.", (double)search.pending);
+    append_metric(out, "persona_search_updates_total", "counter", "Documents (re)indexed or removed.", (double)search.updates);
+    append_metric(out, "persona_search_merges_total", "counter", "Full-text segments written.", (double)search.merges);
+    FilenameIndexStats names = get_filename_index_stats();
+    append_metric(out, "persona_find_paths", "gauge", "Paths in the filename index.", (double)names.paths);
+    append_metric(out, "persona_find_postings", "gauge", "Trigram postings in the filename index.", (double)names.postings);
+    append_metric(out, "persona_find_updates_total", "counter", "Filename index updates after the initial walk.", (double)names.updates);
+
+    // --- 5. Apps and the error log ---
+    AppRegistryStats apps = get_app_registry_stats();
+    append_metric(out, "persona_apps", "gauge", "Apps in the registry.", (double)apps.apps);
+    append_metric(out, "persona_apps_reloads_total", "counter", "App registry rebuilds.", (double)apps.reloads);
+    ErrorLogStats log = get_error_log_stats();
+    append_family(out, "persona_error_reports_total", "counter", "Frontend error reports, by outcome.", "outcome", {
+        { "written", (double)log.written }, { "duplicate", (double)log.duplicates },
+        { "dropped", (double)log.dropped }, { "limited", (double)log.limited } });
+    append_metric(out, "persona_error_log_bytes_total", "counter", "Bytes written to the error log.", (double)log.bytes);
+    append_metric(out, "persona_error_log_rotations_total", "counter", "Error log rotations.", (double)log.rotations);
+    return out;
+}
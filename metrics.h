@@ -0,0 +1,27 @@
+﻿#pragma once
+
+#include "httplib.h"
+#include <string>
+
+/**
+ * @brief Starts recording every request the server handles.
+ *
+ * Installs a pre-routing handler (which notes the route and the start time) and a logger
+ * (which httplib calls once the response has been written). Each request's latency,
+ * status class and bytes are added to counters owned by the thread that handled it:
+ * there are no shared read-modify-write atomics on the request path, and a scrape adds
+ * the threads' counters up.
+ *
+ * The same hooks (plus a post-routing handler) drive request tracing: see trace.h.
+ *
+ * Latency goes into a log-linear (HDR-style) histogram with 8 sub-buckets per power of
+ * two, i.e. within 12.5%, from 1 us to several days.
+ *
+ * Must be called before the server starts listening.
+ */
+void metrics_install(httplib::Server& server);
+
+/**
+ * @brief Renders the request metrics and every module's counters in the Prometheus text format.
+ */
+std::string render_metrics();
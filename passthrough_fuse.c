@@ -0,0 +1,771 @@
+﻿/**
+ * @file passthrough_fuse.c
+ *
+ * Linux counterpart of passthrough.c: exposes a backing directory through a FUSE3
+ * low-level filesystem, implementing the same operation set as PtfsInterface.
+ *
+ * Unlike the WinFsp version, which rebuilds a full path with ConcatPath for every
+ * call, this backend is inode based: each FUSE inode keeps an O_PATH descriptor to
+ * the backing object and every operation is performed relative to it (openat,
+ * fstatat, unlinkat, renameat, ...). Reads and writes are passed to the kernel as
+ * file descriptors so that libfuse can splice the data instead of copying it.
+ *
+ * PtfsInterface              -> fuse_lowlevel_ops
+ *   GetVolumeInfo            -> statfs
+ *   Create                   -> create, mkdir
+ *   Open / Close             -> open, opendir / release, releasedir
+ *   Read / Write             -> read, write_buf
+ *   Flush                    -> flush, fsync
+ *   GetFileInfo              -> lookup, getattr
+ *   SetBasicInfo/SetFileSize -> setattr
+ *   Rename                   -> rename
+ *   ReadDirectory            -> readdir, readdirplus
+ *   SetDelete                -> unlink, rmdir
+ */
+
+#ifndef _WIN32
+
+#define _GNU_SOURCE
+#define FUSE_USE_VERSION 34
+
+#include <fuse_lowlevel.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+
+#define PROGNAME                        "passthrough"
+#define ENTRY_TIMEOUT                   1.0     /* same as VolumeParams.FileInfoTimeout = 1000 */
+#define INODE_BUCKETS                   4096
+
+typedef struct PTFS_INODE
+{
+    struct PTFS_INODE *Next;                    /* hash bucket chain */
+    int Fd;                                     /* O_PATH descriptor of the backing object */
+    ino_t Ino;
+    dev_t Dev;
+    uint64_t RefCount;                          /* kernel lookup count */
+} PTFS_INODE;
+
+typedef struct
+{
+    PTFS_INODE Root;
+    pthread_mutex_t Lock;                       /* protects Buckets and RefCount */
+    PTFS_INODE *Buckets[INODE_BUCKETS];
+    int Debug;
+} PTFS;
+
+typedef struct
+{
+    DIR *Dir;
+    struct dirent *Entry;                       /* entry read but not yet returned */
+    off_t Offset;
+} PTFS_DIR_CONTEXT;
+
+static PTFS *PtfsFromReq(fuse_req_t req)
+{
+    return (PTFS *)fuse_req_userdata(req);
+}
+
+static PTFS_INODE *InodeFromIno(fuse_req_t req, fuse_ino_t ino)
+{
+    if (FUSE_ROOT_ID == ino)
+        return &PtfsFromReq(req)->Root;
+    return (PTFS_INODE *)(uintptr_t)ino;
+}
+
+static int FdFromIno(fuse_req_t req, fuse_ino_t ino)
+{
+    return InodeFromIno(req, ino)->Fd;
+}
+
+static unsigned BucketFromKey(ino_t Ino, dev_t Dev)
+{
+    return (unsigned)((Ino ^ (Dev << 7)) % INODE_BUCKETS);
+}
+
+/* finds an already known inode by (st_ino, st_dev); Ptfs->Lock must be held */
+static PTFS_INODE *InodeFind(PTFS *Ptfs, const struct stat *St)
+{
+    PTFS_INODE *Inode;
+
+    if (St->st_ino == Ptfs->Root.Ino && St->st_dev == Ptfs->Root.Dev)
+        return &Ptfs->Root;
+
+    for (Inode = Ptfs->Buckets[BucketFromKey(St->st_ino, St->st_dev)]; 0 != Inode; Inode = Inode->Next)
+        if (Inode->Ino == St->st_ino && Inode->Dev == St->st_dev)
+            return Inode;
+
+    return 0;
+}
+
+static void InodeUnref(PTFS *Ptfs, PTFS_INODE *Inode, uint64_t N)
+{
+    PTFS_INODE **P;
+
+    if (&Ptfs->Root == Inode)
+        return;
+
+    pthread_mutex_lock(&Ptfs->Lock);
+    Inode->RefCount -= N;
+    if (0 != Inode->RefCount)
+    {
+        pthread_mutex_unlock(&Ptfs->Lock);
+        return;
+    }
+
+    for (P = &Ptfs->Buckets[BucketFromKey(Inode->Ino, Inode->Dev)]; *P != Inode; P = &(*P)->Next)
+        ;
+    *P = Inode->Next;
+    pthread_mutex_unlock(&Ptfs->Lock);
+
+    close(Inode->Fd);
+    free(Inode);
+}
+
+/*
+ * Resolves Name inside Parent and fills Entry. This is the only place where names are
+ * looked up; everything else goes through the descriptor cached in the inode.
+ */
+static int DoLookup(fuse_req_t req, fuse_ino_t Parent, const char *Name,
+    struct fuse_entry_param *Entry)
+{
+    PTFS *Ptfs = PtfsFromReq(req);
+    PTFS_INODE *Inode, *NewInode;
+    int Fd;
+
+    memset(Entry, 0, sizeof *Entry);
+    Entry->attr_timeout = ENTRY_TIMEOUT;
+    Entry->entry_timeout = ENTRY_TIMEOUT;
+
+    Fd = openat(FdFromIno(req, Parent), Name, O_PATH | O_NOFOLLOW | O_CLOEXEC);
+    if (-1 == Fd)
+        return errno;
+
+    if (-1 == fstatat(Fd, "", &Entry->attr, AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW))
+    {
+        int Error = errno;
+        close(Fd);
+        return Error;
+    }
+
+    NewInode = malloc(sizeof *NewInode);
+    if (0 == NewInode)
+    {
+        close(Fd);
+        return ENOMEM;
+    }
+
+    pthread_mutex_lock(&Ptfs->Lock);
+    Inode = InodeFind(Ptfs, &Entry->attr);
+    if (0 != Inode)
+    {
+        /* already known: keep the existing descriptor and drop ours */
+        if (&Ptfs->Root != Inode)
+            Inode->RefCount++;
+        pthread_mutex_unlock(&Ptfs->Lock);
+        free(NewInode);
+        close(Fd);
+    }
+    else
+    {
+        unsigned Bucket = BucketFromKey(Entry->attr.st_ino, Entry->attr.st_dev);
+        NewInode->Fd = Fd;
+        NewInode->Ino = Entry->attr.st_ino;
+        NewInode->Dev = Entry->attr.st_dev;
+        NewInode->RefCount = 1;
+        NewInode->Next = Ptfs->Buckets[Bucket];
+        Ptfs->Buckets[Bucket] = NewInode;
+        pthread_mutex_unlock(&Ptfs->Lock);
+        Inode = NewInode;
+    }
+
+    Entry->ino = &Ptfs->Root == Inode ? FUSE_ROOT_ID : (fuse_ino_t)(uintptr_t)Inode;
+
+    if (Ptfs->Debug)
+        fprintf(stderr, PROGNAME ": lookup %s -> %llu\n", Name, (unsigned long long)Entry->attr.st_ino);
+
+    return 0;
+}
+
+/* reopens an O_PATH descriptor with real access flags through /proc/self/fd */
+static int ReopenInode(PTFS_INODE *Inode, int Flags)
+{
+    char ProcPath[64];
+
+    snprintf(ProcPath, sizeof ProcPath, "/proc/self/fd/%d", Inode->Fd);
+    return open(ProcPath, (Flags & ~O_NOFOLLOW) | O_CLOEXEC);
+}
+
+static void PtfsInit(void *UserData, struct fuse_conn_info *Conn)
+{
+    /* let the kernel move file data with splice() instead of copying through our buffers */
+    if (Conn->capable & FUSE_CAP_SPLICE_WRITE)
+        Conn->want |= FUSE_CAP_SPLICE_WRITE;
+    if (Conn->capable & FUSE_CAP_SPLICE_MOVE)
+        Conn->want |= FUSE_CAP_SPLICE_MOVE;
+    if (Conn->capable & FUSE_CAP_SPLICE_READ)
+        Conn->want |= FUSE_CAP_SPLICE_READ;
+}
+
+static void PtfsLookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    struct fuse_entry_param Entry;
+    int Error = DoLookup(req, parent, name, &Entry);
+
+    if (0 != Error)
+        fuse_reply_err(req, Error);
+    else
+        fuse_reply_entry(req, &Entry);
+}
+
+static void PtfsForget(fuse_req_t req, fuse_ino_t ino, uint64_t nlookup)
+{
+    InodeUnref(PtfsFromReq(req), InodeFromIno(req, ino), nlookup);
+    fuse_reply_none(req);
+}
+
+static void PtfsForgetMulti(fuse_req_t req, size_t count, struct fuse_forget_data *forgets)
+{
+    size_t I;
+
+    for (I = 0; count > I; I++)
+        InodeUnref(PtfsFromReq(req), InodeFromIno(req, forgets[I].ino), forgets[I].nlookup);
+    fuse_reply_none(req);
+}
+
+static void PtfsGetAttr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    struct stat St;
+
+    if (-1 == fstatat(FdFromIno(req, ino), "", &St, AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW))
+        fuse_reply_err(req, errno);
+    else
+        fuse_reply_attr(req, &St, ENTRY_TIMEOUT);
+}
+
+static void PtfsSetAttr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
+    int valid, struct fuse_file_info *fi)
+{
+    PTFS_INODE *Inode = InodeFromIno(req, ino);
+    char ProcPath[64];
+    int Result;
+
+    snprintf(ProcPath, sizeof ProcPath, "/proc/self/fd/%d", Inode->Fd);
+
+    if (valid & FUSE_SET_ATTR_MODE)
+    {
+        Result = 0 != fi ? fchmod((int)fi->fh, attr->st_mode) : chmod(ProcPath, attr->st_mode);
+        if (-1 == Result)
+            goto fail;
+    }
+
+    /* SetFileSize */
+    if (valid & FUSE_SET_ATTR_SIZE)
+    {
+        Result = 0 != fi ? ftruncate((int)fi->fh, attr->st_size) : truncate(ProcPath, attr->st_size);
+        if (-1 == Result)
+            goto fail;
+    }
+
+    /* SetBasicInfo (timestamps) */
+    if (valid & (FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_MTIME))
+    {
+        struct timespec Times[2];
+
+        Times[0].tv_sec = 0;
+        Times[0].tv_nsec = UTIME_OMIT;
+        Times[1].tv_sec = 0;
+        Times[1].tv_nsec = UTIME_OMIT;
+
+        if (valid & FUSE_SET_ATTR_ATIME_NOW)
+            Times[0].tv_nsec = UTIME_NOW;
+        else if (valid & FUSE_SET_ATTR_ATIME)
+            Times[0] = attr->st_atim;
+
+        if (valid & FUSE_SET_ATTR_MTIME_NOW)
+            Times[1].tv_nsec = UTIME_NOW;
+        else if (valid & FUSE_SET_ATTR_MTIME)
+            Times[1] = attr->st_mtim;
+
+        Result = 0 != fi ? futimens((int)fi->fh, Times) : utimensat(AT_FDCWD, ProcPath, Times, 0);
+        if (-1 == Result)
+            goto fail;
+    }
+
+    PtfsGetAttr(req, ino, fi);
+    return;
+
+fail:
+    fuse_reply_err(req, errno);
+}
+
+static void PtfsMkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode)
+{
+    struct fuse_entry_param Entry;
+    int Error;
+
+    if (-1 == mkdirat(FdFromIno(req, parent), name, mode))
+    {
+        fuse_reply_err(req, errno);
+        return;
+    }
+
+    Error = DoLookup(req, parent, name, &Entry);
+    if (0 != Error)
+        fuse_reply_err(req, Error);
+    else
+        fuse_reply_entry(req, &Entry);
+}
+
+static void PtfsCreate(fuse_req_t req, fuse_ino_t parent, const char *name,
+    mode_t mode, struct fuse_file_info *fi)
+{
+    struct fuse_entry_param Entry;
+    int Fd, Error;
+
+    Fd = openat(FdFromIno(req, parent), name,
+        (fi->flags | O_CREAT | O_CLOEXEC) & ~O_NOFOLLOW, mode);
+    if (-1 == Fd)
+    {
+        fuse_reply_err(req, errno);
+        return;
+    }
+
+    Error = DoLookup(req, parent, name, &Entry);
+    if (0 != Error)
+    {
+        close(Fd);
+        fuse_reply_err(req, Error);
+        return;
+    }
+
+    fi->fh = (uint64_t)Fd;
+    fuse_reply_create(req, &Entry, fi);
+}
+
+static void PtfsOpen(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    int Fd = ReopenInode(InodeFromIno(req, ino), fi->flags);
+
+    if (-1 == Fd)
+    {
+        fuse_reply_err(req, errno);
+        return;
+    }
+
+    fi->fh = (uint64_t)Fd;
+    fuse_reply_open(req, fi);
+}
+
+static void PtfsRelease(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    close((int)fi->fh);
+    fuse_reply_err(req, 0);
+}
+
+static void PtfsFlush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    /* closing a duplicate reports deferred write errors without closing the handle itself */
+    int Result = close(dup((int)fi->fh));
+
+    fuse_reply_err(req, -1 == Result ? errno : 0);
+}
+
+static void PtfsFsync(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi)
+{
+    int Result = datasync ? fdatasync((int)fi->fh) : fsync((int)fi->fh);
+
+    fuse_reply_err(req, -1 == Result ? errno : 0);
+}
+
+static void PtfsRead(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+    struct fuse_file_info *fi)
+{
+    struct fuse_bufvec Buf = FUSE_BUFVEC_INIT(size);
+
+    /* hand libfuse the descriptor; it will splice from it straight into /dev/fuse */
+    Buf.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+    Buf.buf[0].fd = (int)fi->fh;
+    Buf.buf[0].pos = off;
+
+    fuse_reply_data(req, &Buf, FUSE_BUF_SPLICE_MOVE);
+}
+
+static void PtfsWriteBuf(fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec *in_buf,
+    off_t off, struct fuse_file_info *fi)
+{
+    struct fuse_bufvec OutBuf = FUSE_BUFVEC_INIT(fuse_buf_size(in_buf));
+    ssize_t Result;
+
+    OutBuf.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+    OutBuf.buf[0].fd = (int)fi->fh;
+    OutBuf.buf[0].pos = off;
+
+    Result = fuse_buf_copy(&OutBuf, in_buf, FUSE_BUF_SPLICE_NONBLOCK);
+    if (0 > Result)
+        fuse_reply_err(req, (int)-Result);
+    else
+        fuse_reply_write(req, (size_t)Result);
+}
+
+static void PtfsUnlink(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    int Result = unlinkat(FdFromIno(req, parent), name, 0);
+
+    fuse_reply_err(req, -1 == Result ? errno : 0);
+}
+
+static void PtfsRmdir(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    int Result = unlinkat(FdFromIno(req, parent), name, AT_REMOVEDIR);
+
+    fuse_reply_err(req, -1 == Result ? errno : 0);
+}
+
+static void PtfsRename(fuse_req_t req, fuse_ino_t parent, const char *name,
+    fuse_ino_t newparent, const char *newname, unsigned int flags)
+{
+    int Result;
+
+    /* flags carries RENAME_NOREPLACE / RENAME_EXCHANGE, i.e. the inverse of ReplaceIfExists */
+    if (0 != flags)
+        Result = renameat2(FdFromIno(req, parent), name, FdFromIno(req, newparent), newname, flags);
+    else
+        Result = renameat(FdFromIno(req, parent), name, FdFromIno(req, newparent), newname);
+
+    fuse_reply_err(req, -1 == Result ? errno : 0);
+}
+
+static void PtfsOpenDir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    PTFS_DIR_CONTEXT *DirContext;
+    int Fd;
+
+    DirContext = malloc(sizeof *DirContext);
+    if (0 == DirContext)
+    {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+    memset(DirContext, 0, sizeof *DirContext);
+
+    Fd = openat(FdFromIno(req, ino), ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (-1 == Fd || 0 == (DirContext->Dir = fdopendir(Fd)))
+    {
+        int Error = errno;
+        if (-1 != Fd)
+            close(Fd);
+        free(DirContext);
+        fuse_reply_err(req, Error);
+        return;
+    }
+
+    fi->fh = (uint64_t)(uintptr_t)DirContext;
+    fuse_reply_open(req, fi);
+}
+
+static void DoReadDir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+    struct fuse_file_info *fi, int Plus)
+{
+    PTFS_DIR_CONTEXT *DirContext = (PTFS_DIR_CONTEXT *)(uintptr_t)fi->fh;
+    char *Buffer, *P;
+    size_t Remaining;
+    int Error = 0;
+
+    Buffer = malloc(size);
+    if (0 == Buffer)
+    {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+    P = Buffer;
+    Remaining = size;
+
+    if (off != DirContext->Offset)
+    {
+        seekdir(DirContext->Dir, off);
+        DirContext->Entry = 0;
+        DirContext->Offset = off;
+    }
+
+    for (;;)
+    {
+        struct dirent *Dirent;
+        size_t EntrySize;
+        off_t NextOffset;
+
+        if (0 == DirContext->Entry)
+        {
+            errno = 0;
+            DirContext->Entry = readdir(DirContext->Dir);
+            if (0 == DirContext->Entry)
+            {
+                Error = errno;
+                break;
+            }
+        }
+        Dirent = DirContext->Entry;
+        NextOffset = Dirent->d_off;
+
+        if (Plus)
+        {
+            struct fuse_entry_param Entry;
+            int IsDot = 0 == strcmp(Dirent->d_name, ".") || 0 == strcmp(Dirent->d_name, "..");
+
+            if (IsDot)
+            {
+                /* "." and ".." are not looked up, so they must not take a reference */
+                memset(&Entry, 0, sizeof Entry);
+                Entry.attr.st_ino = Dirent->d_ino;
+                Entry.attr.st_mode = Dirent->d_type << 12;
+            }
+            else if (0 != (Error = DoLookup(req, ino, Dirent->d_name, &Entry)))
+            {
+                if (ENOENT != Error && ESTALE != Error)
+                    break;
+                /* deleted since readdir: skip it, or every later call would stop here again */
+                Error = 0;
+                DirContext->Entry = 0;
+                DirContext->Offset = NextOffset;
+                continue;
+            }
+
+            EntrySize = fuse_add_direntry_plus(req, P, Remaining, Dirent->d_name, &Entry, NextOffset);
+            if (EntrySize > Remaining)
+            {
+                /* does not fit; give back the reference we just took */
+                if (!IsDot && FUSE_ROOT_ID != Entry.ino)
+                    InodeUnref(PtfsFromReq(req), InodeFromIno(req, Entry.ino), 1);
+                break;
+            }
+        }
+        else
+        {
+            struct stat St;
+
+            memset(&St, 0, sizeof St);
+            St.st_ino = Dirent->d_ino;
+            St.st_mode = Dirent->d_type << 12;
+
+            EntrySize = fuse_add_direntry(req, P, Remaining, Dirent->d_name, &St, NextOffset);
+            if (EntrySize > Remaining)
+                break;
+        }
+
+        P += EntrySize;
+        Remaining -= EntrySize;
+        DirContext->Entry = 0;
+        DirContext->Offset = NextOffset;
+    }
+
+    /* report an error only if nothing at all could be returned */
+    if (0 != Error && P == Buffer)
+        fuse_reply_err(req, Error);
+    else
+        fuse_reply_buf(req, Buffer, (size_t)(P - Buffer));
+
+    free(Buffer);
+}
+
+static void PtfsReadDir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+    struct fuse_file_info *fi)
+{
+    DoReadDir(req, ino, size, off, fi, 0);
+}
+
+static void PtfsReadDirPlus(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+    struct fuse_file_info *fi)
+{
+    DoReadDir(req, ino, size, off, fi, 1);
+}
+
+static void PtfsReleaseDir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    PTFS_DIR_CONTEXT *DirContext = (PTFS_DIR_CONTEXT *)(uintptr_t)fi->fh;
+
+    closedir(DirContext->Dir);
+    free(DirContext);
+    fuse_reply_err(req, 0);
+}
+
+static void PtfsStatFs(fuse_req_t req, fuse_ino_t ino)
+{
+    struct statvfs Stv;
+
+    if (-1 == fstatvfs(FdFromIno(req, ino), &Stv))
+        fuse_reply_err(req, errno);
+    else
+        fuse_reply_statfs(req, &Stv);
+}
+
+static const struct fuse_lowlevel_ops PtfsOps =
+{
+    .init = PtfsInit,
+    .lookup = PtfsLookup,
+    .forget = PtfsForget,
+    .forget_multi = PtfsForgetMulti,
+    .getattr = PtfsGetAttr,
+    .setattr = PtfsSetAttr,
+    .mkdir = PtfsMkdir,
+    .unlink = PtfsUnlink,
+    .rmdir = PtfsRmdir,
+    .rename = PtfsRename,
+    .create = PtfsCreate,
+    .open = PtfsOpen,
+    .read = PtfsRead,
+    .write_buf = PtfsWriteBuf,
+    .flush = PtfsFlush,
+    .fsync = PtfsFsync,
+    .release = PtfsRelease,
+    .opendir = PtfsOpenDir,
+    .readdir = PtfsReadDir,
+    .readdirplus = PtfsReadDirPlus,
+    .releasedir = PtfsReleaseDir,
+    .statfs = PtfsStatFs,
+};
+
+/**
+ * Mounts the pass through file system and serves requests until it is unmounted
+ * or the process receives SIGINT/SIGTERM. This is the Linux replacement for
+ * FspServiceRun + SvcStart and accepts the same -d/-p/-m options, plus:
+ *
+ *   -t MaxIdleThreads   worker threads kept around by the multithreaded loop
+ *   -o FuseOptions      passed through to libfuse (e.g. allow_other)
+ *
+ * Mounted, if not null, is called once the mount is in place and before the session
+ * loop starts. The file system cannot answer requests until this function returns, so
+ * Mounted must not access the mount itself (e.g. it should start a thread that does).
+ */
+int start_fuse_filesystem(int argc, char *argv[], void (*Mounted)(void))
+{
+    char **argp, **arge;
+    char *PassThrough = 0;
+    char *MountPoint = 0;
+    unsigned MaxIdleThreads = 16;
+    struct fuse_args Args = FUSE_ARGS_INIT(0, 0);
+    struct fuse_loop_config LoopConfig;
+    struct fuse_session *Session = 0;
+    struct stat St;
+    PTFS *Ptfs = 0;
+    int Result = 1;
+
+    fuse_opt_add_arg(&Args, argv[0]);
+
+    Ptfs = malloc(sizeof *Ptfs);
+    if (0 == Ptfs)
+        goto exit;
+    memset(Ptfs, 0, sizeof *Ptfs);
+    Ptfs->Root.Fd = -1;
+    pthread_mutex_init(&Ptfs->Lock, 0);
+
+    for (argp = argv + 1, arge = argv + argc; arge > argp; argp++)
+    {
+        if ('-' != argp[0][0] || arge <= argp + 1)
+            goto usage;
+        switch (argp[0][1])
+        {
+        case 'd':
+            Ptfs->Debug = 0 != strtol(*++argp, 0, 0);
+            if (Ptfs->Debug)
+                fuse_opt_add_arg(&Args, "-d");
+            break;
+        case 'm':
+            MountPoint = *++argp;
+            break;
+        case 'o':
+            fuse_opt_add_arg(&Args, "-o");
+            fuse_opt_add_arg(&Args, *++argp);
+            break;
+        case 'p':
+            PassThrough = *++argp;
+            break;
+        case 't':
+            MaxIdleThreads = (unsigned)strtoul(*++argp, 0, 0);
+            break;
+        default:
+            goto usage;
+        }
+    }
+
+    if (0 == PassThrough || 0 == MountPoint)
+        goto usage;
+
+    Ptfs->Root.Fd = open(PassThrough, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (-1 == Ptfs->Root.Fd || -1 == fstat(Ptfs->Root.Fd, &St))
+    {
+        fprintf(stderr, PROGNAME ": cannot open %s: %s\n", PassThrough, strerror(errno));
+        goto exit;
+    }
+    Ptfs->Root.Ino = St.st_ino;
+    Ptfs->Root.Dev = St.st_dev;
+
+    Session = fuse_session_new(&Args, &PtfsOps, sizeof PtfsOps, Ptfs);
+    if (0 == Session)
+    {
+        fprintf(stderr, PROGNAME ": cannot create file system\n");
+        goto exit;
+    }
+
+    if (0 != fuse_set_signal_handlers(Session))
+        goto exit;
+
+    if (0 != fuse_session_mount(Session, MountPoint))
+    {
+        fprintf(stderr, PROGNAME ": cannot mount file system on %s\n", MountPoint);
+        fuse_remove_signal_handlers(Session);
+        goto exit;
+    }
+
+    fprintf(stderr, PROGNAME " -p %s -m %s\n", PassThrough, MountPoint);
+
+    if (0 != Mounted)
+        Mounted();
+
+    /* one /dev/fuse descriptor per worker thread avoids contention on a single queue */
+    LoopConfig.clone_fd = 1;
+    LoopConfig.max_idle_threads = MaxIdleThreads;
+    Result = fuse_session_loop_mt(Session, &LoopConfig);
+
+    fuse_session_unmount(Session);
+    fuse_remove_signal_handlers(Session);
+
+exit:
+    if (0 != Session)
+        fuse_session_destroy(Session);
+    if (0 != Ptfs)
+    {
+        if (-1 != Ptfs->Root.Fd)
+            close(Ptfs->Root.Fd);
+        pthread_mutex_destroy(&Ptfs->Lock);
+        free(Ptfs);
+    }
+    fuse_opt_free_args(&Args);
+
+    return Result;
+
+usage:
+    fprintf(stderr, ""
+        "usage: %s OPTIONS\n"
+        "\n"
+        "options:\n"
+        "    -d DebugFlags       [non-zero: enable debug logs]\n"
+        "    -p Directory        [directory to expose as pass through file system]\n"
+        "    -m MountPoint       [directory]\n"
+        "    -t MaxIdleThreads   [worker threads of the session loop; default 16]\n"
+        "    -o FuseOptions      [options passed to libfuse]\n",
+        argv[0]);
+
+    Result = 2;
+    goto exit;
+}
+
+#endif /* !_WIN32 */
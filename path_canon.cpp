@@ -0,0 +1,103 @@
+﻿#include "path_canon.h"
+
+namespace {
+
+typedef native_string::value_type native_char;
+
+#ifdef _WIN32
+const native_char kSeparator = L'\\';
+#else
+const native_char kSeparator = '/';
+#endif
+
+inline bool is_separator(native_char c)
+{
+    return c == '/' || c == '\\';
+}
+
+inline native_char ascii_upper(native_char c)
+{
+    return c >= 'a' && c <= 'z' ? (native_char)(c - 'a' + 'A') : c;
+}
+
+/**
+ * @brief Whether 'base' (a name up to its first '.') is a DOS device name, in any case.
+ */
+bool is_device_name(native_string_view base)
+{
+    // "NUL .txt" is the device too: Win32 ignores spaces before the extension.
+    while (!base.empty() && base.back() == ' ') base.remove_suffix(1);
+
+    static const char* const kDevices[] = { "CON", "PRN", "AUX", "NUL", "CONIN$", "CONOUT$" };
+    for (const char* device : kDevices) {
+        size_t i = 0;
+        while (device[i] && i < base.size() && ascii_upper(base[i]) == (native_char)device[i]) i++;
+        if (!device[i] && i == base.size()) return true;
+    }
+    // COM0-COM9 and LPT0-LPT9.
+    if (base.size() == 4 && base[3] >= '0' && base[3] <= '9') {
+        native_char a = ascii_upper(base[0]), b = ascii_upper(base[1]), c = ascii_upper(base[2]);
+        return (a == 'C' && b == 'O' && c == 'M') || (a == 'L' && b == 'P' && c == 'T');
+    }
+    return false;
+}
+
+PathStatus check_windows_segment(native_string_view segment)
+{
+    for (native_char c : segment) {
+        if ((unsigned)c < 32 || c == '<' || c == '>' || c == ':' || c == '"' || c == '|' || c == '?' || c == '*') {
+            return PathStatus::invalid_character;
+        }
+    }
+    // Win32 strips trailing dots and spaces, so "a.txt." would name "a.txt".
+    if (segment.back() == '.' || segment.back() == ' ') {
+        return PathStatus::reserved_name;
+    }
+    size_t dot = segment.find('.');
+    if (is_device_name(segment.substr(0, dot == native_string_view::npos ? segment.size() : dot))) {
+        return PathStatus::reserved_name;
+    }
+    return PathStatus::ok;
+}
+
+} // namespace
+
+PathStatus append_canonical_path(native_string_view requested, native_string& out, bool windows_names)
+{
+    const size_t floor = out.size();
+    const native_char* p = requested.data();
+    const native_char* end = p + requested.size();
+
+    while (p < end) {
+        // --- 1. The next segment ---
+        while (p < end && is_separator(*p)) p++;
+        const native_char* start = p;
+        while (p < end && !is_separator(*p)) {
+            if (*p == 0) return PathStatus::invalid_character;
+            p++;
+        }
+        native_string_view segment(start, p - start);
+        if (segment.empty() || (segment.size() == 1 && segment[0] == '.')) {
+            continue;
+        }
+
+        // --- 2. ".." drops the last segment, but never anything before 'floor' ---
+        if (segment.size() == 2 && segment[0] == '.' && segment[1] == '.') {
+            if (out.size() == floor) return PathStatus::escapes_root;
+            size_t separator = out.rfind(kSeparator);
+            out.resize(separator == native_string::npos || separator < floor ? floor : separator);
+            continue;
+        }
+
+        // --- 3. Anything else is a name ---
+        if (windows_names) {
+            PathStatus status = check_windows_segment(segment);
+            if (status != PathStatus::ok) return status;
+        }
+        if (out.size() != floor || (floor != 0 && !is_separator(out[floor - 1]))) {
+            out += kSeparator;
+        }
+        out.append(segment.data(), segment.size());
+    }
+    return PathStatus::ok;
+}
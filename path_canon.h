@@ -0,0 +1,39 @@
+﻿#pragma once
+
+#include "platform.h"
+#include <string_view>
+
+typedef std::basic_string_view<native_string::value_type> native_string_view;
+
+#ifdef _WIN32
+const bool kWindowsNames = true;
+#else
+const bool kWindowsNames = false;
+#endif
+
+enum class PathStatus {
+    ok,
+    escapes_root,                   // A ".." would climb above the starting directory.
+    reserved_name,                  // A Windows device name (CON, NUL, COM1, ...) or a name ending in '.' or ' '.
+    invalid_character,              // NUL, or on Windows a control character or one of < > : " | ? *
+};
+
+/**
+ * @brief Canonicalizes a client-supplied relative path without touching the file system.
+ *
+ * The path is split into segments at '/' and '\', empty and "." segments are dropped,
+ * and ".." removes the previous segment. Each remaining segment is appended to 'out'
+ * after a native separator. 'out' must already hold the directory the path is relative
+ * to (normally the root, with its trailing separator), and ".." can never remove any
+ * of it.
+ *
+ * With Windows rules, a segment is also refused if Win32 would quietly reinterpret it:
+ * device names (with or without an extension), trailing dots or spaces, and drive or
+ * stream colons. Paths built this way can be used as extended-length ("\\?\") paths,
+ * which Win32 does not normalize again and which have no MAX_PATH limit.
+ *
+ * Works on views of the input and never allocates, except to grow 'out'.
+ *
+ * @return PathStatus::ok, or why the path was refused ('out' is then unspecified).
+ */
+PathStatus append_canonical_path(native_string_view requested, native_string& out, bool windows_names = kWindowsNames);
@@ -0,0 +1,322 @@
+﻿#pragma once
+
+#include <string>
+#include <vector>
+#include <ctime>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * @brief The platform abstraction layer used by the web server.
+ *
+ * server.cpp never talks to the operating system directly for anything that differs
+ * between Windows and Linux. Instead it calls the functions declared here, which are
+ * implemented once per platform:
+ *
+ *   - platform_win32.cpp : the original Win32 code (UTF-16 paths, CreateThread, ...).
+ *   - platform_posix.cpp : a native Linux implementation (UTF-8 paths, std::thread, realpath, unlink).
+ *
+ * Paths are passed around as 'native_string', which is the string type the OS uses
+ * natively for file names: std::wstring (UTF-16) on Windows and std::string (UTF-8) on Linux.
+ * This keeps every handler free of #ifdefs and avoids any conversion on Linux.
+ */
+
+#ifdef _WIN32
+typedef std::wstring native_string;
+#define NATIVE_TEXT(s) L##s
+#else
+typedef std::string native_string;
+#define NATIVE_TEXT(s) s
+#endif
+
+/**
+ * @brief An open file: a HANDLE on Windows, a file descriptor on Linux.
+ */
+#ifdef _WIN32
+typedef void* platform_file;
+#else
+typedef int platform_file;
+#endif
+#define PLATFORM_INVALID_FILE ((platform_file)-1)
+
+/**
+ * @brief Converts a wide string (UTF-16 on Windows, UTF-32 on Linux) to a UTF-8 encoded string.
+ */
+std::string wstring_to_utf8(const std::wstring& wstr);
+
+/**
+ * @brief Converts a UTF-8 encoded string to a wide string (UTF-16 on Windows, UTF-32 on Linux).
+ */
+std::wstring utf8_to_wstring(const std::string& str);
+
+/**
+ * @brief Converts a UTF-8 string (as received over HTTP) into the OS's native path string.
+ *
+ * On Linux this is a plain copy because the kernel already speaks UTF-8.
+ */
+native_string utf8_to_native(const std::string& str);
+
+/**
+ * @brief Converts a native path string back to UTF-8 for use in JSON responses.
+ */
+std::string native_to_utf8(const native_string& str);
+
+/**
+ * @brief Returns the root directory of the virtual drive, always ending with a separator.
+ *
+ * On Windows this is "C:\PersonaRoot\", spelled as an extended-length path ("\\?\C:\...").
+ * On Linux it defaults to "./PersonaRoot/". Either can be changed with
+ * platform_set_root_path() before the server starts.
+ */
+const native_string& platform_root_path();
+
+/**
+ * @brief Overrides the virtual drive root. Must be called before start_web_server().
+ *
+ * The directory is also kept open for the rest of the process, which pins it in place
+ * (and on Linux lets files below it be opened relative to it).
+ *
+ * @param path The directory to use as the root. It is canonicalized immediately.
+ * @return true if the directory exists and was accepted, false otherwise.
+ */
+bool platform_set_root_path(const native_string& path);
+
+/**
+ * @brief Acts as a security checkpoint to prevent directory traversal attacks.
+ *
+ * This function takes a filename provided by a user, combines it with the virtual
+ * drive's root path, and verifies that the final, fully-resolved path is still safely
+ * within that root directory. '.' and '..' are resolved on the string (path_canon.h),
+ * without system calls or MAX_PATH limits. On Linux, symlinks that lead out of the root
+ * are refused when the path is opened (openat2 with RESOLVE_BENEATH), or checked here
+ * with realpath() on kernels without it.
+ *
+ * @param requested_filename The filename or relative path from the user's request.
+ * @param out_full_path An output parameter that will be filled with the safe,
+ * canonical path if the check is successful.
+ * @return true if the path is safe and within the root, false otherwise.
+ */
+bool is_safe_path(const native_string& requested_filename, native_string& out_full_path);
+
+/**
+ * @brief Deletes a single file. Returns true on success.
+ */
+bool platform_delete_file(const native_string& path);
+
+/**
+ * @brief Renames a file, replacing any file already at 'to'. Returns true on success.
+ *
+ * Within one directory this is atomic: other readers see either the old file or the new one.
+ */
+bool platform_rename_file(const native_string& from, const native_string& to);
+
+/**
+ * @brief Thread-safe conversion of a time_t into local calendar time.
+ */
+bool platform_local_time(std::time_t time, std::tm& out);
+
+/**
+ * @brief Lists the names of all subdirectories (excluding "." and "..") of a directory.
+ *
+ * @param dir The directory to scan, relative to the working directory or absolute.
+ * @return std::vector<native_string> The bare names of the subdirectories, or an empty list on error.
+ */
+std::vector<native_string> platform_list_subdirectories(const native_string& dir);
+
+/**
+ * @brief Runs 'fn(arg)' on a new, detached background thread.
+ */
+void platform_start_thread(void (*fn)(void*), void* arg);
+
+/**
+ * @brief Watches a directory and everything below it for changes (inotify / ReadDirectoryChangesW).
+ *
+ * The watch runs on its own background thread for the rest of the process's life.
+ * 'callback(path, ctx)' is called on that thread with the full path of every file or
+ * directory that is created, modified, deleted or renamed. When the OS drops events
+ * (its queue overflowed), the callback receives 'dir' itself, meaning "anything below
+ * here may have changed".
+ *
+ * @return true if the watch was started.
+ */
+bool platform_watch_tree(const native_string& dir, void (*callback)(const native_string& path, void* ctx), void* ctx);
+
+/**
+ * @brief Opens an existing file for reading, shareable with concurrent writers and deleters.
+ *
+ * Only regular files open; directories, FIFOs and devices fail without blocking.
+ *
+ * On Linux, paths under the root are opened relative to the root's descriptor and the
+ * kernel refuses to resolve them outside it (openat2 with RESOLVE_BENEATH), in the same
+ * walk that opens the file. The other path-based calls below do the same.
+ *
+ * @return platform_file The open file, or PLATFORM_INVALID_FILE on failure.
+ */
+platform_file platform_open_read(const native_string& path);
+
+/**
+ * @brief Creates a file, or truncates an existing one, for writing.
+ *
+ * On Linux the open is confined to the root like platform_open_read().
+ *
+ * @return platform_file The open file, or PLATFORM_INVALID_FILE on failure.
+ */
+platform_file platform_open_write(const native_string& path);
+
+/**
+ * @brief Creates a new file for writing; fails if anything already has that name.
+ *
+ * On Linux the open is confined to the root like platform_open_read().
+ *
+ * @return platform_file The open file, or PLATFORM_INVALID_FILE on failure.
+ */
+platform_file platform_create_file(const native_string& path);
+
+/**
+ * @brief Writes all of 'length' bytes at the current position. Returns true on success.
+ */
+bool platform_write_all(platform_file file, const void* data, size_t length);
+
+/**
+ * @brief Reserves disk space for 'size' bytes without changing the file's size.
+ *
+ * A hint for large writes (fallocate / FileAllocationInfo); false where unsupported.
+ */
+bool platform_preallocate(platform_file file, std::uint64_t size);
+
+/**
+ * @brief Closes a file returned by platform_open_read(), platform_open_write() or platform_create_file().
+ */
+void platform_close_file(platform_file file);
+
+/**
+ * @brief The identity and metadata of a file, as returned by one stat call.
+ *
+ * (device, file_id) identifies the file itself regardless of its name; together with
+ * size and mtime it changes whenever the file is replaced or its content is modified.
+ */
+struct platform_file_info {
+    std::uint64_t size;
+    std::int64_t mtime_ns;      // Last write time, in nanoseconds since 1970-01-01 UTC.
+    std::uint64_t file_id;      // Inode number / NTFS file index.
+    std::uint64_t device;       // st_dev / volume serial number.
+    bool is_directory;
+};
+
+/**
+ * @brief Gets the metadata of an open file (fstat / GetFileInformationByHandle).
+ */
+bool platform_get_file_info(platform_file file, platform_file_info& out_info);
+
+/**
+ * @brief Gets the metadata of a file or directory by path, without opening it for reading.
+ */
+bool platform_stat_path(const native_string& path, platform_file_info& out_info);
+
+/**
+ * @brief One entry of a directory together with its metadata (see platform_read_directory()).
+ */
+struct platform_dir_entry {
+    native_string name;
+    platform_file_info info;    // On Linux, of a symlink's target if that is under the root. All zero if the entry could not be queried.
+    bool is_link;               // A symbolic link (Linux) or reparse point (Windows): walks must not descend into it.
+};
+
+/**
+ * @brief A directory opened for enumeration: a directory handle on Windows, a directory fd on Linux.
+ */
+typedef struct platform_directory_state* platform_directory;
+
+/**
+ * @brief Opens a directory for platform_read_directory().
+ *
+ * @return platform_directory The open directory, or nullptr on failure.
+ */
+platform_directory platform_open_directory(const native_string& path);
+
+/**
+ * @brief Reads the next entries of a directory ("." and ".." excluded) with their metadata.
+ *
+ * The names and metadata come from the OS in bulk, without one call per entry on Windows
+ * (GetFileInformationByHandleEx with FileIdBothDirectoryInfo returns both at once) and
+ * with one statx() per entry on Linux after getdents64() has read the names in large batches.
+ *
+ * @param max_entries Append at most this many entries to 'out'.
+ * @return long long The number of entries appended (0 at the end of the directory), or -1 on error.
+ */
+long long platform_read_directory(platform_directory dir, std::vector<platform_dir_entry>& out, size_t max_entries);
+
+/**
+ * @brief Closes a directory returned by platform_open_directory().
+ */
+void platform_close_directory(platform_directory dir);
+
+/**
+ * @brief Lists a whole directory with metadata, in the order the file system returns it.
+ *
+ * Same as reading the directory to the end with platform_read_directory(), except that
+ * on Linux the statx() calls of a large directory are split across several threads.
+ *
+ * @return true on success; on failure 'out' may hold a partial listing.
+ */
+bool platform_list_directory(const native_string& path, std::vector<platform_dir_entry>& out);
+
+/**
+ * @brief Reserves and commits 'size' bytes of zeroed memory directly from the OS (mmap / VirtualAlloc).
+ *
+ * Meant for large, long-lived buffers: they bypass the heap, so releasing one returns
+ * the pages to the OS right away instead of fragmenting the allocator.
+ *
+ * @return void* The memory, or nullptr on failure.
+ */
+void* platform_alloc_pages(size_t size);
+
+/**
+ * @brief Releases memory returned by platform_alloc_pages().
+ */
+void platform_free_pages(void* memory, size_t size);
+
+/**
+ * @brief Maps the first 'size' bytes of an open file into memory, read-only (mmap / MapViewOfFile).
+ *
+ * The mapping stays valid after the file is closed, until platform_unmap_file().
+ *
+ * @return const void* The mapped bytes, or nullptr on failure (or if 'size' is 0).
+ */
+const void* platform_map_file(platform_file file, std::uint64_t size);
+
+/**
+ * @brief Releases a mapping returned by platform_map_file().
+ */
+void platform_unmap_file(const void* view, std::uint64_t size);
+
+/**
+ * @brief Returns a per-user directory for data the server can always rebuild, creating it if needed.
+ *
+ * "%LOCALAPPDATA%\PersonaWeb" on Windows, "$XDG_CACHE_HOME/persona_web" (or "~/.cache/persona_web")
+ * on Linux. Used for the search index, which must not live inside the virtual drive itself.
+ *
+ * @return native_string The directory, without a trailing separator, or "" if there is none.
+ */
+native_string platform_cache_directory();
+
+/**
+ * @brief Reads up to 'length' bytes at 'offset' without moving any shared file position.
+ *
+ * This is safe to call from several threads on the same file (pread / overlapped ReadFile).
+ *
+ * @return long long The number of bytes read (0 at end of file), or -1 on error.
+ */
+long long platform_read_at(platform_file file, void* buffer, size_t length, std::uint64_t offset);
+
+/**
+ * @brief Sends a range of a file directly to a connected socket, without copying it through user space.
+ *
+ * Uses sendfile() on Linux and TransmitFile() on Windows. The caller must handle
+ * a short count by calling again with the remaining range.
+ *
+ * @param socket The connected socket (SOCKET / int), passed as an integer.
+ * @return long long The number of bytes sent, or -1 if the kernel could not send
+ * this file/socket pair (the caller should fall back to reading and writing).
+ */
+long long platform_send_file(std::uintptr_t socket, platform_file file, std::uint64_t offset, size_t length);
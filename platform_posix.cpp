@@ -0,0 +1,768 @@
+﻿#ifndef _WIN32
+
+#include "platform.h"
+#include "path_canon.h"
+#include "utf_transcode.h"
+#include <algorithm>
+#include <thread>
+#include <unordered_map>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#if defined(SYS_openat2) && __has_include(<linux/openat2.h>)
+#include <linux/openat2.h>
+#define PERSONA_HAVE_OPENAT2 1
+#endif
+
+/**
+ * @brief Converts a wide string (UTF-32 on Linux) to a UTF-8 encoded string.
+ *
+ * Linux has no WideCharToMultiByte, and the server itself never needs wide strings
+ * on this platform, but the function is kept so that code and tools shared with the
+ * Windows build behave identically. Both platforms use the same transcoder
+ * (utf_transcode.h); invalid code points are replaced with U+FFFD.
+ *
+ * @param wstr The wide string (std::wstring) to convert.
+ * @return std::string The resulting UTF-8 encoded string.
+ */
+std::string wstring_to_utf8(const std::wstring& wstr)
+{
+    std::string out;
+    wide_to_utf8(wstr, out);
+    return out;
+}
+
+/**
+ * @brief Converts a UTF-8 encoded string to a wide string (UTF-32 on Linux).
+ *
+ * Malformed sequences are replaced with U+FFFD, matching MultiByteToWideChar's default behavior.
+ *
+ * @param str The UTF-8 encoded string (std::string) to convert.
+ * @return std::wstring The resulting wide string.
+ */
+std::wstring utf8_to_wstring(const std::string& str)
+{
+    std::wstring out;
+    utf8_to_wide(str, out);
+    return out;
+}
+
+// On Linux the native path type already is UTF-8, so no conversion is needed.
+native_string utf8_to_native(const std::string& str) { return str; }
+std::string native_to_utf8(const native_string& str) { return str; }
+
+/**
+ * @brief The virtual drive root, canonical and with a trailing '/'.
+ *
+ * Defaults to "./PersonaRoot/" resolved against the working directory on first use.
+ */
+static native_string g_root_path;
+
+/**
+ * @brief The root, held open (O_PATH) for the life of the process.
+ *
+ * Paths under the root are opened relative to it (see root_relative()), so the kernel
+ * only walks the part below the root, and a root that is renamed or replaced later does
+ * not redirect them.
+ */
+static int g_root_fd = -1;
+
+/**
+ * @brief Whether openat2() can confine path resolution to the root (Linux 5.6+).
+ *
+ * Probed when the root is set. Without it, opens under the root are plain openat() calls
+ * and is_safe_path() falls back to checking symlinks with realpath().
+ */
+static bool g_confined_opens = false;
+
+const native_string& platform_root_path()
+{
+    if (g_root_path.empty()) {
+        platform_set_root_path("PersonaRoot");
+        // Even if the directory does not exist (yet), keep a well-formed prefix so is_safe_path fails closed.
+        if (g_root_path.empty()) g_root_path = "/nonexistent/PersonaRoot/";
+    }
+    return g_root_path;
+}
+
+bool platform_set_root_path(const native_string& path)
+{
+    // Resolve symlinks and relative components so that prefix checks compare real paths.
+    char buffer[PATH_MAX];
+    if (realpath(path.c_str(), buffer) == nullptr) {
+        return false;
+    }
+
+    int fd = open(buffer, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+
+    if (g_root_fd != -1) close(g_root_fd);
+    g_root_fd = fd;
+#ifdef PERSONA_HAVE_OPENAT2
+    struct open_how how = {};
+    how.flags = O_PATH | O_DIRECTORY | O_CLOEXEC;
+    how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+    int probe = (int)syscall(SYS_openat2, fd, ".", &how, sizeof(how));
+    g_confined_opens = probe != -1;
+    if (probe != -1) close(probe);
+#endif
+    g_root_path = buffer;
+    if (g_root_path.back() != '/') g_root_path += '/';
+    return true;
+}
+
+/**
+ * @brief Splits a path for an *at() call: the root's descriptor and the part below the
+ * root for paths under it (the root itself is "."), or AT_FDCWD and the whole path.
+ */
+static int root_relative(const native_string& path, const char*& relative)
+{
+    const native_string& root = platform_root_path();
+    if (g_root_fd != -1 && path.size() + 1 >= root.size() && path.compare(0, root.size() - 1, root, 0, root.size() - 1) == 0 &&
+        (path.size() + 1 == root.size() || path[root.size() - 1] == '/')) {
+        relative = path.size() > root.size() ? path.c_str() + root.size() : ".";
+        return g_root_fd;
+    }
+    relative = path.c_str();
+    return AT_FDCWD;
+}
+
+/**
+ * @brief openat() relative to 'dir', confined below 'dir' by the kernel when possible.
+ *
+ * With openat2(), RESOLVE_BENEATH makes the kernel refuse any ".." or symlink (absolute,
+ * or relative but climbing out) that would leave 'dir' while it walks the path, and
+ * RESOLVE_NO_MAGICLINKS refuses /proc-style links. Symlinks that stay inside still work.
+ * Checking and opening are then the same walk, so nothing can be swapped in between.
+ */
+static int open_beneath(int dir, const char* relative, int flags, mode_t mode = 0)
+{
+#ifdef PERSONA_HAVE_OPENAT2
+    if (g_confined_opens && dir == g_root_fd) {
+        struct open_how how = {};
+        how.flags = (std::uint64_t)(flags | O_CLOEXEC);
+        how.mode = (flags & O_CREAT) ? mode : 0;
+        how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+        int fd;
+        // EAGAIN: a concurrent rename raced a ".." inside a symlink; the walk is simply retried.
+        do {
+            fd = (int)syscall(SYS_openat2, dir, relative, &how, sizeof(how));
+        } while (fd == -1 && (errno == EAGAIN || errno == EINTR));
+        return fd;
+    }
+#endif
+    return openat(dir, relative, flags | O_CLOEXEC, mode);
+}
+
+/**
+ * @brief Opens a path under the root (see root_relative()) with open_beneath().
+ */
+static int open_in_root(const native_string& path, int flags, mode_t mode = 0)
+{
+    const char* relative;
+    int dir = root_relative(path, relative);
+    return open_beneath(dir, relative, flags, mode);
+}
+
+/**
+ * @brief Opens the directory containing 'path' (O_PATH, confined like open_in_root()) for
+ * the *at() calls that act on a name rather than an open file.
+ *
+ * @param leaf Set to the last segment of 'path'.
+ * @return The directory's descriptor, which the caller closes unless it is g_root_fd
+ * (the parent of names directly under the root), or -1.
+ */
+static int open_parent(const native_string& path, const char*& leaf)
+{
+    const char* relative;
+    int dir = root_relative(path, relative);
+    const char* slash = strrchr(relative, '/');
+    if (slash == nullptr) {
+        leaf = relative;
+        return dir;
+    }
+    leaf = slash + 1;
+    if (slash == relative) {
+        return open("/", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    }
+
+    char parent[PATH_MAX];
+    size_t length = (size_t)(slash - relative);
+    if (length >= sizeof(parent)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memcpy(parent, relative, length);
+    parent[length] = '\0';
+    return open_beneath(dir, parent, O_PATH | O_DIRECTORY);
+}
+
+static void close_parent(int fd)
+{
+    if (fd != g_root_fd && fd != AT_FDCWD && fd != -1) close(fd);
+}
+
+/**
+ * @brief Acts as a security checkpoint to prevent directory traversal attacks.
+ *
+ * The requested path is first canonicalized lexically (append_canonical_path()): '.'
+ * and '..' are resolved on the string, and a path that climbs above the root is
+ * refused without any system call.
+ *
+ * A symlink inside the root can still point anywhere. With openat2() that is caught by
+ * the kernel when the path is opened (open_beneath()), so the check ends here and the
+ * file system is walked once per request. On older kernels the path is resolved with
+ * realpath() and must still be inside the root; files that do not exist yet (e.g. for
+ * /api/writefile) are checked through their parent directory.
+ *
+ * @param requested_filename The filename or relative path from the user's request.
+ * @param out_full_path An output parameter that will be filled with the safe,
+ * canonical path if the check is successful.
+ * @return true if the path is safe and within the root, false otherwise.
+ */
+bool is_safe_path(const native_string& requested_filename, native_string& out_full_path)
+{
+    const native_string& root = platform_root_path();
+
+    // 1. Canonicalize on the string: separators, '.', '..', and nothing above the root.
+    out_full_path.assign(root);
+    if (append_canonical_path(requested_filename, out_full_path) != PathStatus::ok) {
+        return false;
+    }
+    if (out_full_path.size() == root.size() || g_confined_opens) {
+        return true;
+    }
+
+    // 2. Without openat2(): resolve symlinks; for a file that does not exist yet, resolve its parent.
+    char resolved[PATH_MAX];
+    if (realpath(out_full_path.c_str(), resolved) == nullptr) {
+        size_t slash = out_full_path.rfind('/');
+        out_full_path[slash] = '\0';
+        const char* parent = realpath(out_full_path.c_str(), resolved);
+        out_full_path[slash] = '/';
+        if (parent == nullptr || strlen(resolved) + 1 >= sizeof(resolved)) {
+            return false;
+        }
+        strcat(resolved, "/");
+    }
+
+    // 3. Final defense: the resolved path must still be the root or inside it.
+    size_t length = strlen(resolved);
+    if (length + 1 == root.size()) {
+        return root.compare(0, length, resolved) == 0;
+    }
+    return length >= root.size() && root.compare(0, root.size(), resolved, root.size()) == 0;
+}
+
+bool platform_delete_file(const native_string& path)
+{
+    // unlinkat() never follows the last segment, so only the directories leading to it need confining.
+    const char* leaf;
+    int parent = open_parent(path, leaf);
+    if (parent == -1) {
+        return false;
+    }
+    bool deleted = unlinkat(parent, leaf, 0) == 0;
+    close_parent(parent);
+    return deleted;
+}
+
+bool platform_rename_file(const native_string& from, const native_string& to)
+{
+    const char* from_leaf;
+    const char* to_leaf;
+    int from_parent = open_parent(from, from_leaf);
+    int to_parent = open_parent(to, to_leaf);
+    bool renamed = from_parent != -1 && to_parent != -1 && renameat(from_parent, from_leaf, to_parent, to_leaf) == 0;
+    close_parent(from_parent);
+    close_parent(to_parent);
+    return renamed;
+}
+
+bool platform_local_time(std::time_t time, std::tm& out)
+{
+    return localtime_r(&time, &out) != nullptr;
+}
+
+std::vector<native_string> platform_list_subdirectories(const native_string& dir)
+{
+    std::vector<native_string> names;
+
+    DIR* handle = opendir(dir.c_str());
+    if (handle == nullptr) {
+        return names;
+    }
+
+    while (struct dirent* entry = readdir(handle)) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+
+        // d_type is not filled in by every filesystem; fall back to a stat in that case.
+        bool is_dir = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_UNKNOWN) {
+            struct stat st;
+            is_dir = fstatat(dirfd(handle), entry->d_name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+        }
+        if (is_dir) names.push_back(entry->d_name);
+    }
+
+    closedir(handle);
+    return names;
+}
+
+void platform_start_thread(void (*fn)(void*), void* arg)
+{
+    std::thread(fn, arg).detach();
+}
+
+/**
+ * @brief The state of one platform_watch_tree() call, owned by its thread.
+ *
+ * inotify watches single directories, so every directory below the root gets its own
+ * watch descriptor, and directories created later are added as their events arrive.
+ */
+struct tree_watch {
+    int fd;
+    native_string root;
+    std::unordered_map<int, native_string> directories;
+    void (*callback)(const native_string& path, void* ctx);
+    void* ctx;
+};
+
+static void add_tree_watches(tree_watch& watch, const native_string& dir)
+{
+    const uint32_t kEvents = IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB |
+        IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+    int wd = inotify_add_watch(watch.fd, dir.c_str(), kEvents);
+    if (wd == -1) {
+        return;
+    }
+    watch.directories[wd] = dir;
+
+    for (const native_string& name : platform_list_subdirectories(dir)) {
+        add_tree_watches(watch, dir + "/" + name);
+    }
+}
+
+static void tree_watch_thread(void* arg)
+{
+    tree_watch* watch = (tree_watch*)arg;
+
+    // inotify_event records are variable-sized; the buffer must be aligned for the struct.
+    alignas(struct inotify_event) char buffer[64 * 1024];
+    for (;;) {
+        ssize_t length = read(watch->fd, buffer, sizeof(buffer));
+        if (length == -1 && errno == EINTR) continue;
+        if (length <= 0) break;
+
+        for (char* p = buffer; p < buffer + length;) {
+            const struct inotify_event* event = (const struct inotify_event*)p;
+            p += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                watch->callback(watch->root, watch->ctx);
+                continue;
+            }
+
+            auto found = watch->directories.find(event->wd);
+            if (found == watch->directories.end()) continue;
+            if (event->mask & IN_IGNORED) {
+                // The directory is gone (or was unwatched); its parent reports the deletion itself.
+                watch->directories.erase(found);
+                continue;
+            }
+
+            native_string path = found->second;
+            if (event->len > 0 && event->name[0] != '\0') {
+                path += '/';
+                path += event->name;
+            }
+            if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO))) {
+                add_tree_watches(*watch, path);
+            }
+            watch->callback(path, watch->ctx);
+        }
+    }
+
+    close(watch->fd);
+    delete watch;
+}
+
+bool platform_watch_tree(const native_string& dir, void (*callback)(const native_string& path, void* ctx), void* ctx)
+{
+    int fd = inotify_init1(IN_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+
+    tree_watch* watch = new tree_watch{ fd, dir, {}, callback, ctx };
+    while (watch->root.size() > 1 && watch->root.back() == '/') watch->root.pop_back();
+    add_tree_watches(*watch, watch->root);
+    if (watch->directories.empty()) {
+        close(fd);
+        delete watch;
+        return false;
+    }
+
+    platform_start_thread(tree_watch_thread, watch);
+    return true;
+}
+
+platform_file platform_open_read(const native_string& path)
+{
+    // O_NONBLOCK so that opening a FIFO (which waits for a writer) returns at once.
+    int fd = open_in_root(path, O_RDONLY | O_NONBLOCK);
+    if (fd == -1) {
+        return PLATFORM_INVALID_FILE;
+    }
+
+    // Only regular files are served: unlike CreateFileW, open() succeeds on directories, and
+    // FIFOs, sockets and devices would block or never end. Then make reads blocking again.
+    struct stat st;
+    int flags;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || (flags = fcntl(fd, F_GETFL)) == -1 ||
+        fcntl(fd, F_SETFL, flags & ~O_NONBLOCK) == -1) {
+        close(fd);
+        return PLATFORM_INVALID_FILE;
+    }
+
+    // Media files are read front to back; let the kernel read ahead aggressively.
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    return fd;
+}
+
+platform_file platform_open_write(const native_string& path)
+{
+    int fd = open_in_root(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    return fd == -1 ? PLATFORM_INVALID_FILE : fd;
+}
+
+platform_file platform_create_file(const native_string& path)
+{
+    int fd = open_in_root(path, O_WRONLY | O_CREAT | O_EXCL, 0666);
+    return fd == -1 ? PLATFORM_INVALID_FILE : fd;
+}
+
+bool platform_write_all(platform_file file, const void* data, size_t length)
+{
+    const char* p = (const char*)data;
+    while (length > 0) {
+        ssize_t written = write(file, p, length);
+        if (written == -1) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += written;
+        length -= (size_t)written;
+    }
+    return true;
+}
+
+bool platform_preallocate(platform_file file, std::uint64_t size)
+{
+    // KEEP_SIZE: the blocks are reserved, but the file only grows as it is written.
+    return fallocate(file, FALLOC_FL_KEEP_SIZE, 0, (off_t)size) == 0;
+}
+
+void platform_close_file(platform_file file)
+{
+    close(file);
+}
+
+/**
+ * @brief Fills a platform_file_info from a stat result.
+ */
+static void fill_file_info(const struct stat& st, platform_file_info& out_info)
+{
+    out_info.size = (std::uint64_t)st.st_size;
+    out_info.mtime_ns = (std::int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    out_info.file_id = (std::uint64_t)st.st_ino;
+    out_info.device = (std::uint64_t)st.st_dev;
+    out_info.is_directory = S_ISDIR(st.st_mode);
+}
+
+bool platform_get_file_info(platform_file file, platform_file_info& out_info)
+{
+    struct stat st;
+    if (fstat(file, &st) != 0) {
+        return false;
+    }
+    fill_file_info(st, out_info);
+    return true;
+}
+
+/**
+ * @brief Opens (O_PATH) what a symlink under the root points to, confined like any other
+ * open; -1 if it dangles or leads out of the root.
+ */
+static int open_link_target(const native_string& path)
+{
+    int fd = open_in_root(path, O_PATH);
+    if (fd == -1 || g_confined_opens) {
+        return fd;
+    }
+    // Without openat2() the open was not confined: check where it ended up.
+    char resolved[PATH_MAX];
+    const native_string& root = platform_root_path();
+    if (realpath(path.c_str(), resolved) == nullptr || (native_string(resolved) + '/').compare(0, root.size(), root) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool platform_stat_path(const native_string& path, platform_file_info& out_info)
+{
+    // The last segment is not followed here; if it is a symlink, its target is opened
+    // (confined like any other open) and described instead.
+    const char* leaf;
+    int parent = open_parent(path, leaf);
+    if (parent == -1) {
+        return false;
+    }
+    struct stat st;
+    bool found = fstatat(parent, *leaf ? leaf : ".", &st, AT_SYMLINK_NOFOLLOW) == 0;
+    close_parent(parent);
+    if (found && S_ISLNK(st.st_mode)) {
+        int fd = open_link_target(path);
+        found = fd != -1 && fstat(fd, &st) == 0;
+        if (fd != -1) close(fd);
+    }
+    if (!found) {
+        return false;
+    }
+    fill_file_info(st, out_info);
+    return true;
+}
+
+/**
+ * @brief The state of one platform_open_directory() call.
+ */
+struct platform_directory_state {
+    int fd;
+    native_string path;
+    size_t position;            // Next record in 'buffer'.
+    size_t length;              // Bytes of records in 'buffer'.
+    // getdents64() returns as many records as fit, so a large buffer means few system calls.
+    alignas(struct dirent64) char buffer[64 * 1024];
+};
+
+// Directories with more entries than this get their statx() calls split across threads.
+static const size_t kParallelStatThreshold = 4096;
+
+platform_directory platform_open_directory(const native_string& path)
+{
+    int fd = open_in_root(path, O_RDONLY | O_DIRECTORY);
+    if (fd == -1) {
+        return nullptr;
+    }
+    platform_directory dir = new platform_directory_state;
+    dir->fd = fd;
+    dir->path = path;
+    dir->position = 0;
+    dir->length = 0;
+    return dir;
+}
+
+void platform_close_directory(platform_directory dir)
+{
+    close(dir->fd);
+    delete dir;
+}
+
+/**
+ * @brief Appends up to 'max_entries' names from getdents64(), with only the d_type guess of is_directory.
+ *
+ * @return long long The number of entries appended, or -1 on error.
+ */
+static long long read_directory_names(platform_directory dir, std::vector<platform_dir_entry>& out, size_t max_entries)
+{
+    size_t added = 0;
+    while (added < max_entries) {
+        if (dir->position >= dir->length) {
+            long n;
+            do {
+                n = syscall(SYS_getdents64, dir->fd, dir->buffer, sizeof(dir->buffer));
+            } while (n == -1 && errno == EINTR);
+            if (n < 0) return -1;
+            if (n == 0) break;
+            dir->position = 0;
+            dir->length = (size_t)n;
+        }
+
+        const struct dirent64* entry = (const struct dirent64*)(dir->buffer + dir->position);
+        dir->position += entry->d_reclen;
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+
+        platform_dir_entry item;
+        item.name = entry->d_name;
+        item.info = platform_file_info{};
+        item.info.is_directory = entry->d_type == DT_DIR;
+        item.is_link = entry->d_type == DT_LNK;
+        if (entry->d_type == DT_UNKNOWN) {
+            // d_type is not filled in by every filesystem; only then does finding links cost a call.
+            struct stat st;
+            item.is_link = fstatat(dir->fd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISLNK(st.st_mode);
+        }
+        out.push_back(std::move(item));
+        added++;
+    }
+    return (long long)added;
+}
+
+/**
+ * @brief Fills in the metadata of entries [first, last) with statx() relative to the directory.
+ */
+static void stat_directory_entries(platform_directory dir, platform_dir_entry* first, platform_dir_entry* last)
+{
+    const unsigned int mask = STATX_TYPE | STATX_SIZE | STATX_MTIME | STATX_INO;
+    for (platform_dir_entry* entry = first; entry != last; ++entry) {
+        // AT_STATX_DONT_SYNC: network file systems may answer from their cache.
+        struct statx stx;
+        if (statx(dir->fd, entry->name.c_str(), AT_STATX_DONT_SYNC | AT_SYMLINK_NOFOLLOW, mask, &stx) != 0) {
+            continue;
+        }
+        if (S_ISLNK(stx.stx_mode)) {
+            // A symlink is described by its target when that is under the root, otherwise
+            // (dangling, or leading out of the root) by the link itself.
+            native_string path = dir->path;
+            if (path.empty() || path.back() != '/') path += '/';
+            path += entry->name;
+            int fd = open_link_target(path);
+            if (fd != -1) {
+                struct statx target;
+                if (statx(fd, "", AT_EMPTY_PATH | AT_STATX_DONT_SYNC, mask, &target) == 0) stx = target;
+                close(fd);
+            }
+        }
+        entry->info.size = stx.stx_size;
+        entry->info.mtime_ns = (std::int64_t)stx.stx_mtime.tv_sec * 1000000000LL + stx.stx_mtime.tv_nsec;
+        entry->info.file_id = stx.stx_ino;
+        entry->info.device = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+        entry->info.is_directory = S_ISDIR(stx.stx_mode);
+    }
+}
+
+long long platform_read_directory(platform_directory dir, std::vector<platform_dir_entry>& out, size_t max_entries)
+{
+    size_t first = out.size();
+    long long added = read_directory_names(dir, out, max_entries);
+    if (added > 0) {
+        stat_directory_entries(dir, out.data() + first, out.data() + out.size());
+    }
+    return added;
+}
+
+bool platform_list_directory(const native_string& path, std::vector<platform_dir_entry>& out)
+{
+    platform_directory dir = platform_open_directory(path);
+    if (dir == nullptr) {
+        return false;
+    }
+
+    // --- 1. All the names first, a buffer full of records per system call ---
+    size_t first = out.size();
+    if (read_directory_names(dir, out, SIZE_MAX) < 0) {
+        platform_close_directory(dir);
+        return false;
+    }
+
+    // --- 2. Then the metadata, in parallel shards when there are many entries ---
+    size_t count = out.size() - first;
+    size_t shards = 1;
+    if (count > kParallelStatThreshold) {
+        size_t cores = std::thread::hardware_concurrency();
+        shards = std::max<size_t>(1, std::min<size_t>({ cores, 8, count / (kParallelStatThreshold / 2) }));
+    }
+    platform_dir_entry* entries = out.data() + first;
+    std::vector<std::thread> workers;
+    for (size_t shard = 1; shard < shards; shard++) {
+        workers.emplace_back(stat_directory_entries, dir, entries + count * shard / shards, entries + count * (shard + 1) / shards);
+    }
+    stat_directory_entries(dir, entries, entries + count / shards);
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    platform_close_directory(dir);
+    return true;
+}
+
+void* platform_alloc_pages(size_t size)
+{
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return memory == MAP_FAILED ? nullptr : memory;
+}
+
+void platform_free_pages(void* memory, size_t size)
+{
+    munmap(memory, size);
+}
+
+const void* platform_map_file(platform_file file, std::uint64_t size)
+{
+    if (size == 0) {
+        return nullptr;
+    }
+    void* view = mmap(nullptr, (size_t)size, PROT_READ, MAP_SHARED, file, 0);
+    return view == MAP_FAILED ? nullptr : view;
+}
+
+void platform_unmap_file(const void* view, std::uint64_t size)
+{
+    munmap(const_cast<void*>(view), (size_t)size);
+}
+
+native_string platform_cache_directory()
+{
+    native_string base;
+    if (const char* cache_home = getenv("XDG_CACHE_HOME")) {
+        base = cache_home;
+    }
+    else if (const char* home = getenv("HOME")) {
+        base = native_string(home) + "/.cache";
+    }
+    if (base.empty()) {
+        return native_string();
+    }
+
+    native_string dir = base + "/persona_web";
+    mkdir(base.c_str(), 0755);
+    if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        return native_string();
+    }
+    return dir;
+}
+
+long long platform_read_at(platform_file file, void* buffer, size_t length, std::uint64_t offset)
+{
+    ssize_t n;
+    do {
+        n = pread(file, buffer, length, (off_t)offset);
+    } while (n == -1 && errno == EINTR);
+    return n;
+}
+
+long long platform_send_file(std::uintptr_t socket, platform_file file, std::uint64_t offset, size_t length)
+{
+    off_t file_offset = (off_t)offset;
+    ssize_t n;
+    do {
+        n = sendfile((int)socket, file, &file_offset, length);
+    } while (n == -1 && errno == EINTR);
+    return n;
+}
+
+#endif // !_WIN32
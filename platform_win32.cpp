@@ -0,0 +1,565 @@
+﻿#ifdef _WIN32
+
+#include <winsock2.h>
+#include <mswsock.h>
+#include <windows.h>
+#include "platform.h"
+#include "path_canon.h"
+#include "utf_transcode.h"
+#pragma comment(lib, "mswsock.lib")
+
+/**
+ * @brief Converts a wide string (UTF-16 on Windows) to a UTF-8 encoded string.
+ *
+ * This function is necessary for handling file paths and other strings that may
+ * contain non-ASCII characters, ensuring they are compatible with web standards
+ * and libraries that expect UTF-8. It runs for every entry of a directory listing,
+ * so it uses the vectorized single-pass transcoder (utf_transcode.h) rather than
+ * sizing and then filling with two WideCharToMultiByte calls.
+ *
+ * @param wstr The wide string (std::wstring) to convert.
+ * @return std::string The resulting UTF-8 encoded string.
+ */
+std::string wstring_to_utf8(const std::wstring& wstr)
+{
+    std::string out;
+    wide_to_utf8(wstr, out);
+    return out;
+}
+
+/**
+ * @brief Converts a UTF-8 encoded string to a wide string (UTF-16 on Windows).
+ *
+ * This is the reverse of the wstring_to_utf8 function. It's useful for when you need
+ * to pass a standard string to a Windows API function that expects a wide string
+ * (LPCWSTR), especially for handling file paths with international characters.
+ * Malformed sequences become U+FFFD, as with MultiByteToWideChar.
+ *
+ * @param str The UTF-8 encoded string (std::string) to convert.
+ * @return std::wstring The resulting wide string (UTF-16).
+ */
+std::wstring utf8_to_wstring(const std::string& str)
+{
+    std::wstring out;
+    utf8_to_wide(str, out);
+    return out;
+}
+
+// On Windows the native path type is UTF-16, so these are thin wrappers around the converters above.
+native_string utf8_to_native(const std::string& str) { return utf8_to_wstring(str); }
+std::string native_to_utf8(const native_string& str) { return wstring_to_utf8(str); }
+
+/**
+ * @brief The virtual drive root. On Windows this is always the WinFsp mount point.
+ *
+ * Spelled as an extended-length path ("\\?\C:\PersonaRoot\"): request paths below it
+ * are canonicalized by is_safe_path() itself, so Win32 must not normalize them again,
+ * and they are not limited to MAX_PATH.
+ */
+static native_string g_root_path;
+
+/**
+ * @brief The root, held open for the life of the process.
+ *
+ * It is opened without FILE_SHARE_DELETE, so the root cannot be renamed, deleted or
+ * replaced while the server runs: the paths is_safe_path() builds from g_root_path
+ * keep naming files under this same directory.
+ */
+static HANDLE g_root_handle = INVALID_HANDLE_VALUE;
+
+const native_string& platform_root_path()
+{
+    if (g_root_path.empty()) {
+        platform_set_root_path(L"C:\\PersonaRoot");
+        // Even if the drive is not mounted (yet), keep a well-formed prefix so is_safe_path fails closed.
+        if (g_root_path.empty()) g_root_path = L"\\\\?\\C:\\PersonaRoot\\";
+    }
+    return g_root_path;
+}
+
+bool platform_set_root_path(const native_string& path)
+{
+    // Resolve the directory to its canonical form and make sure it ends with a separator,
+    // so that the prefix comparison in is_safe_path() cannot match "C:\PersonaRootEvil".
+    DWORD needed = GetFullPathNameW(path.c_str(), 0, NULL, NULL);
+    if (needed == 0) {
+        return false;
+    }
+    std::wstring full(needed, L'\0');
+    DWORD length = GetFullPathNameW(path.c_str(), needed, &full[0], NULL);
+    if (length == 0 || length >= needed) {
+        return false;
+    }
+    full.resize(length);
+    if (full.back() != L'\\') full += L'\\';
+
+    // "C:\x\" becomes "\\?\C:\x\" and "\\server\share\" becomes "\\?\UNC\server\share\".
+    std::wstring extended;
+    if (full.compare(0, 4, L"\\\\?\\") == 0) extended = full;
+    else if (full.compare(0, 2, L"\\\\") == 0) extended = L"\\\\?\\UNC\\" + full.substr(2);
+    else extended = L"\\\\?\\" + full;
+
+    HANDLE handle = CreateFileW(extended.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE,
+        NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    BY_HANDLE_FILE_INFORMATION info;
+    if (!GetFileInformationByHandle(handle, &info) || !(info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+        CloseHandle(handle);
+        return false;
+    }
+
+    if (g_root_handle != INVALID_HANDLE_VALUE) CloseHandle(g_root_handle);
+    g_root_handle = handle;
+    g_root_path = extended;
+    return true;
+}
+
+/**
+ * @brief Acts as a security checkpoint to prevent directory traversal attacks.
+ *
+ * This function takes a filename provided by a user, combines it with the virtual
+ * drive's root path (C:\PersonaRoot\), and verifies that the final path is still
+ * safely within that root directory. This is crucial for preventing users from
+ * accessing unauthorized files using relative paths like "../../Windows/System32/".
+ *
+ * The path is canonicalized on the string (append_canonical_path()), the way
+ * GetFullPathNameW did it but without a kernel transition, a temporary string or a
+ * MAX_PATH limit: a ".." that would climb above the root, device names such as "NUL",
+ * and names Win32 would silently rewrite (trailing dots, ':' streams) are refused.
+ *
+ * @param requested_filename The filename or relative path from the user's request.
+ * @param out_full_path An output parameter that will be filled with the safe,
+ * canonical path if the check is successful.
+ * @return true if the path is safe and within C:\PersonaRoot\, false otherwise.
+ */
+bool is_safe_path(const native_string& requested_filename, native_string& out_full_path)
+{
+    out_full_path.assign(platform_root_path());
+    return append_canonical_path(requested_filename, out_full_path) == PathStatus::ok;
+}
+
+bool platform_delete_file(const native_string& path)
+{
+    // Use the Windows API's DeleteFileW with the (already verified) path.
+    return DeleteFileW(path.c_str()) != 0;
+}
+
+bool platform_rename_file(const native_string& from, const native_string& to)
+{
+    return MoveFileExW(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+}
+
+bool platform_local_time(std::time_t time, std::tm& out)
+{
+    // Use the thread-safe localtime_s on Windows to get the local time.
+    return localtime_s(&out, &time) == 0;
+}
+
+std::vector<native_string> platform_list_subdirectories(const native_string& dir)
+{
+    std::vector<native_string> names;
+
+    // Use the Windows API to find all files and folders in the directory.
+    std::wstring pattern = dir + L"\\*";
+    WIN32_FIND_DATAW find_data;
+    HANDLE find_handle = FindFirstFileW(pattern.c_str(), &find_data);
+    if (find_handle == INVALID_HANDLE_VALUE) {
+        return names;
+    }
+
+    do {
+        std::wstring name = find_data.cFileName;
+        // Keep the item only if it's a directory and not "." or "..".
+        if ((find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) &&
+            name != L"." && name != L"..")
+        {
+            names.push_back(name);
+        }
+    } while (FindNextFileW(find_handle, &find_data) != 0);
+
+    // Clean up and close the file search handle.
+    FindClose(find_handle);
+    return names;
+}
+
+/**
+ * @brief Bundles the user's thread function with its argument so it fits CreateThread's single LPVOID.
+ */
+struct thread_start_info {
+    void (*fn)(void*);
+    void* arg;
+};
+
+static DWORD WINAPI thread_trampoline(LPVOID lpParam)
+{
+    thread_start_info* info = (thread_start_info*)lpParam;
+    info->fn(info->arg);
+    delete info;
+    return 0;
+}
+
+void platform_start_thread(void (*fn)(void*), void* arg)
+{
+    // Use the Windows API's CreateThread to run the function in the background.
+    HANDLE thread = CreateThread(
+        NULL,                                  // Default security attributes.
+        0,                                     // Default stack size.
+        thread_trampoline,                     // The function to execute in the new thread.
+        new thread_start_info{ fn, arg },      // The argument to pass to the thread function.
+        0,                                     // Default creation flags (run immediately).
+        NULL                                   // We don't need to store the thread ID.
+    );
+
+    // The thread runs detached; we never wait on it, so release our handle right away.
+    if (thread != NULL) CloseHandle(thread);
+}
+
+/**
+ * @brief The state of one platform_watch_tree() call, owned by its thread.
+ */
+struct tree_watch {
+    HANDLE directory;
+    native_string root;     // Always ends with a separator.
+    void (*callback)(const native_string& path, void* ctx);
+    void* ctx;
+};
+
+static void tree_watch_thread(void* arg)
+{
+    tree_watch* watch = (tree_watch*)arg;
+
+    // FILE_NOTIFY_INFORMATION records must be DWORD-aligned.
+    DWORD buffer[16 * 1024];
+    for (;;) {
+        DWORD length = 0;
+        // One handle with bWatchSubtree = TRUE covers the whole tree, including directories created later.
+        if (!ReadDirectoryChangesW(watch->directory, buffer, sizeof(buffer), TRUE,
+            FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME |
+            FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE,
+            &length, NULL, NULL)) {
+            break;
+        }
+
+        // A zero length means the change buffer overflowed and the individual events were lost.
+        if (length == 0) {
+            watch->callback(watch->root, watch->ctx);
+            continue;
+        }
+
+        const BYTE* p = (const BYTE*)buffer;
+        for (;;) {
+            const FILE_NOTIFY_INFORMATION* info = (const FILE_NOTIFY_INFORMATION*)p;
+            native_string path = watch->root;
+            path.append(info->FileName, info->FileNameLength / sizeof(WCHAR));
+            watch->callback(path, watch->ctx);
+
+            if (info->NextEntryOffset == 0) break;
+            p += info->NextEntryOffset;
+        }
+    }
+
+    CloseHandle(watch->directory);
+    delete watch;
+}
+
+bool platform_watch_tree(const native_string& dir, void (*callback)(const native_string& path, void* ctx), void* ctx)
+{
+    HANDLE directory = CreateFileW(dir.c_str(), FILE_LIST_DIRECTORY,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+        OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+    if (directory == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    tree_watch* watch = new tree_watch{ directory, dir, callback, ctx };
+    if (watch->root.empty() || (watch->root.back() != L'\\' && watch->root.back() != L'/')) watch->root += L'\\';
+
+    platform_start_thread(tree_watch_thread, watch);
+    return true;
+}
+
+platform_file platform_open_read(const native_string& path)
+{
+    // Share everything so that an open stream never blocks the explorer from renaming or deleting the file.
+    HANDLE handle = CreateFileW(path.c_str(), GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    return handle == INVALID_HANDLE_VALUE ? PLATFORM_INVALID_FILE : (platform_file)handle;
+}
+
+platform_file platform_open_write(const native_string& path)
+{
+    // Readers share writes and deletes (platform_open_read()), so they never block this open.
+    HANDLE handle = CreateFileW(path.c_str(), GENERIC_WRITE,
+        FILE_SHARE_READ | FILE_SHARE_DELETE, NULL,
+        CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    return handle == INVALID_HANDLE_VALUE ? PLATFORM_INVALID_FILE : (platform_file)handle;
+}
+
+platform_file platform_create_file(const native_string& path)
+{
+    HANDLE handle = CreateFileW(path.c_str(), GENERIC_WRITE,
+        FILE_SHARE_READ | FILE_SHARE_DELETE, NULL,
+        CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+    return handle == INVALID_HANDLE_VALUE ? PLATFORM_INVALID_FILE : (platform_file)handle;
+}
+
+bool platform_write_all(platform_file file, const void* data, size_t length)
+{
+    const char* p = (const char*)data;
+    while (length > 0) {
+        DWORD chunk = length > (1u << 30) ? (1u << 30) : (DWORD)length;
+        DWORD written;
+        if (!WriteFile((HANDLE)file, p, chunk, &written, NULL)) {
+            return false;
+        }
+        p += written;
+        length -= written;
+    }
+    return true;
+}
+
+bool platform_preallocate(platform_file file, std::uint64_t size)
+{
+    // The allocation size reserves clusters; the end of file still moves only as data is written.
+    FILE_ALLOCATION_INFO allocation;
+    allocation.AllocationSize.QuadPart = (LONGLONG)size;
+    return SetFileInformationByHandle((HANDLE)file, FileAllocationInfo, &allocation, sizeof(allocation)) != 0;
+}
+
+void platform_close_file(platform_file file)
+{
+    CloseHandle((HANDLE)file);
+}
+
+/**
+ * @brief Fills a platform_file_info from GetFileInformationByHandle's result.
+ */
+static std::int64_t filetime_to_unix_ns(std::int64_t filetime)
+{
+    // FILETIME counts 100 ns intervals since 1601-01-01; shift it to the Unix epoch.
+    const std::int64_t kEpochDifference = 116444736000000000LL;
+    return (filetime - kEpochDifference) * 100;
+}
+
+static void fill_file_info(const BY_HANDLE_FILE_INFORMATION& info, platform_file_info& out_info)
+{
+    std::int64_t write_time = ((std::int64_t)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime;
+
+    out_info.size = ((std::uint64_t)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+    out_info.mtime_ns = filetime_to_unix_ns(write_time);
+    out_info.file_id = ((std::uint64_t)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+    out_info.device = info.dwVolumeSerialNumber;
+    out_info.is_directory = (info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+}
+
+bool platform_get_file_info(platform_file file, platform_file_info& out_info)
+{
+    BY_HANDLE_FILE_INFORMATION info;
+    if (!GetFileInformationByHandle((HANDLE)file, &info)) {
+        return false;
+    }
+    fill_file_info(info, out_info);
+    return true;
+}
+
+bool platform_stat_path(const native_string& path, platform_file_info& out_info)
+{
+    // Opening with no data access only touches the metadata; BACKUP_SEMANTICS allows directories too.
+    HANDLE handle = CreateFileW(path.c_str(), FILE_READ_ATTRIBUTES,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+        OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    bool ok = platform_get_file_info((platform_file)handle, out_info);
+    CloseHandle(handle);
+    return ok;
+}
+
+/**
+ * @brief The state of one platform_open_directory() call.
+ */
+struct platform_directory_state {
+    HANDLE handle;
+    std::uint64_t device;       // The volume serial number, shared by every entry.
+    bool restart;               // The next query must start from the beginning.
+    bool done;
+    bool has_record;            // 'buffer' still holds records at 'position'.
+    DWORD position;
+    // Each query returns as many records as fit, so a large buffer means few round trips
+    // (the same batching FindFirstFileExW does with FIND_FIRST_EX_LARGE_FETCH).
+    alignas(LONGLONG) char buffer[64 * 1024];
+};
+
+platform_directory platform_open_directory(const native_string& path)
+{
+    HANDLE handle = CreateFileW(path.c_str(), FILE_LIST_DIRECTORY,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+        OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return nullptr;
+    }
+    BY_HANDLE_FILE_INFORMATION info;
+    if (!GetFileInformationByHandle(handle, &info) || !(info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+        CloseHandle(handle);
+        return nullptr;
+    }
+
+    platform_directory dir = new platform_directory_state;
+    dir->handle = handle;
+    dir->device = info.dwVolumeSerialNumber;
+    dir->restart = true;
+    dir->done = false;
+    dir->has_record = false;
+    dir->position = 0;
+    return dir;
+}
+
+void platform_close_directory(platform_directory dir)
+{
+    CloseHandle(dir->handle);
+    delete dir;
+}
+
+long long platform_read_directory(platform_directory dir, std::vector<platform_dir_entry>& out, size_t max_entries)
+{
+    size_t added = 0;
+    while (added < max_entries) {
+        // --- 1. Refill the buffer: names, sizes, times and file ids all come back in one call ---
+        if (!dir->has_record) {
+            if (dir->done) break;
+            FILE_INFO_BY_HANDLE_CLASS info_class = dir->restart ? FileIdBothDirectoryRestartInfo : FileIdBothDirectoryInfo;
+            if (!GetFileInformationByHandleEx(dir->handle, info_class, dir->buffer, sizeof(dir->buffer))) {
+                if (GetLastError() == ERROR_NO_MORE_FILES) {
+                    dir->done = true;
+                    break;
+                }
+                return -1;
+            }
+            dir->restart = false;
+            dir->has_record = true;
+            dir->position = 0;
+        }
+
+        // --- 2. Take the next record ---
+        const FILE_ID_BOTH_DIR_INFO* record = (const FILE_ID_BOTH_DIR_INFO*)(dir->buffer + dir->position);
+        if (record->NextEntryOffset == 0) {
+            dir->has_record = false;
+        }
+        else {
+            dir->position += record->NextEntryOffset;
+        }
+
+        std::wstring name(record->FileName, record->FileNameLength / sizeof(WCHAR));
+        if (name == L"." || name == L"..") continue;
+
+        platform_dir_entry item;
+        item.name = std::move(name);
+        item.info.size = (std::uint64_t)record->EndOfFile.QuadPart;
+        item.info.mtime_ns = filetime_to_unix_ns(record->LastWriteTime.QuadPart);
+        item.info.file_id = (std::uint64_t)record->FileId.QuadPart;
+        item.info.device = dir->device;
+        item.info.is_directory = (record->FileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+        item.is_link = (record->FileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0;
+        out.push_back(std::move(item));
+        added++;
+    }
+    return (long long)added;
+}
+
+bool platform_list_directory(const native_string& path, std::vector<platform_dir_entry>& out)
+{
+    platform_directory dir = platform_open_directory(path);
+    if (dir == nullptr) {
+        return false;
+    }
+    long long added;
+    do {
+        added = platform_read_directory(dir, out, 4096);
+    } while (added > 0);
+    platform_close_directory(dir);
+    return added == 0;
+}
+
+void* platform_alloc_pages(size_t size)
+{
+    return VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+}
+
+void platform_free_pages(void* memory, size_t size)
+{
+    VirtualFree(memory, 0, MEM_RELEASE);
+}
+
+const void* platform_map_file(platform_file file, std::uint64_t size)
+{
+    if (size == 0) {
+        return nullptr;
+    }
+    HANDLE mapping = CreateFileMappingW((HANDLE)file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL) {
+        return nullptr;
+    }
+    // The view keeps the mapping object alive on its own.
+    const void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, (SIZE_T)size);
+    CloseHandle(mapping);
+    return view;
+}
+
+void platform_unmap_file(const void* view, std::uint64_t size)
+{
+    UnmapViewOfFile(view);
+}
+
+native_string platform_cache_directory()
+{
+    wchar_t local_app_data[MAX_PATH];
+    DWORD length = GetEnvironmentVariableW(L"LOCALAPPDATA", local_app_data, MAX_PATH);
+    if (length == 0 || length >= MAX_PATH) {
+        return native_string();
+    }
+
+    native_string dir = native_string(local_app_data) + L"\\PersonaWeb";
+    if (!CreateDirectoryW(dir.c_str(), NULL) && GetLastError() != ERROR_ALREADY_EXISTS) {
+        return native_string();
+    }
+    return dir;
+}
+
+long long platform_read_at(platform_file file, void* buffer, size_t length, std::uint64_t offset)
+{
+    // A positioned read: the offset travels in the OVERLAPPED structure, not in the shared file pointer.
+    OVERLAPPED overlapped = { 0 };
+    overlapped.Offset = (DWORD)offset;
+    overlapped.OffsetHigh = (DWORD)(offset >> 32);
+
+    DWORD bytes_read = 0;
+    if (length > MAXDWORD) length = MAXDWORD;
+    if (!ReadFile((HANDLE)file, buffer, (DWORD)length, &bytes_read, &overlapped)) {
+        return GetLastError() == ERROR_HANDLE_EOF ? 0 : -1;
+    }
+    return (long long)bytes_read;
+}
+
+long long platform_send_file(std::uintptr_t socket, platform_file file, std::uint64_t offset, size_t length)
+{
+    // TransmitFile reads from the file's current position, so move it first. Each stream
+    // opens its own handle, so this position is never shared between requests.
+    LARGE_INTEGER position;
+    position.QuadPart = (LONGLONG)offset;
+    if (!SetFilePointerEx((HANDLE)file, position, NULL, FILE_BEGIN)) {
+        return -1;
+    }
+
+    // TransmitFile can send at most 2^31 - 2 bytes per call.
+    if (length > 0x7FFFFFFE) length = 0x7FFFFFFE;
+    if (!TransmitFile((SOCKET)socket, (HANDLE)file, (DWORD)length, 0, NULL, NULL, 0)) {
+        return -1;
+    }
+    return (long long)length;
+}
+
+#endif // _WIN32
@@ -0,0 +1,137 @@
+﻿#include "root_watch.h"
+#include "file_receiver.h"
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace {
+
+typedef void (*WatchCallback)(const native_string& path, void* ctx);
+
+struct RootWatch {
+    std::mutex lock;
+    std::vector<std::pair<WatchCallback, void*>> subscribers;
+    bool active = false;
+};
+
+RootWatch& root_watch()
+{
+    // Never destroyed: the watch thread calls into it for the life of the process.
+    static RootWatch* watch = new RootWatch();
+    return *watch;
+}
+
+std::once_flag g_start_once;
+
+void dispatch(const native_string& path, void* ctx)
+{
+    RootWatch& watch = root_watch();
+    std::lock_guard<std::mutex> guard(watch.lock);
+    for (const auto& subscriber : watch.subscribers) {
+        subscriber.first(path, subscriber.second);
+    }
+}
+
+} // namespace
+
+bool root_watch_subscribe(void (*callback)(const native_string& path, void* ctx), void* ctx)
+{
+    RootWatch& watch = root_watch();
+    {
+        std::lock_guard<std::mutex> guard(watch.lock);
+        watch.subscribers.emplace_back(callback, ctx);
+    }
+    std::call_once(g_start_once, [&watch] {
+        bool active = platform_watch_tree(platform_root_path(), dispatch, nullptr);
+        std::lock_guard<std::mutex> guard(watch.lock);
+        watch.active = active;
+    });
+    std::lock_guard<std::mutex> guard(watch.lock);
+    return watch.active;
+}
+
+native_string join_native_path(const native_string& directory, const native_string& name)
+{
+    native_string path = directory;
+    if (path.empty() || path.back() != kPathSeparator) path += kPathSeparator;
+    path += name;
+    return path;
+}
+
+bool root_relative_path(const native_string& full_path, std::string& out)
+{
+    const native_string& root = platform_root_path();
+    if (full_path.compare(0, root.size(), root) == 0) {
+        out = native_to_utf8(full_path.substr(root.size()));
+    }
+    else if (full_path.size() + 1 == root.size() && root.compare(0, full_path.size(), full_path) == 0) {
+        out.clear();
+    }
+    else {
+        return false;
+    }
+    std::replace(out.begin(), out.end(), '\\', '/');
+    while (!out.empty() && out.back() == '/') out.pop_back();
+    return true;
+}
+
+void walk_root_tree(const native_string& full_path, const std::string& relative_path,
+    const std::function<void(const native_string& full_path, const std::string& relative_path, const platform_dir_entry& entry)>& visit)
+{
+    std::vector<std::pair<native_string, std::string>> directories = { { full_path, relative_path } };
+    std::vector<platform_dir_entry> entries;
+    while (!directories.empty()) {
+        std::pair<native_string, std::string> directory = std::move(directories.back());
+        directories.pop_back();
+
+        entries.clear();
+        platform_list_directory(directory.first, entries);
+        for (const platform_dir_entry& entry : entries) {
+            if (is_upload_temp_name(entry.name)) continue;
+            native_string child = join_native_path(directory.first, entry.name);
+            std::string child_relative = (directory.second.empty() ? std::string() : directory.second + "/") + native_to_utf8(entry.name);
+            visit(child, child_relative, entry);
+            if (entry.info.is_directory && !entry.is_link) directories.emplace_back(std::move(child), std::move(child_relative));
+        }
+    }
+}
+
+void RootChangeQueue::push(const native_string& path)
+{
+    // An upload is indexed once it is renamed over its target, not while it arrives.
+    if (is_upload_temp_name(path)) return;
+    std::string relative_path;
+    std::lock_guard<std::mutex> guard(lock_);
+    if (root_relative_path(path, relative_path) && relative_path.empty()) {
+        rescan_ = true;
+    }
+    else {
+        pending_.insert(path);
+    }
+    wake_.notify_one();
+}
+
+bool RootChangeQueue::take(std::set<native_string>& pending, bool& rescan, std::chrono::milliseconds timeout)
+{
+    std::unique_lock<std::mutex> guard(lock_);
+    auto ready = [this] { return !pending_.empty() || rescan_; };
+    if (timeout == std::chrono::milliseconds::max()) {
+        wake_.wait(guard, ready);
+    }
+    else if (!wake_.wait_for(guard, timeout, ready)) {
+        pending.clear();
+        rescan = false;
+        return false;
+    }
+    pending.clear();
+    pending.swap(pending_);
+    rescan = rescan_;
+    rescan_ = false;
+    return true;
+}
+
+size_t RootChangeQueue::size()
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    return pending_.size();
+}
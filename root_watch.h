@@ -0,0 +1,78 @@
+﻿#pragma once
+
+#include "platform.h"
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+
+#ifdef _WIN32
+const wchar_t kPathSeparator = L'\\';
+#else
+const char kPathSeparator = '/';
+#endif
+
+/**
+ * @brief Subscribes to changes anywhere below the virtual drive root.
+ *
+ * Every module that keeps state derived from the drive (the listing cache, the search
+ * index) shares one recursive watch on platform_root_path() instead of starting its
+ * own: each watch costs a watch descriptor per directory on Linux. The watch starts
+ * with the first subscription. The callbacks run on the watch thread, one event at a
+ * time, with the same arguments as platform_watch_tree() passes, so they must be quick.
+ *
+ * @return true if the watch is running; false means changes will not be reported and
+ * the subscriber has to fall back to revalidating on its own.
+ */
+bool root_watch_subscribe(void (*callback)(const native_string& path, void* ctx), void* ctx);
+
+/**
+ * @brief Appends 'name' to a native directory path, with a separator if it has none yet.
+ */
+native_string join_native_path(const native_string& directory, const native_string& name);
+
+/**
+ * @brief The name the indexes use for a path: UTF-8, relative to the root, '/'-separated.
+ *
+ * The root itself gives "", whether or not it ends with a separator: the watch reports a
+ * lost event (an overflow) with the root minus its trailing separator on Linux.
+ *
+ * @return false if the path is not the root or below it.
+ */
+bool root_relative_path(const native_string& full_path, std::string& out);
+
+/**
+ * @brief Walks everything below a directory of the drive, depth first, without following links.
+ *
+ * @param visit Called for every entry with its full path and its root_relative_path().
+ */
+void walk_root_tree(const native_string& full_path, const std::string& relative_path,
+    const std::function<void(const native_string& full_path, const std::string& relative_path, const platform_dir_entry& entry)>& visit);
+
+/**
+ * @brief Changed paths waiting for an index's background thread.
+ *
+ * Fed by the root watch and by the write handlers; a change to the root itself (an
+ * overflow: events were lost) asks for a full rescan instead of being queued.
+ */
+class RootChangeQueue {
+public:
+    void push(const native_string& path);
+
+    /**
+     * @brief Waits until something is queued, then takes all of it.
+     *
+     * @return false if 'timeout' passed first ('pending' is then empty and 'rescan' false).
+     */
+    bool take(std::set<native_string>& pending, bool& rescan, std::chrono::milliseconds timeout = std::chrono::milliseconds::max());
+
+    size_t size();
+
+private:
+    std::mutex lock_;
+    std::condition_variable wake_;
+    std::set<native_string> pending_;
+    bool rescan_ = false;
+};
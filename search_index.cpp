@@ -0,0 +1,1213 @@
+﻿#include "search_index.h"
+#include "root_watch.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <set>
+#include <shared_mutex>
+#include <string_view>
+#include <unordered_map>
+
+namespace {
+
+// Files larger than this are not indexed (logs, dumps: not what people search for).
+const std::uint64_t kMaxIndexedFileSize = 8 * 1024 * 1024;
+
+// Longer "words" are nearly always encoded data (base64, hashes) and are skipped.
+const size_t kMaxTokenBytes = 64;
+
+// Postings per block. Each block has a skip entry, so a lookup can jump over 128 documents at a time.
+const size_t kBlockSize = 128;
+
+// A prefix query ("photo*") expands to at most this many words.
+const size_t kMaxPrefixTerms = 1024;
+
+const size_t kMaxQueryTerms = 16;
+
+// The in-memory segment is merged into a new on-disk segment once it holds this many postings,
+// or once the index has been idle for kIdleMergeDelay with anything not yet merged. A merge
+// rewrites the whole segment, so above kCheapMergeBytes an idle merge also waits until
+// 1/kIdleMergeDivisor of kMergePostings has changed. Until then the changes live in memory
+// only; after a restart the first reconcile indexes them again.
+const std::uint64_t kMergePostings = 2000000;
+const std::chrono::seconds kIdleMergeDelay(60);
+const std::uint64_t kCheapMergeBytes = 32 * 1024 * 1024;
+const std::uint64_t kIdleMergeDivisor = 8;
+
+// BM25 parameters (the usual defaults).
+const double kBm25K1 = 1.2;
+const double kBm25B = 0.75;
+
+// Only these file types are read as text.
+const char* const kTextExtensions[] = {
+    "txt", "md", "markdown", "json", "js", "ts", "css", "html", "htm", "xml", "csv", "tsv", "log",
+    "ini", "cfg", "conf", "yaml", "yml", "toml", "c", "cc", "cpp", "h", "hpp", "py", "java", "cs",
+    "go", "rs", "sh", "bat", "ps1", "sql",
+};
+
+// ============================================================================
+// --- On-disk segment format ---
+// ============================================================================
+//
+// One file, mapped and read in place (all integers little-endian):
+//
+//   SegmentHeader
+//   postings       for each term: SkipEntry[block_count], then its blocks (4-byte aligned)
+//   DocRecord[doc_count]
+//   TermRecord[term_count]     sorted by the term's bytes, for binary search
+//   string pool                paths and terms, back to back
+//   kFooterMagic               written last: a torn write never has it
+//
+// A block holds up to kBlockSize postings as varint pairs (doc gap, term frequency), where
+// the gap is doc - previous doc - 1, the previous doc of a block's first posting being
+// the last doc of the block before (-1 for the first block). Doc ids are the positions
+// in DocRecord[]. Segments are written under a new name (generation) each time and never
+// modified, so a mapped segment stays valid while the next one is written.
+
+const char kSegmentMagic[8] = { 'P', 'S', 'I', 'D', 'X', 'S', 'E', 'G' };
+const char kFooterMagic[8] = { 'P', 'S', 'I', 'D', 'X', 'E', 'N', 'D' };
+const std::uint32_t kSegmentVersion = 1;
+
+struct SegmentHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t doc_count;
+    std::uint32_t term_count;
+    std::uint32_t reserved;
+    std::uint64_t total_tokens;
+    std::uint64_t postings_offset;
+    std::uint64_t docs_offset;
+    std::uint64_t terms_offset;
+    std::uint64_t strings_offset;
+    std::uint64_t strings_size;
+};
+
+struct DocRecord {
+    std::uint64_t size;             // The file's size and mtime when it was indexed.
+    std::int64_t mtime_ns;
+    std::uint64_t path_offset;      // Into the string pool; UTF-8, relative to the root, '/'-separated.
+    std::uint32_t path_length;
+    std::uint32_t token_count;      // Document length, for BM25.
+};
+
+struct TermRecord {
+    std::uint64_t term_offset;      // Into the string pool.
+    std::uint64_t postings_offset;  // Into the postings section.
+    std::uint32_t term_length;
+    std::uint32_t doc_freq;
+    std::uint32_t block_count;
+    std::uint32_t reserved;
+};
+
+struct SkipEntry {
+    std::uint32_t last_doc;         // The last doc id in the block.
+    std::uint32_t offset;           // Where the block starts, from the end of the skip table.
+};
+
+struct Posting {
+    std::uint32_t doc;
+    std::uint32_t tf;               // Occurrences of the term in the document.
+};
+
+/**
+ * @brief A mapped, validated on-disk segment. Immutable.
+ */
+class Segment {
+public:
+    static std::unique_ptr<Segment> open(const native_string& path)
+    {
+        platform_file file = platform_open_read(path);
+        if (file == PLATFORM_INVALID_FILE) return nullptr;
+        platform_file_info info;
+        const void* view = nullptr;
+        if (platform_get_file_info(file, info) && info.size >= sizeof(SegmentHeader) + sizeof(kFooterMagic)) {
+            view = platform_map_file(file, info.size);
+        }
+        platform_close_file(file);
+        if (view == nullptr) return nullptr;
+
+        std::unique_ptr<Segment> segment(new Segment((const char*)view, info.size));
+        if (!segment->validate()) return nullptr;
+        return segment;
+    }
+
+    ~Segment()
+    {
+        platform_unmap_file(data_, size_);
+    }
+
+    std::uint32_t doc_count() const { return header().doc_count; }
+    std::uint32_t term_count() const { return header().term_count; }
+    std::uint64_t total_tokens() const { return header().total_tokens; }
+    std::uint64_t bytes() const { return size_; }
+
+    const DocRecord& doc(std::uint32_t id) const { return docs()[id]; }
+    std::string doc_path(std::uint32_t id) const { return std::string(string_at(doc(id).path_offset, doc(id).path_length)); }
+
+    const TermRecord* terms_begin() const { return terms(); }
+    const TermRecord* terms_end() const { return terms() + term_count(); }
+    std::string_view term(const TermRecord& record) const { return string_at(record.term_offset, record.term_length); }
+    const unsigned char* postings(const TermRecord& record) const
+    {
+        return (const unsigned char*)data_ + header().postings_offset + record.postings_offset;
+    }
+
+    const TermRecord* find_term(std::string_view text) const
+    {
+        const TermRecord* found = std::lower_bound(terms_begin(), terms_end(), text,
+            [this](const TermRecord& record, std::string_view value) { return term(record) < value; });
+        return found != terms_end() && term(*found) == text ? found : nullptr;
+    }
+
+    // The terms starting with 'prefix', as a range of records.
+    std::pair<const TermRecord*, const TermRecord*> prefix_range(std::string_view prefix) const
+    {
+        const TermRecord* first = std::lower_bound(terms_begin(), terms_end(), prefix,
+            [this](const TermRecord& record, std::string_view value) { return term(record) < value; });
+        const TermRecord* last = first;
+        while (last != terms_end() && term(*last).substr(0, prefix.size()) == prefix) ++last;
+        return { first, last };
+    }
+
+private:
+    Segment(const char* data, std::uint64_t size) : data_(data), size_(size) {}
+
+    const SegmentHeader& header() const { return *(const SegmentHeader*)data_; }
+    const DocRecord* docs() const { return (const DocRecord*)(data_ + header().docs_offset); }
+    const TermRecord* terms() const { return (const TermRecord*)(data_ + header().terms_offset); }
+    std::string_view string_at(std::uint64_t offset, std::uint32_t length) const
+    {
+        return std::string_view(data_ + header().strings_offset + offset, length);
+    }
+
+    // Checks that every section and every string reference lies inside the file.
+    bool validate() const
+    {
+        const SegmentHeader& h = header();
+        if (memcmp(h.magic, kSegmentMagic, sizeof(kSegmentMagic)) != 0 || h.version != kSegmentVersion) return false;
+        if (memcmp(data_ + size_ - sizeof(kFooterMagic), kFooterMagic, sizeof(kFooterMagic)) != 0) return false;
+
+        std::uint64_t end = size_ - sizeof(kFooterMagic);
+        if (h.postings_offset > h.docs_offset || h.docs_offset % 8 != 0 || h.terms_offset % 8 != 0) return false;
+        if (h.docs_offset + (std::uint64_t)h.doc_count * sizeof(DocRecord) > h.terms_offset) return false;
+        if (h.terms_offset + (std::uint64_t)h.term_count * sizeof(TermRecord) > h.strings_offset) return false;
+        if (h.strings_offset + h.strings_size > end) return false;
+
+        std::uint64_t postings_size = h.docs_offset - h.postings_offset;
+        for (std::uint32_t i = 0; i < h.doc_count; i++) {
+            if (docs()[i].path_offset + docs()[i].path_length > h.strings_size) return false;
+        }
+        for (std::uint32_t i = 0; i < h.term_count; i++) {
+            const TermRecord& record = terms()[i];
+            if (record.term_offset + record.term_length > h.strings_size) return false;
+            if (record.postings_offset % 4 != 0 ||
+                record.postings_offset + (std::uint64_t)record.block_count * sizeof(SkipEntry) > postings_size) return false;
+        }
+        return true;
+    }
+
+    const char* data_;
+    std::uint64_t size_;
+};
+
+// ============================================================================
+// --- Postings ---
+// ============================================================================
+
+void write_varint(std::string& out, std::uint32_t value)
+{
+    while (value >= 0x80) {
+        out += (char)(value | 0x80);
+        value >>= 7;
+    }
+    out += (char)value;
+}
+
+std::uint32_t read_varint(const unsigned char*& p)
+{
+    std::uint32_t value = 0;
+    for (int shift = 0;; shift += 7) {
+        unsigned char byte = *p++;
+        value |= (std::uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80) || shift >= 28) break;
+    }
+    return value;
+}
+
+/**
+ * @brief Walks the postings of one term in ascending doc order, over a segment's blocks or a plain array.
+ */
+class PostingCursor {
+public:
+    // Over an on-disk term: only the blocks actually visited are decoded.
+    void reset(const unsigned char* postings, std::uint32_t block_count, std::uint32_t doc_freq)
+    {
+        skips_ = (const SkipEntry*)postings;
+        blocks_ = postings + block_count * sizeof(SkipEntry);
+        block_count_ = block_count;
+        doc_freq_ = doc_freq;
+        block_ = 0;
+        decoded_.clear();
+        if (block_count_ > 0) load_block(0);
+        else end_ = begin_ = nullptr;
+    }
+
+    // Over postings already in memory (the live segment, or a merged prefix expansion).
+    void reset(const Posting* begin, const Posting* end)
+    {
+        block_count_ = 0;
+        block_ = 0;
+        current_ = begin_ = begin;
+        end_ = end;
+    }
+
+    bool valid() const { return current_ != end_; }
+    const Posting& current() const { return *current_; }
+
+    void next()
+    {
+        if (++current_ == end_ && block_ + 1 < block_count_) load_block(block_ + 1);
+    }
+
+    // Moves to the first posting whose doc is >= 'target'.
+    void seek(std::uint32_t target)
+    {
+        if (!valid() || current_->doc >= target) return;
+        if (block_count_ > 0 && skips_[block_].last_doc < target) {
+            // Binary search the skip table instead of decoding the blocks in between.
+            const SkipEntry* found = std::lower_bound(skips_ + block_ + 1, skips_ + block_count_, target,
+                [](const SkipEntry& skip, std::uint32_t value) { return skip.last_doc < value; });
+            if (found == skips_ + block_count_) {
+                current_ = end_;
+                return;
+            }
+            load_block((std::uint32_t)(found - skips_));
+        }
+        current_ = std::lower_bound(current_, end_, target,
+            [](const Posting& posting, std::uint32_t value) { return posting.doc < value; });
+    }
+
+private:
+    void load_block(std::uint32_t block)
+    {
+        block_ = block;
+        std::uint32_t count = block + 1 < block_count_ ? (std::uint32_t)kBlockSize : doc_freq_ - block * (std::uint32_t)kBlockSize;
+        const unsigned char* p = blocks_ + skips_[block].offset;
+        std::int64_t previous = block == 0 ? -1 : (std::int64_t)skips_[block - 1].last_doc;
+
+        decoded_.resize(count);
+        for (std::uint32_t i = 0; i < count; i++) {
+            previous += (std::int64_t)read_varint(p) + 1;
+            decoded_[i].doc = (std::uint32_t)previous;
+            decoded_[i].tf = read_varint(p);
+        }
+        current_ = begin_ = decoded_.data();
+        end_ = decoded_.data() + decoded_.size();
+    }
+
+    const SkipEntry* skips_ = nullptr;
+    const unsigned char* blocks_ = nullptr;
+    std::uint32_t block_count_ = 0;
+    std::uint32_t doc_freq_ = 0;
+    std::uint32_t block_ = 0;
+    std::vector<Posting> decoded_;
+    const Posting* begin_ = nullptr;
+    const Posting* current_ = nullptr;
+    const Posting* end_ = nullptr;
+};
+
+// Decodes a whole on-disk posting list.
+void decode_postings(const Segment& segment, const TermRecord& record, std::vector<Posting>& out)
+{
+    PostingCursor cursor;
+    cursor.reset(segment.postings(record), record.block_count, record.doc_freq);
+    for (; cursor.valid(); cursor.next()) out.push_back(cursor.current());
+}
+
+// Sorts postings by doc and adds up the frequencies of the same doc (after a prefix expansion).
+void merge_postings(std::vector<Posting>& postings)
+{
+    std::sort(postings.begin(), postings.end(), [](const Posting& a, const Posting& b) { return a.doc < b.doc; });
+    size_t out = 0;
+    for (size_t i = 0; i < postings.size(); i++) {
+        if (out > 0 && postings[out - 1].doc == postings[i].doc) postings[out - 1].tf += postings[i].tf;
+        else postings[out++] = postings[i];
+    }
+    postings.resize(out);
+}
+
+// ============================================================================
+// --- Tokenizer ---
+// ============================================================================
+
+const std::uint32_t kInvalidCodePoint = 0xFFFFFFFF;
+
+// Decodes one UTF-8 sequence; an invalid byte decodes as kInvalidCodePoint and is skipped alone.
+std::uint32_t decode_utf8(const unsigned char*& p, const unsigned char* end)
+{
+    unsigned char lead = *p++;
+    if (lead < 0x80) return lead;
+
+    int length;
+    std::uint32_t cp;
+    if ((lead & 0xE0) == 0xC0) { length = 1; cp = lead & 0x1F; }
+    else if ((lead & 0xF0) == 0xE0) { length = 2; cp = lead & 0x0F; }
+    else if ((lead & 0xF8) == 0xF0) { length = 3; cp = lead & 0x07; }
+    else return kInvalidCodePoint;
+
+    if (end - p < length) return kInvalidCodePoint;
+    for (int i = 0; i < length; i++) {
+        if ((p[i] & 0xC0) != 0x80) return kInvalidCodePoint;
+        cp = (cp << 6) | (p[i] & 0x3F);
+    }
+    // Overlong forms, surrogates and values past U+10FFFF are not valid UTF-8.
+    static const std::uint32_t kMinimum[] = { 0, 0x80, 0x800, 0x10000 };
+    if (cp < kMinimum[length] || (cp >= 0xD800 && cp <= 0xDFFF) || cp > 0x10FFFF) return kInvalidCodePoint;
+    p += length;
+    return cp;
+}
+
+void append_utf8(std::string& out, std::uint32_t cp)
+{
+    if (cp < 0x80) {
+        out += (char)cp;
+    }
+    else if (cp < 0x800) {
+        out += (char)(0xC0 | (cp >> 6));
+        out += (char)(0x80 | (cp & 0x3F));
+    }
+    else if (cp < 0x10000) {
+        out += (char)(0xE0 | (cp >> 12));
+        out += (char)(0x80 | ((cp >> 6) & 0x3F));
+        out += (char)(0x80 | (cp & 0x3F));
+    }
+    else {
+        out += (char)(0xF0 | (cp >> 18));
+        out += (char)(0x80 | ((cp >> 12) & 0x3F));
+        out += (char)(0x80 | ((cp >> 6) & 0x3F));
+        out += (char)(0x80 | (cp & 0x3F));
+    }
+}
+
+/**
+ * @brief Is the code point part of a word? Letters and digits of any script are;
+ * spaces, punctuation, symbols and emoji are not.
+ */
+bool is_word_char(std::uint32_t cp)
+{
+    if (cp < 0x80) return (cp >= '0' && cp <= '9') || (cp >= 'a' && cp <= 'z') || (cp >= 'A' && cp <= 'Z');
+    if (cp == kInvalidCodePoint) return false;
+    if (cp < 0xC0) return cp == 0xAA || cp == 0xB5 || cp == 0xBA;     // Latin-1 punctuation and symbols
+    if (cp == 0xD7 || cp == 0xF7) return false;                         // x and / signs
+    if (cp >= 0x2000 && cp <= 0x2BFF) return false;                     // Punctuation, symbols, arrows, box drawing
+    if (cp >= 0x3000 && cp <= 0x303F) return false;                     // CJK symbols and punctuation
+    if (cp >= 0xE000 && cp <= 0xF8FF) return false;                     // Private use
+    if (cp >= 0xFE30 && cp <= 0xFE4F) return false;                     // CJK compatibility forms
+    if ((cp >= 0xFF00 && cp <= 0xFF0F) || (cp >= 0xFF1A && cp <= 0xFF20) ||
+        (cp >= 0xFF3B && cp <= 0xFF40) || (cp >= 0xFF5B && cp <= 0xFF65)) return false;    // Fullwidth punctuation
+    if (cp >= 0xFFF0 && cp <= 0xFFFF) return false;                     // Specials, including U+FFFD
+    if (cp >= 0x1F000 && cp <= 0x1FAFF) return false;                   // Emoji and pictographs
+    return true;
+}
+
+// Simple case folding for the scripts with a one-to-one upper/lower mapping; fullwidth Latin to ASCII.
+std::uint32_t fold_case(std::uint32_t cp)
+{
+    if (cp >= 'A' && cp <= 'Z') return cp + 0x20;
+    if (cp < 0x80) return cp;
+    if (cp >= 0xC0 && cp <= 0xDE && cp != 0xD7) return cp + 0x20;       // Latin-1
+    if (cp >= 0x391 && cp <= 0x3A9 && cp != 0x3A2) return cp + 0x20;    // Greek
+    if (cp >= 0x410 && cp <= 0x42F) return cp + 0x20;                   // Cyrillic
+    if (cp >= 0x400 && cp <= 0x40F) return cp + 0x50;
+    if (cp >= 0xFF21 && cp <= 0xFF3A) return cp - 0xFF21 + 'a';         // Fullwidth A-Z
+    if (cp >= 0xFF41 && cp <= 0xFF5A) return cp - 0xFF41 + 'a';         // Fullwidth a-z
+    if (cp >= 0xFF10 && cp <= 0xFF19) return cp - 0xFF10 + '0';         // Fullwidth digits
+    return cp;
+}
+
+/**
+ * @brief Splits UTF-8 text into case-folded words and calls 'emit(word)' for each one.
+ */
+template <typename Emit>
+void tokenize(const char* data, size_t size, Emit&& emit)
+{
+    const unsigned char* p = (const unsigned char*)data;
+    const unsigned char* end = p + size;
+    std::string token;
+    bool too_long = false;
+
+    while (p < end) {
+        std::uint32_t cp = decode_utf8(p, end);
+        if (is_word_char(cp)) {
+            if (!too_long) {
+                append_utf8(token, fold_case(cp));
+                too_long = token.size() > kMaxTokenBytes;
+            }
+            continue;
+        }
+        if (!token.empty() && !too_long) emit(token);
+        token.clear();
+        too_long = false;
+    }
+    if (!token.empty() && !too_long) emit(token);
+}
+
+// ============================================================================
+// --- Index state ---
+// ============================================================================
+
+struct LiveDoc {
+    std::string path;
+    std::uint64_t size;
+    std::int64_t mtime_ns;
+    std::uint32_t token_count;
+};
+
+/**
+ * @brief Everything a query reads. Guarded by g_state_lock; only the indexer thread writes.
+ *
+ * Doc ids [0, base_docs) are the on-disk segment's documents, the ones after that are
+ * the live (in-memory) segment's, in the order they were indexed. A changed file gets a
+ * new id in the live segment and its old id is marked deleted; merging drops deleted
+ * documents and renumbers the rest.
+ */
+struct IndexState {
+    std::unique_ptr<Segment> segment;
+    std::uint32_t base_docs = 0;
+    std::vector<LiveDoc> live_docs;
+    std::unordered_map<std::string, std::vector<Posting>> live_terms;
+    std::uint64_t live_postings = 0;
+    std::vector<std::uint8_t> deleted;              // By doc id.
+    std::map<std::string, std::uint32_t> paths;     // Relative path -> current doc id.
+    std::uint64_t alive_tokens = 0;                 // Tokens of the documents in 'paths', for BM25.
+    bool dirty = false;                             // Anything changed since the last merge.
+};
+
+std::shared_mutex g_state_lock;
+
+IndexState& index_state()
+{
+    // Never destroyed: the indexer thread uses it for the life of the process.
+    static IndexState* state = new IndexState();
+    return *state;
+}
+
+RootChangeQueue& indexer_queue()
+{
+    static RootChangeQueue* queue = new RootChangeQueue();
+    return *queue;
+}
+
+std::once_flag g_start_once;
+native_string g_segment_dir;        // Where segments are stored; "" keeps the index in memory only.
+std::string g_segment_prefix;       // "search-<hash of the root>-", so each root has its own index.
+std::uint64_t g_generation = 0;
+
+std::atomic<bool> g_ready{ false };
+std::atomic<std::uint64_t> g_queries{ 0 };
+std::atomic<std::uint64_t> g_updates{ 0 };
+std::atomic<std::uint64_t> g_merges{ 0 };
+
+std::uint32_t doc_token_count(const IndexState& state, std::uint32_t id)
+{
+    return id < state.base_docs ? state.segment->doc(id).token_count : state.live_docs[id - state.base_docs].token_count;
+}
+
+std::string doc_path(const IndexState& state, std::uint32_t id)
+{
+    return id < state.base_docs ? state.segment->doc_path(id) : state.live_docs[id - state.base_docs].path;
+}
+
+void doc_identity(const IndexState& state, std::uint32_t id, std::uint64_t& size, std::int64_t& mtime_ns)
+{
+    if (id < state.base_docs) {
+        size = state.segment->doc(id).size;
+        mtime_ns = state.segment->doc(id).mtime_ns;
+    }
+    else {
+        size = state.live_docs[id - state.base_docs].size;
+        mtime_ns = state.live_docs[id - state.base_docs].mtime_ns;
+    }
+}
+
+// ============================================================================
+// --- Paths ---
+// ============================================================================
+
+bool is_text_file(const std::string& relative_path)
+{
+    size_t dot = relative_path.rfind('.');
+    if (dot == std::string::npos || relative_path.find('/', dot) != std::string::npos) return false;
+    std::string extension = relative_path.substr(dot + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)tolower(c); });
+    for (const char* known : kTextExtensions) {
+        if (extension == known) return true;
+    }
+    return false;
+}
+
+// ============================================================================
+// --- Indexer thread: updates ---
+// ============================================================================
+
+void remove_document(IndexState& state, const std::string& relative_path)
+{
+    auto found = state.paths.find(relative_path);
+    if (found == state.paths.end()) return;
+    std::uint32_t id = found->second;
+    state.deleted[id] = 1;
+    state.alive_tokens -= doc_token_count(state, id);
+    state.paths.erase(found);
+    state.dirty = true;
+    g_updates.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Removes a path and, if it was a directory, everything that was below it.
+void remove_tree(const std::string& relative_path)
+{
+    IndexState& state = index_state();
+    std::unique_lock<std::shared_mutex> guard(g_state_lock);
+    remove_document(state, relative_path);
+    std::string prefix = relative_path.empty() ? std::string() : relative_path + "/";
+    for (auto it = state.paths.lower_bound(prefix); it != state.paths.end() && it->first.compare(0, prefix.size(), prefix) == 0;) {
+        std::string path = (it++)->first;
+        remove_document(state, path);
+    }
+}
+
+// Reads a whole file; false if it cannot be read or does not look like text.
+bool read_text_file(const native_string& full_path, std::uint64_t size, std::string& out)
+{
+    platform_file file = platform_open_read(full_path);
+    if (file == PLATFORM_INVALID_FILE) return false;
+    out.resize((size_t)size);
+    std::uint64_t done = 0;
+    while (done < size) {
+        long long n = platform_read_at(file, &out[(size_t)done], (size_t)(size - done), done);
+        if (n <= 0) break;
+        done += (std::uint64_t)n;
+    }
+    platform_close_file(file);
+    out.resize((size_t)done);
+    // A NUL byte near the start means a binary file with a text-like extension.
+    return memchr(out.data(), 0, std::min<size_t>(out.size(), 8192)) == nullptr;
+}
+
+/**
+ * @brief (Re)indexes one file, unless the index already has this exact version of it.
+ */
+void index_file(const native_string& full_path, const std::string& relative_path, const platform_file_info& info)
+{
+    IndexState& state = index_state();
+    if (!is_text_file(relative_path) || info.size > kMaxIndexedFileSize) {
+        remove_tree(relative_path);
+        return;
+    }
+    auto found = state.paths.find(relative_path);     // Only this thread writes: no lock needed to read.
+    if (found != state.paths.end()) {
+        std::uint64_t size;
+        std::int64_t mtime_ns;
+        doc_identity(state, found->second, size, mtime_ns);
+        if (size == info.size && mtime_ns == info.mtime_ns) return;
+    }
+
+    // --- 1. Read and tokenize outside the lock ---
+    std::string content;
+    std::unordered_map<std::string, std::uint32_t> counts;
+    std::uint32_t token_count = 0;
+    if (read_text_file(full_path, info.size, content)) {
+        tokenize(content.data(), content.size(), [&](const std::string& token) {
+            counts[token]++;
+            token_count++;
+        });
+    }
+
+    // --- 2. Publish it as a new live document, replacing the old version ---
+    std::unique_lock<std::shared_mutex> guard(g_state_lock);
+    remove_document(state, relative_path);
+    std::uint32_t id = state.base_docs + (std::uint32_t)state.live_docs.size();
+    state.live_docs.push_back(LiveDoc{ relative_path, info.size, info.mtime_ns, token_count });
+    state.deleted.push_back(0);
+    for (const auto& count : counts) {
+        state.live_terms[count.first].push_back(Posting{ id, count.second });
+    }
+    state.live_postings += counts.size();
+    state.paths[relative_path] = id;
+    state.alive_tokens += token_count;
+    state.dirty = true;
+    g_updates.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Brings everything below a directory up to date: new and changed files are
+ * indexed, documents whose file is gone are removed.
+ */
+void reconcile(const native_string& full_path, const std::string& relative_path)
+{
+    std::set<std::string> seen;
+    walk_root_tree(full_path, relative_path, [&seen](const native_string& child, const std::string& child_relative, const platform_dir_entry& entry) {
+        if (entry.info.is_directory || !is_text_file(child_relative)) return;
+        seen.insert(child_relative);
+        index_file(child, child_relative, entry.info);
+    });
+
+    // Documents below this directory that no longer exist.
+    std::vector<std::string> gone;
+    {
+        IndexState& state = index_state();
+        std::string prefix = relative_path.empty() ? std::string() : relative_path + "/";
+        for (auto it = state.paths.lower_bound(prefix); it != state.paths.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it) {
+            if (!seen.count(it->first)) gone.push_back(it->first);
+        }
+    }
+    for (const std::string& path : gone) {
+        remove_tree(path);
+    }
+}
+
+/**
+ * @brief Handles one changed path reported by the file watch or a write handler.
+ */
+void apply_change(const native_string& full_path)
+{
+    std::string relative_path;
+    if (!root_relative_path(full_path, relative_path)) return;
+
+    platform_file_info info;
+    if (!platform_stat_path(full_path, info)) {
+        remove_tree(relative_path);
+    }
+    else if (info.is_directory) {
+        reconcile(full_path, relative_path);
+    }
+    else {
+        index_file(full_path, relative_path, info);
+    }
+}
+
+// ============================================================================
+// --- Indexer thread: segments ---
+// ============================================================================
+
+native_string segment_path(std::uint64_t generation)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%llu.idx", (unsigned long long)generation);
+    return g_segment_dir + kPathSeparator + utf8_to_native(g_segment_prefix + name);
+}
+
+// Appends zero bytes until the stream position is a multiple of 'alignment'.
+void pad_to(std::ofstream& out, std::uint64_t& position, std::uint64_t alignment)
+{
+    static const char kZeros[8] = {};
+    std::uint64_t padding = (alignment - position % alignment) % alignment;
+    out.write(kZeros, (std::streamsize)padding);
+    position += padding;
+}
+
+/**
+ * @brief Writes the current state (minus deleted documents) as a new segment and switches to it.
+ */
+void merge_segment()
+{
+    IndexState& state = index_state();
+    if (g_segment_dir.empty()) return;
+
+    // --- 1. New doc ids: the surviving documents, in their current order ---
+    std::uint32_t total_docs = state.base_docs + (std::uint32_t)state.live_docs.size();
+    std::vector<std::uint32_t> new_ids(total_docs, UINT32_MAX);
+    std::vector<std::uint32_t> old_ids;
+    for (std::uint32_t id = 0; id < total_docs; id++) {
+        if (!state.deleted[id]) {
+            new_ids[id] = (std::uint32_t)old_ids.size();
+            old_ids.push_back(id);
+        }
+    }
+
+    std::uint64_t generation = g_generation + 1;
+    native_string final_path = segment_path(generation);
+    native_string temp_path = final_path + NATIVE_TEXT(".tmp");
+    std::ofstream out(std::filesystem::path(temp_path), std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) return;
+
+    SegmentHeader header = {};
+    out.write((const char*)&header, sizeof(header));
+    std::uint64_t position = sizeof(header);
+    header.postings_offset = position;
+
+    // --- 2. Postings: the on-disk and live terms, merged in sorted order ---
+    std::vector<const std::string*> live_terms;
+    for (const auto& term : state.live_terms) live_terms.push_back(&term.first);
+    std::sort(live_terms.begin(), live_terms.end(), [](const std::string* a, const std::string* b) { return *a < *b; });
+
+    std::vector<TermRecord> terms;
+    std::string strings;
+    const TermRecord* base = state.segment ? state.segment->terms_begin() : nullptr;
+    const TermRecord* base_end = state.segment ? state.segment->terms_end() : nullptr;
+    size_t live = 0;
+    std::vector<Posting> postings;
+    std::string blocks;
+    std::vector<SkipEntry> skips;
+    while (base != base_end || live < live_terms.size()) {
+        // The next term in sorted order, from either side (or both).
+        std::string_view term;
+        bool from_base = false;
+        bool from_live = false;
+        if (base != base_end && (live == live_terms.size() || state.segment->term(*base) <= *live_terms[live])) {
+            term = state.segment->term(*base);
+            from_base = true;
+            from_live = live < live_terms.size() && term == *live_terms[live];
+        }
+        else {
+            term = *live_terms[live];
+            from_live = true;
+        }
+
+        postings.clear();
+        if (from_base) {
+            decode_postings(*state.segment, *base, postings);
+            ++base;
+        }
+        if (from_live) {
+            const std::vector<Posting>& live_postings = state.live_terms.find(*live_terms[live])->second;
+            postings.insert(postings.end(), live_postings.begin(), live_postings.end());
+            ++live;
+        }
+        // Drop deleted documents and renumber; the order is preserved.
+        size_t kept = 0;
+        for (const Posting& posting : postings) {
+            if (new_ids[posting.doc] != UINT32_MAX) postings[kept++] = Posting{ new_ids[posting.doc], posting.tf };
+        }
+        postings.resize(kept);
+        if (postings.empty()) continue;
+
+        blocks.clear();
+        skips.clear();
+        std::int64_t previous = -1;
+        for (size_t i = 0; i < postings.size(); i++) {
+            if (i % kBlockSize == 0) skips.push_back(SkipEntry{ 0, (std::uint32_t)blocks.size() });
+            write_varint(blocks, (std::uint32_t)(postings[i].doc - previous - 1));
+            write_varint(blocks, postings[i].tf);
+            previous = postings[i].doc;
+            skips.back().last_doc = postings[i].doc;
+        }
+
+        pad_to(out, position, 4);
+        TermRecord record = {};
+        record.term_offset = strings.size();
+        record.term_length = (std::uint32_t)term.size();
+        record.postings_offset = position - header.postings_offset;
+        record.doc_freq = (std::uint32_t)postings.size();
+        record.block_count = (std::uint32_t)skips.size();
+        terms.push_back(record);
+        strings.append(term.data(), term.size());
+
+        out.write((const char*)skips.data(), (std::streamsize)(skips.size() * sizeof(SkipEntry)));
+        out.write(blocks.data(), (std::streamsize)blocks.size());
+        position += skips.size() * sizeof(SkipEntry) + blocks.size();
+    }
+
+    // --- 3. Documents, terms, strings, footer, and finally the header ---
+    pad_to(out, position, 8);
+    header.docs_offset = position;
+    std::uint64_t total_tokens = 0;
+    for (std::uint32_t old_id : old_ids) {
+        DocRecord record = {};
+        doc_identity(state, old_id, record.size, record.mtime_ns);
+        std::string path = doc_path(state, old_id);
+        record.path_offset = strings.size();
+        record.path_length = (std::uint32_t)path.size();
+        record.token_count = doc_token_count(state, old_id);
+        total_tokens += record.token_count;
+        strings += path;
+        out.write((const char*)&record, sizeof(record));
+    }
+    position += old_ids.size() * sizeof(DocRecord);
+    header.terms_offset = position;
+    out.write((const char*)terms.data(), (std::streamsize)(terms.size() * sizeof(TermRecord)));
+    position += terms.size() * sizeof(TermRecord);
+    header.strings_offset = position;
+    header.strings_size = strings.size();
+    out.write(strings.data(), (std::streamsize)strings.size());
+    out.write(kFooterMagic, sizeof(kFooterMagic));
+
+    memcpy(header.magic, kSegmentMagic, sizeof(kSegmentMagic));
+    header.version = kSegmentVersion;
+    header.doc_count = (std::uint32_t)old_ids.size();
+    header.term_count = (std::uint32_t)terms.size();
+    header.total_tokens = total_tokens;
+    out.seekp(0);
+    out.write((const char*)&header, sizeof(header));
+    out.close();
+
+    std::error_code error;
+    if (!out || (std::filesystem::rename(std::filesystem::path(temp_path), std::filesystem::path(final_path), error), error)) {
+        std::filesystem::remove(std::filesystem::path(temp_path), error);
+        return;
+    }
+    std::unique_ptr<Segment> segment = Segment::open(final_path);
+    if (!segment) return;
+
+    // --- 4. Switch to the new segment ---
+    std::map<std::string, std::uint32_t> paths;
+    for (const auto& path : state.paths) paths.emplace_hint(paths.end(), path.first, new_ids[path.second]);
+    {
+        std::unique_lock<std::shared_mutex> guard(g_state_lock);
+        std::swap(state.segment, segment);
+        state.base_docs = (std::uint32_t)old_ids.size();
+        state.live_docs.clear();
+        state.live_terms.clear();
+        state.live_postings = 0;
+        state.deleted.assign(state.base_docs, 0);
+        state.paths.swap(paths);
+        state.alive_tokens = total_tokens;
+        state.dirty = false;
+    }
+    segment.reset();    // The old mapping, now that no query can be using it.
+
+    // Older generations are no longer needed. On Windows a file still mapped elsewhere
+    // cannot be deleted; it is tried again after the next merge.
+    std::filesystem::remove(std::filesystem::path(segment_path(g_generation)), error);
+    g_generation = generation;
+    g_merges.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Maps the newest valid segment of this root, if there is one.
+ */
+void load_segment()
+{
+    std::error_code error;
+    std::vector<std::uint64_t> generations;
+    for (std::filesystem::directory_iterator it(std::filesystem::path(g_segment_dir), error), end; !error && it != end; it.increment(error)) {
+        std::string name = native_to_utf8(it->path().filename().native());
+        if (name.compare(0, g_segment_prefix.size(), g_segment_prefix) != 0) continue;
+        if (name.size() < 4 || name.compare(name.size() - 4, 4, ".idx") != 0) {
+            // A leftover temporary file from an interrupted merge.
+            if (name.size() > 4 && name.compare(name.size() - 4, 4, ".tmp") == 0) std::filesystem::remove(it->path(), error);
+            continue;
+        }
+        generations.push_back(strtoull(name.c_str() + g_segment_prefix.size(), nullptr, 10));
+    }
+    std::sort(generations.rbegin(), generations.rend());
+
+    IndexState& state = index_state();
+    for (std::uint64_t generation : generations) {
+        std::unique_ptr<Segment> segment = Segment::open(segment_path(generation));
+        if (!segment) continue;
+
+        std::unique_lock<std::shared_mutex> guard(g_state_lock);
+        state.base_docs = segment->doc_count();
+        state.deleted.assign(state.base_docs, 0);
+        for (std::uint32_t id = 0; id < state.base_docs; id++) {
+            state.paths.emplace_hint(state.paths.end(), segment->doc_path(id), id);
+        }
+        state.alive_tokens = segment->total_tokens();
+        state.segment = std::move(segment);
+        g_generation = generation;
+        break;
+    }
+    // Anything older than what was loaded is of no use any more.
+    for (std::uint64_t generation : generations) {
+        if (generation < g_generation) std::filesystem::remove(std::filesystem::path(segment_path(generation)), error);
+    }
+}
+
+void on_root_change(const native_string& path, void* ctx)
+{
+    indexer_queue().push(path);
+}
+
+// Whether it is time for merge_segment(); see kMergePostings.
+bool merge_due(const IndexState& state, bool idle)
+{
+    if (state.live_postings >= kMergePostings) return true;
+    if (!idle || !state.dirty) return false;
+    std::uint64_t segment_bytes = state.segment ? state.segment->bytes() : 0;
+    return segment_bytes <= kCheapMergeBytes || state.live_postings >= kMergePostings / kIdleMergeDivisor;
+}
+
+void indexer_thread(void* arg)
+{
+    // --- 1. Answer queries from the last segment right away, then catch up with the disk ---
+    load_segment();
+    bool watching = root_watch_subscribe(on_root_change, nullptr);
+    reconcile(platform_root_path(), std::string());
+    g_ready = true;
+    if (merge_due(index_state(), true)) merge_segment();
+
+    // --- 2. Follow the changes ---
+    RootChangeQueue& queue = indexer_queue();
+    std::set<native_string> pending;
+    bool rescan;
+    for (;;) {
+        // Without a file watch, compare everything again every time the idle delay passes.
+        if (!queue.take(pending, rescan, kIdleMergeDelay)) rescan = !watching;
+
+        if (rescan) {
+            reconcile(platform_root_path(), std::string());
+        }
+        for (const native_string& path : pending) {
+            apply_change(path);
+        }
+
+        bool idle = pending.empty() && !rescan;
+        if (merge_due(index_state(), idle)) {
+            merge_segment();
+        }
+    }
+}
+
+// ============================================================================
+// --- Queries ---
+// ============================================================================
+
+struct QueryTerm {
+    std::string text;
+    bool prefix;
+};
+
+/**
+ * @brief One query term's postings within one segment.
+ */
+struct TermSource {
+    PostingCursor cursor;
+    std::vector<Posting> owned;     // For prefix expansions.
+    std::uint64_t doc_freq = 0;
+    size_t term = 0;                // Index into the query's terms.
+};
+
+std::vector<QueryTerm> parse_query(const std::string& query)
+{
+    std::vector<QueryTerm> terms;
+    size_t pos = 0;
+    while (pos < query.size() && terms.size() < kMaxQueryTerms) {
+        size_t end = query.find_first_of(" \t\r\n", pos);
+        if (end == std::string::npos) end = query.size();
+        std::string word = query.substr(pos, end - pos);
+        pos = end + 1;
+
+        bool prefix = !word.empty() && word.back() == '*';
+        std::vector<std::string> tokens;
+        tokenize(word.data(), word.size(), [&tokens](const std::string& token) { tokens.push_back(token); });
+        for (size_t i = 0; i < tokens.size() && terms.size() < kMaxQueryTerms; i++) {
+            terms.push_back(QueryTerm{ tokens[i], prefix && i + 1 == tokens.size() });
+        }
+    }
+    return terms;
+}
+
+// Sets up the on-disk segment's postings for every term; false if one of them has none.
+bool open_segment_sources(const Segment& segment, const std::vector<QueryTerm>& terms, std::vector<TermSource>& sources)
+{
+    sources.resize(terms.size());
+    for (size_t i = 0; i < terms.size(); i++) {
+        TermSource& source = sources[i];
+        source.term = i;
+        if (!terms[i].prefix) {
+            const TermRecord* record = segment.find_term(terms[i].text);
+            if (!record) return false;
+            source.cursor.reset(segment.postings(*record), record->block_count, record->doc_freq);
+            source.doc_freq = record->doc_freq;
+            continue;
+        }
+        auto range = segment.prefix_range(terms[i].text);
+        if (range.first == range.second) return false;
+        for (const TermRecord* record = range.first; record != range.second && record - range.first < (std::ptrdiff_t)kMaxPrefixTerms; ++record) {
+            decode_postings(segment, *record, source.owned);
+        }
+        merge_postings(source.owned);
+        source.cursor.reset(source.owned.data(), source.owned.data() + source.owned.size());
+        source.doc_freq = source.owned.size();
+    }
+    return true;
+}
+
+// The same for the live segment.
+bool open_live_sources(const IndexState& state, const std::vector<QueryTerm>& terms, std::vector<TermSource>& sources)
+{
+    sources.resize(terms.size());
+    for (size_t i = 0; i < terms.size(); i++) {
+        TermSource& source = sources[i];
+        source.term = i;
+        if (!terms[i].prefix) {
+            auto found = state.live_terms.find(terms[i].text);
+            if (found == state.live_terms.end()) return false;
+            source.cursor.reset(found->second.data(), found->second.data() + found->second.size());
+            source.doc_freq = found->second.size();
+            continue;
+        }
+        size_t expanded = 0;
+        for (const auto& term : state.live_terms) {
+            if (term.first.compare(0, terms[i].text.size(), terms[i].text) != 0) continue;
+            source.owned.insert(source.owned.end(), term.second.begin(), term.second.end());
+            if (++expanded == kMaxPrefixTerms) break;
+        }
+        if (source.owned.empty()) return false;
+        merge_postings(source.owned);
+        source.cursor.reset(source.owned.data(), source.owned.data() + source.owned.size());
+        source.doc_freq = source.owned.size();
+    }
+    return true;
+}
+
+typedef std::pair<double, std::uint32_t> ScoredDoc;
+typedef std::priority_queue<ScoredDoc, std::vector<ScoredDoc>, std::greater<ScoredDoc>> TopDocs;
+
+/**
+ * @brief Intersects one segment's sources and scores every document that has all the terms.
+ *
+ * The rarest term leads; the others seek to its documents (leapfrogging over the
+ * documents they lack), so the cost follows the shortest list, not the longest.
+ */
+void collect_matches(const IndexState& state, std::vector<TermSource>& sources, const std::vector<double>& idf,
+    double average_length, size_t limit, TopDocs& top, std::uint64_t& total)
+{
+    std::sort(sources.begin(), sources.end(), [](const TermSource& a, const TermSource& b) { return a.doc_freq < b.doc_freq; });
+    PostingCursor& lead = sources[0].cursor;
+    while (lead.valid()) {
+        std::uint32_t target = lead.current().doc;
+        bool all = true;
+        for (size_t i = 1; i < sources.size(); i++) {
+            sources[i].cursor.seek(target);
+            if (!sources[i].cursor.valid()) return;
+            if (sources[i].cursor.current().doc != target) {
+                lead.seek(sources[i].cursor.current().doc);
+                all = false;
+                break;
+            }
+        }
+        if (!all) continue;
+
+        if (!state.deleted[target]) {
+            double length_norm = kBm25K1 * (1 - kBm25B + kBm25B * doc_token_count(state, target) / average_length);
+            double score = 0;
+            for (const TermSource& source : sources) {
+                double tf = source.cursor.current().tf;
+                score += idf[source.term] * tf * (kBm25K1 + 1) / (tf + length_norm);
+            }
+            total++;
+            if (top.size() < limit) top.emplace(score, target);
+            else if (score > top.top().first) {
+                top.pop();
+                top.emplace(score, target);
+            }
+        }
+        lead.next();
+    }
+}
+
+} // namespace
+
+void search_index_start()
+{
+    std::call_once(g_start_once, [] {
+        // --- 1. Where this root's segments live ---
+        if (const char* dir = getenv("PERSONA_INDEX_DIR")) {
+            g_segment_dir = utf8_to_native(dir);
+        }
+        else {
+            g_segment_dir = platform_cache_directory();
+        }
+        std::string root = native_to_utf8(platform_root_path());
+        std::uint64_t hash = 14695981039346656037ULL;
+        for (unsigned char c : root) hash = (hash ^ c) * 1099511628211ULL;
+        char prefix[32];
+        snprintf(prefix, sizeof(prefix), "search-%016llx-", (unsigned long long)hash);
+        g_segment_prefix = prefix;
+
+        // --- 2. Everything else happens on the indexer thread ---
+        platform_start_thread(indexer_thread, nullptr);
+    });
+}
+
+void search_index_update(const native_string& full_path)
+{
+    on_root_change(full_path, nullptr);
+}
+
+std::vector<SearchHit> search_index_query(const std::string& query, size_t limit, std::uint64_t& out_total)
+{
+    g_queries.fetch_add(1, std::memory_order_relaxed);
+    out_total = 0;
+    std::vector<SearchHit> hits;
+    std::vector<QueryTerm> terms = parse_query(query);
+    if (terms.empty() || limit == 0) return hits;
+
+    IndexState& state = index_state();
+    std::shared_lock<std::shared_mutex> guard(g_state_lock);
+
+    // --- 1. Each term's postings in both segments ---
+    std::vector<TermSource> base_sources;
+    std::vector<TermSource> live_sources;
+    bool in_base = state.segment && open_segment_sources(*state.segment, terms, base_sources);
+    bool in_live = open_live_sources(state, terms, live_sources);
+    if (!in_base && !in_live) return hits;
+
+    // --- 2. BM25 statistics over both segments ---
+    double documents = (double)std::max<size_t>(state.paths.size(), 1);
+    double average_length = std::max(1.0, (double)state.alive_tokens / documents);
+    std::vector<double> idf(terms.size());
+    for (size_t i = 0; i < terms.size(); i++) {
+        double doc_freq = (in_base ? (double)base_sources[i].doc_freq : 0) + (in_live ? (double)live_sources[i].doc_freq : 0);
+        idf[i] = std::log(1 + (documents - doc_freq + 0.5) / (doc_freq + 0.5));
+    }
+
+    // --- 3. Intersect and keep the best ---
+    TopDocs top;
+    if (in_base) collect_matches(state, base_sources, idf, average_length, limit, top, out_total);
+    if (in_live) collect_matches(state, live_sources, idf, average_length, limit, top, out_total);
+
+    hits.resize(top.size());
+    for (size_t i = hits.size(); i-- > 0;) {
+        hits[i].path = "/" + doc_path(state, top.top().second);
+        hits[i].score = top.top().first;
+        top.pop();
+    }
+    return hits;
+}
+
+std::string search_fold_case(const std::string& text)
+{
+    std::string out;
+    out.reserve(text.size());
+    const unsigned char* p = (const unsigned char*)text.data();
+    const unsigned char* end = p + text.size();
+    while (p < end) {
+        const unsigned char* start = p;
+        std::uint32_t cp = decode_utf8(p, end);
+        if (cp == kInvalidCodePoint) out += (char)*start;     // Invalid bytes are kept as they are.
+        else append_utf8(out, fold_case(cp));
+    }
+    return out;
+}
+
+SearchIndexStats get_search_index_stats()
+{
+    SearchIndexStats stats;
+    {
+        IndexState& state = index_state();
+        std::shared_lock<std::shared_mutex> guard(g_state_lock);
+        stats.documents = state.paths.size();
+        stats.terms = state.segment ? state.segment->term_count() : 0;
+        stats.segment_bytes = state.segment ? state.segment->bytes() : 0;
+        stats.live_postings = state.live_postings;
+    }
+    stats.pending = indexer_queue().size();
+    stats.queries = g_queries.load(std::memory_order_relaxed);
+    stats.updates = g_updates.load(std::memory_order_relaxed);
+    stats.merges = g_merges.load(std::memory_order_relaxed);
+    stats.ready = g_ready.load();
+    return stats;
+}
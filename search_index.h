@@ -0,0 +1,74 @@
+﻿#pragma once
+
+#include "platform.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Starts the full-text search index over the text files of the virtual drive.
+ *
+ * The index lives in an on-disk segment (see search_index.cpp for the format) that is
+ * memory-mapped at startup, so a restart can answer queries right away. A background
+ * indexer thread then brings it up to date: it compares every text file's size and
+ * mtime with what the segment recorded, and re-reads only what changed. After that it
+ * follows the drive's change notifications (see root_watch_subscribe()) and
+ * search_index_update() calls. New content goes into an in-memory segment that is
+ * merged into a new on-disk segment once it has grown large enough.
+ *
+ * The segment is stored in PERSONA_INDEX_DIR if set, otherwise in platform_cache_directory().
+ */
+void search_index_start();
+
+/**
+ * @brief Tells the index that a file or directory was written, replaced or deleted.
+ *
+ * Called by the write handlers so their changes become searchable without waiting for
+ * the file watch. The update itself happens on the indexer thread.
+ *
+ * @param full_path The canonical path (see is_safe_path()).
+ */
+void search_index_update(const native_string& full_path);
+
+/**
+ * @brief One search result.
+ */
+struct SearchHit {
+    std::string path;               // The file's path as the client sees it, e.g. "/notes/todo.md".
+    double score;                   // BM25 relevance; higher is better.
+};
+
+/**
+ * @brief Finds the documents that contain every word of a query.
+ *
+ * The query is split into words with the same tokenizer as the documents (letters and
+ * digits, case-folded); a word ending in '*' matches every word it is a prefix of.
+ *
+ * @param limit The number of best hits to return.
+ * @param out_total Set to the number of matching documents.
+ * @return The best hits, best first.
+ */
+std::vector<SearchHit> search_index_query(const std::string& query, size_t limit, std::uint64_t& out_total);
+
+/**
+ * @brief Case-folds UTF-8 text the way the index does (ASCII, Latin-1, Greek, Cyrillic and
+ * fullwidth Latin letters to lower case), so other lookups can match case-insensitively.
+ */
+std::string search_fold_case(const std::string& text);
+
+/**
+ * @brief Counters describing the search index, for diagnostics and metrics.
+ */
+struct SearchIndexStats {
+    uint64_t documents;             // Searchable documents.
+    uint64_t terms;                 // Distinct words in the on-disk segment.
+    uint64_t segment_bytes;         // Size of the mapped on-disk segment.
+    uint64_t live_postings;         // Postings in the in-memory segment, not yet merged.
+    uint64_t pending;               // Paths waiting for the indexer thread.
+    uint64_t queries;
+    uint64_t updates;               // Documents (re)indexed or removed.
+    uint64_t merges;                // On-disk segments written.
+    bool ready;                     // The startup scan has finished.
+};
+
+SearchIndexStats get_search_index_stats();
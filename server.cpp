@@ -1,18 +1,35 @@
-﻿#include <winsock2.h>
+﻿#ifdef _WIN32
+#include <winsock2.h>
 #pragma comment(lib, "ws2_32.lib")
+#endif
 #include "httplib.h"
 #include <iostream>
 #include <string>
 #include <vector>
 #include <locale>
 #include <codecvt>
-#include <fstream>
-#include <windows.h>
 #include <stdexcept>
 #include <filesystem>
 #include <chrono>
 #include <iomanip>
+#include <algorithm>
+#include <atomic>
 #include "nlohmann/json.hpp"
+#include "platform.h"
+#include "content_type.h"
+#include "file_receiver.h"
+#include "file_sender.h"
+#include "file_cache.h"
+#include "static_assets.h"
+#include "conditional_get.h"
+#include "directory_listing.h"
+#include "tree_walk.h"
+#include "search_index.h"
+#include "filename_index.h"
+#include "app_registry.h"
+#include "error_log.h"
+#include "metrics.h"
+#include "trace.h"
 
 /**
  * @brief Declares the function to start the virtual filesystem.
@@ -26,15 +43,15 @@ extern "C" int start_filesystem(int argc, wchar_t* argv[]);
 /**
  * @brief The main function for the web server thread.
  *
- * This function is designed to be executed in a separate thread via the Windows API's CreateThread.
+ * This function is designed to be executed in a separate thread via platform_start_thread
+ * (CreateThread on Windows, std::thread on Linux).
  * It takes a pointer to an httplib::Server object and starts its listening loop.
  * Running the server in its own thread is crucial because svr->listen() is a blocking call
  * that would otherwise freeze the main application's UI or other operations.
  *
  * @param lpParam A void pointer which is expected to be a pointer to the httplib::Server instance.
- * @return DWORD The thread's exit code (0 indicates success).
  */
-DWORD WINAPI run_server(LPVOID lpParam) {
+void run_server(void* lpParam) {
     // Cast the void pointer argument back to a usable httplib::Server pointer.
     httplib::Server* svr = (httplib::Server*)lpParam;
 
@@ -44,162 +61,134 @@ DWORD WINAPI run_server(LPVOID lpParam) {
     // Start the server's blocking listening loop. This function will continuously wait for
     // and handle incoming HTTP requests until the server is stopped.
     svr->listen("localhost", 1234);
-
-    // Standard return value for a successfully terminated thread.
-    return 0;
 }
 
 /**
- * @brief Converts a wide string (UTF-16 on Windows) to a UTF-8 encoded string.
+ * @brief Reads an optional non-negative integer query parameter.
  *
- * This function is necessary for handling file paths and other strings that may
- * contain non-ASCII characters, ensuring they are compatible with web standards
- * and libraries that expect UTF-8. It uses the Windows API's WideCharToMultiByte.
- *
- * @param wstr The wide string (std::wstring) to convert.
- * @return std::string The resulting UTF-8 encoded string.
+ * @param value Left unchanged if the parameter is absent; values above 'max' are clamped to it.
+ * @return false if the parameter is present but not a number of at least 'min'.
  */
-std::string wstring_to_utf8(const std::wstring& wstr)
+static bool get_count_param(const httplib::Request& req, const char* name, std::uint64_t min, std::uint64_t max, std::uint64_t& value)
 {
-    // If the input string is empty, return an empty string immediately to avoid errors.
-    if (wstr.empty()) return std::string();
-
-    // Step 1: Calculate the required buffer size for the output UTF-8 string.
-    // We call WideCharToMultiByte with a NULL output buffer to ask it how much space is needed.
-    int size_needed = WideCharToMultiByte(
-        CP_UTF8,      // The target character set (UTF-8).
-        0,            // Default flags.
-        &wstr[0],     // Pointer to the start of the wide string.
-        (int)wstr.size(), // Length of the wide string.
-        NULL,         // NULL for the output buffer to calculate size.
-        0,            // 0 for the output buffer size.
-        NULL,         // Not used.
-        NULL          // Not used.
-    );
-
-    // Step 2: Perform the actual conversion.
-    // Create a string of the calculated size, initialized with zeros.
-    std::string strTo(size_needed, 0);
-
-    // Call the function again, this time providing the output buffer.
-    WideCharToMultiByte(
-        CP_UTF8,
-        0,
-        &wstr[0],
-        (int)wstr.size(),
-        &strTo[0],    // Pointer to the start of the output string buffer.
-        size_needed,  // The size of the output buffer.
-        NULL,
-        NULL
-    );
-
-    // Return the converted UTF-8 string.
-    return strTo;
+    if (!req.has_param(name)) {
+        return true;
+    }
+    const std::string& text = req.get_param_value(name);
+    char* end = nullptr;
+    unsigned long long parsed = strtoull(text.c_str(), &end, 10);
+    if (text.empty() || !isdigit((unsigned char)text[0]) || *end != '\0' || parsed < min) {
+        return false;
+    }
+    value = std::min<std::uint64_t>(parsed, max);
+    return true;
 }
 
 /**
- * @brief Converts a UTF-8 encoded string to a wide string (UTF-16 on Windows).
- *
- * This is the reverse of the wstring_to_utf8 function. It's useful for when you need
- * to pass a standard string to a Windows API function that expects a wide string
- * (LPCWSTR), especially for handling file paths with international characters.
- *
- * @param str The UTF-8 encoded string (std::string) to convert.
- * @return std::wstring The resulting wide string (UTF-16).
+ * @brief utf8_to_native() and is_safe_path(), timed as the request's "safe_path" span.
  */
-std::wstring utf8_to_wstring(const std::string& str)
+static native_string traced_utf8_to_native(const std::string& utf8)
+{
+    TraceScope span("safe_path");
+    return utf8_to_native(utf8);
+}
+
+static bool traced_is_safe_path(const native_string& requested, native_string& full_path)
 {
-    // Return immediately if the input string is empty.
-    if (str.empty()) return std::wstring();
-
-    // Step 1: Calculate the required buffer size for the output wide string.
-    // Call MultiByteToWideChar with a NULL output buffer to get the needed size.
-    int size_needed = MultiByteToWideChar(
-        CP_UTF8,      // The source character set (UTF-8).
-        0,            // Default flags.
-        &str[0],      // Pointer to the start of the source string.
-        (int)str.size(), // Length of the source string in bytes.
-        NULL,         // NULL for the output buffer to calculate size.
-        0             // 0 for the output buffer size.
-    );
-
-    // Step 2: Perform the actual conversion.
-    // Create a wide string of the calculated size.
-    std::wstring wstrTo(size_needed, 0);
-
-    // Call the function again, this time providing the destination buffer.
-    MultiByteToWideChar(
-        CP_UTF8,
-        0,
-        &str[0],
-        (int)str.size(),
-        &wstrTo[0],   // Pointer to the start of the destination buffer.
-        size_needed   // The size of the destination buffer.
-    );
-
-    // Return the converted wide string.
-    return wstrTo;
+    TraceScope span("safe_path");
+    return is_safe_path(requested, full_path);
 }
 
 /**
- * @brief Acts as a security checkpoint to prevent directory traversal attacks.
+ * @brief The streaming mode of /api/writefile: the request body is the file itself.
  *
- * This function takes a filename provided by a user, combines it with the virtual
- * drive's root path (C:\PersonaRoot\), and verifies that the final, fully-resolved
- * path is still safely within that root directory. This is crucial for preventing
- * users from accessing unauthorized files using relative paths like "../../Windows/System32/".
+ * The body is raw bytes, or multipart/form-data with one file part (other fields are
+ * ignored). It goes through a FileReceiver into a hidden temporary file next to the
+ * target (upload_temp_path()), which then replaces the target in one rename: readers never
+ * see a half-written file, and a failed or aborted upload leaves the old one untouched.
  *
- * @param requested_filename The filename or relative path from the user's request.
- * @param out_full_path An output parameter that will be filled with the safe,
- * canonical path if the check is successful.
- * @return true if the path is safe and within C:\PersonaRoot\, false otherwise.
+ * The body is read to the end even after an error, so the connection stays in sync for
+ * the client's next request.
  */
-bool is_safe_path(const std::wstring& requested_filename, std::wstring& out_full_path)
+static void receive_upload(const httplib::Request& req, httplib::Response& res, const httplib::ContentReader& content_reader, const std::string& utf8_filename)
 {
-    // 1. Combine the base path of the virtual drive with the requested filename.
-    std::wstring combined_path = L"C:\\PersonaRoot\\" + requested_filename;
-
-    // 2. Use the Windows API to resolve the path into its canonical, absolute form.
-    // This function is key as it processes any potentially malicious ".." or "." components.
-    wchar_t final_path_buffer[MAX_PATH];
-    if (GetFullPathNameW(combined_path.c_str(), MAX_PATH, final_path_buffer, NULL) == 0) {
-        // If the path calculation fails (e.g., due to invalid characters), consider it unsafe.
-        return false;
+    static std::atomic<std::uint64_t> s_uploads{ 0 };
+    const int kUploadCreateAttempts = 16;
+
+    auto fail = [&](int status, const std::string& message) {
+        res.status = status;
+        res.set_content("{\"status\": \"error\", \"message\": \"" + message + "\"}", "application/json");
+    };
+
+    // Multipart bodies arrive part by part; only the first part that carries a file is kept.
+    int file_parts = 0;
+    bool in_file = false;
+    auto read_body = [&](const httplib::ContentReceiver& receiver) {
+        if (!req.is_multipart_form_data()) {
+            return content_reader(receiver);
+        }
+        return content_reader(
+            [&](const httplib::FormData& part) {
+                in_file = !part.filename.empty() && file_parts++ == 0;
+                return true;
+            },
+            [&](const char* data, size_t length) { return !in_file || receiver(data, length); });
+    };
+    auto discard = [](const char*, size_t) { return true; };
+
+    // --- 1. Perform security check ---
+    native_string safe_full_path;
+    if (!traced_is_safe_path(traced_utf8_to_native(utf8_filename), safe_full_path)) {
+        read_body(discard);
+        fail(403, "Forbidden: Path is not safe.");
+        return;
     }
 
-    // 3. Final defense: Check if the fully resolved path starts with our safe directory prefix.
-    std::wstring safe_prefix = L"C:\\PersonaRoot\\";
-    if (wcsncmp(final_path_buffer, safe_prefix.c_str(), safe_prefix.length()) != 0) {
-        // If the resolved path has "escaped" the safe directory, treat it as a hostile request and block it.
-        return false;
+    // --- 2. Stream the body into a temporary file beside the target ---
+    TraceScope span("fs");
+    // Created exclusively, so a name left behind by an earlier run (or anything else) is never truncated.
+    native_string temp_path;
+    platform_file file = PLATFORM_INVALID_FILE;
+    for (int attempt = 0; attempt < kUploadCreateAttempts && file == PLATFORM_INVALID_FILE; attempt++) {
+        temp_path = upload_temp_path(safe_full_path, ++s_uploads);
+        file = platform_create_file(temp_path);
+    }
+    if (file == PLATFORM_INVALID_FILE) {
+        read_body(discard);
+        fail(500, "Failed to open file for writing");
+        return;
     }
 
-    // 4. If all checks pass, provide the safe, canonical path via the output parameter and report success.
-    out_full_path = final_path_buffer;
-    return true;
-}
+    bool written;
+    std::uint64_t bytes;
+    {
+        FileReceiver receiver(file, req.get_header_value_u64("Content-Length"));
+        bool ok = true;
+        bool complete = read_body([&](const char* data, size_t length) {
+            // After a failed write, keep reading (and dropping) the rest of the body.
+            if (ok) ok = receiver.write(data, length);
+            return true;
+            });
+        // finish() also waits for a write still in flight, which must end before the file is closed.
+        written = receiver.finish() && ok && complete;
+        bytes = receiver.bytes();
+    }
+    platform_close_file(file);
+
+    // --- 3. Replace the target, or drop the partial file ---
+    bool no_file_part = req.is_multipart_form_data() && file_parts == 0;
+    if (!written || no_file_part || !platform_rename_file(temp_path, safe_full_path)) {
+        platform_delete_file(temp_path);
+        if (!written) fail(500, "Failed to write file");
+        else if (no_file_part) fail(400, "The form has no file part");
+        else fail(500, "Failed to replace the file");
+        return;
+    }
 
-/**
- * @brief Determines the MIME type of a file based on its extension.
- *
- * This helper function is used to set the correct `Content-Type` HTTP header
- * when serving static files. This tells the browser how to properly interpret
- * the content (e.g., as an HTML document, a JavaScript file, a CSS stylesheet, etc.).
- *
- * @param path The file path or filename to check.
- * @return std::string The corresponding MIME type as a string.
- */
-std::string get_mime_type(const std::string& path) {
-    // Find the last occurrence of the extension substring to identify the file type.
-    // Note: A more robust implementation might first isolate the extension after the last '.'.
-    if (path.rfind(".html") != std::string::npos) return "text/html";
-    if (path.rfind(".js") != std::string::npos) return "application/javascript";
-    if (path.rfind(".css") != std::string::npos) return "text/css";
-    // ... Other common types like .json, .png, .jpg could be added here ...
-
-    // If the file type is unknown, return the generic binary stream type.
-    // This typically instructs the browser to download the file rather than trying to display it.
-    return "application/octet-stream";
+    file_cache_invalidate(safe_full_path);
+    search_index_update(safe_full_path);
+    filename_index_update(safe_full_path);
+    res.set_content("{\"status\": \"success\", \"filename\": \"" + utf8_filename + "\", \"bytes\": " + std::to_string(bytes) + "}", "application/json");
 }
 
 /**
@@ -217,7 +206,30 @@ extern "C" int start_web_server() {
     // This ensures that the server is created only once, the first time this function is called,
     // and persists for the entire lifetime of the application. This is crucial for maintaining
     // a single, consistent server instance across potential multiple calls.
-    static httplib::Server server;
+    // PersonaServer is an httplib::Server that can also stream files with sendfile/TransmitFile.
+    static PersonaServer server;
+
+    // Send small responses right away: with Nagle's algorithm a response written in more
+    // than one piece (headers, then body) waits for the client's delayed ACK, about 40 ms.
+    server.set_tcp_nodelay(true);
+
+    // Count every request by route, with its latency and bytes (served at /api/metrics).
+    metrics_install(server);
+
+    // Load the frontend (index.html, explorer.js, lib/, apps/) into memory and keep it in sync with the disk.
+    static_assets_start(std::filesystem::current_path().native());
+
+    // Load the app manifests for /api/apps and reload them when they change.
+    app_registry_start((std::filesystem::current_path() / "apps").native());
+
+    // Frontend errors (/api/log) are appended to persona_error.log by a background writer.
+    error_log_start(NATIVE_TEXT("persona_error.log"));
+
+    // Load the full-text index of the drive's text files and keep it in sync in the background.
+    search_index_start();
+
+    // Index every path under the root by trigrams for find-as-you-type (/api/find).
+    filename_index_start();
 
     /**
  * @brief Handles GET requests to list resources (files/directories) in the virtual drive.
@@ -228,6 +240,14 @@ extern "C" int start_web_server() {
  *
  * The route uses a regular expression R"(/api/resources(/.*)?)" to capture the
  * optional path that follows "/api/resources/". For example, "/api/resources/MyFolder".
+ *
+ * Each directory item carries name, isDir, size, mtime (ms since 1970), fileId and a mime
+ * hint, all read in bulk with the directory itself (see platform_read_directory()).
+ * Items are sorted by name. Optional query parameters for large directories:
+ *   - limit=N: return at most N items (up to kMaxListingPageSize), plus a "nextCursor"
+ *     member if more follow.
+ *   - cursor=C: continue after the page whose "nextCursor" was C.
+ *   - stream=1: send the items in chunks, in file system order, while the directory is read.
  */
     server.Get(R"(/api/resources(/.*)?)", [&](const httplib::Request& req, httplib::Response& res) {
         // Set a CORS header to allow requests from any web origin.
@@ -242,40 +262,56 @@ extern "C" int start_web_server() {
             if (!requested_path_utf8.empty() && requested_path_utf8[0] == '/') {
                 requested_path_utf8 = requested_path_utf8.substr(1);
             }
-            // Convert the UTF-8 path to a wide string for Windows API compatibility.
-            std::wstring requested_path_wide = utf8_to_wstring(requested_path_utf8);
+            // Convert the UTF-8 path to the OS's native path string (UTF-16 on Windows).
+            native_string requested_path_native = traced_utf8_to_native(requested_path_utf8);
 
             // --- 2. Perform security check ---
             // Pass the requested path through our security checkpoint.
-            std::wstring full_path;
-            if (!is_safe_path(requested_path_wide, full_path)) {
-                // If the path is outside the safe "C:\PersonaRoot\" directory, deny access.
+            native_string full_path;
+            if (!traced_is_safe_path(requested_path_native, full_path)) {
+                // If the path is outside the safe root directory, deny access.
                 res.status = 403; // 403 Forbidden
                 res.set_content("Forbidden", "text/plain");
                 return;
             }
 
-            // --- 3. Build the JSON response ---
+            // --- 3. Directories ---
+            // ?stream=1 sends the entries while the directory is still being read.
+            if (req.has_param("stream") && req.get_param_value("stream") != "0") {
+                if (stream_directory_listing(res, full_path, "/" + requested_path_utf8)) {
+                    return;
+                }
+            }
+            else if (std::shared_ptr<const DirectoryListing> listing = get_directory_listing(full_path, "/" + requested_path_utf8)) {
+                // ?limit=N&cursor=C returns one page; without them, the whole prebuilt listing.
+                if (req.has_param("limit") || req.has_param("cursor")) {
+                    std::uint64_t limit = kMaxListingPageSize;
+                    if (!get_count_param(req, "limit", 1, kMaxListingPageSize, limit)) {
+                        res.status = 400; // 400 Bad Request
+                        res.set_content("Invalid 'limit' parameter.", "text/plain");
+                        return;
+                    }
+                    std::string page = build_listing_page(*listing, req.get_param_value("cursor"), (size_t)limit);
+                    if (!check_conditional_get(req, res, make_content_etag(page.data(), page.size(), ""), listing->built_ns)) {
+                        res.set_content(std::move(page), "application/json; charset=utf-8");
+                    }
+                    return;
+                }
+                if (!check_conditional_get(req, res, listing->etag, listing->built_ns)) {
+                    set_shared_content(res, listing, listing->body.data(), listing->body.size(), "application/json; charset=utf-8");
+                }
+                return;
+            }
+
+            // --- 4. Anything else gets an empty item list ---
             nlohmann::json response_json;
             // The file browser UI expects a specific JSON structure.
-            response_json["name"] = wstring_to_utf8(std::filesystem::path(full_path).filename().wstring());
-            response_json["isDir"] = std::filesystem::is_directory(full_path);
-            response_json["items"] = nlohmann::json::array(); // Initialize an empty array for directory contents.
+            response_json["name"] = native_to_utf8(std::filesystem::path(full_path).filename().native());
+            response_json["isDir"] = false;
+            response_json["items"] = nlohmann::json::array();
             response_json["path"] = "/" + requested_path_utf8;
 
-            // If the requested path points to a directory, list its contents.
-            if (response_json["isDir"]) {
-                for (const auto& entry : std::filesystem::directory_iterator(full_path)) {
-                    nlohmann::json item;
-                    item["name"] = wstring_to_utf8(entry.path().filename().wstring());
-                    item["isDir"] = entry.is_directory();
-                    // Note: More properties like size and modification date could be added here.
-
-                    response_json["items"].push_back(item);
-                }
-            }
-
-            // --- 4. Send the response ---
+            // --- 5. Send the response ---
             // Convert the JSON object to a string and send it back to the client.
             res.set_content(response_json.dump(), "application/json; charset=utf-8");
 
@@ -287,6 +323,163 @@ extern "C" int start_web_server() {
         }
         });
 
+    /**
+ * @brief Handles GET requests to walk a whole directory tree in one request.
+ *
+ * The route R"(/api/tree(/.*)?)" takes the same paths as /api/resources and streams
+ * the subtree as newline-delimited JSON, one line per directory, read in parallel
+ * (see stream_tree_walk()). Optional query parameters:
+ *   - depth=N: how many levels to descend below the directory (default kDefaultTreeDepth).
+ *   - maxEntries=N: stop after N items (default kDefaultTreeEntries).
+ */
+    server.Get(R"(/api/tree(/.*)?)", [&](const httplib::Request& req, httplib::Response& res) {
+        // Set a CORS header to allow requests from any web origin.
+        res.set_header("Access-Control-Allow-Origin", "*");
+
+        try {
+            // --- 1. Process the requested path and the limits ---
+            std::string requested_path_utf8 = req.matches[1].str();
+            if (!requested_path_utf8.empty() && requested_path_utf8[0] == '/') {
+                requested_path_utf8 = requested_path_utf8.substr(1);
+            }
+
+            std::uint64_t depth = kDefaultTreeDepth;
+            std::uint64_t max_entries = kDefaultTreeEntries;
+            if (!get_count_param(req, "depth", 0, kMaxTreeDepth, depth) ||
+                !get_count_param(req, "maxEntries", 1, kMaxTreeEntries, max_entries)) {
+                res.status = 400; // 400 Bad Request
+                res.set_content("Invalid 'depth' or 'maxEntries' parameter.", "text/plain");
+                return;
+            }
+
+            // --- 2. Perform security check ---
+            native_string full_path;
+            if (!traced_is_safe_path(traced_utf8_to_native(requested_path_utf8), full_path)) {
+                res.status = 403; // 403 Forbidden
+                res.set_content("Forbidden", "text/plain");
+                return;
+            }
+            platform_file_info info;
+            if (!platform_stat_path(full_path, info) || !info.is_directory) {
+                res.status = 404; // 404 Not Found
+                res.set_content("Directory not found", "text/plain");
+                return;
+            }
+
+            // --- 3. Stream the walk ---
+            stream_tree_walk(res, full_path, "/" + requested_path_utf8, (unsigned)depth, max_entries);
+        }
+        catch (const std::exception& e) {
+            res.status = 500;
+            res.set_content(e.what(), "text/plain");
+        }
+        });
+
+    /**
+ * @brief Handles GET requests to search the content of the drive's text files.
+ *
+ * Query: /api/search?q=<words>&limit=<n>. Every word must occur in a file for it to
+ * match; a word ending in '*' matches as a prefix. Results are ranked by BM25.
+ * Response: {"indexing":bool,"query":..,"results":[{"path":"/..","score":..}],"total":N},
+ * where "indexing" is true until the startup scan has caught up with the disk.
+ */
+    server.Get("/api/search", [](const httplib::Request& req, httplib::Response& res) {
+        // Set a CORS header to allow requests from any web origin.
+        res.set_header("Access-Control-Allow-Origin", "*");
+
+        try {
+            // --- 1. Read the query ---
+            if (!req.has_param("q")) {
+                res.status = 400; // 400 Bad Request
+                res.set_content("Missing 'q' parameter.", "text/plain");
+                return;
+            }
+            std::string query = req.get_param_value("q");
+            std::uint64_t limit = 20;
+            if (!get_count_param(req, "limit", 1, 200, limit)) {
+                res.status = 400; // 400 Bad Request
+                res.set_content("Invalid 'limit' parameter.", "text/plain");
+                return;
+            }
+
+            // --- 2. Search ---
+            std::uint64_t total = 0;
+            std::vector<SearchHit> hits;
+            {
+                TraceScope span("query");
+                hits = search_index_query(query, (size_t)limit, total);
+            }
+
+            // --- 3. Build the response ---
+            nlohmann::json response_json;
+            response_json["indexing"] = !get_search_index_stats().ready;
+            response_json["query"] = query;
+            response_json["results"] = nlohmann::json::array();
+            for (const SearchHit& hit : hits) {
+                response_json["results"].push_back({ { "path", hit.path }, { "score", hit.score } });
+            }
+            response_json["total"] = total;
+            TraceScope dump_span("json_dump");
+            res.set_content(response_json.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace), "application/json; charset=utf-8");
+        }
+        catch (const std::exception& e) {
+            res.status = 500;
+            res.set_content(e.what(), "text/plain");
+        }
+        });
+
+    /**
+ * @brief Handles GET requests to find files and directories by name, as the user types.
+ *
+ * Query: /api/find?q=<text>&limit=<n>. Matches every path containing the text,
+ * case-insensitively; whole-name and name-prefix matches rank first.
+ * Response: {"indexing":bool,"query":..,"results":[{"isDir":..,"path":"/..","score":..}],"total":N}.
+ */
+    server.Get("/api/find", [](const httplib::Request& req, httplib::Response& res) {
+        // Set a CORS header to allow requests from any web origin.
+        res.set_header("Access-Control-Allow-Origin", "*");
+
+        try {
+            // --- 1. Read the query ---
+            if (!req.has_param("q")) {
+                res.status = 400; // 400 Bad Request
+                res.set_content("Missing 'q' parameter.", "text/plain");
+                return;
+            }
+            std::string query = req.get_param_value("q");
+            std::uint64_t limit = 20;
+            if (!get_count_param(req, "limit", 1, 200, limit)) {
+                res.status = 400; // 400 Bad Request
+                res.set_content("Invalid 'limit' parameter.", "text/plain");
+                return;
+            }
+
+            // --- 2. Find ---
+            std::uint64_t total = 0;
+            std::vector<FindHit> hits;
+            {
+                TraceScope span("query");
+                hits = filename_index_find(query, (size_t)limit, total);
+            }
+
+            // --- 3. Build the response ---
+            nlohmann::json response_json;
+            response_json["indexing"] = !get_filename_index_stats().ready;
+            response_json["query"] = query;
+            response_json["results"] = nlohmann::json::array();
+            for (const FindHit& hit : hits) {
+                response_json["results"].push_back({ { "isDir", hit.is_dir }, { "path", hit.path }, { "score", hit.score } });
+            }
+            response_json["total"] = total;
+            TraceScope dump_span("json_dump");
+            res.set_content(response_json.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace), "application/json; charset=utf-8");
+        }
+        catch (const std::exception& e) {
+            res.status = 500;
+            res.set_content(e.what(), "text/plain");
+        }
+        });
+
     /**
  * @brief Handles GET requests to read the content of a specific file.
  *
@@ -304,31 +497,49 @@ extern "C" int start_web_server() {
             // --- 1. Get and process the filename ---
             // Get the filename from the query parameter (e.g., /api/readfile?filename=MyFile.txt).
             std::string utf8_filename = req.get_param_value("filename");
-            // Convert to a wide string for Windows API compatibility.
-            std::wstring wide_filename = utf8_to_wstring(utf8_filename);
+            // Convert to the native path string for OS API compatibility.
+            native_string native_filename = traced_utf8_to_native(utf8_filename);
 
             // --- 2. Perform security check ---
-            std::wstring safe_full_path;
+            native_string safe_full_path;
             // Pass the requested filename through our security checkpoint.
-            if (!is_safe_path(wide_filename, safe_full_path)) {
+            if (!traced_is_safe_path(native_filename, safe_full_path)) {
                 // If the security check fails, deny access with a 403 Forbidden error.
                 res.status = 403;
                 res.set_content("Forbidden: Path is not safe.", "text/plain");
                 return; // Stop execution immediately.
             }
 
-            // --- 3. Read and return the file content ---
-            // Open the file from the now-verified safe path in binary mode.
-            std::ifstream infile(safe_full_path, std::ios::binary);
-            if (infile.is_open()) {
-                // Read the entire file content into a string in one go.
-                std::string content((std::istreambuf_iterator<char>(infile)), std::istreambuf_iterator<char>());
-                infile.close();
+            // --- 3. Return the file content ---
+            // The viewers re-request the same files constantly, so small and medium files are
+            // served from the in-memory file cache (revalidated against the file's size, mtime and id).
+            // A viewer reopening a file it already has gets a 304 from the cached entry's identity.
+            std::shared_ptr<const CachedFile> cached;
+            {
+                TraceScope span("fs");
+                cached = file_cache_get(safe_full_path);
+            }
+            if (cached) {
+                if (!check_conditional_get(req, res, make_file_etag(cached->info()), cached->info().mtime_ns)) {
+                    set_cached_file_content(res, std::move(cached), "text/plain; charset=utf-8");
+                }
+                return;
+            }
 
-                // Send the file content as the response.
-                res.set_content(content, "text/plain; charset=utf-8");
+            // Anything else is opened from the now-verified safe path and streamed from the file
+            // as the response is written (through pooled buffers or sendfile), never copied into a string.
+            platform_file file = platform_open_read(safe_full_path);
+            platform_file_info info;
+            if (file != PLATFORM_INVALID_FILE && platform_get_file_info(file, info)) {
+                // Send the file content as the response, unless the client's copy is still current.
+                if (check_conditional_get(req, res, make_file_etag(info), info.mtime_ns)) {
+                    platform_close_file(file);
+                    return;
+                }
+                set_file_content(res, file, info.size, "text/plain; charset=utf-8");
             }
             else {
+                if (file != PLATFORM_INVALID_FILE) platform_close_file(file);
                 // If the file could not be opened (e.g., it doesn't exist), return a 404 Not Found error.
                 res.status = 404;
                 res.set_content("File not found or could not be opened.", "text/plain");
@@ -356,162 +567,127 @@ extern "C" int start_web_server() {
         }
 
         std::string utf8_filename = req.get_param_value("filename");
-        std::wstring wide_filename = utf8_to_wstring(utf8_filename);
+        native_string native_filename = traced_utf8_to_native(utf8_filename);
 
-        std::wstring safe_full_path;
-        if (!is_safe_path(wide_filename, safe_full_path)) {
+        native_string safe_full_path;
+        if (!traced_is_safe_path(native_filename, safe_full_path)) {
             res.status = 403; // Forbidden
             res.set_content("Forbidden: Path is not safe.", "text/plain");
             return;
         }
 
         // --- 2. Open the file for streaming ---
-        auto file_stream = std::make_shared<std::ifstream>(safe_full_path, std::ios::binary);
+        // Each request gets its own handle, read with positioned I/O, so no shared seek position is involved.
+        platform_file file = platform_open_read(safe_full_path);
 
-        if (!file_stream->is_open()) {
+        if (file == PLATFORM_INVALID_FILE) {
             res.status = 404;
             res.set_content("File not found.", "text/plain");
             return;
         }
 
-        // --- 3. Get file size ---
-        file_stream->seekg(0, std::ios::end);
-        auto file_size = file_stream->tellg();
-        file_stream->seekg(0, std::ios::beg);
-
-        // --- 4. Set up the content provider for streaming ---
-        res.set_content_provider(
-            file_size,
-            // MODIFIED: Determine MIME type dynamically based on the filename.
-            get_mime_type(utf8_filename).c_str(),
-
-            // This lambda function is the core of the streaming.
-            [file_stream](size_t offset, size_t length, httplib::DataSink& sink) {
-                file_stream->seekg(offset);
-
-                std::vector<char> buffer(length);
-                file_stream->read(buffer.data(), length);
-
-                sink.write(buffer.data(), file_stream->gcount());
+        // --- 3. Get file size and validators ---
+        // One metadata call on the open handle gives the size, the ETag and Last-Modified.
+        platform_file_info info;
+        if (!platform_get_file_info(file, info)) {
+            platform_close_file(file);
+            res.status = 500;
+            res.set_content("Cannot read file size.", "text/plain");
+            return;
+        }
 
-                return true;
-            },
+        // A player restarting a video it still has cached gets a 304; a Range request with a
+        // stale If-Range gets the whole new file instead of a piece of it.
+        if (check_conditional_get(req, res, make_file_etag(info), info.mtime_ns)) {
+            platform_close_file(file);
+            return;
+        }
 
-            // This lambda is called after the entire file has been sent.
-            [file_stream](bool success) {
-                file_stream->close();
-            }
-        );
+        // --- 4. Hand the file to the response for streaming ---
+        // httplib applies any Range header itself, and send_file_range() hands each range to the
+        // kernel (sendfile/TransmitFile) so the bytes never pass through our buffers.
+        // The type comes from the extension, or from the first block for files without a known one,
+        // so players can start decoding without buffering to sniff it themselves.
+        set_file_content(res, file, info.size, std::string(content_type_for_file(file, info, utf8_filename)));
         });
 
     /**
  * @brief Handles GET requests to discover and list all available applications.
  *
- * This endpoint scans the "./apps/" directory on the server, looking for subdirectories
- * that represent individual applications. It reads the "manifest.json" from each one,
- * processes the paths within it to be web-accessible, and returns a JSON array
- * of all valid app configurations to the frontend.
+ * Returns a JSON array of every app's manifest.json (from "./apps/<app>/"), with its
+ * paths rewritten to be web-accessible. The list is built at startup and rebuilt by a
+ * file watch when a manifest changes (see app_registry_start()), so a request only
+ * sends the current, already serialized snapshot.
  */
     server.Get("/api/apps", [](const httplib::Request& req, httplib::Response& res) {
         // Set a CORS header to allow requests from any web origin.
         res.set_header("Access-Control-Allow-Origin", "*");
 
-        // --- 1. Scan the "./apps/" directory for subdirectories ---
-        // Use the Windows API to find all files and folders in the "apps" directory.
-        std::wstring apps_dir_path = L".\\apps\\*";
-        WIN32_FIND_DATAW find_data;
-        HANDLE find_handle = FindFirstFileW(apps_dir_path.c_str(), &find_data);
-
-        // This will hold the list of all processed app manifests.
-        nlohmann::json apps_list = nlohmann::json::array();
-
-        if (find_handle != INVALID_HANDLE_VALUE) {
-            // Loop through all items found in the "apps" directory.
-            do {
-                std::wstring dir_name = find_data.cFileName;
-
-                // Process the item only if it's a directory and not "." or "..".
-                if ((find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) &&
-                    dir_name != L"." && dir_name != L"..")
-                {
-                    // --- 2. Read and parse the manifest.json for each app ---
-                    std::wstring manifest_path = L".\\apps\\" + dir_name + L"\\manifest.json";
-                    std::ifstream manifest_file(manifest_path);
-
-                    if (manifest_file.is_open()) {
-                        try {
-                            nlohmann::json manifest_json;
-                            manifest_file >> manifest_json;
-
-                            // --- 3. IMPORTANT: Convert relative paths to web-accessible paths ---
-                            // Get the original entry_point (e.g., "viewer.js").
-                            std::string original_entry_point = manifest_json["entry_point"];
-                            // Prepend the app's directory to create a full path (e.g., "apps/text_viewer/viewer.js").
-                            manifest_json["entry_point"] = "apps/" + wstring_to_utf8(dir_name) + "/" + original_entry_point;
-
-                            // Do the same for the "readme" path if it exists.
-                            if (manifest_json.contains("readme")) {
-                                std::string original_readme = manifest_json["readme"];
-                                manifest_json["readme"] = "apps/" + wstring_to_utf8(dir_name) + "/" + original_readme;
-                            }
-
-                            // Add the modified manifest object to our list of apps.
-                            apps_list.push_back(manifest_json);
-                        }
-                        catch (const std::exception& e) {
-                            // If parsing fails for one manifest, print an error and continue with the next.
-                            std::cerr << "JSON parse error in " << wstring_to_utf8(manifest_path) << ": " << e.what() << std::endl;
-                        }
-                    }
-                }
-            } while (FindNextFileW(find_handle, &find_data) != 0);
-            // Clean up and close the file search handle.
-            FindClose(find_handle);
-        }
-
-        // For debugging: print the final JSON data to the server console.
-        std::cout << "Final JSON data sent to frontend:\n" << apps_list.dump(4) << std::endl;
-
-        // --- 4. Send the final list to the frontend ---
-        res.set_content(apps_list.dump(), "application/json; charset=utf-8");
+        serve_app_registry(req, res);
         });
 
     /**
  * @brief Handles POST requests to create or overwrite a file in the virtual drive.
  *
- * This endpoint expects a JSON body containing a "filename" and "content".
- * It performs a security check on the filename and then writes the provided
- * content to the specified file within the C:\PersonaRoot\ directory.
- * If the file already exists, its content will be replaced.
+ * Two ways to send the content:
+ * - JSON: a body containing a "filename" and "content" (text only).
+ * - Upload: /api/writefile?filename=<path> with the file itself as the body, raw or as
+ *   multipart/form-data with one file part. It is streamed to disk as it arrives (see
+ *   receive_upload()), so files of any size and type can be sent with constant memory.
+ *
+ * The filename is checked with is_safe_path(), and an existing file is replaced.
  */
-    server.Post("/api/writefile", [](const httplib::Request& req, httplib::Response& res) {
+    server.Post("/api/writefile", [](const httplib::Request& req, httplib::Response& res, const httplib::ContentReader& content_reader) {
         // Set a CORS header to allow requests from any web origin.
         res.set_header("Access-Control-Allow-Origin", "*");
 
+        if (req.has_param("filename")) {
+            receive_upload(req, res, content_reader, req.get_param_value("filename"));
+            return;
+        }
+
         try {
             // --- 1. Parse the incoming JSON request body ---
             // Example expected body: {"filename": "new.txt", "content": "hello world"}
-            auto json_body = nlohmann::json::parse(req.body);
+            // This handler reads the body itself (ContentReader), so collect it first.
+            std::string body;
+            content_reader([&](const char* data, size_t length) {
+                body.append(data, length);
+                return true;
+                });
+            nlohmann::json json_body;
+            {
+                TraceScope span("json_parse");
+                json_body = nlohmann::json::parse(body);
+            }
             std::string utf8_filename = json_body["filename"];
-            std::string content = json_body["content"];
+            // Referenced in place rather than copied out of the parsed document.
+            const std::string& content = json_body["content"].get_ref<const std::string&>();
 
-            // Convert the filename to a wide string to properly handle non-ASCII characters on Windows.
-            std::wstring wide_filename = utf8_to_wstring(utf8_filename);
+            // Convert the filename to the native path string to properly handle non-ASCII characters on Windows.
+            native_string native_filename = traced_utf8_to_native(utf8_filename);
 
             // --- 2. Perform security check ---
-            std::wstring safe_full_path;
+            native_string safe_full_path;
             // It's critical to validate the path to prevent writing files outside the virtual drive.
-            if (!is_safe_path(wide_filename, safe_full_path)) {
+            if (!traced_is_safe_path(native_filename, safe_full_path)) {
                 // If the security check fails, throw an error to be caught below.
                 throw std::runtime_error("Path is not safe");
             }
 
             // --- 3. Write the content to the file ---
-            // Open the file at the verified safe path. std::ofstream overwrites by default.
-            std::ofstream outfile(safe_full_path);
-            if (outfile.is_open()) {
-                outfile << content;
-                outfile.close();
+            // Create or overwrite the file at the verified safe path; on Linux the open itself
+            // is confined to the root, so a symlink swapped in after the check cannot redirect it.
+            TraceScope write_span("fs");
+            platform_file outfile = platform_open_write(safe_full_path);
+            if (outfile != PLATFORM_INVALID_FILE) {
+                bool written = platform_write_all(outfile, content.data(), content.size());
+                platform_close_file(outfile);
+                if (!written) throw std::runtime_error("Failed to write file");
+                // Drop any cached copy right away rather than waiting for the next revalidation.
+                file_cache_invalidate(safe_full_path);
+                search_index_update(safe_full_path);
+                filename_index_update(safe_full_path);
                 // Send a success response back to the client.
                 res.set_content("{\"status\": \"success\", \"filename\": \"" + utf8_filename + "\"}", "application/json");
             }
@@ -537,22 +713,34 @@ extern "C" int start_web_server() {
 
         try {
             // --- 1. Parse the request and get the filename ---
-            auto json_body = nlohmann::json::parse(req.body);
+            nlohmann::json json_body;
+            {
+                TraceScope span("json_parse");
+                json_body = nlohmann::json::parse(req.body);
+            }
             std::string utf8_filename = json_body["filename"];
 
-            // Convert to a wide string for Windows API compatibility.
-            std::wstring wide_filename = utf8_to_wstring(utf8_filename);
+            // Convert to the native path string for OS API compatibility.
+            native_string native_filename = traced_utf8_to_native(utf8_filename);
 
             // --- 2. Perform security check using the robust function ---
-            std::wstring safe_full_path;
-            if (!is_safe_path(wide_filename, safe_full_path)) {
+            native_string safe_full_path;
+            if (!traced_is_safe_path(native_filename, safe_full_path)) {
                 // If the security check fails, throw an error.
                 throw std::runtime_error("Forbidden: Path is not safe.");
             }
 
             // --- 3. Delete the file ---
-            // Use the Windows API's DeleteFileW with the verified safe path.
-            if (DeleteFileW(safe_full_path.c_str())) {
+            // Use the platform's delete call (DeleteFileW / unlink) with the verified safe path.
+            bool deleted;
+            {
+                TraceScope span("fs");
+                deleted = platform_delete_file(safe_full_path);
+            }
+            if (deleted) {
+                file_cache_invalidate(safe_full_path);
+                search_index_update(safe_full_path);
+                filename_index_update(safe_full_path);
                 // If deletion is successful, send a success status.
                 res.set_content("{\"status\": \"success\"}", "application/json");
             }
@@ -578,26 +766,35 @@ extern "C" int start_web_server() {
 
         try {
             // --- 1. Parse the incoming JSON request body ---
-            auto json_body = nlohmann::json::parse(req.body);
+            nlohmann::json json_body;
+            {
+                TraceScope span("json_parse");
+                json_body = nlohmann::json::parse(req.body);
+            }
             std::string utf8_filename = json_body["filename"];
             std::string content = json_body["content"];
 
-            // Convert to a wide string for Windows API compatibility.
-            std::wstring wide_filename = utf8_to_wstring(utf8_filename);
+            // Convert to the native path string for OS API compatibility.
+            native_string native_filename = traced_utf8_to_native(utf8_filename);
 
             // --- 2. Perform security check using the robust function ---
-            std::wstring safe_full_path;
-            if (!is_safe_path(wide_filename, safe_full_path)) {
+            native_string safe_full_path;
+            if (!traced_is_safe_path(native_filename, safe_full_path)) {
                 // If the security check fails, throw an error.
                 throw std::runtime_error("Forbidden: Path is not safe.");
             }
 
             // --- 3. Overwrite the file ---
             // Open the file at the verified safe path, truncating any existing content.
-            std::ofstream outfile(safe_full_path, std::ios::trunc);
-            if (outfile.is_open()) {
-                outfile << content;
-                outfile.close();
+            TraceScope write_span("fs");
+            platform_file outfile = platform_open_write(safe_full_path);
+            if (outfile != PLATFORM_INVALID_FILE) {
+                bool written = platform_write_all(outfile, content.data(), content.size());
+                platform_close_file(outfile);
+                if (!written) throw std::runtime_error("Failed to write file");
+                file_cache_invalidate(safe_full_path);
+                search_index_update(safe_full_path);
+                filename_index_update(safe_full_path);
                 // Send a success response.
                 res.set_content("{\"status\": \"success\"}", "application/json");
             }
@@ -613,6 +810,67 @@ extern "C" int start_web_server() {
         }
         });
 
+    /**
+ * @brief Handles GET requests for the server's metrics, in the Prometheus text format.
+ *
+ * Per-route request counts, latency histograms and quantiles, in-flight gauges and
+ * bytes, plus the counters of the caches, pools and indexes (see render_metrics()).
+ * Registered before the static catch-all route, which would otherwise match it.
+ */
+    server.Get("/api/metrics", [](const httplib::Request& req, httplib::Response& res) {
+        res.set_content(render_metrics(), "text/plain; version=0.0.4; charset=utf-8");
+        });
+
+    /**
+ * @brief Handles GET requests for the kept request traces, as Chrome trace-event JSON (see trace.h).
+ */
+    server.Get("/api/debug/trace", [](const httplib::Request& req, httplib::Response& res) {
+        res.set_header("Access-Control-Allow-Origin", "*");
+        res.set_content(render_trace_json(false), "application/json; charset=utf-8");
+        });
+
+    /**
+ * @brief Handles POST requests that change the tracing, answered with the traces as GET does.
+ *
+ * JSON body: optional "sample" (0 to 1), the fraction of requests that are kept, and
+ * "clear" (true empties the trace rings after this dump).
+ *
+ * Unlike the other routes there is no CORS header, and the body must be sent as
+ * application/json: a page from another origin then needs a preflight the server never
+ * grants, so it cannot change the tracing behind the user's back.
+ */
+    server.Post("/api/debug/trace", [](const httplib::Request& req, httplib::Response& res) {
+        if (req.get_header_value("Content-Type").compare(0, 16, "application/json") != 0) {
+            res.status = 415; // 415 Unsupported Media Type
+            res.set_content("The body must be application/json.", "text/plain");
+            return;
+        }
+        nlohmann::json json_body = nlohmann::json::parse(req.body, nullptr, false);
+        if (json_body.is_discarded() || !json_body.is_object()) {
+            res.status = 400; // 400 Bad Request
+            res.set_content("Invalid JSON body.", "text/plain");
+            return;
+        }
+
+        if (json_body.contains("sample")) {
+            const nlohmann::json& sample = json_body["sample"];
+            double rate = sample.is_number() ? sample.get<double>() : -1.0;
+            if (!(rate >= 0.0 && rate <= 1.0)) {
+                res.status = 400; // 400 Bad Request
+                res.set_content("Invalid 'sample' value.", "text/plain");
+                return;
+            }
+            trace_set_sample_rate(rate);
+        }
+        if (json_body.contains("clear") && !json_body["clear"].is_boolean()) {
+            res.status = 400; // 400 Bad Request
+            res.set_content("Invalid 'clear' value.", "text/plain");
+            return;
+        }
+        bool clear = json_body.value("clear", false);
+        res.set_content(render_trace_json(clear), "application/json; charset=utf-8");
+        });
+
     /**
  * @brief A catch-all GET handler to serve static files (e.g., HTML, JS, CSS).
  *
@@ -633,24 +891,35 @@ extern "C" int start_web_server() {
             path = "/index.html";
         }
 
-        // --- Construct the local filesystem path ---
+        // --- Serve known assets from memory ---
+        // The frontend's files are preloaded (with gzip/brotli/zstd variants) by static_assets_start().
+        if (serve_static_asset(req, res, path)) {
+            return;
+        }
+
+        // --- Otherwise, construct the local filesystem path ---
         // The web path starts with "/", which we need to remove before joining with the local path.
         // std::filesystem::current_path() gets the server's working directory (e.g., "C:\...").
         // The result is the absolute local path to the requested file.
         std::filesystem::path file_path = std::filesystem::current_path() / path.substr(1);
 
-        // --- Check if the file exists and serve it ---
-        // Verify that the path points to an existing, regular file (not a directory).
-        if (std::filesystem::exists(file_path) && std::filesystem::is_regular_file(file_path)) {
-            // Open the file in binary mode.
-            std::ifstream ifs(file_path, std::ios::binary);
-            if (ifs) {
-                // Read the entire file content into a string.
-                std::string content((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+        // --- Open the file and serve it ---
+        // platform_open_read() only opens existing regular files (not directories), and one
+        // metadata call on the open file gives both its size and its validators.
+        platform_file file = platform_open_read(file_path.native());
+        if (file != PLATFORM_INVALID_FILE) {
+            platform_file_info info;
+            if (platform_get_file_info(file, info)) {
+                if (check_conditional_get(req, res, make_file_etag(info), info.mtime_ns)) {
+                    platform_close_file(file);
+                    return;
+                }
                 // Send the content as the response, setting the correct MIME type.
-                res.set_content(content, get_mime_type(path).c_str());
+                // It is streamed into the response rather than read into a string.
+                set_file_content(res, file, info.size, std::string(content_type_for_file(file, info, path)));
             }
             else {
+                platform_close_file(file);
                 // If the file exists but cannot be read, send a server error.
                 res.status = 500;
                 res.set_content("Cannot read file", "text/plain");
@@ -670,33 +939,66 @@ extern "C" int start_web_server() {
  * to the server. The server then writes these errors, prefixed with a timestamp,
  * to a local log file ("persona_error.log"). This is essential for debugging
  * issues that occur on the user's end.
+ *
+ * The body may also be a JSON array of reports (at most kMaxLogBatchReports).
+ * Reports are only queued here (see error_log_submit()): repeats of the same error
+ * within a few seconds are folded into one line with a count, each client has a
+ * token bucket (see error_log_admit()), and a full queue answers 503 with
+ * Retry-After instead of stalling the request thread on the disk.
+ * Response: {"accepted":n,"dropped":n,"duplicates":n,"limited":n,"status":..}.
  */
     server.Post("/api/log", [](const httplib::Request& req, httplib::Response& res) {
         try {
-            // --- 1. Get the current system time and format it as a string ---
-            auto now = std::chrono::system_clock::now();
-            auto in_time_t = std::chrono::system_clock::to_time_t(now);
-            std::tm buf;
-            // Use the thread-safe localtime_s on Windows to get the local time.
-            localtime_s(&buf, &in_time_t);
-            std::stringstream ss;
-            // Format the time into a "YYYY-MM-DD HH:MM:SS" string.
-            ss << std::put_time(&buf, "%Y-%m-%d %X");
-
-            // --- 2. Open the log file in append mode ---
-            // std::ios::app ensures that new logs are added to the end of the file
-            // without overwriting existing content.
-            std::ofstream log_file("persona_error.log", std::ios::app);
-            if (log_file.is_open()) {
-                // --- 3. Write the formatted log message ---
-                // The request body (req.body) contains the JSON-stringified error from the client.
-                // Example line: [2025-08-17 14:30:00] ERROR: {"message":"...","stack":"..."}
-                log_file << "[" << ss.str() << "] ERROR: " << req.body << std::endl;
-                log_file.close();
-            }
-
-            // Send a simple confirmation response to the client.
-            res.set_content("{\"status\": \"logged\"}", "application/json");
+            // --- 1. Split the body into reports ---
+            // The body is one JSON-stringified error from the client, or a JSON array of them.
+            // Each report is fingerprinted by its "message" and "stack" (or, without those, its text).
+            std::vector<std::pair<std::string, std::uint64_t>> reports;
+            nlohmann::json body = nlohmann::json::parse(req.body, nullptr, false);
+            auto add_report = [&reports](std::string text, const nlohmann::json& report) {
+                std::string message = report.is_object() && report.contains("message") && report["message"].is_string() ? report["message"].get<std::string>() : text;
+                std::string stack = report.is_object() && report.contains("stack") && report["stack"].is_string() ? report["stack"].get<std::string>() : std::string();
+                std::uint64_t fingerprint = error_log_fingerprint(message, stack);
+                reports.emplace_back(std::move(text), fingerprint);
+            };
+            if (body.is_array()) {
+                for (const nlohmann::json& report : body) {
+                    if (reports.size() == kMaxLogBatchReports) break;
+                    add_report(report.is_string() ? report.get<std::string>() : report.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace), report);
+                }
+            }
+            else {
+                add_report(req.body, body);
+            }
+
+            // --- 2. Apply the client's rate limit ---
+            size_t admitted = error_log_admit(req.remote_addr, reports.size());
+
+            // --- 3. Queue the admitted reports for the background writer ---
+            // It timestamps them and appends them to persona_error.log, e.g.
+            // [2025-08-17 14:30:00] ERROR: {"message":"...","stack":"..."}
+            size_t counts[3] = { 0, 0, 0 };
+            for (size_t i = 0; i < admitted; i++) {
+                counts[(int)error_log_submit(std::move(reports[i].first), reports[i].second)]++;
+            }
+            size_t queued = counts[(int)LogSubmitResult::queued];
+            size_t duplicates = counts[(int)LogSubmitResult::duplicate];
+            size_t dropped = counts[(int)LogSubmitResult::dropped];
+
+            nlohmann::json response_json;
+            response_json["accepted"] = queued;
+            response_json["dropped"] = dropped;
+            response_json["duplicates"] = duplicates;
+            response_json["limited"] = reports.size() - admitted;
+            if (queued + duplicates == 0 && !reports.empty()) {
+                // --- 4. Nothing was taken (rate limit, or the writer is behind): ask the client to slow down ---
+                res.status = admitted == 0 ? 429 : 503; // 429 Too Many Requests / 503 Service Unavailable
+                res.set_header("Retry-After", "1");
+                response_json["status"] = admitted == 0 ? "limited" : "dropped";
+            }
+            else {
+                response_json["status"] = "logged";
+            }
+            res.set_content(response_json.dump(), "application/json");
         }
         catch (const std::exception& e) {
             // If an error occurs while trying to log, send a server error response.
@@ -706,17 +1008,10 @@ extern "C" int start_web_server() {
         });
 
     // --- Launch the server in a separate thread ---
-    // Use the Windows API's CreateThread to run the 'run_server' function in the background.
+    // Use the platform layer to run the 'run_server' function in the background.
     // This is the most critical step, as it prevents the blocking svr->listen() call
     // from freezing the main application that called this start_web_server function.
-    CreateThread(
-        NULL,         // Default security attributes.
-        0,            // Default stack size.
-        run_server,   // The function to execute in the new thread.
-        &server,      // The argument to pass to the thread function (a pointer to our server object).
-        0,            // Default creation flags (run immediately).
-        NULL          // We don't need to store the thread ID.
-    );
+    platform_start_thread(run_server, &server);
 
     // This message is printed immediately after the thread is launched,
     // confirming that the server initialization process has been kicked off.
@@ -0,0 +1,392 @@
+﻿#include "static_assets.h"
+#include "file_cache.h"
+#include "conditional_get.h"
+#include "content_type.h"
+#include "debounced_refresh.h"
+#include "file_sender.h"
+#include <atomic>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#ifdef PERSONA_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef PERSONA_HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+#ifdef PERSONA_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace {
+
+// Assets larger than this are left to the disk-based handler (and sendfile).
+const uint64_t kMaxAssetSize = 16 * 1024 * 1024;
+
+// Total uncompressed bytes held in the table; assets found after the budget is used up
+// are left to the disk-based handler too.
+const uint64_t kMaxTableBytes = 64 * 1024 * 1024;
+
+// The only directories below the static root that hold frontend files. Everything else
+// there (in particular the drive itself, ./PersonaRoot by default) is never loaded.
+const char* const kAssetDirectories[] = { "lib", "apps" };
+
+// Files smaller than this are not worth compressing.
+const size_t kMinCompressSize = 256;
+
+/**
+ * @brief One precompressed representation of an asset.
+ */
+struct EncodedVariant {
+    const char* encoding;       // The Content-Encoding token ("br", "zstd", "gzip").
+    std::string body;
+    std::string etag;
+};
+
+/**
+ * @brief One static file, immutable once built.
+ */
+struct StaticAsset {
+    std::string content_type;
+    std::shared_ptr<const CachedFile> file;     // The uncompressed bytes and the identity they were read at.
+    std::string etag;
+    std::vector<EncodedVariant> encoded;        // In order of preference.
+};
+
+struct AssetTable {
+    // Keyed by the path relative to the static root, with '/' separators (e.g. "lib/golden-layout/goldenlayout.min.js").
+    std::unordered_map<std::string, std::shared_ptr<const StaticAsset>> assets;
+    uint64_t identity_bytes = 0;
+    uint64_t compressed_bytes = 0;
+};
+
+native_string g_root;
+// Published with std::atomic_load/atomic_store; a request keeps the table it loaded alive until it is done.
+std::shared_ptr<const AssetTable> g_table = std::make_shared<AssetTable>();
+
+std::atomic<uint64_t> g_hits{ 0 };
+std::atomic<uint64_t> g_misses{ 0 };
+std::atomic<uint64_t> g_reloads{ 0 };
+
+/**
+ * @brief Whether a path relative to the static root (with '/' separators) is part of the
+ * frontend: a file directly in the root, or anything under one of kAssetDirectories.
+ */
+bool is_frontend_path(const std::string& key)
+{
+    size_t slash = key.find('/');
+    if (slash == std::string::npos) return true;
+    for (const char* dir : kAssetDirectories) {
+        if (key.compare(0, slash, dir) == 0) return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Decides which files are assets, and which of those are worth compressing.
+ */
+bool is_asset_type(const std::string& path, bool& compressible)
+{
+    static const struct { const char* extension; bool compressible; } kTypes[] = {
+        { "html", true }, { "htm", true }, { "js", true }, { "mjs", true }, { "css", true },
+        { "json", true }, { "md", true }, { "txt", true }, { "svg", true }, { "map", true },
+        { "ico", false }, { "png", false }, { "jpg", false }, { "jpeg", false }, { "gif", false },
+        { "webp", false }, { "woff", false }, { "woff2", false },
+    };
+
+    size_t dot = path.rfind('.');
+    size_t slash = path.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+        return false;
+    }
+    std::string extension = path.substr(dot + 1);
+    for (char& c : extension) c = (char)tolower((unsigned char)c);
+
+    for (const auto& type : kTypes) {
+        if (extension == type.extension) {
+            compressible = type.compressible;
+            return true;
+        }
+    }
+    return false;
+}
+
+#ifdef PERSONA_HAVE_BROTLI
+std::string compress_brotli(const char* data, size_t size)
+{
+    std::string out(BrotliEncoderMaxCompressedSize(size), '\0');
+    size_t out_size = out.size();
+    if (!BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT,
+        size, (const uint8_t*)data, &out_size, (uint8_t*)&out[0])) {
+        return std::string();
+    }
+    out.resize(out_size);
+    return out;
+}
+#endif
+
+#ifdef PERSONA_HAVE_ZSTD
+std::string compress_zstd(const char* data, size_t size)
+{
+    std::string out(ZSTD_compressBound(size), '\0');
+    size_t out_size = ZSTD_compress(&out[0], out.size(), data, size, 19);
+    if (ZSTD_isError(out_size)) {
+        return std::string();
+    }
+    out.resize(out_size);
+    return out;
+}
+#endif
+
+#ifdef PERSONA_HAVE_ZLIB
+std::string compress_gzip(const char* data, size_t size)
+{
+    z_stream stream = {};
+    // 15 + 16: maximum window, with a gzip header and trailer instead of a zlib one.
+    if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return std::string();
+    }
+    std::string out(deflateBound(&stream, (uLong)size), '\0');
+    stream.next_in = (Bytef*)data;
+    stream.avail_in = (uInt)size;
+    stream.next_out = (Bytef*)&out[0];
+    stream.avail_out = (uInt)out.size();
+    int result = deflate(&stream, Z_FINISH);
+    deflateEnd(&stream);
+    if (result != Z_STREAM_END) {
+        return std::string();
+    }
+    out.resize(stream.total_out);
+    return out;
+}
+#endif
+
+/**
+ * @brief Reads one asset and precomputes its compressed variants.
+ */
+std::shared_ptr<const StaticAsset> load_asset(const native_string& full_path, const std::string& key, bool compressible)
+{
+    std::shared_ptr<const CachedFile> file = CachedFile::load(full_path);
+    if (!file) {
+        return nullptr;
+    }
+
+    auto asset = std::make_shared<StaticAsset>();
+    // The same Content-Type the disk-based handler would have sent.
+    asset->content_type = std::string(content_type_for_name(key));
+    asset->etag = make_content_etag(file->data(), file->size(), "");
+
+    if (compressible && file->size() >= kMinCompressSize) {
+        auto add_variant = [&](const char* encoding, std::string body) {
+            // Only keep a variant that saves at least 10%; otherwise it is not worth the Vary.
+            if (!body.empty() && body.size() < file->size() - file->size() / 10) {
+                std::string suffix = std::string("-") + encoding;
+                std::string etag = make_content_etag(file->data(), file->size(), suffix.c_str());
+                asset->encoded.push_back({ encoding, std::move(body), std::move(etag) });
+            }
+        };
+#ifdef PERSONA_HAVE_BROTLI
+        add_variant("br", compress_brotli(file->data(), file->size()));
+#endif
+#ifdef PERSONA_HAVE_ZSTD
+        add_variant("zstd", compress_zstd(file->data(), file->size()));
+#endif
+#ifdef PERSONA_HAVE_ZLIB
+        add_variant("gzip", compress_gzip(file->data(), file->size()));
+#endif
+    }
+
+    asset->file = std::move(file);
+    return asset;
+}
+
+/**
+ * @brief Builds a complete table of the static root. Assets whose identity (size, mtime,
+ * file id) is unchanged since 'previous' are reused instead of being read and compressed again.
+ */
+std::shared_ptr<const AssetTable> build_table(const AssetTable* previous)
+{
+    namespace fs = std::filesystem;
+    auto table = std::make_shared<AssetTable>();
+    const fs::path root(g_root);
+    // The drive, in case it lives inside one of the asset directories.
+    native_string drive = platform_root_path();
+    if (drive.size() > 1) drive.pop_back();
+
+    std::error_code ec;
+    for (auto it = fs::recursive_directory_iterator(root, fs::directory_options::skip_permission_denied, ec);
+        !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        const fs::directory_entry& entry = *it;
+        std::string key = native_to_utf8(entry.path().lexically_relative(root).generic_string<native_string::value_type>());
+        std::error_code type_ec;
+        if (entry.is_directory(type_ec)) {
+            // Only descend into the asset directories, and skip hidden ones such as .git.
+            if (entry.path().filename().native()[0] == '.' || !is_frontend_path(it.depth() == 0 ? key + "/" : key) ||
+                entry.path().native() == drive) {
+                it.disable_recursion_pending();
+            }
+            continue;
+        }
+        if (!entry.is_regular_file(type_ec)) continue;
+
+        bool compressible = false;
+        if (!is_asset_type(key, compressible)) continue;
+
+        platform_file_info info;
+        if (!platform_stat_path(entry.path().native(), info) || info.size > kMaxAssetSize) continue;
+        if (table->identity_bytes + info.size > kMaxTableBytes) continue;
+
+        std::shared_ptr<const StaticAsset> asset;
+        if (previous != nullptr) {
+            auto found = previous->assets.find(key);
+            const platform_file_info* old_info = found != previous->assets.end() ? &found->second->file->info() : nullptr;
+            if (old_info != nullptr && old_info->size == info.size && old_info->mtime_ns == info.mtime_ns &&
+                old_info->file_id == info.file_id && old_info->device == info.device) {
+                asset = found->second;
+            }
+        }
+        if (!asset) asset = load_asset(entry.path().native(), key, compressible);
+        if (!asset) continue;
+
+        table->identity_bytes += asset->file->size();
+        for (const EncodedVariant& variant : asset->encoded) table->compressed_bytes += variant.body.size();
+        table->assets.emplace(std::move(key), std::move(asset));
+    }
+    return table;
+}
+
+/**
+ * @brief Rebuilds and publishes the table after the frontend changes (reusing what did not).
+ */
+DebouncedRefresh& refresher()
+{
+    static DebouncedRefresh* refresh = new DebouncedRefresh([] {
+        std::shared_ptr<const AssetTable> previous = std::atomic_load(&g_table);
+        std::atomic_store(&g_table, build_table(previous.get()));
+        g_reloads.fetch_add(1, std::memory_order_relaxed);
+    });
+    return *refresh;
+}
+
+/**
+ * @brief File watch callback: schedules a rebuild when something relevant changed.
+ */
+void on_static_change(const native_string& path, void* ctx)
+{
+    // Ignore files that can never be assets (e.g. persona_error.log, written by /api/log).
+    // Names without an extension may be directories, so those count as relevant too.
+    // Changes outside the frontend (e.g. anywhere in the drive below the static root) never matter.
+    if (path != g_root) {
+        if (path.size() <= g_root.size() + 1 || path.compare(0, g_root.size(), g_root) != 0) return;
+        std::string key = native_to_utf8(path.substr(g_root.size() + 1));
+        for (char& c : key) if (c == '\\') c = '/';
+        if (!is_frontend_path(key)) return;
+        size_t slash = key.rfind('/');
+        bool compressible = false;
+        bool relevant = is_asset_type(key, compressible) ||
+            key.find('.', slash == std::string::npos ? 0 : slash) == std::string::npos;
+        if (!relevant) return;
+    }
+
+    refresher().notify();
+}
+
+/**
+ * @brief Returns true if an Accept-Encoding header allows 'coding' with a non-zero q value.
+ */
+bool accepts_encoding(const std::string& header, const char* coding)
+{
+    bool wildcard = false;
+    size_t pos = 0;
+    while (pos <= header.size()) {
+        size_t end = header.find(',', pos);
+        if (end == std::string::npos) end = header.size();
+        std::string item = header.substr(pos, end - pos);
+        pos = end + 1;
+
+        // Split "name;q=0.5" and trim the name.
+        size_t semicolon = item.find(';');
+        std::string name = item.substr(0, semicolon);
+        name.erase(0, name.find_first_not_of(" \t"));
+        name.erase(name.find_last_not_of(" \t") + 1);
+
+        bool refused = false;
+        if (semicolon != std::string::npos) {
+            size_t q = item.find("q=", semicolon);
+            refused = q != std::string::npos && strtod(item.c_str() + q + 2, nullptr) <= 0.0;
+        }
+
+        if (httplib::detail::case_ignore::equal(name, coding)) return !refused;
+        if (name == "*") wildcard = !refused;
+    }
+    return wildcard;
+}
+
+} // namespace
+
+void static_assets_start(const native_string& dir)
+{
+    g_root = dir;
+    while (g_root.size() > 1 && (g_root.back() == '/' || g_root.back() == '\\')) g_root.pop_back();
+
+    // The first build (reading and compressing every asset) runs on the refresh thread, so
+    // the server starts listening right away; until the table is published, requests for
+    // assets are served from disk.
+    bool watching = platform_watch_tree(g_root, on_static_change, nullptr);
+    refresher().start([] { std::atomic_store(&g_table, build_table(nullptr)); }, watching);
+}
+
+bool serve_static_asset(const httplib::Request& req, httplib::Response& res, const std::string& path)
+{
+    // --- 1. Look the asset up in the current table ---
+    std::shared_ptr<const AssetTable> table = std::atomic_load(&g_table);
+    auto found = table->assets.find(path.size() > 0 && path[0] == '/' ? path.substr(1) : path);
+    if (found == table->assets.end()) {
+        g_misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    std::shared_ptr<const StaticAsset> asset = found->second;
+    g_hits.fetch_add(1, std::memory_order_relaxed);
+
+    // --- 2. Pick the representation: the first precompressed variant the client accepts, else identity ---
+    const char* data = asset->file->data();
+    size_t size = asset->file->size();
+    const std::string* etag = &asset->etag;
+    const std::string& accept_encoding = req.get_header_value("Accept-Encoding");
+    for (const EncodedVariant& variant : asset->encoded) {
+        if (accepts_encoding(accept_encoding, variant.encoding)) {
+            data = variant.body.data();
+            size = variant.body.size();
+            etag = &variant.etag;
+            res.set_header("Content-Encoding", variant.encoding);
+            break;
+        }
+    }
+
+    if (!asset->encoded.empty()) res.set_header("Vary", "Accept-Encoding");
+
+    // --- 3. Revalidation: answer 304 if the browser already has exactly these bytes ---
+    if (check_conditional_get(req, res, *etag, asset->file->info().mtime_ns)) {
+        return true;
+    }
+
+    // --- 4. Send the bytes straight from the table; the asset stays alive until the response is done ---
+    set_shared_content(res, asset, data, size, asset->content_type);
+    return true;
+}
+
+StaticAssetStats get_static_asset_stats()
+{
+    std::shared_ptr<const AssetTable> table = std::atomic_load(&g_table);
+    StaticAssetStats stats;
+    stats.assets = table->assets.size();
+    stats.identity_bytes = table->identity_bytes;
+    stats.compressed_bytes = table->compressed_bytes;
+    stats.hits = g_hits.load(std::memory_order_relaxed);
+    stats.misses = g_misses.load(std::memory_order_relaxed);
+    stats.reloads = g_reloads.load(std::memory_order_relaxed);
+    return stats;
+}
@@ -0,0 +1,48 @@
+﻿#pragma once
+
+#include "httplib.h"
+#include "platform.h"
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief Loads the frontend's static files into memory and keeps them up to date.
+ *
+ * The frontend files in 'dir' (index.html, explorer.js, ...) and everything below its
+ * lib/ and apps/ directories with a known web file type are read into an immutable
+ * table, up to 64 MiB in total, together with precompressed gzip / brotli / zstd
+ * variants (whichever this build has libraries for) of the compressible ones and a
+ * strong ETag per variant. Nothing else below 'dir' is loaded, in particular not the
+ * drive when it lives there. The table is built in the background, and a file watch on
+ * 'dir' rebuilds it when a frontend file changes; requests always see a complete table,
+ * old or new (empty at first, so they fall back to the disk), and never wait for a build.
+ *
+ * @param dir The directory the static catch-all route serves from.
+ */
+void static_assets_start(const native_string& dir);
+
+/**
+ * @brief Answers a static file request from the in-memory table.
+ *
+ * Picks the best variant the client accepts (Accept-Encoding) and applies the usual
+ * conditional GET handling (see check_conditional_get()) with that variant's ETag.
+ *
+ * @param path The decoded URL path, e.g. "/index.html".
+ * @return true if the response was filled in, false if the path is not in the table
+ * (not a known asset type, too large, or missing) and must be served from disk.
+ */
+bool serve_static_asset(const httplib::Request& req, httplib::Response& res, const std::string& path);
+
+/**
+ * @brief Counters describing the static asset table, for diagnostics and metrics.
+ */
+struct StaticAssetStats {
+    uint64_t assets;
+    uint64_t identity_bytes;        // Uncompressed size of all assets.
+    uint64_t compressed_bytes;      // Size of all precompressed variants together.
+    uint64_t hits;                  // Requests answered from memory (including 304s).
+    uint64_t misses;                // Requests that fell back to the disk.
+    uint64_t reloads;               // Table rebuilds triggered by the file watch.
+};
+
+StaticAssetStats get_static_asset_stats();
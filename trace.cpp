@@ -0,0 +1,264 @@
+﻿#include "trace.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+#include "nlohmann/json.hpp"
+
+namespace {
+
+// Spans beyond this many in one request are not recorded.
+const size_t kMaxSpansPerRequest = 64;
+
+// Kept events per thread; the oldest are overwritten.
+const size_t kRingEvents = 4096;
+
+const double kDefaultSampleRate = 0.01;
+const std::uint64_t kDefaultSlowMs = 250;
+
+struct Span {
+    const char* name;
+    std::uint64_t start_ns;
+    std::uint64_t end_ns;           // 0 while the span is open.
+};
+
+/**
+ * @brief One kept event: a whole request, or one span of it.
+ */
+struct TraceEvent {
+    const char* name;               // The span name; "request" for the request itself.
+    std::string detail;             // For requests: "GET /api/resources/docs".
+    std::uint64_t start_ns;
+    std::uint64_t end_ns;
+    std::uint32_t request;          // Links the spans to their request.
+    int status;                     // For requests: the response status.
+};
+
+/**
+ * @brief One request thread's trace state.
+ */
+struct ThreadTrace {
+    std::uint32_t tid = 0;
+    std::uint64_t random = 0;
+
+    // The request being handled; touched only by the owner thread.
+    bool in_request = false;
+    bool forced = false;
+    std::uint64_t request_start = 0;
+    std::uint64_t handler_end = 0;
+    Span spans[kMaxSpansPerRequest];
+    size_t span_count = 0;
+
+    // Kept events; the owner appends and dumps read, both under 'lock'.
+    std::mutex lock;
+    std::vector<TraceEvent> ring;
+    size_t next = 0;
+};
+
+struct TraceRegistry {
+    std::mutex lock;
+    std::vector<ThreadTrace*> threads;
+};
+
+TraceRegistry& trace_registry()
+{
+    // Never destroyed; the blocks outlive their threads so their events can still be dumped.
+    static TraceRegistry* registry = new TraceRegistry();
+    return *registry;
+}
+
+thread_local ThreadTrace* t_trace = nullptr;
+
+std::atomic<double> g_sample_rate{ -1.0 };     // < 0: not read from the environment yet.
+std::atomic<std::uint64_t> g_slow_ns{ 0 };
+std::atomic<std::uint32_t> g_next_request{ 1 };
+
+const std::chrono::steady_clock::time_point g_epoch = std::chrono::steady_clock::now();
+
+std::uint64_t now_ns()
+{
+    return (std::uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - g_epoch).count();
+}
+
+ThreadTrace& thread_trace()
+{
+    if (!t_trace) {
+        t_trace = new ThreadTrace();
+        TraceRegistry& registry = trace_registry();
+        std::lock_guard<std::mutex> guard(registry.lock);
+        t_trace->tid = (std::uint32_t)registry.threads.size() + 1;
+        t_trace->random = 0x9E3779B97F4A7C15ULL * t_trace->tid;
+        registry.threads.push_back(t_trace);
+    }
+    return *t_trace;
+}
+
+void load_settings()
+{
+    if (g_sample_rate.load() >= 0) return;
+    const char* sample = getenv("PERSONA_TRACE_SAMPLE");
+    const char* slow = getenv("PERSONA_TRACE_SLOW_MS");
+    double rate = sample ? atof(sample) : kDefaultSampleRate;
+    g_slow_ns = (slow ? strtoull(slow, nullptr, 10) : kDefaultSlowMs) * 1000000ULL;
+    double expected = -1.0;
+    g_sample_rate.compare_exchange_strong(expected, std::min(1.0, std::max(0.0, rate)));
+}
+
+bool sample(ThreadTrace& trace)
+{
+    // xorshift64: a per-thread generator, so sampling needs no shared state.
+    trace.random ^= trace.random << 13;
+    trace.random ^= trace.random >> 7;
+    trace.random ^= trace.random << 17;
+    return (double)(trace.random >> 11) * (1.0 / 9007199254740992.0) < g_sample_rate.load(std::memory_order_relaxed);
+}
+
+void keep_event(ThreadTrace& trace, TraceEvent&& event)
+{
+    if (trace.ring.size() < kRingEvents) {
+        trace.ring.push_back(std::move(event));
+    }
+    else {
+        trace.ring[trace.next] = std::move(event);
+        trace.next = (trace.next + 1) % kRingEvents;
+    }
+}
+
+} // namespace
+
+TraceScope::TraceScope(const char* name) : index_(-1)
+{
+    ThreadTrace* trace = t_trace;
+    if (!trace || !trace->in_request || trace->span_count == kMaxSpansPerRequest) return;
+    index_ = (int)trace->span_count++;
+    trace->spans[index_] = Span{ name, now_ns(), 0 };
+}
+
+TraceScope::~TraceScope()
+{
+    if (index_ >= 0) t_trace->spans[index_].end_ns = now_ns();
+}
+
+void trace_begin_request(const httplib::Request& req)
+{
+    load_settings();
+    ThreadTrace& trace = thread_trace();
+    trace.in_request = true;
+    trace.forced = req.get_header_value("X-Persona-Trace") == "1";
+    trace.span_count = 0;
+    trace.handler_end = 0;
+    trace.request_start = now_ns();
+}
+
+void trace_finish_handler(const httplib::Request& req, httplib::Response& res)
+{
+    ThreadTrace& trace = thread_trace();
+    if (!trace.in_request) return;
+    trace.handler_end = now_ns();
+
+    // --- Server-Timing: the time per span name, then the whole handler ---
+    // e.g. "safe_path;dur=0.004, fs;dur=0.210, json_dump;dur=0.051, handler;dur=0.302"
+    std::string header;
+    char item[96];
+    for (size_t i = 0; i < trace.span_count; i++) {
+        bool seen = false;
+        for (size_t j = 0; j < i && !seen; j++) seen = strcmp(trace.spans[j].name, trace.spans[i].name) == 0;
+        if (seen) continue;
+        std::uint64_t total = 0;
+        for (size_t j = i; j < trace.span_count; j++) {
+            const Span& span = trace.spans[j];
+            if (strcmp(span.name, trace.spans[i].name) == 0 && span.end_ns) total += span.end_ns - span.start_ns;
+        }
+        snprintf(item, sizeof(item), "%s;dur=%.3f, ", trace.spans[i].name, total / 1e6);
+        header += item;
+    }
+    snprintf(item, sizeof(item), "handler;dur=%.3f", (trace.handler_end - trace.request_start) / 1e6);
+    header += item;
+    res.set_header("Server-Timing", header);
+    res.set_header("Timing-Allow-Origin", "*");
+}
+
+void trace_end_request(const httplib::Request& req, const httplib::Response& res)
+{
+    ThreadTrace& trace = thread_trace();
+    if (!trace.in_request) return;
+    trace.in_request = false;
+
+    // --- 1. Keep the request if it was sampled, asked for, or slow ---
+    std::uint64_t end = now_ns();
+    bool slow = end - trace.request_start >= g_slow_ns.load(std::memory_order_relaxed);
+    if (!trace.forced && !slow && !sample(trace)) return;
+
+    // --- 2. Copy the request and its spans into the ring ---
+    std::uint32_t request = g_next_request.fetch_add(1, std::memory_order_relaxed);
+    std::uint64_t handler_end = trace.handler_end ? trace.handler_end : end;
+    std::lock_guard<std::mutex> guard(trace.lock);
+    keep_event(trace, TraceEvent{ "request", req.method + " " + req.path, trace.request_start, end, request, res.status });
+    keep_event(trace, TraceEvent{ "handler", std::string(), trace.request_start, handler_end, request, 0 });
+    keep_event(trace, TraceEvent{ "write", std::string(), handler_end, end, request, 0 });
+    for (size_t i = 0; i < trace.span_count; i++) {
+        const Span& span = trace.spans[i];
+        keep_event(trace, TraceEvent{ span.name, std::string(), span.start_ns, span.end_ns ? span.end_ns : end, request, 0 });
+    }
+}
+
+void trace_set_sample_rate(double rate)
+{
+    load_settings();
+    g_sample_rate = std::min(1.0, std::max(0.0, rate));
+}
+
+double trace_sample_rate()
+{
+    load_settings();
+    return g_sample_rate.load();
+}
+
+std::string render_trace_json(bool clear)
+{
+    // --- 1. Collect every thread's kept events ---
+    struct Collected {
+        std::uint32_t tid;
+        TraceEvent event;
+    };
+    std::vector<Collected> events;
+    {
+        TraceRegistry& registry = trace_registry();
+        std::lock_guard<std::mutex> registry_guard(registry.lock);
+        for (ThreadTrace* trace : registry.threads) {
+            std::lock_guard<std::mutex> guard(trace->lock);
+            for (const TraceEvent& event : trace->ring) events.push_back(Collected{ trace->tid, event });
+            if (clear) {
+                trace->ring.clear();
+                trace->next = 0;
+            }
+        }
+    }
+    std::sort(events.begin(), events.end(), [](const Collected& a, const Collected& b) { return a.event.start_ns < b.event.start_ns; });
+
+    // --- 2. Chrome trace-event format: complete ("X") events, times in microseconds ---
+    nlohmann::json trace_events = nlohmann::json::array();
+    for (const Collected& collected : events) {
+        const TraceEvent& event = collected.event;
+        bool is_request = strcmp(event.name, "request") == 0;
+        nlohmann::json item;
+        item["name"] = is_request ? event.detail : std::string(event.name);
+        item["cat"] = is_request ? "request" : "phase";
+        item["ph"] = "X";
+        item["ts"] = event.start_ns / 1000.0;
+        item["dur"] = (event.end_ns - event.start_ns) / 1000.0;
+        item["pid"] = 1;
+        item["tid"] = collected.tid;
+        item["args"]["request"] = event.request;
+        if (is_request) item["args"]["status"] = event.status;
+        trace_events.push_back(std::move(item));
+    }
+    nlohmann::json trace_json;
+    trace_json["displayTimeUnit"] = "ms";
+    trace_json["traceEvents"] = std::move(trace_events);
+    return trace_json.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+}
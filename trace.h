@@ -0,0 +1,54 @@
+﻿#pragma once
+
+#include "httplib.h"
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief Times one phase of the current request ("safe_path", "fs", "json_dump", ...).
+ *
+ * Declare one at the start of a block; the span ends when it goes out of scope. Spans
+ * are kept per thread for the request being handled: they become the request's
+ * Server-Timing header, and if the request is sampled or slow they are copied into the
+ * thread's trace ring for /api/debug/trace. Outside a request it does nothing.
+ *
+ * @param name A string literal; only the pointer is stored.
+ */
+class TraceScope {
+public:
+    explicit TraceScope(const char* name);
+    ~TraceScope();
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    int index_;                     // The span's slot in the request, or -1 if not recorded.
+};
+
+/**
+ * @brief Request hooks, called by the handlers metrics_install() registers: when routing
+ * starts, when the handler is done (before the headers are written; adds Server-Timing),
+ * and after the response has been written.
+ */
+void trace_begin_request(const httplib::Request& req);
+void trace_finish_handler(const httplib::Request& req, httplib::Response& res);
+void trace_end_request(const httplib::Request& req, const httplib::Response& res);
+
+/**
+ * @brief The fraction of requests whose spans are kept, 0 to 1.
+ *
+ * Starts at PERSONA_TRACE_SAMPLE (default 0.01). Requests slower than
+ * PERSONA_TRACE_SLOW_MS (default 250) are always kept, as are requests carrying an
+ * "X-Persona-Trace: 1" header.
+ */
+void trace_set_sample_rate(double rate);
+double trace_sample_rate();
+
+/**
+ * @brief Renders the kept spans of every thread as Chrome trace-event JSON
+ * (load it in chrome://tracing or ui.perfetto.dev).
+ *
+ * @param clear Also empty the rings, so the next dump only has newer requests.
+ */
+std::string render_trace_json(bool clear);
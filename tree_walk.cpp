@@ -0,0 +1,255 @@
+﻿#include "tree_walk.h"
+#include "directory_listing.h"
+#include "file_receiver.h"
+#include "root_watch.h"
+#include "work_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+// Directories wait instead of being read while this much output is waiting for the client.
+const size_t kMaxBufferedBytes = 4 * 1024 * 1024;
+
+// A directory's items are cut into lines of about this size.
+const size_t kLineBytes = 64 * 1024;
+
+// Entries read from the OS per platform_read_directory() call.
+const size_t kReadBatchSize = 512;
+
+// While there is nothing to send, the client connection is checked this often.
+const std::chrono::seconds kDisconnectCheckInterval(1);
+
+struct PendingDirectory {
+    native_string path;
+    std::string request_path;
+    unsigned depth;
+};
+
+/**
+ * @brief The shared state of one walk: its limits, its output and the directories still to do.
+ */
+struct TreeWalk {
+    unsigned max_depth;
+    uint64_t max_entries;
+    std::atomic<bool> cancelled{ false };
+    std::atomic<bool> truncated{ false };
+    std::atomic<uint64_t> entries{ 0 };         // Items claimed so far (may overshoot max_entries).
+    std::atomic<uint64_t> directories{ 0 };
+
+    std::mutex lock;
+    std::condition_variable ready;              // Signaled when output arrives or the walk ends.
+    std::string output;                         // Complete lines not yet sent.
+    std::vector<PendingDirectory> deferred;     // Directories put off while 'output' was full.
+    size_t outstanding = 0;                     // Directories submitted, deferred or being read.
+};
+
+std::atomic<uint64_t> g_walks{ 0 };
+std::atomic<uint64_t> g_cancelled{ 0 };
+std::atomic<uint64_t> g_directories{ 0 };
+std::atomic<uint64_t> g_entries{ 0 };
+
+void walk_directory(const std::shared_ptr<TreeWalk>& walk, const PendingDirectory& directory);
+
+void submit_directory(const std::shared_ptr<TreeWalk>& walk, PendingDirectory directory)
+{
+    work_pool_submit([walk, directory]() { walk_directory(walk, directory); });
+}
+
+void cancel_walk(TreeWalk& walk)
+{
+    if (!walk.cancelled.exchange(true)) {
+        g_cancelled.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void emit_line(TreeWalk& walk, const std::string& line)
+{
+    std::lock_guard<std::mutex> guard(walk.lock);
+    walk.output += line;
+    walk.ready.notify_one();
+}
+
+/**
+ * @brief Reads one directory: emits its items and returns the subdirectories to walk next.
+ */
+std::vector<PendingDirectory> read_directory(TreeWalk& walk, const PendingDirectory& directory)
+{
+    std::vector<PendingDirectory> children;
+    walk.directories.fetch_add(1, std::memory_order_relaxed);
+    g_directories.fetch_add(1, std::memory_order_relaxed);
+
+    const std::string head = "{\"depth\":" + std::to_string(directory.depth) + ",\"items\":[";
+    std::string tail = "],\"path\":";
+    append_json_string(tail, directory.request_path);
+    tail += "}\n";
+
+    platform_directory handle = platform_open_directory(directory.path);
+    if (handle == nullptr) {
+        std::string line = "{\"depth\":" + std::to_string(directory.depth) + ",\"error\":\"Cannot read directory.\",\"items\":[";
+        emit_line(walk, line + tail);
+        return children;
+    }
+
+    std::string line = head;
+    bool line_empty = true;
+    bool line_sent = false;
+    std::vector<platform_dir_entry> batch;
+    long long added = 0;
+    uint64_t sent = 0;
+    while (!walk.cancelled.load(std::memory_order_relaxed)) {
+        batch.clear();
+        added = platform_read_directory(handle, batch, kReadBatchSize);
+        if (added <= 0) break;
+
+        bool limit_reached = false;
+        for (const platform_dir_entry& entry : batch) {
+            if (is_upload_temp_name(entry.name)) continue;
+            if (walk.entries.fetch_add(1, std::memory_order_relaxed) >= walk.max_entries) {
+                walk.truncated = true;
+                limit_reached = true;
+                break;
+            }
+            DirectoryEntry item = make_directory_entry(entry);
+            if (!line_empty) line += ',';
+            append_directory_entry(line, item);
+            line_empty = false;
+            sent++;
+
+            if (entry.info.is_directory && !entry.is_link && directory.depth < walk.max_depth) {
+                native_string child_path = join_native_path(directory.path, entry.name);
+                std::string child_request_path = directory.request_path;
+                if (child_request_path.empty() || child_request_path.back() != '/') child_request_path += '/';
+                child_request_path += item.name;
+                children.push_back(PendingDirectory{ std::move(child_path), std::move(child_request_path), directory.depth + 1 });
+            }
+
+            // A huge directory goes out in several lines rather than one giant one.
+            if (line.size() >= kLineBytes) {
+                emit_line(walk, line + tail);
+                line = head;
+                line_empty = true;
+                line_sent = true;
+            }
+        }
+        if (limit_reached) break;
+    }
+    platform_close_directory(handle);
+    g_entries.fetch_add(sent, std::memory_order_relaxed);
+
+    if (added < 0) {
+        line = "{\"depth\":" + std::to_string(directory.depth) + ",\"error\":\"Cannot read directory.\",\"items\":[" + line.substr(head.size());
+        line_empty = false;
+    }
+    if (!line_empty || !line_sent) {
+        emit_line(walk, line + tail);
+    }
+    return children;
+}
+
+/**
+ * @brief The pool task for one directory.
+ */
+void walk_directory(const std::shared_ptr<TreeWalk>& walk, const PendingDirectory& directory)
+{
+    std::vector<PendingDirectory> children;
+    if (!walk->cancelled && walk->entries.load(std::memory_order_relaxed) < walk->max_entries) {
+        // --- 1. Put the directory off while the client has not caught up with the output ---
+        {
+            std::lock_guard<std::mutex> guard(walk->lock);
+            if (walk->output.size() >= kMaxBufferedBytes) {
+                walk->deferred.push_back(directory);
+                return;
+            }
+        }
+
+        // --- 2. Read it ---
+        children = read_directory(*walk, directory);
+    }
+
+    // --- 3. Hand the subdirectories to the pool and retire this directory ---
+    {
+        std::lock_guard<std::mutex> guard(walk->lock);
+        walk->outstanding += children.size();
+        walk->outstanding--;
+        if (walk->outstanding == 0) walk->ready.notify_one();
+    }
+    for (PendingDirectory& child : children) {
+        submit_directory(walk, std::move(child));
+    }
+}
+
+} // namespace
+
+void stream_tree_walk(httplib::Response& res, const native_string& full_path, const std::string& request_path,
+    unsigned max_depth, std::uint64_t max_entries)
+{
+    auto walk = std::make_shared<TreeWalk>();
+    walk->max_depth = max_depth;
+    walk->max_entries = max_entries;
+    walk->outstanding = 1;
+    g_walks.fetch_add(1, std::memory_order_relaxed);
+    submit_directory(walk, PendingDirectory{ full_path, request_path, 0 });
+
+    res.set_chunked_content_provider("application/x-ndjson; charset=utf-8",
+        [walk](size_t offset, httplib::DataSink& sink) {
+            // --- 1. Wait for output (or the end), and let deferred directories continue ---
+            std::string chunk;
+            std::vector<PendingDirectory> resume;
+            bool finished;
+            {
+                std::unique_lock<std::mutex> guard(walk->lock);
+                walk->ready.wait_for(guard, kDisconnectCheckInterval,
+                    [&walk] { return !walk->output.empty() || walk->outstanding == 0; });
+                chunk.swap(walk->output);
+                resume.swap(walk->deferred);
+                finished = walk->outstanding == 0 && chunk.empty();
+            }
+            for (PendingDirectory& directory : resume) {
+                submit_directory(walk, std::move(directory));
+            }
+
+            // --- 2. Send it ---
+            if (!chunk.empty()) {
+                if (!sink.write(chunk.data(), chunk.size())) {
+                    cancel_walk(*walk);
+                    return false;
+                }
+                return true;
+            }
+            if (finished) {
+                uint64_t entries = std::min(walk->entries.load(), walk->max_entries);
+                std::string summary = "{\"directories\":" + std::to_string(walk->directories.load()) +
+                    ",\"done\":true,\"entries\":" + std::to_string(entries) +
+                    ",\"truncated\":" + (walk->truncated ? "true" : "false") + "}\n";
+                if (!sink.write(summary.data(), summary.size())) return false;
+                sink.done();
+                return true;
+            }
+
+            // --- 3. Nothing yet: stop walking if the client has gone away ---
+            if (!sink.is_writable()) {
+                cancel_walk(*walk);
+                return false;
+            }
+            return true;
+        },
+        [walk](bool success) {
+            if (!success) cancel_walk(*walk);
+        });
+}
+
+TreeWalkStats get_tree_walk_stats()
+{
+    TreeWalkStats stats;
+    stats.walks = g_walks.load(std::memory_order_relaxed);
+    stats.cancelled = g_cancelled.load(std::memory_order_relaxed);
+    stats.directories = g_directories.load(std::memory_order_relaxed);
+    stats.entries = g_entries.load(std::memory_order_relaxed);
+    return stats;
+}
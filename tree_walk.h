@@ -0,0 +1,53 @@
+﻿#pragma once
+
+#include "httplib.h"
+#include "platform.h"
+#include <cstdint>
+#include <string>
+
+// Limits of one /api/tree walk, and what a request gets when it does not set them.
+const unsigned kDefaultTreeDepth = 16;
+const unsigned kMaxTreeDepth = 64;
+const std::uint64_t kDefaultTreeEntries = 100000;
+const std::uint64_t kMaxTreeEntries = 2000000;
+
+/**
+ * @brief Walks a directory tree in parallel and streams it as the body of a response.
+ *
+ * Every directory is one task on the work-stealing pool (see work_pool_submit()), which
+ * lists it in bulk (platform_read_directory()) and submits a task per subdirectory, so
+ * a deep or lopsided tree keeps every core busy. The body is newline-delimited JSON
+ * (application/x-ndjson), one line per directory as soon as it has been read:
+ *
+ *   {"depth":1,"items":[...],"path":"/Videos/2024"}
+ *
+ * with the same items as /api/resources (a very large directory may take several
+ * lines with the same path), then a last line with the totals:
+ *
+ *   {"directories":120,"done":true,"entries":5310,"truncated":false}
+ *
+ * Lines from different directories come in no particular order. Symbolic links and
+ * reparse points are listed but never followed. Only a bounded amount of output is
+ * buffered: when the client reads slowly, pending directories wait instead of piling
+ * up lines. If the client disconnects, the walk is cancelled and its remaining
+ * directories are skipped.
+ *
+ * @param full_path The canonical path of the directory (see is_safe_path()).
+ * @param request_path The path as the client sees it, e.g. "/Videos".
+ * @param max_depth How many levels below 'full_path' to descend (0 lists only 'full_path').
+ * @param max_entries Stop after this many items; the last line then says "truncated":true.
+ */
+void stream_tree_walk(httplib::Response& res, const native_string& full_path, const std::string& request_path,
+    unsigned max_depth, std::uint64_t max_entries);
+
+/**
+ * @brief Counters describing /api/tree walks, for diagnostics and metrics.
+ */
+struct TreeWalkStats {
+    uint64_t walks;
+    uint64_t cancelled;             // Walks whose client went away before the end.
+    uint64_t directories;           // Directories read by all walks.
+    uint64_t entries;               // Items sent by all walks.
+};
+
+TreeWalkStats get_tree_walk_stats();
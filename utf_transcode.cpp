@@ -0,0 +1,446 @@
+﻿#include "utf_transcode.h"
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#define UTF_TRANSCODE_X86 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_SSE4
+#define TARGET_AVX2
+#else
+#define TARGET_SSE4 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace {
+
+// Conversions whose output fits in this many bytes are done on the stack.
+const size_t kStackBytes = 1024;
+
+// Below this many characters left, no kernel can convert a whole block: skip the call.
+const size_t kMinKernelInput = 16;
+const size_t kMinKernelWide = 8;
+
+typedef std::uint32_t code_point;
+
+/**
+ * @brief The vector kernels. Each converts a prefix of its input that it can handle
+ * whole and returns how many input characters it consumed (0 if none).
+ */
+struct Kernels {
+    const char* isa;
+    size_t (*ascii_to_wide)(const unsigned char* in, size_t length, wchar_t* out);
+    size_t (*three_byte_to_wide)(const unsigned char* in, size_t length, wchar_t* out);   // Returns wide characters written.
+    size_t (*ascii_to_utf8)(const wchar_t* in, size_t length, char* out);
+    size_t (*three_byte_to_utf8)(const wchar_t* in, size_t length, char* out);
+};
+
+// --- Scalar: one sequence at a time ---
+
+/**
+ * @brief Writes one code point: a surrogate pair for U+10000 and above when wchar_t is 16 bits.
+ */
+inline wchar_t* put_wide(wchar_t* out, code_point cp)
+{
+    if (sizeof(wchar_t) == 2 && cp >= 0x10000) {
+        cp -= 0x10000;
+        *out++ = (wchar_t)(0xD800 | (cp >> 10));
+        *out++ = (wchar_t)(0xDC00 | (cp & 0x3FF));
+        return out;
+    }
+    *out++ = (wchar_t)cp;
+    return out;
+}
+
+/**
+ * @brief Decodes the sequence starting at 'p' (a byte of 0x80 or above).
+ *
+ * A malformed sequence becomes one U+FFFD per maximal subpart: the lead byte and the
+ * continuation bytes that could still have completed it are replaced together, and
+ * decoding resumes at the first byte that could not. So E0 80 80 (overlong) gives three.
+ */
+const unsigned char* decode_one(const unsigned char* p, const unsigned char* end, wchar_t*& out)
+{
+    unsigned char c = *p;
+    code_point cp;
+    int extra;
+    // The allowed second bytes (Unicode Table 3-7): narrower ranges after E0, ED, F0 and
+    // F4 rule out overlong forms, surrogates and values above U+10FFFF.
+    unsigned char low = 0x80;
+    unsigned char high = 0xBF;
+    if (c >= 0xC2 && c <= 0xDF) { cp = c & 0x1F; extra = 1; }
+    else if ((c & 0xF0) == 0xE0) { cp = c & 0x0F; extra = 2; low = c == 0xE0 ? 0xA0 : 0x80; high = c == 0xED ? 0x9F : 0xBF; }
+    else if (c >= 0xF0 && c <= 0xF4) { cp = c & 0x07; extra = 3; low = c == 0xF0 ? 0x90 : 0x80; high = c == 0xF4 ? 0x8F : 0xBF; }
+    else { *out++ = (wchar_t)0xFFFD; return p + 1; }
+
+    // Consume the continuation bytes, stopping at the first one that cannot continue the sequence.
+    int i = 1;
+    for (; i <= extra && p + i < end && p[i] >= low && p[i] <= high; i++) {
+        cp = (cp << 6) | (p[i] & 0x3F);
+        low = 0x80;
+        high = 0xBF;
+    }
+    if (i <= extra) {
+        cp = 0xFFFD;
+    }
+    out = put_wide(out, cp);
+    return p + i;
+}
+
+/**
+ * @brief Encodes the character at 'p' (0x80 or above), joining a surrogate pair when wchar_t is 16 bits.
+ */
+const wchar_t* encode_one(const wchar_t* p, const wchar_t* end, char*& out)
+{
+    code_point cp = (code_point)*p++;
+    if (sizeof(wchar_t) == 2 && cp >= 0xD800 && cp <= 0xDBFF && p < end && (code_point)*p >= 0xDC00 && (code_point)*p <= 0xDFFF) {
+        cp = 0x10000 + ((cp - 0xD800) << 10) + ((code_point)*p++ - 0xDC00);
+    }
+    // Lone surrogates and values above U+10FFFF cannot be encoded.
+    else if ((cp >= 0xD800 && cp <= 0xDFFF) || cp > 0x10FFFF) {
+        cp = 0xFFFD;
+    }
+
+    if (cp < 0x800) {
+        *out++ = (char)(0xC0 | (cp >> 6));
+        *out++ = (char)(0x80 | (cp & 0x3F));
+    }
+    else if (cp < 0x10000) {
+        *out++ = (char)(0xE0 | (cp >> 12));
+        *out++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+        *out++ = (char)(0x80 | (cp & 0x3F));
+    }
+    else {
+        *out++ = (char)(0xF0 | (cp >> 18));
+        *out++ = (char)(0x80 | ((cp >> 12) & 0x3F));
+        *out++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+        *out++ = (char)(0x80 | (cp & 0x3F));
+    }
+    return p;
+}
+
+size_t no_ascii_to_wide(const unsigned char*, size_t, wchar_t*) { return 0; }
+size_t no_three_byte_to_wide(const unsigned char*, size_t, wchar_t*) { return 0; }
+size_t no_ascii_to_utf8(const wchar_t*, size_t, char*) { return 0; }
+size_t no_three_byte_to_utf8(const wchar_t*, size_t, char*) { return 0; }
+
+#ifdef UTF_TRANSCODE_X86
+
+// --- SSE2 (every x86-64 CPU): ASCII, 16 characters at a time ---
+
+size_t ascii_to_wide_sse2(const unsigned char* in, size_t length, wchar_t* out)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(in + i));
+        if (_mm_movemask_epi8(v)) break;
+        __m128i lo = _mm_unpacklo_epi8(v, zero);
+        __m128i hi = _mm_unpackhi_epi8(v, zero);
+        if (sizeof(wchar_t) == 2) {
+            _mm_storeu_si128((__m128i*)(out + i), lo);
+            _mm_storeu_si128((__m128i*)(out + i + 8), hi);
+        }
+        else {
+            _mm_storeu_si128((__m128i*)(out + i), _mm_unpacklo_epi16(lo, zero));
+            _mm_storeu_si128((__m128i*)(out + i + 4), _mm_unpackhi_epi16(lo, zero));
+            _mm_storeu_si128((__m128i*)(out + i + 8), _mm_unpacklo_epi16(hi, zero));
+            _mm_storeu_si128((__m128i*)(out + i + 12), _mm_unpackhi_epi16(hi, zero));
+        }
+    }
+    return i;
+}
+
+size_t ascii_to_utf8_sse2(const wchar_t* in, size_t length, char* out)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i bytes;
+        if (sizeof(wchar_t) == 2) {
+            __m128i a = _mm_loadu_si128((const __m128i*)(in + i));
+            __m128i b = _mm_loadu_si128((const __m128i*)(in + i + 8));
+            __m128i high = _mm_and_si128(_mm_or_si128(a, b), _mm_set1_epi16((short)0xFF80));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, zero)) != 0xFFFF) break;
+            bytes = _mm_packus_epi16(a, b);
+        }
+        else {
+            __m128i a = _mm_loadu_si128((const __m128i*)(in + i));
+            __m128i b = _mm_loadu_si128((const __m128i*)(in + i + 4));
+            __m128i c = _mm_loadu_si128((const __m128i*)(in + i + 8));
+            __m128i d = _mm_loadu_si128((const __m128i*)(in + i + 12));
+            __m128i any = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+            __m128i high = _mm_and_si128(any, _mm_set1_epi32((int)0xFFFFFF80));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(high, zero)) != 0xFFFF) break;
+            bytes = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+        }
+        _mm_storeu_si128((__m128i*)(out + i), bytes);
+    }
+    return i;
+}
+
+// --- SSE4.1: three-byte sequences (U+0800..U+FFFF: Hangul, CJK), four at a time ---
+
+TARGET_SSE4 size_t three_byte_to_wide_sse4(const unsigned char* in, size_t length, wchar_t* out)
+{
+    // Lead bytes 1110xxxx at 0, 3, 6, 9 and continuation bytes 10xxxxxx between them.
+    const __m128i mask = _mm_setr_epi8((char)0xF0, (char)0xC0, (char)0xC0, (char)0xF0, (char)0xC0, (char)0xC0,
+        (char)0xF0, (char)0xC0, (char)0xC0, (char)0xF0, (char)0xC0, (char)0xC0, 0, 0, 0, 0);
+    const __m128i pattern = _mm_setr_epi8((char)0xE0, (char)0x80, (char)0x80, (char)0xE0, (char)0x80, (char)0x80,
+        (char)0xE0, (char)0x80, (char)0x80, (char)0xE0, (char)0x80, (char)0x80, 0, 0, 0, 0);
+    // Each sequence into one 32-bit lane, last byte lowest: b2 | b1 << 8 | b0 << 16.
+    const __m128i spread = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+
+    size_t count = 0;
+    // Each step reads 16 bytes and consumes 12.
+    for (size_t i = 0; i + 16 <= length; i += 12, count += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(in + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(v, mask), pattern)) != 0xFFFF) break;
+
+        __m128i lanes = _mm_shuffle_epi8(v, spread);
+        __m128i cp = _mm_or_si128(_mm_or_si128(
+            _mm_and_si128(lanes, _mm_set1_epi32(0x3F)),
+            _mm_and_si128(_mm_srli_epi32(lanes, 2), _mm_set1_epi32(0xFC0))),
+            _mm_and_si128(_mm_srli_epi32(lanes, 4), _mm_set1_epi32(0xF000)));
+
+        // Overlong forms and surrogates are left to the scalar decoder.
+        __m128i bad = _mm_or_si128(_mm_cmplt_epi32(cp, _mm_set1_epi32(0x800)),
+            _mm_cmpeq_epi32(_mm_and_si128(cp, _mm_set1_epi32(0xF800)), _mm_set1_epi32(0xD800)));
+        if (!_mm_testz_si128(bad, bad)) break;
+
+        if (sizeof(wchar_t) == 2) {
+            _mm_storel_epi64((__m128i*)(out + count), _mm_packus_epi32(cp, cp));
+        }
+        else {
+            _mm_storeu_si128((__m128i*)(out + count), cp);
+        }
+    }
+    return count;
+}
+
+TARGET_SSE4 size_t three_byte_to_utf8_sse4(const wchar_t* in, size_t length, char* out)
+{
+    // Bytes 0-2 of each 32-bit lane, packed together.
+    const __m128i compact = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+    size_t i = 0;
+    // Each step writes 16 bytes and keeps 12; stopping 8 characters short of the end
+    // keeps the extra 4 within the 3-bytes-per-character the caller provides.
+    for (; i + 8 <= length; i += 4) {
+        __m128i cp = sizeof(wchar_t) == 2
+            ? _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)(in + i)))
+            : _mm_loadu_si128((const __m128i*)(in + i));
+        __m128i bad = _mm_or_si128(_mm_or_si128(
+            _mm_cmplt_epi32(cp, _mm_set1_epi32(0x800)),
+            _mm_cmpgt_epi32(cp, _mm_set1_epi32(0xFFFF))),
+            _mm_cmpeq_epi32(_mm_and_si128(cp, _mm_set1_epi32(0xF800)), _mm_set1_epi32(0xD800)));
+        if (!_mm_testz_si128(bad, bad)) break;
+
+        // 1110xxxx 10xxxxxx 10xxxxxx, first byte lowest.
+        __m128i lanes = _mm_or_si128(_mm_or_si128(
+            _mm_srli_epi32(cp, 12),
+            _mm_and_si128(_mm_slli_epi32(cp, 2), _mm_set1_epi32(0x3F00))),
+            _mm_or_si128(_mm_and_si128(_mm_slli_epi32(cp, 16), _mm_set1_epi32(0x3F0000)), _mm_set1_epi32(0x8080E0)));
+        _mm_storeu_si128((__m128i*)(out + 3 * i), _mm_shuffle_epi8(lanes, compact));
+    }
+    return i;
+}
+
+// --- AVX2: ASCII, 32 characters at a time ---
+
+TARGET_AVX2 size_t ascii_to_wide_avx2(const unsigned char* in, size_t length, wchar_t* out)
+{
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(in + i));
+        if (_mm256_movemask_epi8(v)) break;
+        if (sizeof(wchar_t) == 2) {
+            _mm256_storeu_si256((__m256i*)(out + i), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v)));
+            _mm256_storeu_si256((__m256i*)(out + i + 16), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1)));
+        }
+        else {
+            for (size_t k = 0; k < 32; k += 8) {
+                _mm256_storeu_si256((__m256i*)(out + i + k), _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(in + i + k))));
+            }
+        }
+    }
+    // Clear the upper halves before the SSE tail (and the caller's SSE code), or each
+    // legacy SSE instruction pays for the dirty AVX state.
+    _mm256_zeroupper();
+    return i + ascii_to_wide_sse2(in + i, length - i, out + i);
+}
+
+TARGET_AVX2 size_t ascii_to_utf8_avx2(const wchar_t* in, size_t length, char* out)
+{
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i bytes;
+        if (sizeof(wchar_t) == 2) {
+            __m256i a = _mm256_loadu_si256((const __m256i*)(in + i));
+            __m256i b = _mm256_loadu_si256((const __m256i*)(in + i + 16));
+            if (!_mm256_testz_si256(_mm256_or_si256(a, b), _mm256_set1_epi16((short)0xFF80))) break;
+            // packus works within 128-bit lanes: a0-7 b0-7 | a8-15 b8-15.
+            bytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+        }
+        else {
+            __m256i a = _mm256_loadu_si256((const __m256i*)(in + i));
+            __m256i b = _mm256_loadu_si256((const __m256i*)(in + i + 8));
+            __m256i c = _mm256_loadu_si256((const __m256i*)(in + i + 16));
+            __m256i d = _mm256_loadu_si256((const __m256i*)(in + i + 24));
+            __m256i any = _mm256_or_si256(_mm256_or_si256(a, b), _mm256_or_si256(c, d));
+            if (!_mm256_testz_si256(any, _mm256_set1_epi32((int)0xFFFFFF80))) break;
+            // Two in-lane packs leave the 4-byte groups in the order a0 b0 c0 d0 | a1 b1 c1 d1.
+            __m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(a, b), _mm256_packs_epi32(c, d));
+            bytes = _mm256_permutevar8x32_epi32(packed, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+        }
+        _mm256_storeu_si256((__m256i*)(out + i), bytes);
+    }
+    _mm256_zeroupper();
+    return i + ascii_to_utf8_sse2(in + i, length - i, out + i);
+}
+
+bool cpu_has_sse41()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 19)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.1");
+#endif
+}
+
+bool cpu_has_avx2()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    bool os_saves_ymm = (info[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6;
+    __cpuidex(info, 7, 0);
+    return os_saves_ymm && (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // UTF_TRANSCODE_X86
+
+Kernels select_kernels()
+{
+    Kernels kernels = { "scalar", no_ascii_to_wide, no_three_byte_to_wide, no_ascii_to_utf8, no_three_byte_to_utf8 };
+#ifdef UTF_TRANSCODE_X86
+    const char* cap = getenv("PERSONA_TRANSCODE");
+    int limit = !cap ? 3 : strcmp(cap, "scalar") == 0 ? 0 : strcmp(cap, "sse2") == 0 ? 1 : strcmp(cap, "sse4") == 0 ? 2 : 3;
+    if (limit >= 1) {
+        kernels = { "sse2", ascii_to_wide_sse2, no_three_byte_to_wide, ascii_to_utf8_sse2, no_three_byte_to_utf8 };
+    }
+    if (limit >= 2 && cpu_has_sse41()) {
+        kernels = { "sse4", ascii_to_wide_sse2, three_byte_to_wide_sse4, ascii_to_utf8_sse2, three_byte_to_utf8_sse4 };
+    }
+    if (limit >= 3 && cpu_has_sse41() && cpu_has_avx2()) {
+        kernels = { "avx2", ascii_to_wide_avx2, three_byte_to_wide_sse4, ascii_to_utf8_avx2, three_byte_to_utf8_sse4 };
+    }
+#endif
+    return kernels;
+}
+
+const Kernels& kernels()
+{
+    static const Kernels selected = select_kernels();
+    return selected;
+}
+
+} // namespace
+
+size_t utf8_to_wide(const char* in, size_t length, wchar_t* out)
+{
+    const Kernels& k = kernels();
+    const unsigned char* p = (const unsigned char*)in;
+    const unsigned char* end = p + length;
+    wchar_t* o = out;
+    while (p < end) {
+        // --- 1. ASCII: whole vectors, then the rest of the run byte by byte ---
+        if (end - p >= (ptrdiff_t)kMinKernelInput) {
+            size_t run = k.ascii_to_wide(p, end - p, o);
+            p += run;
+            o += run;
+        }
+        while (p < end && *p < 0x80) *o++ = (wchar_t)*p++;
+        if (p == end) break;
+
+        // --- 2. A run of three-byte sequences ---
+        if ((*p & 0xF0) == 0xE0 && end - p >= (ptrdiff_t)kMinKernelInput) {
+            size_t count = k.three_byte_to_wide(p, end - p, o);
+            p += 3 * count;
+            o += count;
+            if (p == end || *p < 0x80) continue;
+        }
+
+        // --- 3. Any other sequence, or a short or invalid one ---
+        p = decode_one(p, end, o);
+    }
+    return o - out;
+}
+
+size_t wide_to_utf8(const wchar_t* in, size_t length, char* out)
+{
+    const Kernels& k = kernels();
+    const wchar_t* p = in;
+    const wchar_t* end = in + length;
+    char* o = out;
+    while (p < end) {
+        // --- 1. ASCII ---
+        if (end - p >= (ptrdiff_t)kMinKernelInput) {
+            size_t run = k.ascii_to_utf8(p, end - p, o);
+            p += run;
+            o += run;
+        }
+        while (p < end && (code_point)*p < 0x80) *o++ = (char)*p++;
+        if (p == end) break;
+
+        // --- 2. A run of U+0800..U+FFFF ---
+        if ((code_point)*p >= 0x800 && end - p >= (ptrdiff_t)kMinKernelWide) {
+            size_t count = k.three_byte_to_utf8(p, end - p, o);
+            p += count;
+            o += 3 * count;
+            if (p == end || (code_point)*p < 0x80) continue;
+        }
+
+        // --- 3. Anything else ---
+        p = encode_one(p, end, o);
+    }
+    return o - out;
+}
+
+void utf8_to_wide(const std::string& in, std::wstring& out)
+{
+    if (in.size() * sizeof(wchar_t) <= kStackBytes) {
+        wchar_t buffer[kStackBytes / sizeof(wchar_t)];
+        out.assign(buffer, utf8_to_wide(in.data(), in.size(), buffer));
+        return;
+    }
+    out.resize(in.size());
+    out.resize(utf8_to_wide(in.data(), in.size(), &out[0]));
+}
+
+void wide_to_utf8(const std::wstring& in, std::string& out)
+{
+    if (in.size() * kMaxUtf8PerWide <= kStackBytes) {
+        char buffer[kStackBytes];
+        out.assign(buffer, wide_to_utf8(in.data(), in.size(), buffer));
+        return;
+    }
+    out.resize(in.size() * kMaxUtf8PerWide);
+    out.resize(wide_to_utf8(in.data(), in.size(), &out[0]));
+}
+
+const char* utf_transcode_isa()
+{
+    return kernels().isa;
+}
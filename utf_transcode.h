@@ -0,0 +1,53 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <string>
+
+/**
+ * @brief UTF-8 <-> wide string conversion (UTF-16 on Windows, UTF-32 on Linux).
+ *
+ * One validating pass on both platforms, with SIMD fast paths chosen at startup:
+ * ASCII runs 16 (SSE2) or 32 (AVX2) characters at a time, and runs of three-byte
+ * sequences (Hangul, CJK) four at a time (SSE4.1). Anything else, and the tails, go
+ * through the scalar decoder, so every path gives the same result.
+ *
+ * Malformed UTF-8 becomes U+FFFD, one per maximal subpart (the Unicode recommendation
+ * MultiByteToWideChar follows): E0 80 80 gives three, a truncated E3 81 one. Lone
+ * surrogates and values above U+10FFFF in the wide input also become U+FFFD.
+ *
+ * Set PERSONA_TRANSCODE to "scalar", "sse2", "sse4" or "avx2" to cap the instruction set used.
+ */
+
+// The most UTF-8 bytes one wide character can turn into.
+const size_t kMaxUtf8PerWide = sizeof(wchar_t) == 2 ? 3 : 4;
+
+/**
+ * @brief Converts UTF-8 into caller-provided storage.
+ *
+ * @param out Room for 'length' wide characters (never more are written).
+ * @return The number of wide characters written.
+ */
+size_t utf8_to_wide(const char* in, size_t length, wchar_t* out);
+
+/**
+ * @brief Converts wide characters into caller-provided storage.
+ *
+ * @param out Room for length * kMaxUtf8PerWide bytes.
+ * @return The number of bytes written.
+ */
+size_t wide_to_utf8(const wchar_t* in, size_t length, char* out);
+
+/**
+ * @brief Replaces 'out' with the conversion of 'in'.
+ *
+ * Short inputs are converted on the stack and copied into 'out' at their exact size, so
+ * a string is allocated at most once (and not at all when it fits its inline buffer or
+ * the capacity 'out' already has).
+ */
+void utf8_to_wide(const std::string& in, std::wstring& out);
+void wide_to_utf8(const std::wstring& in, std::string& out);
+
+/**
+ * @brief The instruction set the conversions use: "avx2", "sse4", "sse2" or "scalar".
+ */
+const char* utf_transcode_isa();
@@ -0,0 +1,134 @@
+﻿#include "work_pool.h"
+#include "platform.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+typedef std::function<void()> Task;
+
+/**
+ * @brief One worker's deque. The owner works at the back, thieves take from the front.
+ */
+struct Worker {
+    std::mutex lock;
+    std::deque<Task> tasks;
+};
+
+struct WorkPool {
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<uint64_t> queued{ 0 };      // Tasks in all deques together.
+    std::atomic<unsigned> next_worker{ 0 }; // Round robin for tasks submitted from outside.
+    std::mutex sleep_lock;
+    std::condition_variable wake;
+};
+
+std::atomic<uint64_t> g_tasks{ 0 };
+std::atomic<uint64_t> g_steals{ 0 };
+
+// The index of the worker running on this thread, -1 on other threads.
+thread_local int t_worker_index = -1;
+
+void worker_thread(void* arg);
+
+WorkPool& work_pool()
+{
+    // Never destroyed: the detached workers wait on it for the life of the process.
+    static WorkPool* pool = [] {
+        WorkPool* created = new WorkPool();
+        unsigned count = std::max(2u, std::thread::hardware_concurrency());
+        for (unsigned i = 0; i < count; i++) {
+            created->workers.emplace_back(new Worker());
+        }
+        for (unsigned i = 0; i < count; i++) {
+            platform_start_thread(worker_thread, (void*)(uintptr_t)i);
+        }
+        return created;
+    }();
+    return *pool;
+}
+
+/**
+ * @brief Takes a task: the newest of our own, or else the oldest of someone else's.
+ */
+bool take_task(WorkPool& pool, unsigned self, Task& out)
+{
+    {
+        Worker& own = *pool.workers[self];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (!own.tasks.empty()) {
+            out = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            pool.queued.fetch_sub(1);
+            return true;
+        }
+    }
+    size_t count = pool.workers.size();
+    for (size_t i = 1; i < count; i++) {
+        Worker& victim = *pool.workers[(self + i) % count];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.tasks.empty()) {
+            out = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            pool.queued.fetch_sub(1);
+            g_steals.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+void worker_thread(void* arg)
+{
+    unsigned self = (unsigned)(uintptr_t)arg;
+    t_worker_index = (int)self;
+    WorkPool& pool = work_pool();
+
+    for (;;) {
+        Task task;
+        if (take_task(pool, self, task)) {
+            task();
+            g_tasks.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        // Nothing anywhere: sleep until something is submitted. 'queued' is raised before
+        // the notification and checked under the same lock, so no wake-up is lost.
+        std::unique_lock<std::mutex> sleep(pool.sleep_lock);
+        pool.wake.wait(sleep, [&pool] { return pool.queued.load() > 0; });
+    }
+}
+
+} // namespace
+
+void work_pool_submit(std::function<void()> task)
+{
+    WorkPool& pool = work_pool();
+    unsigned target = t_worker_index >= 0 ? (unsigned)t_worker_index : pool.next_worker.fetch_add(1) % pool.workers.size();
+    {
+        Worker& worker = *pool.workers[target];
+        std::lock_guard<std::mutex> guard(worker.lock);
+        worker.tasks.push_back(std::move(task));
+    }
+    pool.queued.fetch_add(1);
+    std::lock_guard<std::mutex> sleep(pool.sleep_lock);
+    pool.wake.notify_one();
+}
+
+unsigned work_pool_size()
+{
+    return (unsigned)work_pool().workers.size();
+}
+
+WorkPoolStats get_work_pool_stats()
+{
+    WorkPoolStats stats;
+    stats.workers = work_pool_size();
+    stats.tasks = g_tasks.load(std::memory_order_relaxed);
+    stats.steals = g_steals.load(std::memory_order_relaxed);
+    return stats;
+}
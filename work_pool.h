@@ -0,0 +1,34 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <functional>
+
+/**
+ * @brief Runs a task on the process-wide work-stealing pool.
+ *
+ * The pool has one worker per core, each with its own deque of tasks. A task
+ * submitted from inside a worker goes onto that worker's deque, and the worker takes
+ * its newest task first (depth-first, cache-friendly); an idle worker steals the
+ * oldest task of another one, which for recursive work is the biggest piece left.
+ * This keeps all cores busy on lopsided work such as a directory tree, where one
+ * subdirectory may hold most of the files.
+ *
+ * Tasks must not block for long: the workers are shared by every request.
+ */
+void work_pool_submit(std::function<void()> task);
+
+/**
+ * @brief The number of worker threads in the pool.
+ */
+unsigned work_pool_size();
+
+/**
+ * @brief Counters describing the work pool, for diagnostics and metrics.
+ */
+struct WorkPoolStats {
+    uint64_t workers;
+    uint64_t tasks;                 // Tasks run so far.
+    uint64_t steals;                // Tasks taken from another worker's deque.
+};
+
+WorkPoolStats get_work_pool_stats();